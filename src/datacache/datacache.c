@@ -33,6 +33,69 @@
 
 #define LOG_STRERROR_FILE(kind,op,fn) GNUNET_log_from_strerror_file (kind, "datacache", op, fn)
 
+
+struct IndexNode;
+
+struct IndexLeaf;
+
+
+/**
+ * Reference to a subtree of the key index.  At most one of the
+ * members is set; both are NULL for the empty tree.
+ */
+struct IndexRef
+{
+  /**
+   * The subtree is an inner node.
+   */
+  struct IndexNode *node;
+
+  /**
+   * The subtree is a single key.
+   */
+  struct IndexLeaf *leaf;
+};
+
+
+/**
+ * Inner node of the key index.  The key index is a binary trie over
+ * the bits of the keys (most significant bit first, as memcmp()
+ * orders them) that omits nodes with a single child.  Descending
+ * towards the child that matches a target's bit first visits the keys
+ * in order of increasing XOR distance to the target; visiting child 0
+ * first visits the keys in ascending order.
+ */
+struct IndexNode
+{
+  /**
+   * Subtrees for the keys where bit @e bit is 0 and 1.
+   */
+  struct IndexRef child[2];
+
+  /**
+   * First bit in which the keys of the two subtrees differ.
+   */
+  unsigned int bit;
+};
+
+
+/**
+ * Key in the key index.
+ */
+struct IndexLeaf
+{
+  /**
+   * The key.
+   */
+  struct GNUNET_HashCode key;
+
+  /**
+   * Number of values stored under the key.
+   */
+  unsigned int count;
+};
+
+
 /**
  * Internal state of the datacache library.
  */
@@ -85,6 +148,12 @@ struct GNUNET_DATACACHE_Handle
    */
   struct GNUNET_DATACACHE_PluginEnvironment env;
 
+  /**
+   * Index of the keys in the cache for proximity and successor
+   * searches.
+   */
+  struct IndexRef index;
+
   /**
    * How much space is in use right now?
    */
@@ -93,6 +162,174 @@ struct GNUNET_DATACACHE_Handle
 };
 
 
+/**
+ * Obtain a bit of a key, counting from the most significant bit of
+ * the first byte.
+ *
+ * @param key key to look at
+ * @param bit index of the bit
+ * @return the bit (0 or 1)
+ */
+static int
+key_bit (const struct GNUNET_HashCode *key,
+         unsigned int bit)
+{
+  const unsigned char *b = (const unsigned char *) key;
+
+  return (b[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+
+/**
+ * Find the first bit (in the order of #key_bit()) in which two keys
+ * differ.
+ *
+ * @param a first key
+ * @param b second key
+ * @return index of the first differing bit, the number of bits in
+ *         a key if @a a and @a b are equal
+ */
+static unsigned int
+key_first_difference (const struct GNUNET_HashCode *a,
+                      const struct GNUNET_HashCode *b)
+{
+  const unsigned char *ca = (const unsigned char *) a;
+  const unsigned char *cb = (const unsigned char *) b;
+  unsigned int i;
+  unsigned int bit;
+
+  for (i = 0; i < sizeof (struct GNUNET_HashCode); i++)
+    if (ca[i] != cb[i])
+      break;
+  if (sizeof (struct GNUNET_HashCode) == i)
+    return 8 * sizeof (struct GNUNET_HashCode);
+  bit = 8 * i;
+  while (key_bit (a, bit) == key_bit (b, bit))
+    bit++;
+  return bit;
+}
+
+
+/**
+ * Add a value to the key index.
+ *
+ * @param h handle to the datacache
+ * @param key key of the value
+ */
+static void
+index_add (struct GNUNET_DATACACHE_Handle *h,
+           const struct GNUNET_HashCode *key)
+{
+  struct IndexRef *pos;
+  struct IndexNode *node;
+  struct IndexLeaf *leaf;
+  unsigned int bit;
+  int dir;
+
+  pos = &h->index;
+  if ( (NULL == pos->node) &&
+       (NULL == pos->leaf) )
+  {
+    /* index was empty */
+    leaf = GNUNET_new (struct IndexLeaf);
+    leaf->key = *key;
+    leaf->count = 1;
+    pos->leaf = leaf;
+    return;
+  }
+  /* find the key that shares the longest prefix with 'key' */
+  while (NULL != pos->node)
+    pos = &pos->node->child[key_bit (key,
+                                     pos->node->bit)];
+  bit = key_first_difference (key,
+                              &pos->leaf->key);
+  if (8 * sizeof (struct GNUNET_HashCode) == bit)
+  {
+    pos->leaf->count++;
+    return;
+  }
+  /* the new node goes above the first subtree that splits later */
+  pos = &h->index;
+  while ( (NULL != pos->node) &&
+          (pos->node->bit < bit) )
+    pos = &pos->node->child[key_bit (key,
+                                     pos->node->bit)];
+  leaf = GNUNET_new (struct IndexLeaf);
+  leaf->key = *key;
+  leaf->count = 1;
+  dir = key_bit (key, bit);
+  node = GNUNET_new (struct IndexNode);
+  node->bit = bit;
+  node->child[1 - dir] = *pos;
+  node->child[dir].leaf = leaf;
+  pos->node = node;
+  pos->leaf = NULL;
+}
+
+
+/**
+ * Remove a value from the key index.
+ *
+ * @param h handle to the datacache
+ * @param key key of the value
+ */
+static void
+index_remove (struct GNUNET_DATACACHE_Handle *h,
+              const struct GNUNET_HashCode *key)
+{
+  struct IndexRef *pos;
+  struct IndexRef *parent;
+  struct IndexNode *node;
+
+  parent = NULL;
+  pos = &h->index;
+  while (NULL != pos->node)
+  {
+    parent = pos;
+    pos = &pos->node->child[key_bit (key,
+                                     pos->node->bit)];
+  }
+  if ( (NULL == pos->leaf) ||
+       (0 != memcmp (key,
+                     &pos->leaf->key,
+                     sizeof (struct GNUNET_HashCode))) )
+  {
+    GNUNET_break (0);
+    return;
+  }
+  if (0 < --pos->leaf->count)
+    return;
+  GNUNET_free (pos->leaf);
+  pos->leaf = NULL;
+  if (NULL == parent)
+    return;
+  /* replace the parent by the sibling of the leaf */
+  node = parent->node;
+  *parent = node->child[(pos == &node->child[0]) ? 1 : 0];
+  GNUNET_free (node);
+}
+
+
+/**
+ * Free a subtree of the key index.
+ *
+ * @param pos subtree to free
+ */
+static void
+index_free (struct IndexRef *pos)
+{
+  if (NULL != pos->node)
+  {
+    index_free (&pos->node->child[0]);
+    index_free (&pos->node->child[1]);
+    GNUNET_free (pos->node);
+    pos->node = NULL;
+  }
+  GNUNET_free_non_null (pos->leaf);
+  pos->leaf = NULL;
+}
+
+
 /**
  * Function called by plugins to notify the datacache
  * about content deletions.
@@ -111,6 +348,7 @@ env_delete_notify (void *cls,
   LOG (GNUNET_ERROR_TYPE_DEBUG,
        "Content under key `%s' discarded\n",
        GNUNET_h2s (key));
+  index_remove (h, key);
   GNUNET_assert (h->utilization >= size);
   h->utilization -= size;
   GNUNET_CONTAINER_bloomfilter_remove (h->filter,
@@ -185,9 +423,14 @@ GNUNET_DATACACHE_create (const struct GNUNET_CONFIGURATION_Handle *cfg,
     }
     if (NULL == ret->filter)
     {
-	ret->filter = GNUNET_CONTAINER_bloomfilter_init (NULL,
-                                                         bf_size,
-                                                         5); /* approx. 3% false positives at max use */
+      /* the filter never leaves this process, so we can use the
+         layout that only touches one cache line per test */
+      bf_size = GNUNET_MAX (1, (bf_size + GNUNET_CONTAINER_BLOOMFILTER_BLOCK_SIZE - 1)
+                            / GNUNET_CONTAINER_BLOOMFILTER_BLOCK_SIZE)
+        * GNUNET_CONTAINER_BLOOMFILTER_BLOCK_SIZE;
+      ret->filter = GNUNET_CONTAINER_bloomfilter_init_blocked (NULL,
+                                                               bf_size,
+                                                               5); /* approx. 3% false positives at max use */
     }
   }
   ret->stats = GNUNET_STATISTICS_create ("datacache", cfg);
@@ -231,6 +474,7 @@ GNUNET_DATACACHE_destroy (struct GNUNET_DATACACHE_Handle *h)
     GNUNET_CONTAINER_bloomfilter_free (h->filter);
   if (NULL != h->api)
     GNUNET_break (NULL == GNUNET_PLUGIN_unload (h->lib_name, h->api));
+  index_free (&h->index);
   GNUNET_free (h->lib_name);
   GNUNET_free (h->short_name);
   GNUNET_free (h->section);
@@ -300,6 +544,7 @@ GNUNET_DATACACHE_put (struct GNUNET_DATACACHE_Handle *h,
                             GNUNET_NO);
   if (NULL != h->filter)
     GNUNET_CONTAINER_bloomfilter_add (h->filter, key);
+  index_add (h, key);
   while (h->utilization + used > h->env.quota)
     GNUNET_assert (GNUNET_OK == h->api->del (h->api->cls));
   h->utilization += used;
@@ -375,11 +620,161 @@ GNUNET_DATACACHE_get_random (struct GNUNET_DATACACHE_Handle *h,
 }
 
 
+/**
+ * Closure for #closest_cb() and #closest_walk().
+ */
+struct ClosestContext
+{
+  /**
+   * Handle to the datacache.
+   */
+  struct GNUNET_DATACACHE_Handle *h;
+
+  /**
+   * Key we are looking for values close to.
+   */
+  const struct GNUNET_HashCode *key;
+
+  /**
+   * Function to call with the results, can be NULL.
+   */
+  GNUNET_DATACACHE_Iterator iter;
+
+  /**
+   * Closure for @e iter.
+   */
+  void *iter_cls;
+
+  /**
+   * Number of results wanted.
+   */
+  unsigned int num_results;
+
+  /**
+   * Number of results found so far.
+   */
+  unsigned int cnt;
+
+  /**
+   * Set to #GNUNET_YES once we are done.
+   */
+  int stop;
+};
+
+
+/**
+ * Pass a value found for a close key to the iterator.
+ *
+ * @param cls the `struct ClosestContext`
+ * @param key key of the value
+ * @param size number of bytes in @a data
+ * @param data the value
+ * @param type type of the value
+ * @param exp when does the value expire
+ * @param path_len number of entries in @a path
+ * @param path path of the value
+ * @return #GNUNET_OK to continue with the values of @a key
+ */
+static int
+closest_cb (void *cls,
+            const struct GNUNET_HashCode *key,
+            size_t size,
+            const char *data,
+            enum GNUNET_BLOCK_Type type,
+            struct GNUNET_TIME_Absolute exp,
+            unsigned int path_len,
+            const struct GNUNET_PeerIdentity *path)
+{
+  struct ClosestContext *cc = cls;
+
+  cc->cnt++;
+  if ( (NULL != cc->iter) &&
+       (GNUNET_OK != cc->iter (cc->iter_cls,
+                               key,
+                               size,
+                               data,
+                               type,
+                               exp,
+                               path_len,
+                               path)) )
+    cc->stop = GNUNET_YES;
+  if (cc->cnt >= cc->num_results)
+    cc->stop = GNUNET_YES;
+  return (GNUNET_YES == cc->stop) ? GNUNET_SYSERR : GNUNET_OK;
+}
+
+
+/**
+ * Pass the values stored under a key of the key index to the iterator.
+ *
+ * @param cc search context
+ * @param leaf key to pass the values of
+ */
+static void
+closest_leaf (struct ClosestContext *cc,
+              const struct IndexLeaf *leaf)
+{
+  (void) cc->h->api->get (cc->h->api->cls,
+                          &leaf->key,
+                          GNUNET_BLOCK_TYPE_ANY,
+                          &closest_cb,
+                          cc);
+}
+
+
+/**
+ * Pass the values of a subtree of the key index to the iterator,
+ * closest keys first.
+ *
+ * @param cc search context
+ * @param pos non-empty subtree to search
+ */
+static void
+closest_walk (struct ClosestContext *cc,
+              const struct IndexRef *pos)
+{
+  int dir;
+
+  if (NULL != pos->leaf)
+  {
+    closest_leaf (cc, pos->leaf);
+    return;
+  }
+  dir = key_bit (cc->key,
+                 pos->node->bit);
+  closest_walk (cc, &pos->node->child[dir]);
+  if (GNUNET_YES != cc->stop)
+    closest_walk (cc, &pos->node->child[1 - dir]);
+}
+
+
+/**
+ * Pass the values of a subtree of the key index to the iterator,
+ * smallest keys first.
+ *
+ * @param cc search context
+ * @param pos non-empty subtree to search
+ */
+static void
+ascending_walk (struct ClosestContext *cc,
+                const struct IndexRef *pos)
+{
+  if (NULL != pos->leaf)
+  {
+    closest_leaf (cc, pos->leaf);
+    return;
+  }
+  ascending_walk (cc, &pos->node->child[0]);
+  if (GNUNET_YES != cc->stop)
+    ascending_walk (cc, &pos->node->child[1]);
+}
+
+
 /**
  * Iterate over the results that are "close" to a particular key in
- * the datacache.  "close" is defined as numerically larger than @a
- * key (when interpreted as a circular address space), with small
- * distance.
+ * the datacache.  "close" is defined as a small XOR distance to @a
+ * key (distances compare like memcmp()), results are returned
+ * closest first.  @a iter must not modify the datacache.
  *
  * @param h handle to the datacache
  * @param key area of the keyspace to look into
@@ -395,6 +790,8 @@ GNUNET_DATACACHE_get_closest (struct GNUNET_DATACACHE_Handle *h,
                               GNUNET_DATACACHE_Iterator iter,
                               void *iter_cls)
 {
+  struct ClosestContext cc;
+
   GNUNET_STATISTICS_update (h->stats,
                             gettext_noop ("# proximity search requests received"),
                             1,
@@ -402,11 +799,106 @@ GNUNET_DATACACHE_get_closest (struct GNUNET_DATACACHE_Handle *h,
   LOG (GNUNET_ERROR_TYPE_DEBUG,
        "Processing proximity search at `%s'\n",
        GNUNET_h2s (key));
-  return h->api->get_closest (h->api->cls,
-                              key,
-                              num_results,
-                              iter,
-                              iter_cls);
+  if ( (0 == num_results) ||
+       ( (NULL == h->index.node) &&
+         (NULL == h->index.leaf) ) )
+    return 0;
+  cc.h = h;
+  cc.key = key;
+  cc.iter = iter;
+  cc.iter_cls = iter_cls;
+  cc.num_results = num_results;
+  cc.cnt = 0;
+  cc.stop = GNUNET_NO;
+  closest_walk (&cc, &h->index);
+  return cc.cnt;
+}
+
+
+/**
+ * Iterate over the results that are numerically larger than or
+ * equal to a particular key in the datacache, treating the key space
+ * as circular.  Results are returned in ascending order of their
+ * keys, starting at @a key and wrapping around to the smallest key.
+ * @a iter must not modify the datacache.
+ *
+ * @param h handle to the datacache
+ * @param key where in the keyspace to start
+ * @param num_results number of results that should be returned to @a iter
+ * @param iter maybe NULL (to just count)
+ * @param iter_cls closure for @a iter
+ * @return the number of results found
+ */
+unsigned int
+GNUNET_DATACACHE_get_successors (struct GNUNET_DATACACHE_Handle *h,
+                                 const struct GNUNET_HashCode *key,
+                                 unsigned int num_results,
+                                 GNUNET_DATACACHE_Iterator iter,
+                                 void *iter_cls)
+{
+  struct ClosestContext cc;
+  const struct IndexNode *path[8 * sizeof (struct GNUNET_HashCode)];
+  const struct IndexRef *pos;
+  unsigned int depth;
+  unsigned int bit;
+  unsigned int i;
+  int below;
+
+  GNUNET_STATISTICS_update (h->stats,
+                            gettext_noop ("# successor search requests received"),
+                            1,
+                            GNUNET_NO);
+  LOG (GNUNET_ERROR_TYPE_DEBUG,
+       "Processing successor search at `%s'\n",
+       GNUNET_h2s (key));
+  if ( (0 == num_results) ||
+       ( (NULL == h->index.node) &&
+         (NULL == h->index.leaf) ) )
+    return 0;
+  cc.h = h;
+  cc.key = key;
+  cc.iter = iter;
+  cc.iter_cls = iter_cls;
+  cc.num_results = num_results;
+  cc.cnt = 0;
+  cc.stop = GNUNET_NO;
+  /* find the first bit in which 'key' differs from the keys that
+     share the longest prefix with it */
+  pos = &h->index;
+  while (NULL != pos->node)
+    pos = &pos->node->child[key_bit (key,
+                                     pos->node->bit)];
+  bit = key_first_difference (key,
+                              &pos->leaf->key);
+  /* all keys below 'pos' share the bits before 'bit' with 'key';
+     every other key branches off the path to 'pos' */
+  depth = 0;
+  pos = &h->index;
+  while ( (NULL != pos->node) &&
+          (pos->node->bit < bit) )
+  {
+    path[depth++] = pos->node;
+    pos = &pos->node->child[key_bit (key,
+                                     pos->node->bit)];
+  }
+  below = (8 * sizeof (struct GNUNET_HashCode) != bit) &&
+          (1 == key_bit (key, bit));
+  /* keys >= 'key': 'pos' (unless smaller), then the subtrees that
+     branch off to the right, deepest (smallest) first */
+  if (! below)
+    ascending_walk (&cc, pos);
+  for (i = depth; (i > 0) && (GNUNET_YES != cc.stop); i--)
+    if (0 == key_bit (key, path[i - 1]->bit))
+      ascending_walk (&cc, &path[i - 1]->child[1]);
+  /* wrap around: keys < 'key', the subtrees that branch off to the
+     left, shallowest (smallest) first, then 'pos' if smaller */
+  for (i = 0; (i < depth) && (GNUNET_YES != cc.stop); i++)
+    if (1 == key_bit (key, path[i]->bit))
+      ascending_walk (&cc, &path[i]->child[0]);
+  if ( (below) &&
+       (GNUNET_YES != cc.stop) )
+    ascending_walk (&cc, pos);
+  return cc.cnt;
 }
 
 
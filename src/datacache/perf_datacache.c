@@ -33,10 +33,32 @@
 
 #define ITERATIONS 10000
 
+/**
+ * Number of values we store under the same key.
+ */
+#define VALUES_PER_KEY 1000
+
+/**
+ * How often do we fetch all values of that key?
+ */
+#define MULTI_GETS 10
+
+/**
+ * Number of proximity searches we run.
+ */
+#define CLOSEST_QUERIES 1000
+
+/**
+ * Number of results we ask for in each proximity search.
+ */
+#define NUM_CLOSEST 16
+
 static int ok;
 
 static unsigned int found;
 
+static unsigned int multi_found;
+
 /**
  * Name of plugin under test.
  */
@@ -57,6 +79,19 @@ checkIt (void *cls,
 }
 
 
+static int
+countIt (void *cls,
+         const struct GNUNET_HashCode * key, size_t size, const char *data,
+         enum GNUNET_BLOCK_Type type,
+	 struct GNUNET_TIME_Absolute exp,
+	 unsigned int path_len,
+	 const struct GNUNET_PeerIdentity *path)
+{
+  multi_found++;
+  return GNUNET_OK;
+}
+
+
 static void
 run (void *cls, char *const *args, const char *cfgfile,
      const struct GNUNET_CONFIGURATION_Handle *cfg)
@@ -119,6 +154,50 @@ run (void *cls, char *const *args, const char *cfgfile,
     GAUGER (gstr, "Time to GET item from datacache",
             GNUNET_TIME_absolute_get_duration (start).rel_value_us / 1000LL / found,
             "ms/item");
+  start = GNUNET_TIME_absolute_get ();
+  found = 0;
+  for (i = 0; i < CLOSEST_QUERIES; i++)
+  {
+    GNUNET_CRYPTO_hash (&i, sizeof (i), &n);
+    found += GNUNET_DATACACHE_get_closest (h, &n, NUM_CLOSEST, NULL, NULL);
+  }
+  FPRINTF (stdout,
+           "Found %u results in %u proximity searches in %s\n",
+           found, CLOSEST_QUERIES,
+           GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start), GNUNET_YES));
+  GAUGER (gstr, "Time to GET_CLOSEST from datacache",
+          GNUNET_TIME_absolute_get_duration (start).rel_value_us / CLOSEST_QUERIES,
+          "us/search");
+
+  /* many values under a single key; these expire last so that the
+     quota does not discard them */
+  exp = GNUNET_TIME_relative_to_absolute (GNUNET_TIME_UNIT_DAYS);
+  memset (&k, 42, sizeof (struct GNUNET_HashCode));
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < VALUES_PER_KEY; i++)
+  {
+    GNUNET_CRYPTO_hash (&i, sizeof (i), &n);
+    ASSERT (GNUNET_OK ==
+            GNUNET_DATACACHE_put (h, &k, sizeof (struct GNUNET_HashCode),
+                                  (const char *) &n, 1, exp,
+				  0, NULL));
+  }
+  FPRINTF (stdout, "Stored %u values under one key in %s\n", VALUES_PER_KEY,
+	   GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start), GNUNET_YES));
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < MULTI_GETS; i++)
+  {
+    multi_found = 0;
+    GNUNET_DATACACHE_get (h, &k, 1, &countIt, NULL);
+    ASSERT (VALUES_PER_KEY == multi_found);
+  }
+  FPRINTF (stdout,
+           "Fetched all %u values of a key %u times in %s\n",
+           VALUES_PER_KEY, MULTI_GETS,
+           GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start), GNUNET_YES));
+  GAUGER (gstr, "Time to GET all values of a key from datacache",
+          GNUNET_TIME_absolute_get_duration (start).rel_value_us / 1000LL / MULTI_GETS,
+          "ms/key");
   GNUNET_DATACACHE_destroy (h);
   ASSERT (ok == 0);
   return;
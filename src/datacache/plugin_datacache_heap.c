@@ -34,30 +34,41 @@
 
 
 /**
- * Context for all functions in this plugin.
+ * Log2 of the number of shards the index is split into.  Each shard
+ * grows separately, so growing the index of a large cache never has
+ * to move more than a small fraction of the entries at once.
  */
-struct Plugin
-{
-  /**
-   * Our execution environment.
-   */
-  struct GNUNET_DATACACHE_PluginEnvironment *env;
+#define SHARD_BITS 8
 
-  /**
-   * Our hash map.
-   */
-  struct GNUNET_CONTAINER_MultiHashMap *map;
+/**
+ * Number of shards of the index.
+ */
+#define NUM_SHARDS (1 << SHARD_BITS)
 
-  /**
-   * Heap for expirations.
-   */
-  struct GNUNET_CONTAINER_Heap *heap;
+/**
+ * Minimum number of slots in each table of a shard.
+ */
+#define MIN_SLOTS 16
 
-};
+/**
+ * Expected size of a value, used to size the tables initially.
+ */
+#define EXPECTED_VALUE_SIZE 1024
+
+/**
+ * Size of a heap node (the struct is opaque to us).
+ */
+#define HEAP_NODE_SIZE (5 * sizeof (void *) + sizeof (GNUNET_CONTAINER_HeapCostType) + sizeof (unsigned int))
+
+/**
+ * Bookkeeping of the allocator per allocation.
+ */
+#define MALLOC_OVERHEAD (2 * sizeof (void *))
 
 
 /**
- * Entry in the hash map.
+ * Entry in the index.  The data follows this struct, followed by
+ * the path (if it was known when the entry was created).
  */
 struct Value
 {
@@ -77,20 +88,47 @@ struct Value
   struct GNUNET_CONTAINER_HeapNode *hn;
 
   /**
-   * Path information.
+   * Next value with the same key.
+   */
+  struct Value *next;
+
+  /**
+   * Previous value with the same key, NULL if this value is the
+   * one in the key table.
+   */
+  struct Value *prev;
+
+  /**
+   * Path information, either stored after the data or (if the path
+   * grew later) allocated separately.
    */
   struct GNUNET_PeerIdentity *path_info;
 
   /**
-   * Payload (actual payload follows this struct)
+   * Number of bytes of data.
    */
   size_t size;
 
+  /**
+   * Number of bytes we reported to the datacache for this entry.
+   */
+  size_t charged;
+
+  /**
+   * CRC of the data, to find duplicates quickly.
+   */
+  uint32_t crc;
+
   /**
    * Number of entries in @e path_info.
    */
   unsigned int path_info_len;
 
+  /**
+   * Number of path entries that fit after the data.
+   */
+  unsigned int path_info_room;
+
   /**
    * Type of the block.
    */
@@ -99,99 +137,366 @@ struct Value
 };
 
 
-#define OVERHEAD (sizeof (struct Value) + 64)
+/**
+ * Memory used by an entry besides its data and path: the entry
+ * itself, its heap node and two slots in each table of its shard
+ * (the tables are at most half full).
+ */
+#define OVERHEAD (sizeof (struct Value) + HEAP_NODE_SIZE + 2 * MALLOC_OVERHEAD + 4 * sizeof (struct Value *))
 
 
 /**
- * Closure for #put_cb().
+ * Open-addressed hash table of values (with linear probing).
  */
-struct PutContext
+struct Table
 {
   /**
-   * Expiration time for the new value.
+   * The slots, NULL if empty.
    */
-  struct GNUNET_TIME_Absolute discard_time;
+  struct Value **slots;
 
   /**
-   * Data for the new value.
+   * Number of slots, a power of two.
    */
-  const char *data;
+  unsigned int size;
 
   /**
-   * Heap from the plugin.
+   * Number of slots in use.
    */
-  struct GNUNET_CONTAINER_Heap *heap;
+  unsigned int count;
 
   /**
-   * Path information.
+   * #GNUNET_YES if this table indexes blocks by key and CRC,
+   * #GNUNET_NO if it indexes the first value of each key by key.
    */
-  const struct GNUNET_PeerIdentity *path_info;
+  int by_block;
+};
+
 
+/**
+ * Part of the index, for the keys starting with particular bits.
+ */
+struct Shard
+{
   /**
-   * Number of bytes in @e data.
+   * First value for each key; the other values of the key are
+   * linked to it.
    */
-  size_t size;
+  struct Table keys;
 
   /**
-   * Type of the node.
+   * All values, by key and CRC of the data.
    */
-  enum GNUNET_BLOCK_Type type;
+  struct Table blocks;
+};
+
 
+/**
+ * Context for all functions in this plugin.
+ */
+struct Plugin
+{
   /**
-   * Number of entries in @e path_info.
+   * Our execution environment.
    */
-  unsigned int path_info_len;
+  struct GNUNET_DATACACHE_PluginEnvironment *env;
+
+  /**
+   * Heap for expirations.
+   */
+  struct GNUNET_CONTAINER_Heap *heap;
+
+  /**
+   * The shards of our index.
+   */
+  struct Shard shards[NUM_SHARDS];
 
   /**
-   * Value to set to #GNUNET_YES if an equivalent block was found.
+   * Number of values in the index.
    */
-  int found;
+  unsigned long long num_values;
+
 };
 
 
 /**
- * Function called during PUT to detect if an equivalent block
- * already exists.
+ * Find the shard for a key.
  *
- * @param cls the `struct PutContext`
- * @param key the key for the value(s)
- * @param value an existing value
- * @return #GNUNET_YES if not found (to continue to iterate)
+ * @param plugin the plugin
+ * @param key the key
+ * @return the shard that indexes @a key
  */
-static int
-put_cb (void *cls,
-	const struct GNUNET_HashCode *key,
-	void *value)
+static struct Shard *
+get_shard (struct Plugin *plugin,
+           const struct GNUNET_HashCode *key)
+{
+  return &plugin->shards[key->bits[0] & (NUM_SHARDS - 1)];
+}
+
+
+/**
+ * Compute the hash of a key (and block) for a table.  Different
+ * bits of the key than for the shard are used, as all keys of a
+ * shard share those.
+ *
+ * @param key the key
+ * @param crc CRC of the block, ignored unless @a by_block
+ * @param by_block #GNUNET_YES for the block table
+ * @return the hash
+ */
+static uint32_t
+table_hash (const struct GNUNET_HashCode *key,
+            uint32_t crc,
+            int by_block)
+{
+  if (GNUNET_YES == by_block)
+    return key->bits[2] ^ crc;
+  return key->bits[1];
+}
+
+
+/**
+ * Initialize a table.
+ *
+ * @param t table to initialize
+ * @param size number of slots, a power of two
+ * @param by_block #GNUNET_YES for a block table
+ */
+static void
+table_init (struct Table *t,
+            unsigned int size,
+            int by_block)
+{
+  t->slots = GNUNET_new_array (size, struct Value *);
+  t->size = size;
+  t->count = 0;
+  t->by_block = by_block;
+}
+
+
+/**
+ * Store a value in the first free slot of its probe sequence.
+ *
+ * @param t table to add @a val to, must have a free slot
+ * @param val value to add
+ */
+static void
+table_place (struct Table *t,
+             struct Value *val)
+{
+  unsigned int i;
+
+  i = table_hash (&val->key, val->crc, t->by_block) & (t->size - 1);
+  while (NULL != t->slots[i])
+    i = (i + 1) & (t->size - 1);
+  t->slots[i] = val;
+}
+
+
+/**
+ * Add a value to a table, doubling its size if it would become more
+ * than half full.
+ *
+ * @param t table to add @a val to
+ * @param val value to add
+ */
+static void
+table_insert (struct Table *t,
+              struct Value *val)
 {
-  struct PutContext *put_ctx = cls;
-  struct Value *val = value;
+  struct Value **old;
+  unsigned int old_size;
+  unsigned int i;
 
-  if ( (val->size == put_ctx->size) &&
-       (val->type == put_ctx->type) &&
-       (0 == memcmp (&val[1], put_ctx->data, put_ctx->size)) )
+  if (2 * (t->count + 1) > t->size)
   {
-    put_ctx->found = GNUNET_YES;
-    val->discard_time = GNUNET_TIME_absolute_max (val->discard_time,
-						  put_ctx->discard_time);
-    /* replace old path with new path */
-    GNUNET_array_grow (val->path_info,
-		       val->path_info_len,
-		       put_ctx->path_info_len);
-    memcpy (val->path_info,
-	    put_ctx->path_info,
-	    put_ctx->path_info_len * sizeof (struct GNUNET_PeerIdentity));
-    GNUNET_CONTAINER_heap_update_cost (put_ctx->heap,
-				       val->hn,
-				       val->discard_time.abs_value_us);
-    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-		"Got same value for key %s and type %d (size %u vs %u)\n",
-		GNUNET_h2s (key),
-		val->type,
-		(unsigned int) val->size,
-		(unsigned int) put_ctx->size);
-    return GNUNET_NO;
+    old = t->slots;
+    old_size = t->size;
+    t->size *= 2;
+    t->slots = GNUNET_new_array (t->size, struct Value *);
+    for (i = 0; i < old_size; i++)
+      if (NULL != old[i])
+        table_place (t, old[i]);
+    GNUNET_free (old);
   }
-  return GNUNET_YES;
+  table_place (t, val);
+  t->count++;
+}
+
+
+/**
+ * Find the slot of a value.
+ *
+ * @param t table to search
+ * @param val value to find, must be in @a t
+ * @return index of the slot of @a val
+ */
+static unsigned int
+table_find (const struct Table *t,
+            const struct Value *val)
+{
+  unsigned int i;
+
+  i = table_hash (&val->key, val->crc, t->by_block) & (t->size - 1);
+  while (val != t->slots[i])
+  {
+    GNUNET_assert (NULL != t->slots[i]);
+    i = (i + 1) & (t->size - 1);
+  }
+  return i;
+}
+
+
+/**
+ * Clear a slot of a table.  Values later in the same probe sequence
+ * are moved up, so that lookups never need to skip empty slots.
+ *
+ * @param t table to modify
+ * @param i index of the slot to clear
+ */
+static void
+table_remove_at (struct Table *t,
+                 unsigned int i)
+{
+  unsigned int j;
+  unsigned int home;
+  unsigned int mask;
+
+  mask = t->size - 1;
+  t->slots[i] = NULL;
+  t->count--;
+  j = i;
+  while (1)
+  {
+    j = (j + 1) & mask;
+    if (NULL == t->slots[j])
+      return;
+    home = table_hash (&t->slots[j]->key,
+                       t->slots[j]->crc,
+                       t->by_block) & mask;
+    /* can the value in 'j' be moved to 'i', i.e. is its home
+       not (cyclically) within (i,j]? */
+    if ( (i <= j)
+         ? ( (home <= i) || (home > j) )
+         : ( (home <= i) && (home > j) ) )
+    {
+      t->slots[i] = t->slots[j];
+      t->slots[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+
+/**
+ * Find the first value for a key.
+ *
+ * @param shard shard for @a key
+ * @param key key to look for
+ * @return NULL if there is no value for @a key
+ */
+static struct Value *
+find_key (const struct Shard *shard,
+          const struct GNUNET_HashCode *key)
+{
+  const struct Table *t = &shard->keys;
+  unsigned int i;
+
+  i = table_hash (key, 0, GNUNET_NO) & (t->size - 1);
+  while (NULL != t->slots[i])
+  {
+    if (0 == memcmp (key,
+                     &t->slots[i]->key,
+                     sizeof (struct GNUNET_HashCode)))
+      return t->slots[i];
+    i = (i + 1) & (t->size - 1);
+  }
+  return NULL;
+}
+
+
+/**
+ * Find a value with the same key, type and data.
+ *
+ * @param shard shard for @a key
+ * @param key key of the value
+ * @param crc CRC of @a data
+ * @param size number of bytes in @a data
+ * @param data the data
+ * @param type type of the value
+ * @return NULL if there is no such value
+ */
+static struct Value *
+find_block (const struct Shard *shard,
+            const struct GNUNET_HashCode *key,
+            uint32_t crc,
+            size_t size,
+            const char *data,
+            enum GNUNET_BLOCK_Type type)
+{
+  const struct Table *t = &shard->blocks;
+  const struct Value *val;
+  unsigned int i;
+
+  i = table_hash (key, crc, GNUNET_YES) & (t->size - 1);
+  while (NULL != (val = t->slots[i]))
+  {
+    if ( (val->crc == crc) &&
+         (val->size == size) &&
+         (val->type == type) &&
+         (0 == memcmp (key,
+                       &val->key,
+                       sizeof (struct GNUNET_HashCode))) &&
+         (0 == memcmp (&val[1], data, size)) )
+      return t->slots[i];
+    i = (i + 1) & (t->size - 1);
+  }
+  return NULL;
+}
+
+
+/**
+ * Remove a value from the index and free it.  The caller must have
+ * removed it from the heap already.
+ *
+ * @param plugin the plugin
+ * @param val value to remove
+ */
+static void
+remove_value (struct Plugin *plugin,
+              struct Value *val)
+{
+  struct Shard *shard;
+  unsigned int i;
+
+  shard = get_shard (plugin, &val->key);
+  table_remove_at (&shard->blocks,
+                   table_find (&shard->blocks, val));
+  if (NULL != val->prev)
+  {
+    val->prev->next = val->next;
+    if (NULL != val->next)
+      val->next->prev = val->prev;
+  }
+  else
+  {
+    i = table_find (&shard->keys, val);
+    if (NULL == val->next)
+    {
+      table_remove_at (&shard->keys, i);
+    }
+    else
+    {
+      /* same key, so same slot */
+      shard->keys.slots[i] = val->next;
+      val->next->prev = NULL;
+    }
+  }
+  plugin->num_values--;
+  if ( (NULL != val->path_info) &&
+       ((void *) val->path_info != ((char *) &val[1]) + val->size) )
+    GNUNET_free (val->path_info);
+  GNUNET_free (val);
 }
 
 
@@ -219,107 +524,110 @@ heap_plugin_put (void *cls,
 		 const struct GNUNET_PeerIdentity *path_info)
 {
   struct Plugin *plugin = cls;
+  struct Shard *shard;
   struct Value *val;
-  struct PutContext put_ctx;
-
-  put_ctx.found = GNUNET_NO;
-  put_ctx.heap = plugin->heap;
-  put_ctx.data = data;
-  put_ctx.size = size;
-  put_ctx.path_info = path_info;
-  put_ctx.path_info_len = path_info_len;
-  put_ctx.discard_time = discard_time;
-  put_ctx.type = type;
-  GNUNET_CONTAINER_multihashmap_get_multiple (plugin->map,
-					      key,
-					      &put_cb,
-					      &put_ctx);
-  if (GNUNET_YES == put_ctx.found)
+  struct Value *head;
+  uint32_t crc;
+  void *inline_path;
+
+  shard = get_shard (plugin, key);
+  crc = (uint32_t) GNUNET_CRYPTO_crc32_n (data, size);
+  val = find_block (shard, key, crc, size, data, type);
+  if (NULL != val)
+  {
+    val->discard_time = GNUNET_TIME_absolute_max (val->discard_time,
+						  discard_time);
+    /* replace old path with new path */
+    inline_path = ((char *) &val[1]) + val->size;
+    if ( (NULL != val->path_info) &&
+         ((void *) val->path_info != inline_path) )
+    {
+      GNUNET_free (val->path_info);
+      val->path_info = NULL;
+    }
+    if (path_info_len <= val->path_info_room)
+      val->path_info = (0 == path_info_len) ? NULL : inline_path;
+    else
+      val->path_info = GNUNET_new_array (path_info_len,
+                                         struct GNUNET_PeerIdentity);
+    val->path_info_len = path_info_len;
+    memcpy (val->path_info,
+	    path_info,
+	    path_info_len * sizeof (struct GNUNET_PeerIdentity));
+    GNUNET_CONTAINER_heap_update_cost (plugin->heap,
+				       val->hn,
+				       val->discard_time.abs_value_us);
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Got same value for key %s and type %d (size %u)\n",
+         GNUNET_h2s (key),
+         val->type,
+         (unsigned int) size);
     return 0;
-  val = GNUNET_malloc (sizeof (struct Value) + size);
+  }
+  val = GNUNET_malloc (sizeof (struct Value) + size +
+                       path_info_len * sizeof (struct GNUNET_PeerIdentity));
   memcpy (&val[1], data, size);
   val->key = *key;
   val->type = type;
   val->discard_time = discard_time;
   val->size = size;
-  GNUNET_array_grow (val->path_info,
-		     val->path_info_len,
-		     path_info_len);
-  memcpy (val->path_info, path_info,
-	  path_info_len * sizeof (struct GNUNET_PeerIdentity));
-  (void) GNUNET_CONTAINER_multihashmap_put (plugin->map,
-					    &val->key,
-					    val,
-					    GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE);
+  val->crc = crc;
+  val->path_info_len = path_info_len;
+  val->path_info_room = path_info_len;
+  if (0 != path_info_len)
+  {
+    val->path_info = (struct GNUNET_PeerIdentity *) (((char *) &val[1]) + size);
+    memcpy (val->path_info, path_info,
+            path_info_len * sizeof (struct GNUNET_PeerIdentity));
+  }
+  val->charged = OVERHEAD + size +
+    path_info_len * sizeof (struct GNUNET_PeerIdentity);
+  head = find_key (shard, key);
+  if (NULL == head)
+  {
+    table_insert (&shard->keys, val);
+  }
+  else
+  {
+    /* keep 'head' in the key table */
+    val->prev = head;
+    val->next = head->next;
+    if (NULL != head->next)
+      head->next->prev = val;
+    head->next = val;
+  }
+  table_insert (&shard->blocks, val);
   val->hn = GNUNET_CONTAINER_heap_insert (plugin->heap,
 					  val,
 					  val->discard_time.abs_value_us);
-  return size + OVERHEAD;
+  plugin->num_values++;
+  return val->charged;
 }
 
 
 /**
- * Closure for #get_cb().
- */
-struct GetContext
-{
-  /**
-   * Function to call for each result.
-   */
-  GNUNET_DATACACHE_Iterator iter;
-
-  /**
-   * Closure for @e iter.
-   */
-  void *iter_cls;
-
-  /**
-   * Number of results found.
-   */
-  unsigned int cnt;
-
-  /**
-   * Block type requested.
-   */
-  enum GNUNET_BLOCK_Type type;
-};
-
-
-
-/**
- * Function called during GET to find matching blocks.
- * Only matches by type.
+ * Pass a value to an iterator.
  *
- * @param cls the `struct GetContext`
- * @param key the key for the value(s)
- * @param value an existing value
- * @return #GNUNET_YES to continue to iterate
+ * @param val the value
+ * @param iter maybe NULL (to just count)
+ * @param iter_cls closure for @a iter
+ * @return #GNUNET_OK to continue to iterate
  */
 static int
-get_cb (void *cls,
-	const struct GNUNET_HashCode *key,
-	void *value)
+call_iter (const struct Value *val,
+           GNUNET_DATACACHE_Iterator iter,
+           void *iter_cls)
 {
-  struct GetContext *get_ctx = cls;
-  struct Value *val = value;
-  int ret;
-
-  if ( (get_ctx->type != val->type) &&
-       (GNUNET_BLOCK_TYPE_ANY != get_ctx->type) )
+  if (NULL == iter)
     return GNUNET_OK;
-  if (NULL != get_ctx->iter)
-    ret = get_ctx->iter (get_ctx->iter_cls,
-			 key,
-			 val->size,
-			 (const char *) &val[1],
-			 val->type,
-                         val->discard_time,
-			 val->path_info_len,
-			 val->path_info);
-  else
-    ret = GNUNET_YES;
-  get_ctx->cnt++;
-  return ret;
+  return iter (iter_cls,
+               &val->key,
+               val->size,
+               (const char *) &val[1],
+               val->type,
+               val->discard_time,
+               val->path_info_len,
+               val->path_info);
 }
 
 
@@ -342,17 +650,22 @@ heap_plugin_get (void *cls,
                  void *iter_cls)
 {
   struct Plugin *plugin = cls;
-  struct GetContext get_ctx;
-
-  get_ctx.type = type;
-  get_ctx.iter = iter;
-  get_ctx.iter_cls = iter_cls;
-  get_ctx.cnt = 0;
-  GNUNET_CONTAINER_multihashmap_get_multiple (plugin->map,
-					      key,
-					      &get_cb,
-					      &get_ctx);
-  return get_ctx.cnt;
+  struct Value *val;
+  struct Value *next;
+  unsigned int cnt;
+
+  cnt = 0;
+  for (val = find_key (get_shard (plugin, key), key); NULL != val; val = next)
+  {
+    next = val->next;
+    if ( (type != val->type) &&
+         (GNUNET_BLOCK_TYPE_ANY != type) )
+      continue;
+    cnt++;
+    if (GNUNET_OK != call_iter (val, iter, iter_cls))
+      break;
+  }
+  return cnt;
 }
 
 
@@ -368,19 +681,18 @@ heap_plugin_del (void *cls)
 {
   struct Plugin *plugin = cls;
   struct Value *val;
+  struct GNUNET_HashCode key;
+  size_t charged;
 
   val = GNUNET_CONTAINER_heap_remove_root (plugin->heap);
   if (NULL == val)
     return GNUNET_SYSERR;
-  GNUNET_assert (GNUNET_YES ==
-		 GNUNET_CONTAINER_multihashmap_remove (plugin->map,
-						       &val->key,
-						       val));
+  key = val->key;
+  charged = val->charged;
+  remove_value (plugin, val);
   plugin->env->delete_notify (plugin->env->cls,
-			      &val->key,
-			      val->size + OVERHEAD);
-  GNUNET_free_non_null (val->path_info);
-  GNUNET_free (val);
+			      &key,
+			      charged);
   return GNUNET_OK;
 }
 
@@ -399,41 +711,24 @@ heap_plugin_get_random (void *cls,
                         void *iter_cls)
 {
   struct Plugin *plugin = cls;
-  struct GetContext get_ctx;
-
-  get_ctx.type = GNUNET_BLOCK_TYPE_ANY;
-  get_ctx.iter = iter;
-  get_ctx.iter_cls = iter_cls;
-  get_ctx.cnt = 0;
-  GNUNET_CONTAINER_multihashmap_get_random (plugin->map,
-                                            &get_cb,
-                                            &get_ctx);
-  return get_ctx.cnt;
-}
+  const struct Table *t;
+  unsigned int s;
+  unsigned int i;
 
-
-/**
- * Iterate over the results that are "close" to a particular key in
- * the datacache.  "close" is defined as numerically larger than @a
- * key (when interpreted as a circular address space), with small
- * distance.
- *
- * @param cls closure (internal context for the plugin)
- * @param key area of the keyspace to look into
- * @param num_results number of results that should be returned to @a iter
- * @param iter maybe NULL (to just count)
- * @param iter_cls closure for @a iter
- * @return the number of results found
- */
-static unsigned int
-heap_plugin_get_closest (void *cls,
-                         const struct GNUNET_HashCode *key,
-                         unsigned int num_results,
-                         GNUNET_DATACACHE_Iterator iter,
-                         void *iter_cls)
-{
-  GNUNET_break (0); // not implemented!
-  return 0;
+  if (0 == plugin->num_values)
+    return 0;
+  /* start at a random slot of a random shard, take the next value */
+  s = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_WEAK,
+                                NUM_SHARDS);
+  while (0 == plugin->shards[s].blocks.count)
+    s = (s + 1) % NUM_SHARDS;
+  t = &plugin->shards[s].blocks;
+  i = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_WEAK,
+                                t->size);
+  while (NULL == t->slots[i])
+    i = (i + 1) & (t->size - 1);
+  (void) call_iter (t->slots[i], iter, iter_cls);
+  return 1;
 }
 
 
@@ -449,10 +744,22 @@ libgnunet_plugin_datacache_heap_init (void *cls)
   struct GNUNET_DATACACHE_PluginEnvironment *env = cls;
   struct GNUNET_DATACACHE_PluginFunctions *api;
   struct Plugin *plugin;
+  unsigned long long expected;
+  unsigned int size;
+  unsigned int i;
 
   plugin = GNUNET_new (struct Plugin);
-  plugin->map = GNUNET_CONTAINER_multihashmap_create (1024,  /* FIXME: base on quota! */
-						      GNUNET_YES);
+  /* size the tables for the number of values we expect per shard */
+  expected = env->quota / (OVERHEAD + EXPECTED_VALUE_SIZE) / NUM_SHARDS;
+  size = MIN_SLOTS;
+  while ( (size < 2 * expected) &&
+          (size < (1U << 30)) )
+    size *= 2;
+  for (i = 0; i < NUM_SHARDS; i++)
+  {
+    table_init (&plugin->shards[i].keys, size, GNUNET_NO);
+    table_init (&plugin->shards[i].blocks, size, GNUNET_YES);
+  }
   plugin->heap = GNUNET_CONTAINER_heap_create (GNUNET_CONTAINER_HEAP_ORDER_MIN);
   plugin->env = env;
   api = GNUNET_new (struct GNUNET_DATACACHE_PluginFunctions);
@@ -461,7 +768,6 @@ libgnunet_plugin_datacache_heap_init (void *cls)
   api->put = &heap_plugin_put;
   api->del = &heap_plugin_del;
   api->get_random = &heap_plugin_get_random;
-  api->get_closest = &heap_plugin_get_closest;
   LOG (GNUNET_ERROR_TYPE_INFO,
        _("Heap datacache running\n"));
   return api;
@@ -480,18 +786,16 @@ libgnunet_plugin_datacache_heap_done (void *cls)
   struct GNUNET_DATACACHE_PluginFunctions *api = cls;
   struct Plugin *plugin = api->cls;
   struct Value *val;
+  unsigned int i;
 
   while (NULL != (val = GNUNET_CONTAINER_heap_remove_root (plugin->heap)))
+    remove_value (plugin, val);
+  GNUNET_CONTAINER_heap_destroy (plugin->heap);
+  for (i = 0; i < NUM_SHARDS; i++)
   {
-    GNUNET_assert (GNUNET_YES ==
-		   GNUNET_CONTAINER_multihashmap_remove (plugin->map,
-							 &val->key,
-							 val));
-    GNUNET_free_non_null (val->path_info);
-    GNUNET_free (val);
+    GNUNET_free (plugin->shards[i].keys.slots);
+    GNUNET_free (plugin->shards[i].blocks.slots);
   }
-  GNUNET_CONTAINER_heap_destroy (plugin->heap);
-  GNUNET_CONTAINER_multihashmap_destroy (plugin->map);
   GNUNET_free (plugin);
   GNUNET_free (api);
   return NULL;
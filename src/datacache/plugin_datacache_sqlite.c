@@ -190,13 +190,142 @@ sqlite_plugin_put (void *cls,
 }
 
 
+/**
+ * Pass the results of a GET statement to the iterator.
+ *
+ * @param plugin the plugin
+ * @param stmt statement to step through, yields value, expire, path
+ *        and type
+ * @param key key of the results
+ * @param iter iterator to call
+ * @param iter_cls closure for @a iter
+ * @param[in,out] cnt incremented by the number of results passed
+ * @return #GNUNET_OK if all results were passed, #GNUNET_NO if
+ *         @a iter asked us to stop
+ */
+static int
+iterate_results (struct Plugin *plugin,
+                 sqlite3_stmt *stmt,
+                 const struct GNUNET_HashCode *key,
+                 GNUNET_DATACACHE_Iterator iter,
+                 void *iter_cls,
+                 unsigned int *cnt)
+{
+  struct GNUNET_TIME_Absolute exp;
+  unsigned int size;
+  const char *dat;
+  unsigned int psize;
+  unsigned int type;
+  int64_t ntime;
+  const struct GNUNET_PeerIdentity *path;
+  int ret;
+
+  while (SQLITE_ROW == (ret = sqlite3_step (stmt)))
+  {
+    size = sqlite3_column_bytes (stmt, 0);
+    dat = sqlite3_column_blob (stmt, 0);
+    exp.abs_value_us = sqlite3_column_int64 (stmt, 1);
+    psize = sqlite3_column_bytes (stmt, 2);
+    type = sqlite3_column_int (stmt, 3);
+    if (0 != psize % sizeof (struct GNUNET_PeerIdentity))
+    {
+      GNUNET_break (0);
+      psize = 0;
+    }
+    psize /= sizeof (struct GNUNET_PeerIdentity);
+    if (0 != psize)
+      path = sqlite3_column_blob (stmt, 2);
+    else
+      path = NULL;
+    ntime = (int64_t) exp.abs_value_us;
+    if (ntime == INT64_MAX)
+      exp = GNUNET_TIME_UNIT_FOREVER_ABS;
+    (*cnt)++;
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Found %u-byte result when processing GET for key `%4s'\n",
+         (unsigned int) size,
+         GNUNET_h2s (key));
+    if (GNUNET_OK != iter (iter_cls,
+                           key,
+                           size,
+                           dat,
+                           type,
+                           exp,
+                           psize,
+                           path))
+      return GNUNET_NO;
+  }
+  if (SQLITE_DONE != ret)
+    LOG_SQLITE (plugin->dbh,
+                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                "sqlite3_step");
+  return GNUNET_OK;
+}
+
+
+/**
+ * Pick a random row id between the smallest and the largest row id
+ * in the table.
+ *
+ * @param plugin our plugin
+ * @param quality how good the random number has to be
+ * @param[out] rowid set to the random row id
+ * @return #GNUNET_OK on success, #GNUNET_NO if the table is empty,
+ *         #GNUNET_SYSERR on error
+ */
+static int
+random_rowid (struct Plugin *plugin,
+              enum GNUNET_CRYPTO_Quality quality,
+              sqlite3_int64 *rowid)
+{
+  sqlite3_stmt *stmt;
+  sqlite3_int64 min;
+  sqlite3_int64 max;
+
+  if (SQLITE_OK !=
+      sq_prepare (plugin->dbh,
+                  "SELECT MIN(_ROWID_),MAX(_ROWID_) FROM ds090",
+                  &stmt))
+  {
+    LOG_SQLITE (plugin->dbh,
+                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                "sq_prepare");
+    return GNUNET_SYSERR;
+  }
+  if (SQLITE_ROW != sqlite3_step (stmt))
+  {
+    LOG_SQLITE (plugin->dbh,
+                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                "sqlite3_step");
+    sqlite3_finalize (stmt);
+    return GNUNET_SYSERR;
+  }
+  if (SQLITE_NULL == sqlite3_column_type (stmt, 0))
+  {
+    sqlite3_finalize (stmt);
+    return GNUNET_NO;
+  }
+  min = sqlite3_column_int64 (stmt, 0);
+  max = sqlite3_column_int64 (stmt, 1);
+  sqlite3_finalize (stmt);
+  *rowid = min + (sqlite3_int64)
+    GNUNET_CRYPTO_random_u64 (quality,
+                              (uint64_t) (max - min) + 1);
+  return GNUNET_OK;
+}
+
+
 /**
  * Iterate over the results for a particular key
- * in the datastore.
+ * in the datastore.  The results are streamed from a single query
+ * (per half of the table, see below) instead of being fetched one
+ * by one, so a key with many values costs one pass over its index
+ * entries.
  *
  * @param cls closure (our `struct Plugin`)
  * @param key
  * @param type entries of which type are relevant?
+ *        #GNUNET_BLOCK_TYPE_ANY for all types
  * @param iter maybe NULL (to just count)
  * @param iter_cls closure for @a iter
  * @return the number of results found
@@ -208,92 +337,101 @@ sqlite_plugin_get (void *cls,
                    GNUNET_DATACACHE_Iterator iter,
                    void *iter_cls)
 {
+  static const char *const get_sql[2][2] = {
+    {
+      "SELECT value,expire,path,type FROM ds090 WHERE key=? AND type=? AND expire >= ? AND _ROWID_ >= ?",
+      "SELECT value,expire,path,type FROM ds090 WHERE key=? AND type=? AND expire >= ? AND _ROWID_ < ?"
+    },
+    {
+      "SELECT value,expire,path,type FROM ds090 WHERE key=? AND expire >= ? AND _ROWID_ >= ?",
+      "SELECT value,expire,path,type FROM ds090 WHERE key=? AND expire >= ? AND _ROWID_ < ?"
+    }
+  };
   struct Plugin *plugin = cls;
   sqlite3_stmt *stmt;
   struct GNUNET_TIME_Absolute now;
-  struct GNUNET_TIME_Absolute exp;
-  unsigned int size;
-  const char *dat;
   unsigned int cnt;
-  unsigned int off;
   unsigned int total;
-  unsigned int psize;
-  char scratch[256];
+  unsigned int i;
+  int any;
+  int col;
+  sqlite3_int64 pivot;
   int64_t ntime;
-  const struct GNUNET_PeerIdentity *path;
 
   now = GNUNET_TIME_absolute_get ();
+  ntime = (int64_t) now.abs_value_us;
+  GNUNET_assert (ntime >= 0);
   LOG (GNUNET_ERROR_TYPE_DEBUG,
        "Processing GET for key `%4s'\n",
        GNUNET_h2s (key));
-  if (sq_prepare
-      (plugin->dbh,
-       "SELECT count(*) FROM ds090 WHERE key=? AND type=? AND expire >= ?",
-       &stmt) != SQLITE_OK)
-  {
-    LOG_SQLITE (plugin->dbh,
-                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
-                "sq_prepare");
-    return 0;
-  }
-  ntime = (int64_t) now.abs_value_us;
-  GNUNET_assert (ntime >= 0);
-  if ((SQLITE_OK !=
-       sqlite3_bind_blob (stmt, 1, key, sizeof (struct GNUNET_HashCode),
-                          SQLITE_TRANSIENT)) ||
-      (SQLITE_OK != sqlite3_bind_int (stmt, 2, type)) ||
-      (SQLITE_OK != sqlite3_bind_int64 (stmt, 3, now.abs_value_us)))
-  {
-    LOG_SQLITE (plugin->dbh,
-                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
-                "sqlite3_bind_xxx");
-    sqlite3_finalize (stmt);
-    return 0;
-  }
-
-  if (SQLITE_ROW != sqlite3_step (stmt))
+  any = (GNUNET_BLOCK_TYPE_ANY == type) ? 1 : 0;
+  if (NULL == iter)
   {
-    LOG_SQLITE (plugin->dbh, GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
-                "sqlite_step");
+    if (sq_prepare
+        (plugin->dbh,
+         any
+         ? "SELECT count(*) FROM ds090 WHERE key=? AND expire >= ?"
+         : "SELECT count(*) FROM ds090 WHERE key=? AND type=? AND expire >= ?",
+         &stmt) != SQLITE_OK)
+    {
+      LOG_SQLITE (plugin->dbh,
+                  GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                  "sq_prepare");
+      return 0;
+    }
+    col = 1;
+    if ((SQLITE_OK !=
+         sqlite3_bind_blob (stmt, col++, key, sizeof (struct GNUNET_HashCode),
+                            SQLITE_TRANSIENT)) ||
+        ( (! any) &&
+          (SQLITE_OK != sqlite3_bind_int (stmt, col++, type)) ) ||
+        (SQLITE_OK != sqlite3_bind_int64 (stmt, col++, now.abs_value_us)))
+    {
+      LOG_SQLITE (plugin->dbh,
+                  GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                  "sqlite3_bind_xxx");
+      sqlite3_finalize (stmt);
+      return 0;
+    }
+    if (SQLITE_ROW != sqlite3_step (stmt))
+    {
+      LOG_SQLITE (plugin->dbh, GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                  "sqlite_step");
+      sqlite3_finalize (stmt);
+      return 0;
+    }
+    total = sqlite3_column_int (stmt, 0);
     sqlite3_finalize (stmt);
-    LOG (GNUNET_ERROR_TYPE_DEBUG,
-         "No content found when processing GET for key `%4s'\n",
-         GNUNET_h2s (key));
-    return 0;
-  }
-  total = sqlite3_column_int (stmt, 0);
-  sqlite3_finalize (stmt);
-  if ((0 == total) || (NULL == iter))
-  {
-    if (0 == total)
-      LOG (GNUNET_ERROR_TYPE_DEBUG,
-           "No content found when processing GET for key `%4s'\n",
-           GNUNET_h2s (key));
     return total;
   }
 
+  /* Start at a random row and wrap around, so that iterators that
+     stop early do not always see the same results: first the rows
+     at or after the pivot, then those before it. */
+  if (GNUNET_OK != random_rowid (plugin,
+                                 GNUNET_CRYPTO_QUALITY_WEAK,
+                                 &pivot))
+    pivot = 0;
   cnt = 0;
-  off = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_WEAK, total);
-  while (cnt < total)
+  for (i = 0; i < 2; i++)
   {
-    off = (off + 1) % total;
-    GNUNET_snprintf (scratch, sizeof (scratch),
-                     "SELECT value,expire,path FROM ds090 WHERE key=? AND type=? AND expire >= ? LIMIT 1 OFFSET %u",
-                     off);
-    if (sq_prepare (plugin->dbh, scratch, &stmt) != SQLITE_OK)
+    if (sq_prepare (plugin->dbh, get_sql[any][i], &stmt) != SQLITE_OK)
     {
       LOG_SQLITE (plugin->dbh,
                   GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
                   "sq_prepare");
       return cnt;
     }
+    col = 1;
     if ((SQLITE_OK !=
-         sqlite3_bind_blob (stmt, 1,
+         sqlite3_bind_blob (stmt, col++,
                             key,
                             sizeof (struct GNUNET_HashCode),
                             SQLITE_TRANSIENT)) ||
-        (SQLITE_OK != sqlite3_bind_int (stmt, 2, type)) ||
-        (SQLITE_OK != sqlite3_bind_int64 (stmt, 3, now.abs_value_us)))
+        ( (! any) &&
+          (SQLITE_OK != sqlite3_bind_int (stmt, col++, type)) ) ||
+        (SQLITE_OK != sqlite3_bind_int64 (stmt, col++, now.abs_value_us)) ||
+        (SQLITE_OK != sqlite3_bind_int64 (stmt, col++, pivot)))
     {
       LOG_SQLITE (plugin->dbh,
                   GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
@@ -301,44 +439,22 @@ sqlite_plugin_get (void *cls,
       sqlite3_finalize (stmt);
       return cnt;
     }
-    if (sqlite3_step (stmt) != SQLITE_ROW)
-      break;
-    size = sqlite3_column_bytes (stmt, 0);
-    dat = sqlite3_column_blob (stmt, 0);
-    exp.abs_value_us = sqlite3_column_int64 (stmt, 1);
-    psize = sqlite3_column_bytes (stmt, 2);
-    if (0 != psize % sizeof (struct GNUNET_PeerIdentity))
-    {
-      GNUNET_break (0);
-      psize = 0;
-    }
-    psize /= sizeof (struct GNUNET_PeerIdentity);
-    if (0 != psize)
-      path = sqlite3_column_blob (stmt, 2);
-    else
-      path = NULL;
-    ntime = (int64_t) exp.abs_value_us;
-    if (ntime == INT64_MAX)
-      exp = GNUNET_TIME_UNIT_FOREVER_ABS;
-    cnt++;
-    LOG (GNUNET_ERROR_TYPE_DEBUG,
-         "Found %u-byte result when processing GET for key `%4s'\n",
-         (unsigned int) size,
-         GNUNET_h2s (key));
-    if (GNUNET_OK != iter (iter_cls,
-                           key,
-                           size,
-                           dat,
-                           type,
-                           exp,
-                           psize,
-                           path))
+    if (GNUNET_OK != iterate_results (plugin,
+                                      stmt,
+                                      key,
+                                      iter,
+                                      iter_cls,
+                                      &cnt))
     {
       sqlite3_finalize (stmt);
       break;
     }
     sqlite3_finalize (stmt);
   }
+  if (0 == cnt)
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "No content found when processing GET for key `%4s'\n",
+         GNUNET_h2s (key));
   return cnt;
 }
 
@@ -449,10 +565,9 @@ sqlite_plugin_get_random (void *cls,
   struct GNUNET_TIME_Absolute exp;
   unsigned int size;
   const char *dat;
-  unsigned int off;
   unsigned int psize;
   unsigned int type;
-  char scratch[256];
+  sqlite3_int64 off;
   int64_t ntime;
   const struct GNUNET_PeerIdentity *path;
   const struct GNUNET_HashCode *key;
@@ -461,22 +576,34 @@ sqlite_plugin_get_random (void *cls,
     return 0;
   if (NULL == iter)
     return 1;
-  off = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_NONCE,
-                                  plugin->num_items);
-  GNUNET_snprintf (scratch,
-                   sizeof (scratch),
-                   "SELECT value,expire,path,key,type FROM ds090 ORDER BY key LIMIT 1 OFFSET %u",
-                   off);
+  /* Pick a random row id and take the first row at or after it,
+     which is a single index lookup instead of a scan over 'off'
+     rows. */
+  if (GNUNET_OK != random_rowid (plugin,
+                                 GNUNET_CRYPTO_QUALITY_NONCE,
+                                 &off))
+    return 0;
   if (SQLITE_OK !=
-      sq_prepare (plugin->dbh, scratch, &stmt))
+      sq_prepare (plugin->dbh,
+                  "SELECT value,expire,path,key,type FROM ds090 WHERE _ROWID_ >= ? ORDER BY _ROWID_ ASC LIMIT 1",
+                  &stmt))
   {
     LOG_SQLITE (plugin->dbh,
                 GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
                 "sq_prepare");
     return 0;
   }
+  if (SQLITE_OK != sqlite3_bind_int64 (stmt, 1, off))
+  {
+    LOG_SQLITE (plugin->dbh,
+                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
+                "sqlite3_bind_xxx");
+    sqlite3_finalize (stmt);
+    return 0;
+  }
   if (SQLITE_ROW != sqlite3_step (stmt))
   {
+    /* the row with the largest row id is at or after 'off' */
     GNUNET_break (0);
     sqlite3_finalize (stmt);
     return 0;
@@ -521,120 +648,6 @@ sqlite_plugin_get_random (void *cls,
 }
 
 
-/**
- * Iterate over the results that are "close" to a particular key in
- * the datacache.  "close" is defined as numerically larger than @a
- * key (when interpreted as a circular address space), with small
- * distance.
- *
- * @param cls closure (internal context for the plugin)
- * @param key area of the keyspace to look into
- * @param num_results number of results that should be returned to @a iter
- * @param iter maybe NULL (to just count)
- * @param iter_cls closure for @a iter
- * @return the number of results found
- */
-static unsigned int
-sqlite_plugin_get_closest (void *cls,
-                           const struct GNUNET_HashCode *key,
-                           unsigned int num_results,
-                           GNUNET_DATACACHE_Iterator iter,
-                           void *iter_cls)
-{
-  struct Plugin *plugin = cls;
-  sqlite3_stmt *stmt;
-  struct GNUNET_TIME_Absolute now;
-  struct GNUNET_TIME_Absolute exp;
-  unsigned int size;
-  const char *dat;
-  unsigned int cnt;
-  unsigned int psize;
-  unsigned int type;
-  int64_t ntime;
-  const struct GNUNET_PeerIdentity *path;
-
-  now = GNUNET_TIME_absolute_get ();
-  LOG (GNUNET_ERROR_TYPE_DEBUG,
-       "Processing GET_CLOSEST for key `%4s'\n",
-       GNUNET_h2s (key));
-  if (SQLITE_OK !=
-      sq_prepare (plugin->dbh,
-                  "SELECT value,expire,path,type,key FROM ds090 WHERE key>=? AND expire >= ? ORDER BY KEY ASC LIMIT ?",
-                  &stmt))
-  {
-    LOG_SQLITE (plugin->dbh,
-                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
-                "sq_prepare");
-    return 0;
-  }
-  ntime = (int64_t) now.abs_value_us;
-  GNUNET_assert (ntime >= 0);
-  if ((SQLITE_OK !=
-       sqlite3_bind_blob (stmt,
-                          1,
-                          key,
-                          sizeof (struct GNUNET_HashCode),
-                          SQLITE_TRANSIENT)) ||
-      (SQLITE_OK != sqlite3_bind_int64 (stmt, 2, now.abs_value_us)) ||
-      (SQLITE_OK != sqlite3_bind_int (stmt, 3, num_results)) )
-  {
-    LOG_SQLITE (plugin->dbh,
-                GNUNET_ERROR_TYPE_ERROR | GNUNET_ERROR_TYPE_BULK,
-                "sqlite3_bind_xxx");
-    sqlite3_finalize (stmt);
-    return 0;
-  }
-  cnt = 0;
-  while (SQLITE_ROW == sqlite3_step (stmt))
-  {
-    if (sizeof (struct GNUNET_HashCode) !=
-        sqlite3_column_bytes (stmt, 4))
-    {
-      GNUNET_break (0);
-      break;
-    }
-    size = sqlite3_column_bytes (stmt, 0);
-    dat = sqlite3_column_blob (stmt, 0);
-    exp.abs_value_us = sqlite3_column_int64 (stmt, 1);
-    psize = sqlite3_column_bytes (stmt, 2);
-    type = sqlite3_column_int (stmt, 3);
-    key = sqlite3_column_blob (stmt, 4);
-    if (0 != psize % sizeof (struct GNUNET_PeerIdentity))
-    {
-      GNUNET_break (0);
-      psize = 0;
-    }
-    psize /= sizeof (struct GNUNET_PeerIdentity);
-    if (0 != psize)
-      path = sqlite3_column_blob (stmt, 2);
-    else
-      path = NULL;
-    ntime = (int64_t) exp.abs_value_us;
-    if (ntime == INT64_MAX)
-      exp = GNUNET_TIME_UNIT_FOREVER_ABS;
-    cnt++;
-    LOG (GNUNET_ERROR_TYPE_DEBUG,
-         "Found %u-byte result at %s when processing GET_CLOSE\n",
-         (unsigned int) size,
-         GNUNET_h2s (key));
-    if (GNUNET_OK != iter (iter_cls,
-                           key,
-                           size,
-                           dat,
-                           type,
-                           exp,
-                           psize,
-                           path))
-    {
-      sqlite3_finalize (stmt);
-      break;
-    }
-  }
-  sqlite3_finalize (stmt);
-  return cnt;
-}
-
-
 /**
  * Entry point for the plugin.
  *
@@ -709,7 +722,6 @@ libgnunet_plugin_datacache_sqlite_init (void *cls)
   api->put = &sqlite_plugin_put;
   api->del = &sqlite_plugin_del;
   api->get_random = &sqlite_plugin_get_random;
-  api->get_closest = &sqlite_plugin_get_closest;
   LOG (GNUNET_ERROR_TYPE_INFO,
        "Sqlite datacache running\n");
   return api;
@@ -60,6 +60,95 @@ checkIt (void *cls,
 }
 
 
+/**
+ * Key that #checkClosest() checks the results against.
+ */
+static struct GNUNET_HashCode closest_target;
+
+/**
+ * XOR distance of the last result to #closest_target.
+ */
+static struct GNUNET_HashCode closest_last;
+
+/**
+ * Number of results passed to #checkClosest().
+ */
+static unsigned int closest_found;
+
+
+/**
+ * Check that the results of a proximity search are returned
+ * closest first.
+ */
+static int
+checkClosest (void *cls,
+              const struct GNUNET_HashCode *key,
+              size_t size, const char *data,
+              enum GNUNET_BLOCK_Type type,
+              struct GNUNET_TIME_Absolute exp,
+              unsigned int path_len,
+              const struct GNUNET_PeerIdentity *path)
+{
+  struct GNUNET_HashCode dist;
+
+  GNUNET_CRYPTO_hash_xor (key, &closest_target, &dist);
+  if ( (closest_found > 0) &&
+       (0 > memcmp (&dist, &closest_last, sizeof (struct GNUNET_HashCode))) )
+  {
+    GNUNET_break (0);
+    ok = 4;
+  }
+  closest_last = dist;
+  closest_found++;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Set once #checkSuccessor() has seen a key smaller than
+ * #closest_target.
+ */
+static int successor_wrapped;
+
+
+/**
+ * Check that the results of a successor search are returned in
+ * ascending order, starting at #closest_target and wrapping around
+ * once.
+ */
+static int
+checkSuccessor (void *cls,
+                const struct GNUNET_HashCode *key,
+                size_t size, const char *data,
+                enum GNUNET_BLOCK_Type type,
+                struct GNUNET_TIME_Absolute exp,
+                unsigned int path_len,
+                const struct GNUNET_PeerIdentity *path)
+{
+  int below;
+
+  below = (0 > memcmp (key, &closest_target, sizeof (struct GNUNET_HashCode)));
+  if ( (! below) &&
+       (GNUNET_YES == successor_wrapped) )
+  {
+    GNUNET_break (0);
+    ok = 5;
+  }
+  if ( (closest_found > 0) &&
+       (below == successor_wrapped) &&
+       (0 > memcmp (key, &closest_last, sizeof (struct GNUNET_HashCode))) )
+  {
+    GNUNET_break (0);
+    ok = 6;
+  }
+  if (below)
+    successor_wrapped = GNUNET_YES;
+  closest_last = *key;
+  closest_found++;
+  return GNUNET_OK;
+}
+
+
 static void
 run (void *cls, char *const *args, const char *cfgfile,
      const struct GNUNET_CONFIGURATION_Handle *cfg)
@@ -100,6 +189,19 @@ run (void *cls, char *const *args, const char *cfgfile,
     k = n;
   }
 
+  memset (&closest_target, 23, sizeof (struct GNUNET_HashCode));
+  closest_found = 0;
+  ASSERT (10 == GNUNET_DATACACHE_get_closest (h, &closest_target, 10,
+                                              &checkClosest, NULL));
+  ASSERT (10 == closest_found);
+
+  closest_found = 0;
+  successor_wrapped = GNUNET_NO;
+  ASSERT (100 == GNUNET_DATACACHE_get_successors (h, &closest_target, 100,
+                                                  &checkSuccessor, NULL));
+  ASSERT (100 == closest_found);
+  ASSERT (GNUNET_YES == successor_wrapped);
+
   memset (&k, 42, sizeof (struct GNUNET_HashCode));
   GNUNET_CRYPTO_hash (&k, sizeof (struct GNUNET_HashCode), &n);
   ASSERT (GNUNET_OK ==
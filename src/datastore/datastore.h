@@ -255,6 +255,86 @@ struct DataMessage
   struct GNUNET_HashCode key;
 
 };
+
+/**
+ * Message from datastore client announcing a batch of PUT requests.
+ * It is followed by @e count separate messages of type
+ * #GNUNET_MESSAGE_TYPE_DATASTORE_PUT, which the service stores in one
+ * transaction and then answers with a single `struct
+ * StatusMultipleMessage`.
+ */
+struct PutMultipleMessage
+{
+  /**
+   * Type is #GNUNET_MESSAGE_TYPE_DATASTORE_PUT_MULTIPLE.
+   */
+  struct GNUNET_MessageHeader header;
+
+  /**
+   * Number of PUT messages that follow.
+   */
+  uint32_t count GNUNET_PACKED;
+
+};
+
+
+/**
+ * Message from datastore service informing client about the
+ * success or failure of each item of a batched PUT request.  This
+ * header is followed by @e count `int32_t` status codes (NBO) and
+ * optionally by a variable-size, 0-terminated error message.
+ */
+struct StatusMultipleMessage
+{
+  /**
+   * Type is #GNUNET_MESSAGE_TYPE_DATASTORE_STATUS_MULTIPLE.
+   */
+  struct GNUNET_MessageHeader header;
+
+  /**
+   * Number of status codes that follow.
+   */
+  uint32_t count GNUNET_PACKED;
+
+  /**
+   * Minimum expiration time required for content to be stored
+   * by the datacache at this time, zero for unknown or no limit.
+   */
+  struct GNUNET_TIME_AbsoluteNBO min_expiration;
+
+};
+
+
+/**
+ * Message to the datastore service asking about content under
+ * several keys.  Followed by @e count keys.  The service answers
+ * with a `struct DataMessage` for each result found and a single
+ * #GNUNET_MESSAGE_TYPE_DATASTORE_DATA_END at the end.
+ */
+struct GetMultipleMessage
+{
+  /**
+   * Type is #GNUNET_MESSAGE_TYPE_DATASTORE_GET_MULTIPLE.
+   */
+  struct GNUNET_MessageHeader header;
+
+  /**
+   * Desired content type.  (actually an enum GNUNET_BLOCK_Type)
+   */
+  uint32_t type GNUNET_PACKED;
+
+  /**
+   * Number of keys that follow.
+   */
+  uint32_t count GNUNET_PACKED;
+
+  /**
+   * Offset of the result for each key.
+   */
+  uint64_t offset GNUNET_PACKED;
+
+};
+
 GNUNET_NETWORK_STRUCT_END
 
 
@@ -64,6 +64,29 @@ struct StatusContext
 };
 
 
+/**
+ * Context for processing status messages of batched requests.
+ */
+struct MultiStatusContext
+{
+  /**
+   * Continuation to call with the status codes.
+   */
+  GNUNET_DATASTORE_ContinuationWithMultiStatus cont;
+
+  /**
+   * Closure for @e cont.
+   */
+  void *cont_cls;
+
+  /**
+   * Number of items in the batch.
+   */
+  unsigned int count;
+
+};
+
+
 /**
  * Context for processing result messages.
  */
@@ -90,6 +113,8 @@ union QueueContext
 
   struct StatusContext sc;
 
+  struct MultiStatusContext msc;
+
   struct ResultContext rc;
 
 };
@@ -168,7 +193,14 @@ struct GNUNET_DATASTORE_QueueEntry
   uint32_t message_size;
 
   /**
-   * Has this message been transmitted to the service?
+   * Number of bytes of the request that were already handed to the
+   * connection.  Requests consisting of several messages (batched
+   * PUTs) are transmitted in multiple chunks.
+   */
+  uint32_t message_sent;
+
+  /**
+   * Has this message (or its first chunk) been transmitted to the service?
    * Only ever GNUNET_YES for the head of the queue.
    * Note that the overall struct should end at a
    * multiple of 64 bits.
@@ -600,6 +632,37 @@ receive_cb (void *cls,
 }
 
 
+/**
+ * Determine how many bytes of the request of @a qe to hand to the
+ * connection next.  Requests consisting of several messages are
+ * sent in chunks of whole messages, each chunk being smaller than
+ * the maximum message size.
+ *
+ * @param qe queue entry to transmit
+ * @return number of bytes in the next chunk
+ */
+static size_t
+get_chunk_size (const struct GNUNET_DATASTORE_QueueEntry *qe)
+{
+  const char *buf = (const char *) &qe[1];
+  struct GNUNET_MessageHeader hdr;
+  size_t chunk;
+  uint16_t msize;
+
+  chunk = 0;
+  while (qe->message_sent + chunk < qe->message_size)
+  {
+    memcpy (&hdr, &buf[qe->message_sent + chunk], sizeof (hdr));
+    msize = ntohs (hdr.size);
+    if ( (chunk > 0) &&
+         (chunk + msize >= GNUNET_SERVER_MAX_MESSAGE_SIZE) )
+      break;
+    chunk += msize;
+  }
+  return chunk;
+}
+
+
 /**
  * Transmit request from queue to datastore service.
  *
@@ -628,9 +691,12 @@ transmit_request (void *cls,
                               gettext_noop ("# transmission request failures"),
                               1, GNUNET_NO);
     do_disconnect (h);
+    /* a partially transmitted batch cannot be resumed */
+    if (GNUNET_YES == qe->was_transmitted)
+      qe->response_proc (h, NULL);
     return 0;
   }
-  if (size < (msize = qe->message_size))
+  if (size < (msize = get_chunk_size (qe)))
   {
     process_queue (h);
     return 0;
@@ -638,10 +704,25 @@ transmit_request (void *cls,
   LOG (GNUNET_ERROR_TYPE_DEBUG,
        "Transmitting %u byte request to DATASTORE\n",
        msize);
-  memcpy (buf, &qe[1], msize);
-  qe->was_transmitted = GNUNET_YES;
-  GNUNET_SCHEDULER_cancel (qe->task);
-  qe->task = NULL;
+  memcpy (buf, ((const char *) &qe[1]) + qe->message_sent, msize);
+  qe->message_sent += msize;
+  if (GNUNET_NO == qe->was_transmitted)
+  {
+    qe->was_transmitted = GNUNET_YES;
+    GNUNET_SCHEDULER_cancel (qe->task);
+    qe->task = NULL;
+  }
+  if (qe->message_sent < qe->message_size)
+  {
+    /* more messages of this request to go */
+    h->th
+      = GNUNET_CLIENT_notify_transmit_ready (h->client, get_chunk_size (qe),
+                                             GNUNET_TIME_absolute_get_remaining (qe->timeout),
+                                             GNUNET_YES,
+                                             &transmit_request, h);
+    GNUNET_break (NULL != h->th);
+    return msize;
+  }
   GNUNET_assert (GNUNET_NO == h->in_receive);
   h->in_receive = GNUNET_YES;
   GNUNET_CLIENT_receive (h->client,
@@ -704,7 +785,7 @@ process_queue (struct GNUNET_DATASTORE_Handle *h)
        "Queueing %u byte request to DATASTORE\n",
        qe->message_size);
   h->th
-    = GNUNET_CLIENT_notify_transmit_ready (h->client, qe->message_size,
+    = GNUNET_CLIENT_notify_transmit_ready (h->client, get_chunk_size (qe),
                                            GNUNET_TIME_absolute_get_remaining (qe->timeout),
                                            GNUNET_YES,
                                            &transmit_request, h);
@@ -838,6 +919,103 @@ process_status_message (void *cls,
 }
 
 
+/**
+ * Type of a function to call when we receive the status message
+ * for a batched PUT request from the service.
+ *
+ * @param cls closure
+ * @param msg message received, NULL on timeout or fatal error
+ */
+static void
+process_multi_status_message (void *cls,
+                              const struct GNUNET_MessageHeader *msg)
+{
+  struct GNUNET_DATASTORE_Handle *h = cls;
+  struct GNUNET_DATASTORE_QueueEntry *qe;
+  struct MultiStatusContext rc;
+  const struct StatusMultipleMessage *sm;
+  const int32_t *nstatus;
+  const char *emsg;
+  size_t msize;
+  unsigned int i;
+  int was_transmitted;
+
+  if (NULL == (qe = h->queue_head))
+  {
+    GNUNET_break (0);
+    do_disconnect (h);
+    return;
+  }
+  rc = qe->qc.msc;
+  {
+    int32_t status[rc.count];
+
+    for (i = 0; i < rc.count; i++)
+      status[i] = GNUNET_SYSERR;
+    if (NULL == msg)
+    {
+      was_transmitted = qe->was_transmitted;
+      free_queue_entry (qe);
+      if (was_transmitted == GNUNET_YES)
+        do_disconnect (h);
+      else
+        process_queue (h);
+      if (NULL != rc.cont)
+        rc.cont (rc.cont_cls, rc.count, status,
+                 GNUNET_TIME_UNIT_ZERO_ABS,
+                 _("Failed to receive status response from database."));
+      return;
+    }
+    GNUNET_assert (GNUNET_YES == qe->was_transmitted);
+    free_queue_entry (qe);
+    msize = ntohs (msg->size);
+    sm = (const struct StatusMultipleMessage *) msg;
+    if ((msize < sizeof (struct StatusMultipleMessage)) ||
+        (ntohs (msg->type) != GNUNET_MESSAGE_TYPE_DATASTORE_STATUS_MULTIPLE) ||
+        (ntohl (sm->count) != rc.count) ||
+        (msize < sizeof (struct StatusMultipleMessage) +
+         rc.count * sizeof (int32_t)))
+    {
+      GNUNET_break (0);
+      h->retry_time = GNUNET_TIME_UNIT_ZERO;
+      do_disconnect (h);
+      if (NULL != rc.cont)
+        rc.cont (rc.cont_cls, rc.count, status,
+                 GNUNET_TIME_UNIT_ZERO_ABS,
+                 _("Error reading response from datastore service"));
+      return;
+    }
+    nstatus = (const int32_t *) &sm[1];
+    for (i = 0; i < rc.count; i++)
+      status[i] = ntohl (nstatus[i]);
+    msize -= sizeof (struct StatusMultipleMessage) + rc.count * sizeof (int32_t);
+    emsg = NULL;
+    if (msize > 0)
+    {
+      emsg = (const char *) &nstatus[rc.count];
+      if (emsg[msize - 1] != '\0')
+      {
+        GNUNET_break (0);
+        emsg = _("Invalid error message received from datastore service");
+      }
+    }
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Received %u status codes/%s\n",
+         rc.count,
+         emsg);
+    GNUNET_STATISTICS_update (h->stats,
+                              gettext_noop ("# status messages received"), 1,
+                              GNUNET_NO);
+    h->retry_time = GNUNET_TIME_UNIT_ZERO;
+    process_queue (h);
+    if (NULL != rc.cont)
+      rc.cont (rc.cont_cls, rc.count, status,
+               GNUNET_TIME_absolute_ntoh (sm->min_expiration),
+               emsg);
+  }
+}
+
+
 /**
  * Store an item in the datastore.  If the item is already present,
  * the priorities are summed up and the higher expiration time and
@@ -927,6 +1105,111 @@ GNUNET_DATASTORE_put (struct GNUNET_DATASTORE_Handle *h,
 }
 
 
+/**
+ * Store a batch of items in the datastore.  The items are sent to
+ * the service back-to-back and are stored within a single database
+ * transaction (if the plugin supports it), saving a round trip per
+ * item compared to #GNUNET_DATASTORE_put.  Otherwise the semantics
+ * for each item are the same as for #GNUNET_DATASTORE_put.
+ *
+ * @param h handle to the datastore
+ * @param rid reservation ID to use (from "reserve"); use 0 if no
+ *            prior reservation was made
+ * @param count number of items in @a items, at most
+ *            #GNUNET_DATASTORE_MAX_BATCH_SIZE
+ * @param items the items to store
+ * @param queue_priority ranking of this request in the priority queue
+ * @param max_queue_size at what queue size should this request be dropped
+ *        (if other requests of higher priority are in the queue)
+ * @param timeout timeout for the operation
+ * @param cont continuation to call when done
+ * @param cont_cls closure for @a cont
+ * @return NULL if the entry was not queued, otherwise a handle that can be used to
+ *         cancel
+ */
+struct GNUNET_DATASTORE_QueueEntry *
+GNUNET_DATASTORE_put_multiple (struct GNUNET_DATASTORE_Handle *h,
+                               uint32_t rid,
+                               unsigned int count,
+                               const struct GNUNET_DATASTORE_PutItem *items,
+                               unsigned int queue_priority,
+                               unsigned int max_queue_size,
+                               struct GNUNET_TIME_Relative timeout,
+                               GNUNET_DATASTORE_ContinuationWithMultiStatus cont,
+                               void *cont_cls)
+{
+  struct GNUNET_DATASTORE_QueueEntry *qe;
+  struct PutMultipleMessage *pm;
+  struct DataMessage dm;
+  char *pos;
+  size_t msize;
+  size_t dsize;
+  unsigned int i;
+  union QueueContext qc;
+
+  GNUNET_assert ( (count > 0) &&
+                  (count <= GNUNET_DATASTORE_MAX_BATCH_SIZE) );
+  LOG (GNUNET_ERROR_TYPE_DEBUG,
+       "Asked to put batch of %u items\n",
+       count);
+  msize = sizeof (struct PutMultipleMessage);
+  for (i = 0; i < count; i++)
+  {
+    dsize = sizeof (struct DataMessage) + items[i].size;
+    GNUNET_assert (dsize < GNUNET_SERVER_MAX_MESSAGE_SIZE);
+    msize += dsize;
+  }
+  qc.msc.cont = cont;
+  qc.msc.cont_cls = cont_cls;
+  qc.msc.count = count;
+  qe = make_queue_entry (h,
+                         msize,
+                         queue_priority,
+                         max_queue_size,
+                         timeout,
+                         &process_multi_status_message, &qc);
+  if (NULL == qe)
+  {
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Could not create queue entry for PUT MULTIPLE\n");
+    return NULL;
+  }
+  GNUNET_STATISTICS_update (h->stats,
+                            gettext_noop ("# PUT MULTIPLE requests executed"),
+                            1, GNUNET_NO);
+  GNUNET_STATISTICS_update (h->stats,
+                            gettext_noop ("# PUT requests executed"),
+                            count, GNUNET_NO);
+  pm = (struct PutMultipleMessage *) &qe[1];
+  pm->header.type = htons (GNUNET_MESSAGE_TYPE_DATASTORE_PUT_MULTIPLE);
+  pm->header.size = htons (sizeof (struct PutMultipleMessage));
+  pm->count = htonl (count);
+  pos = (char *) &pm[1];
+  for (i = 0; i < count; i++)
+  {
+    /* messages following each other need not be aligned */
+    dsize = sizeof (struct DataMessage) + items[i].size;
+    dm.header.type = htons (GNUNET_MESSAGE_TYPE_DATASTORE_PUT);
+    dm.header.size = htons (dsize);
+    dm.rid = htonl (rid);
+    dm.size = htonl ((uint32_t) items[i].size);
+    dm.type = htonl (items[i].type);
+    dm.priority = htonl (items[i].priority);
+    dm.anonymity = htonl (items[i].anonymity);
+    dm.replication = htonl (items[i].replication);
+    dm.reserved = htonl (0);
+    dm.uid = GNUNET_htonll (0);
+    dm.expiration = GNUNET_TIME_absolute_hton (items[i].expiration);
+    dm.key = items[i].key;
+    memcpy (pos, &dm, sizeof (dm));
+    memcpy (&pos[sizeof (dm)], items[i].data, items[i].size);
+    pos += dsize;
+  }
+  process_queue (h);
+  return qe;
+}
+
+
 /**
  * Reserve space in the datastore.  This function should be used
  * to avoid "out of space" failures during a longer sequence of "put"
@@ -1280,6 +1563,69 @@ process_result_message (void *cls, const struct GNUNET_MessageHeader *msg)
 }
 
 
+/**
+ * Type of a function to call when we receive a message from the
+ * service in response to a GET MULTIPLE request.  Unlike
+ * #process_result_message, the queue entry stays at the head of the
+ * queue until the end of the result set has been received.
+ *
+ * @param cls closure with the `struct GNUNET_DATASTORE_Handle *`
+ * @param msg message received, NULL on timeout or fatal error
+ */
+static void
+process_multi_result_message (void *cls,
+                              const struct GNUNET_MessageHeader *msg)
+{
+  struct GNUNET_DATASTORE_Handle *h = cls;
+  struct GNUNET_DATASTORE_QueueEntry *qe;
+  struct ResultContext rc;
+  const struct DataMessage *dm;
+
+  if ( (NULL == msg) ||
+       (ntohs (msg->type) == GNUNET_MESSAGE_TYPE_DATASTORE_DATA_END) )
+  {
+    /* same as for single results */
+    process_result_message (h, msg);
+    return;
+  }
+  qe = h->queue_head;
+  GNUNET_assert (NULL != qe);
+  rc = qe->qc.rc;
+  if ((GNUNET_YES != qe->was_transmitted) ||
+      (ntohs (msg->size) < sizeof (struct DataMessage)) ||
+      (ntohs (msg->type) != GNUNET_MESSAGE_TYPE_DATASTORE_DATA) ||
+      (ntohs (msg->size) !=
+       sizeof (struct DataMessage) +
+       ntohl (((const struct DataMessage *) msg)->size)))
+  {
+    GNUNET_break (0);
+    free_queue_entry (qe);
+    h->retry_time = GNUNET_TIME_UNIT_ZERO;
+    do_disconnect (h);
+    if (rc.proc != NULL)
+      rc.proc (rc.proc_cls, NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS,
+               0);
+    return;
+  }
+  dm = (const struct DataMessage *) msg;
+  LOG (GNUNET_ERROR_TYPE_DEBUG,
+       "Received batch result %llu with type %u and size %u with key %s\n",
+       (unsigned long long) GNUNET_ntohll (dm->uid), ntohl (dm->type),
+       ntohl (dm->size), GNUNET_h2s (&dm->key));
+  h->retry_time = GNUNET_TIME_UNIT_ZERO;
+  /* more results (or the end marker) are to follow */
+  h->in_receive = GNUNET_YES;
+  GNUNET_CLIENT_receive (h->client,
+                         &receive_cb, h,
+                         GNUNET_TIME_absolute_get_remaining (qe->timeout));
+  if (rc.proc != NULL)
+    rc.proc (rc.proc_cls, &dm->key, ntohl (dm->size), &dm[1], ntohl (dm->type),
+             ntohl (dm->priority), ntohl (dm->anonymity),
+             GNUNET_TIME_absolute_ntoh (dm->expiration),
+             GNUNET_ntohll (dm->uid));
+}
+
+
 /**
  * Get a random value from the datastore for content replication.
  * Returns a single, random value among those with the highest
@@ -1483,6 +1829,85 @@ GNUNET_DATASTORE_get_key (struct GNUNET_DATASTORE_Handle *h,
 }
 
 
+/**
+ * Get results for several keys from the datastore with a single
+ * request.  For each key, the processor is called with the result at
+ * the given @a offset (if any); results are streamed back as they are
+ * found, keys without a match are skipped.
+ *
+ * @param h handle to the datastore
+ * @param offset offset of the result (modulo num-results) for each key
+ * @param count number of keys in @a keys, at most
+ *              #GNUNET_DATASTORE_MAX_BATCH_SIZE
+ * @param keys keys to look up
+ * @param type desired type, 0 for any
+ * @param queue_priority ranking of this request in the priority queue
+ * @param max_queue_size at what queue size should this request be dropped
+ *        (if other requests of higher priority are in the queue)
+ * @param timeout how long to wait at most for a response
+ * @param proc function to call on each matching value;
+ *        will be called once with a NULL value at the end
+ * @param proc_cls closure for @a proc
+ * @return NULL if the entry was not queued, otherwise a handle that can be used to
+ *         cancel
+ */
+struct GNUNET_DATASTORE_QueueEntry *
+GNUNET_DATASTORE_get_multiple (struct GNUNET_DATASTORE_Handle *h,
+                               uint64_t offset,
+                               unsigned int count,
+                               const struct GNUNET_HashCode *keys,
+                               enum GNUNET_BLOCK_Type type,
+                               unsigned int queue_priority,
+                               unsigned int max_queue_size,
+                               struct GNUNET_TIME_Relative timeout,
+                               GNUNET_DATASTORE_DatumProcessor proc,
+                               void *proc_cls)
+{
+  struct GNUNET_DATASTORE_QueueEntry *qe;
+  struct GetMultipleMessage *gm;
+  size_t msize;
+  union QueueContext qc;
+
+  GNUNET_assert (NULL != proc);
+  GNUNET_assert ( (count > 0) &&
+                  (count <= GNUNET_DATASTORE_MAX_BATCH_SIZE) );
+  LOG (GNUNET_ERROR_TYPE_DEBUG,
+       "Asked to look for data of type %u under %u keys\n",
+       (unsigned int) type, count);
+  msize = sizeof (struct GetMultipleMessage) +
+    count * sizeof (struct GNUNET_HashCode);
+  qc.rc.proc = proc;
+  qc.rc.proc_cls = proc_cls;
+  qe = make_queue_entry (h,
+                         msize,
+                         queue_priority,
+                         max_queue_size,
+                         timeout,
+                         &process_multi_result_message,
+                         &qc);
+  if (NULL == qe)
+  {
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Could not queue request for %u keys\n",
+         count);
+    return NULL;
+  }
+  GNUNET_STATISTICS_update (h->stats,
+                            gettext_noop ("# GET MULTIPLE requests executed"),
+                            1,
+                            GNUNET_NO);
+  gm = (struct GetMultipleMessage *) &qe[1];
+  gm->header.type = htons (GNUNET_MESSAGE_TYPE_DATASTORE_GET_MULTIPLE);
+  gm->header.size = htons (msize);
+  gm->type = htonl (type);
+  gm->count = htonl (count);
+  gm->offset = GNUNET_htonll (offset);
+  memcpy (&gm[1], keys, count * sizeof (struct GNUNET_HashCode));
+  process_queue (h);
+  return qe;
+}
+
+
 /**
  * Cancel a datastore operation.  The final callback from the
  * operation must not have been done yet.
@@ -1501,6 +1926,25 @@ GNUNET_DATASTORE_cancel (struct GNUNET_DATASTORE_QueueEntry *qe)
        qe->was_transmitted, h->queue_head == qe);
   if (GNUNET_YES == qe->was_transmitted)
   {
+    if (qe->message_sent < qe->message_size)
+    {
+      /* only part of the batch was sent; the service would take
+         whatever we send next as part of it, so start over */
+      free_queue_entry (qe);
+      if (NULL != h->th)
+      {
+        GNUNET_CLIENT_notify_transmit_ready_cancel (h->th);
+        h->th = NULL;
+      }
+      do_disconnect (h);
+      return;
+    }
+    if (&process_multi_result_message == qe->response_proc)
+    {
+      /* number of replies unknown, consume them until the end */
+      qe->qc.rc.proc = NULL;
+      return;
+    }
     free_queue_entry (qe);
     h->skip_next_messages++;
     return;
@@ -29,6 +29,7 @@
 #include "gnunet_protocols.h"
 #include "gnunet_statistics_service.h"
 #include "gnunet_datastore_plugin.h"
+#include "gnunet-service-datastore_worker.h"
 #include "datastore.h"
 
 /**
@@ -48,6 +49,11 @@
  */
 #define MIN_EXPIRE_DELAY GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 1)
 
+/**
+ * How often do we write changes to the bloomfilter to disk?
+ */
+#define BF_SYNC_FREQUENCY GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MINUTES, 1)
+
 /**
  * Name under which we store current space consumption.
  */
@@ -59,6 +65,24 @@ static char *quota_stat_name;
  */
 #define MAX_STAT_SYNC_LAG 50
 
+/**
+ * How long do we keep PUTs in the memtable at most before
+ * writing them to the database?
+ */
+#define MEMTABLE_FLUSH_DELAY GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5)
+
+/**
+ * How often do we try to write an item of the memtable to the
+ * database before we give up on it?
+ */
+#define MAX_FLUSH_ATTEMPTS 3
+
+/**
+ * Unique identifiers we give to items in the memtable start here,
+ * far above the identifiers used by the plugins.
+ */
+#define MEMTABLE_UID_BASE (1LLU << 62)
+
 
 /**
  * Our datastore plugin.
@@ -68,10 +92,15 @@ struct DatastorePlugin
 
   /**
    * API of the transport as returned by the plugin's
-   * initialization function.
+   * initialization function (or of the worker running it).
    */
   struct GNUNET_DATASTORE_PluginFunctions *api;
 
+  /**
+   * API as returned by the plugin's initialization function.
+   */
+  struct GNUNET_DATASTORE_PluginFunctions *lib_api;
+
   /**
    * Short name for the plugin (i.e. "sqlite").
    */
@@ -131,6 +160,12 @@ struct ReservationList
  */
 static struct DatastorePlugin *plugin;
 
+/**
+ * Worker thread running the plugin, NULL if the plugin runs in
+ * the main thread.
+ */
+static struct GSD_Worker *worker;
+
 /**
  * Linked list of space reservations made by clients.
  */
@@ -181,6 +216,28 @@ static unsigned long long payload;
  */
 static struct GNUNET_SCHEDULER_Task * expired_kill_task;
 
+/**
+ * Task that periodically writes changes to the bloomfilter to disk.
+ */
+static struct GNUNET_SCHEDULER_Task *bf_sync_task;
+
+/**
+ * Number of bytes we still want to discard to get our cache
+ * space back.
+ */
+static unsigned long long space_needed;
+
+/**
+ * Task that discards the next item to get our cache space back.
+ */
+static struct GNUNET_SCHEDULER_Task *purge_task;
+
+/**
+ * #GNUNET_YES while we wait for the database to give us the next
+ * item to discard.
+ */
+static int purge_pending;
+
 /**
  * Minimum time that content should have to not be discarded instantly
  * (time stamp of any content that we've been discarding recently to
@@ -217,6 +274,188 @@ static unsigned int last_sync;
 static int stats_worked;
 
 
+/**
+ * A PUT that was accepted but not yet written to the database.
+ */
+struct PendingPut
+{
+
+  /**
+   * This is a doubly-linked list (in order of insertion).
+   */
+  struct PendingPut *next;
+
+  /**
+   * This is a doubly-linked list (in order of insertion).
+   */
+  struct PendingPut *prev;
+
+  /**
+   * Unique identifier we use for the item while it is in the
+   * memtable (at least #MEMTABLE_UID_BASE).
+   */
+  uint64_t uid;
+
+  /**
+   * Number of flushes that failed to write the item to the
+   * database.
+   */
+  unsigned int failures;
+
+  /**
+   * #GNUNET_YES while the item is on the flush list.  It stays in
+   * the #memtable map until the flush was committed.
+   */
+  int in_flush;
+
+#if ! HAVE_UNALIGNED_64_ACCESS
+  void *reserved;
+#endif
+
+  /* followed by the 'struct DataMessage' */
+};
+
+
+/**
+ * Memtable mapping keys to `struct PendingPut` entries (in the
+ * memtable or in the running flush), NULL if PUTs go straight to
+ * the database.
+ */
+static struct GNUNET_CONTAINER_MultiHashMap *memtable;
+
+/**
+ * Head of the list of items in the memtable.
+ */
+static struct PendingPut *pp_head;
+
+/**
+ * Tail of the list of items in the memtable.
+ */
+static struct PendingPut *pp_tail;
+
+/**
+ * Next unique identifier for an item in the memtable.
+ */
+static uint64_t memtable_uid_gen = MEMTABLE_UID_BASE;
+
+/**
+ * Number of bytes (including #GNUNET_DATASTORE_ENTRY_OVERHEAD per
+ * item) at which we write the memtable to the database.
+ */
+static unsigned long long memtable_size;
+
+/**
+ * Number of bytes (including #GNUNET_DATASTORE_ENTRY_OVERHEAD per
+ * item) currently in the memtable.
+ */
+static unsigned long long memtable_bytes;
+
+/**
+ * Head of the list of items that the current flush is writing to
+ * the database.  They stay here (and in the journal) until the
+ * flush was committed.
+ */
+static struct PendingPut *flush_head;
+
+/**
+ * Tail of the list of items that the current flush is writing to
+ * the database.
+ */
+static struct PendingPut *flush_tail;
+
+/**
+ * Task that writes the memtable to the database.
+ */
+static struct GNUNET_SCHEDULER_Task *flush_task;
+
+/**
+ * Number of database PUTs of the current flush that did not yet
+ * complete (plus one while we are still issuing them).
+ */
+static unsigned int flush_pending;
+
+/**
+ * #GNUNET_YES if another flush was requested while one was
+ * still running.
+ */
+static int flush_again;
+
+/**
+ * #GNUNET_YES if the current flush runs in a plugin transaction.
+ */
+static int flush_in_transaction;
+
+/**
+ * Number of flushes we started.
+ */
+static unsigned int flushes_started;
+
+/**
+ * Number of flushes that completed (committed or failed).
+ */
+static unsigned int flushes_completed;
+
+
+/**
+ * A GET or REMOVE request that has to wait until the items that
+ * were in the memtable when it arrived were written to the database.
+ */
+struct DeferredRequest
+{
+
+  /**
+   * This is a doubly-linked list (in order of arrival).
+   */
+  struct DeferredRequest *next;
+
+  /**
+   * This is a doubly-linked list (in order of arrival).
+   */
+  struct DeferredRequest *prev;
+
+  /**
+   * Client that made the request.
+   */
+  struct GNUNET_SERVER_Client *client;
+
+  /**
+   * We run the request once this many flushes completed.
+   */
+  unsigned int flush_gen;
+
+  /* followed by the request message */
+};
+
+
+/**
+ * Head of the list of requests waiting for a flush.
+ */
+static struct DeferredRequest *deferred_head;
+
+/**
+ * Tail of the list of requests waiting for a flush.
+ */
+static struct DeferredRequest *deferred_tail;
+
+/**
+ * Name of the journal with the PUTs in the memtable, NULL if we
+ * do not keep one.
+ */
+static char *journal_name;
+
+/**
+ * Handle of the journal, NULL if we do not keep one or writing to
+ * it failed.
+ */
+static struct GNUNET_DISK_FileHandle *journal_fh;
+
+/**
+ * Number of PUTs from the journal that we are still processing
+ * after a restart (plus one while we are reading the journal).
+ */
+static unsigned int replay_pending;
+
+
 /**
  * Synchronize our utilization statistics with the
  * statistics service.
@@ -236,6 +475,19 @@ sync_stats ()
 }
 
 
+/**
+ * Function called once a reply was handed to the client's
+ * connection (or transmission failed).
+ *
+ * @param cls closure
+ * @param success #GNUNET_OK if the reply was transmitted,
+ *        #GNUNET_SYSERR on failure
+ */
+typedef void
+(*TransmitContinuation) (void *cls,
+                         int success);
+
+
 /**
  * Context for transmitting replies to clients.
  */
@@ -267,6 +519,17 @@ struct TransmitCallbackContext
    */
   struct GNUNET_SERVER_Client *client;
 
+  /**
+   * Function to call after transmission, NULL if this is the
+   * last reply to the client's request.
+   */
+  TransmitContinuation cont;
+
+  /**
+   * Closure for @e cont.
+   */
+  void *cont_cls;
+
 };
 
 
@@ -398,6 +661,17 @@ delete_expired (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
 }
 
 
+/**
+ * Discard the next item to get our cache space back.
+ *
+ * @param cls NULL
+ * @param tc task context
+ */
+static void
+purge_next (void *cls,
+            const struct GNUNET_SCHEDULER_TaskContext *tc);
+
+
 /**
  * An iterator over a set of items stored in the datastore
  * that deletes until we're happy with respect to our quota.
@@ -423,10 +697,13 @@ quota_processor (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
                  uint32_t priority, uint32_t anonymity,
                  struct GNUNET_TIME_Absolute expiration, uint64_t uid)
 {
-  unsigned long long *need = cls;
-
+  purge_pending = GNUNET_NO;
   if (NULL == key)
+  {
+    /* nothing left to discard */
+    space_needed = 0;
     return GNUNET_SYSERR;
+  }
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "Deleting %llu bytes of low-priority (%u) content `%s' of type %u at %s prior to expiration (still trying to free another %llu bytes)\n",
               (unsigned long long) (size + GNUNET_DATASTORE_ENTRY_OVERHEAD),
@@ -434,11 +711,11 @@ quota_processor (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
               GNUNET_h2s (key), type,
 	      GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_remaining (expiration),
 						      GNUNET_YES),
-	      *need);
-  if (size + GNUNET_DATASTORE_ENTRY_OVERHEAD > *need)
-    *need = 0;
+	      space_needed);
+  if (size + GNUNET_DATASTORE_ENTRY_OVERHEAD > space_needed)
+    space_needed = 0;
   else
-    *need -= size + GNUNET_DATASTORE_ENTRY_OVERHEAD;
+    space_needed -= size + GNUNET_DATASTORE_ENTRY_OVERHEAD;
   if (priority > 0)
     min_expiration = GNUNET_TIME_UNIT_FOREVER_ABS;
   else
@@ -447,6 +724,10 @@ quota_processor (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
                             gettext_noop ("# bytes purged (low-priority)"),
                             size, GNUNET_YES);
   GNUNET_CONTAINER_bloomfilter_remove (filter, key);
+  /* the plugin deletes the item once we return */
+  if ( (space_needed > 0) &&
+       (NULL == purge_task) )
+    purge_task = GNUNET_SCHEDULER_add_now (&purge_next, NULL);
   return GNUNET_NO;
 }
 
@@ -466,16 +747,31 @@ quota_processor (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
 static void
 manage_space (unsigned long long need)
 {
-  unsigned long long last;
-
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "Asked to free up %llu bytes of cache space\n", need);
-  last = 0;
-  while ((need > 0) && (last != need))
-  {
-    last = need;
-    plugin->api->get_expiration (plugin->api->cls, &quota_processor, &need);
-  }
+  space_needed += need;
+  if ( (GNUNET_NO == purge_pending) &&
+       (NULL == purge_task) )
+    purge_next (NULL, NULL);
+}
+
+
+/**
+ * Discard the next item to get our cache space back.
+ *
+ * @param cls NULL
+ * @param tc task context
+ */
+static void
+purge_next (void *cls,
+            const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  purge_task = NULL;
+  if ( (0 == space_needed) ||
+       (GNUNET_YES == purge_pending) )
+    return;
+  purge_pending = GNUNET_YES;
+  plugin->api->get_expiration (plugin->api->cls, &quota_processor, NULL);
 }
 
 
@@ -494,6 +790,8 @@ static size_t
 transmit_callback (void *cls, size_t size, void *buf)
 {
   struct TransmitCallbackContext *tcc = cls;
+  TransmitContinuation cont = tcc->cont;
+  void *cont_cls = tcc->cont_cls;
   size_t msize;
 
   tcc->th = NULL;
@@ -507,26 +805,39 @@ transmit_callback (void *cls, size_t size, void *buf)
     GNUNET_SERVER_client_drop (tcc->client);
     GNUNET_free (tcc->msg);
     GNUNET_free (tcc);
+    if (NULL != cont)
+      cont (cont_cls, GNUNET_SYSERR);
     return 0;
   }
   GNUNET_assert (size >= msize);
   memcpy (buf, tcc->msg, msize);
-  GNUNET_SERVER_receive_done (tcc->client, GNUNET_OK);
+  if (NULL == cont)
+    GNUNET_SERVER_receive_done (tcc->client, GNUNET_OK);
   GNUNET_SERVER_client_drop (tcc->client);
   GNUNET_free (tcc->msg);
   GNUNET_free (tcc);
+  if (NULL != cont)
+    cont (cont_cls, GNUNET_OK);
   return msize;
 }
 
 
 /**
- * Transmit the given message to the client.
+ * Transmit the given message to the client.  If @a cont is
+ * given, more replies are to follow and @a cont is called once
+ * the message was transmitted; otherwise this is the last reply
+ * and the client may send its next request afterwards.
  *
  * @param client target of the message
  * @param msg message to transmit, will be freed!
+ * @param cont function to call after transmission, can be NULL
+ * @param cont_cls closure for @a cont
  */
 static void
-transmit (struct GNUNET_SERVER_Client *client, struct GNUNET_MessageHeader *msg)
+transmit_more (struct GNUNET_SERVER_Client *client,
+               struct GNUNET_MessageHeader *msg,
+               TransmitContinuation cont,
+               void *cont_cls)
 {
   struct TransmitCallbackContext *tcc;
 
@@ -536,11 +847,15 @@ transmit (struct GNUNET_SERVER_Client *client, struct GNUNET_MessageHeader *msg)
                 _("Shutdown in progress, aborting transmission.\n"));
     GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
     GNUNET_free (msg);
+    if (NULL != cont)
+      cont (cont_cls, GNUNET_SYSERR);
     return;
   }
   tcc = GNUNET_new (struct TransmitCallbackContext);
   tcc->msg = msg;
   tcc->client = client;
+  tcc->cont = cont;
+  tcc->cont_cls = cont_cls;
   if (NULL ==
       (tcc->th =
        GNUNET_SERVER_notify_transmit_ready (client, ntohs (msg->size),
@@ -551,6 +866,8 @@ transmit (struct GNUNET_SERVER_Client *client, struct GNUNET_MessageHeader *msg)
     GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
     GNUNET_free (msg);
     GNUNET_free (tcc);
+    if (NULL != cont)
+      cont (cont_cls, GNUNET_SYSERR);
     return;
   }
   GNUNET_SERVER_client_keep (client);
@@ -558,6 +875,20 @@ transmit (struct GNUNET_SERVER_Client *client, struct GNUNET_MessageHeader *msg)
 }
 
 
+/**
+ * Transmit the given message to the client as the (last)
+ * reply to its request.
+ *
+ * @param client target of the message
+ * @param msg message to transmit, will be freed!
+ */
+static void
+transmit (struct GNUNET_SERVER_Client *client, struct GNUNET_MessageHeader *msg)
+{
+  transmit_more (client, msg, NULL, NULL);
+}
+
+
 /**
  * Transmit a status code to the client.
  *
@@ -587,10 +918,8 @@ transmit_status (struct GNUNET_SERVER_Client *client, int code, const char *msg)
 
 
 /**
- * Function that will transmit the given datastore entry
- * to the client.
+ * Build a DATA message for the given datastore entry.
  *
- * @param cls closure, pointer to the client (of type GNUNET_SERVER_Client).
  * @param key key for the content
  * @param size number of bytes in data
  * @param data content stored
@@ -600,32 +929,16 @@ transmit_status (struct GNUNET_SERVER_Client *client, int code, const char *msg)
  * @param expiration expiration time for the content
  * @param uid unique identifier for the datum;
  *        maybe 0 if no unique identifier is available
- *
- * @return GNUNET_SYSERR to abort the iteration, GNUNET_OK to continue,
- *         GNUNET_NO to delete the item and continue (if supported)
+ * @return the message, to be freed by the caller
  */
-static int
-transmit_item (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
-               const void *data, enum GNUNET_BLOCK_Type type, uint32_t priority,
-               uint32_t anonymity, struct GNUNET_TIME_Absolute expiration,
-               uint64_t uid)
+static struct DataMessage *
+make_data_message (const struct GNUNET_HashCode *key, uint32_t size,
+                   const void *data, enum GNUNET_BLOCK_Type type,
+                   uint32_t priority, uint32_t anonymity,
+                   struct GNUNET_TIME_Absolute expiration, uint64_t uid)
 {
-  struct GNUNET_SERVER_Client *client = cls;
-  struct GNUNET_MessageHeader *end;
   struct DataMessage *dm;
 
-  if (key == NULL)
-  {
-    /* transmit 'DATA_END' */
-    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG, "Transmitting `%s' message\n",
-                "DATA_END");
-    end = GNUNET_new (struct GNUNET_MessageHeader);
-    end->size = htons (sizeof (struct GNUNET_MessageHeader));
-    end->type = htons (GNUNET_MESSAGE_TYPE_DATASTORE_DATA_END);
-    transmit (client, end);
-    GNUNET_SERVER_client_drop (client);
-    return GNUNET_OK;
-  }
   GNUNET_assert (sizeof (struct DataMessage) + size <
                  GNUNET_SERVER_MAX_MESSAGE_SIZE);
   dm = GNUNET_malloc (sizeof (struct DataMessage) + size);
@@ -652,6 +965,52 @@ transmit_item (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
                             gettext_noop ("# results found"),
                             1,
                             GNUNET_NO);
+  return dm;
+}
+
+
+/**
+ * Function that will transmit the given datastore entry
+ * to the client.
+ *
+ * @param cls closure, pointer to the client (of type GNUNET_SERVER_Client).
+ * @param key key for the content
+ * @param size number of bytes in data
+ * @param data content stored
+ * @param type type of the content
+ * @param priority priority of the content
+ * @param anonymity anonymity-level for the content
+ * @param expiration expiration time for the content
+ * @param uid unique identifier for the datum;
+ *        maybe 0 if no unique identifier is available
+ *
+ * @return GNUNET_SYSERR to abort the iteration, GNUNET_OK to continue,
+ *         GNUNET_NO to delete the item and continue (if supported)
+ */
+static int
+transmit_item (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
+               const void *data, enum GNUNET_BLOCK_Type type, uint32_t priority,
+               uint32_t anonymity, struct GNUNET_TIME_Absolute expiration,
+               uint64_t uid)
+{
+  struct GNUNET_SERVER_Client *client = cls;
+  struct GNUNET_MessageHeader *end;
+  struct DataMessage *dm;
+
+  if (key == NULL)
+  {
+    /* transmit 'DATA_END' */
+    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG, "Transmitting `%s' message\n",
+                "DATA_END");
+    end = GNUNET_new (struct GNUNET_MessageHeader);
+    end->size = htons (sizeof (struct GNUNET_MessageHeader));
+    end->type = htons (GNUNET_MESSAGE_TYPE_DATASTORE_DATA_END);
+    transmit (client, end);
+    GNUNET_SERVER_client_drop (client);
+    return GNUNET_OK;
+  }
+  dm = make_data_message (key, size, data, type, priority, anonymity,
+                          expiration, uid);
   transmit (client, &dm->header);
   GNUNET_SERVER_client_drop (client);
   return GNUNET_OK;
@@ -684,7 +1043,7 @@ handle_reserve (void *cls, struct GNUNET_SERVER_Client *client,
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG, "Processing `%s' request\n", "RESERVE");
   amount = GNUNET_ntohll (msg->amount);
   entries = ntohl (msg->entries);
-  used = payload + reserved;
+  used = payload + reserved + memtable_bytes;
   req =
       amount + ((unsigned long long) GNUNET_DATASTORE_ENTRY_OVERHEAD) * entries;
   if (used + req > quota)
@@ -823,6 +1182,105 @@ check_data (const struct GNUNET_MessageHeader *message)
 }
 
 
+struct PutContext;
+
+
+/**
+ * A batch of PUT requests announced by a PUT_MULTIPLE message.
+ * The PUTs are buffered until all of them arrived, so that the
+ * plugin transaction is never open while we wait for the client.
+ */
+struct PutBatch
+{
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct PutBatch *next;
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct PutBatch *prev;
+
+  /**
+   * Client that announced the batch, NULL if the client
+   * disconnected while PUTs of the batch were still pending.
+   */
+  struct GNUNET_SERVER_Client *client;
+
+  /**
+   * The buffered PUTs of the batch, array of length @e count.
+   */
+  struct PutContext **puts;
+
+  /**
+   * Status code for each PUT of the batch.
+   */
+  int32_t *status;
+
+  /**
+   * First error message of the batch, NULL for none.
+   */
+  char *emsg;
+
+  /**
+   * Number of PUTs in the batch.
+   */
+  unsigned int count;
+
+  /**
+   * Number of PUTs of the batch received so far.
+   */
+  unsigned int received;
+
+  /**
+   * Number of PUTs of the batch completed so far.
+   */
+  unsigned int done;
+
+  /**
+   * #GNUNET_YES if we started a plugin transaction for the batch.
+   */
+  int in_transaction;
+
+};
+
+
+/**
+ * Head of the list of PUT batches we are receiving.
+ */
+static struct PutBatch *batch_head;
+
+/**
+ * Tail of the list of PUT batches we are receiving.
+ */
+static struct PutBatch *batch_tail;
+
+/**
+ * Head of the list of complete PUT batches waiting for
+ * @e active_batch to finish.
+ */
+static struct PutBatch *ready_head;
+
+/**
+ * Tail of the list of complete PUT batches waiting for
+ * @e active_batch to finish.
+ */
+static struct PutBatch *ready_tail;
+
+/**
+ * PUT batch we are storing, NULL for none.  Only one batch
+ * is stored at a time as it may use a plugin transaction.
+ */
+static struct PutBatch *active_batch;
+
+/**
+ * Task that starts storing the next complete batch.
+ */
+static struct GNUNET_SCHEDULER_Task *batch_task;
+
+
 /**
  * Context for a PUT request used to see if the content is
  * already present.
@@ -834,6 +1292,16 @@ struct PutContext
    */
   struct GNUNET_SERVER_Client *client;
 
+  /**
+   * Batch this PUT belongs to, NULL for none.
+   */
+  struct PutBatch *batch;
+
+  /**
+   * Index of this PUT in @e batch.
+   */
+  uint32_t index;
+
 #if ! HAVE_UNALIGNED_64_ACCESS
   void *reserved;
 #endif
@@ -842,6 +1310,309 @@ struct PutContext
 };
 
 
+/**
+ * Find the PUT batch of the given client in a list.
+ *
+ * @param head head of the list to search
+ * @param client client to look for
+ * @return NULL if the client has no batch in the list
+ */
+static struct PutBatch *
+find_batch_in (struct PutBatch *head,
+               struct GNUNET_SERVER_Client *client)
+{
+  struct PutBatch *batch;
+
+  for (batch = head; NULL != batch; batch = batch->next)
+    if (batch->client == client)
+      return batch;
+  return NULL;
+}
+
+
+/**
+ * Find the PUT batch of the given client that we are receiving.
+ *
+ * @param client client to look for
+ * @return NULL if the client has no open batch
+ */
+static struct PutBatch *
+find_batch (struct GNUNET_SERVER_Client *client)
+{
+  return find_batch_in (batch_head, client);
+}
+
+
+/**
+ * Commit the current plugin transaction.  If the plugin runs on a
+ * worker thread, we do not wait for the commit.
+ *
+ * @param cont function to call once the transaction was committed,
+ *        can be NULL
+ * @param cont_cls closure for @a cont
+ */
+static void
+end_batch (GSD_BatchContinuation cont,
+           void *cont_cls)
+{
+  int ret;
+
+  if (NULL != worker)
+  {
+    GSD_worker_end_batch_ (worker, cont, cont_cls);
+    return;
+  }
+  ret = plugin->api->end_batch (plugin->api->cls);
+  if (NULL != cont)
+    cont (cont_cls, ret);
+}
+
+
+/**
+ * Commit the plugin transaction of a batch (if any) and free it.
+ *
+ * @param batch batch to free, must no longer be in the list
+ */
+static void
+free_batch (struct PutBatch *batch)
+{
+  if ( (GNUNET_YES == batch->in_transaction) &&
+       (NULL != plugin) )
+    end_batch (NULL, NULL);
+  GNUNET_free_non_null (batch->emsg);
+  GNUNET_free (batch->puts);
+  GNUNET_free (batch->status);
+  GNUNET_free (batch);
+}
+
+
+/**
+ * Free a batch whose PUTs were not started yet.
+ *
+ * @param batch batch to free, must no longer be in a list
+ */
+static void
+discard_batch (struct PutBatch *batch)
+{
+  unsigned int i;
+
+  for (i = 0; i < batch->received; i++)
+  {
+    GNUNET_SERVER_client_drop (batch->puts[i]->client);
+    GNUNET_free (batch->puts[i]);
+  }
+  free_batch (batch);
+}
+
+
+/**
+ * Store a PUT unless the same content is already present.
+ *
+ * @param pc put context
+ */
+static void
+start_put (struct PutContext *pc);
+
+
+/**
+ * Start storing the next complete batch, unless we are
+ * still storing one.
+ *
+ * @param cls NULL
+ * @param tc scheduler context
+ */
+static void
+run_next_batch (void *cls,
+                const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct PutBatch *batch;
+  unsigned int count;
+  unsigned int i;
+
+  batch_task = NULL;
+  if ( (NULL != active_batch) ||
+       (NULL == (batch = ready_head)) ||
+       (NULL == plugin) )
+    return;
+  GNUNET_CONTAINER_DLL_remove (ready_head, ready_tail, batch);
+  active_batch = batch;
+  /* with a memtable, the flush writes the items in one transaction */
+  if ( (NULL == memtable) &&
+       (NULL != plugin->api->begin_batch) &&
+       (GNUNET_OK == plugin->api->begin_batch (plugin->api->cls)) )
+    batch->in_transaction = GNUNET_YES;
+  /* the batch may be freed once the last PUT completed */
+  count = batch->count;
+  for (i = 0; i < count; i++)
+    start_put (batch->puts[i]);
+}
+
+
+/**
+ * Store the next complete batch from a task of its own: we may be
+ * called from a callback of the plugin, which must not start the
+ * next transaction right away.
+ */
+static void
+schedule_next_batch ()
+{
+  if (NULL == batch_task)
+    batch_task = GNUNET_SCHEDULER_add_now (&run_next_batch, NULL);
+}
+
+
+/**
+ * The plugin transaction of a completed batch was committed,
+ * transmit the status codes to the client.
+ *
+ * @param cls the `struct PutBatch`
+ * @param success #GNUNET_OK if the commit succeeded
+ */
+static void
+batch_committed (void *cls,
+                 int success)
+{
+  struct PutBatch *batch = cls;
+  struct GNUNET_SERVER_Client *client = batch->client;
+  struct StatusMultipleMessage *sm;
+  int32_t *status;
+  const char *emsg;
+  size_t slen;
+  size_t msize;
+  unsigned int i;
+
+  GNUNET_assert (active_batch == batch);
+  active_batch = NULL;
+  if (NULL == client)
+  {
+    /* client disconnected while we stored the batch */
+    free_batch (batch);
+    schedule_next_batch ();
+    return;
+  }
+  if (GNUNET_OK != success)
+  {
+    for (i = 0; i < batch->count; i++)
+      batch->status[i] = GNUNET_SYSERR;
+    GNUNET_free_non_null (batch->emsg);
+    batch->emsg = GNUNET_strdup (_("Failed to commit batch to database"));
+  }
+  emsg = batch->emsg;
+  slen = (NULL == emsg) ? 0 : strlen (emsg) + 1;
+  msize = sizeof (struct StatusMultipleMessage) +
+    batch->count * sizeof (int32_t) + slen;
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Transmitting `%s' message for %u items and message `%s'\n",
+              "STATUS_MULTIPLE", batch->count,
+              (NULL != emsg) ? emsg : "(none)");
+  sm = GNUNET_malloc (msize);
+  sm->header.size = htons (msize);
+  sm->header.type = htons (GNUNET_MESSAGE_TYPE_DATASTORE_STATUS_MULTIPLE);
+  sm->count = htonl (batch->count);
+  sm->min_expiration = GNUNET_TIME_absolute_hton (min_expiration);
+  status = (int32_t *) &sm[1];
+  for (i = 0; i < batch->count; i++)
+    status[i] = htonl (batch->status[i]);
+  if (slen > 0)
+    memcpy (&status[batch->count], emsg, slen);
+  free_batch (batch);
+  transmit (client, &sm->header);
+  GNUNET_SERVER_client_drop (client);
+  schedule_next_batch ();
+}
+
+
+/**
+ * All PUTs of a batch are done, commit and transmit the status
+ * codes to the client.
+ *
+ * @param batch the completed batch
+ */
+static void
+finish_batch (struct PutBatch *batch)
+{
+  if (NULL != batch->client)
+    GNUNET_SERVER_client_keep (batch->client);
+  if (GNUNET_YES != batch->in_transaction)
+  {
+    batch_committed (batch, GNUNET_OK);
+    return;
+  }
+  batch->in_transaction = GNUNET_NO;
+  end_batch (&batch_committed, batch);
+}
+
+
+/**
+ * All PUTs from the journal were processed after a restart.
+ */
+static void
+replay_done (void);
+
+
+/**
+ * A PUT is done, report the result to the client (or record it
+ * in the PUT's batch) and free the PUT context.
+ *
+ * @param pc put context
+ * @param status status code for the client
+ * @param msg error message, can be NULL
+ */
+static void
+put_done (struct PutContext *pc,
+          int status,
+          const char *msg)
+{
+  struct PutBatch *batch = pc->batch;
+
+  if (NULL == pc->client)
+  {
+    /* PUT from the journal */
+    GNUNET_free (pc);
+    if (0 == --replay_pending)
+      replay_done ();
+    return;
+  }
+  if (NULL == batch)
+  {
+    transmit_status (pc->client, status, msg);
+  }
+  else
+  {
+    batch->status[pc->index] = status;
+    if ( (NULL != msg) &&
+         (NULL == batch->emsg) )
+      batch->emsg = GNUNET_strdup (msg);
+    batch->done++;
+    if (batch->done == batch->count)
+      finish_batch (batch);
+  }
+  GNUNET_SERVER_client_drop (pc->client);
+  GNUNET_free (pc);
+}
+
+
+/**
+ * Discard low-priority content if the database grew beyond the
+ * space we may use for it after storing an item.
+ *
+ * @param size size of the item that was stored
+ */
+static void
+check_quota (uint32_t size)
+{
+  if (quota - reserved - cache_size < payload)
+  {
+    GNUNET_log (GNUNET_ERROR_TYPE_INFO,
+                _("Need %llu bytes more space (%llu allowed, using %llu)\n"),
+                (unsigned long long) size + GNUNET_DATASTORE_ENTRY_OVERHEAD,
+                (unsigned long long) (quota - reserved - cache_size),
+                (unsigned long long) payload);
+    manage_space (size + GNUNET_DATASTORE_ENTRY_OVERHEAD);
+  }
+}
+
+
 /**
  * Put continuation.
  *
@@ -871,241 +1642,1478 @@ put_continuation (void *cls,
                 "Successfully stored %u bytes under key `%s'\n",
                 size, GNUNET_h2s (key));
   }
-  transmit_status (pc->client, status, msg);
-  GNUNET_SERVER_client_drop (pc->client);
-  GNUNET_free (pc);
-  if (quota - reserved - cache_size < payload)
-  {
-    GNUNET_log (GNUNET_ERROR_TYPE_INFO,
-                _("Need %llu bytes more space (%llu allowed, using %llu)\n"),
-                (unsigned long long) size + GNUNET_DATASTORE_ENTRY_OVERHEAD,
-                (unsigned long long) (quota - reserved - cache_size),
-                (unsigned long long) payload);
-    manage_space (size + GNUNET_DATASTORE_ENTRY_OVERHEAD);
-  }
+  put_done (pc, status, msg);
+  check_quota (size);
 }
 
 
 /**
- * Actually put the data message.
+ * Append a PUT to the journal.
  *
- * @param pc put context
+ * @param dm the PUT
  */
 static void
-execute_put (struct PutContext *pc)
+journal_append (const struct DataMessage *dm)
 {
-  const struct DataMessage *dm;
+  size_t msize;
 
-  dm = (const struct DataMessage *) &pc[1];
-  plugin->api->put (plugin->api->cls, &dm->key, ntohl (dm->size), &dm[1],
-                    ntohl (dm->type), ntohl (dm->priority),
-                    ntohl (dm->anonymity), ntohl (dm->replication),
-                    GNUNET_TIME_absolute_ntoh (dm->expiration),
-                    &put_continuation, pc);
+  if (NULL == journal_fh)
+    return;
+  msize = ntohs (dm->header.size);
+  if (msize == GNUNET_DISK_file_write (journal_fh, dm, msize))
+    return;
+  /* continue without journal until the next flush */
+  GNUNET_log_strerror_file (GNUNET_ERROR_TYPE_WARNING,
+                            "write",
+                            journal_name);
+  GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (journal_fh));
+  journal_fh = NULL;
 }
 
 
+/**
+ * Replace the journal with one that only contains the items that
+ * are (still) in the memtable or not yet committed by a flush.  The
+ * new journal is written to a temporary file first so that we never
+ * lose accepted PUTs.
+ */
 static void
-check_present_continuation (void *cls,
-			    int status,
-			    const char *msg)
+rewrite_journal ()
 {
-  struct GNUNET_SERVER_Client *client = cls;
+  struct PendingPut *pp;
+  char *tmp;
 
-  transmit_status (client, GNUNET_NO, NULL);
-  GNUNET_SERVER_client_drop (client);
+  if ( (NULL == journal_name) ||
+       (0 != replay_pending) )
+    return;
+  if (NULL != journal_fh)
+  {
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (journal_fh));
+    journal_fh = NULL;
+  }
+  if ( (NULL == pp_head) &&
+       (NULL == flush_head) )
+  {
+    /* common case: everything is in the database */
+    journal_fh = GNUNET_DISK_file_open (journal_name,
+                                        GNUNET_DISK_OPEN_WRITE |
+                                        GNUNET_DISK_OPEN_CREATE |
+                                        GNUNET_DISK_OPEN_TRUNCATE,
+                                        GNUNET_DISK_PERM_USER_READ |
+                                        GNUNET_DISK_PERM_USER_WRITE);
+    if (NULL == journal_fh)
+      GNUNET_log_strerror_file (GNUNET_ERROR_TYPE_WARNING,
+                                "open",
+                                journal_name);
+    return;
+  }
+  GNUNET_asprintf (&tmp,
+                   "%s.tmp",
+                   journal_name);
+  journal_fh = GNUNET_DISK_file_open (tmp,
+                                      GNUNET_DISK_OPEN_WRITE |
+                                      GNUNET_DISK_OPEN_CREATE |
+                                      GNUNET_DISK_OPEN_TRUNCATE,
+                                      GNUNET_DISK_PERM_USER_READ |
+                                      GNUNET_DISK_PERM_USER_WRITE);
+  if (NULL == journal_fh)
+    GNUNET_log_strerror_file (GNUNET_ERROR_TYPE_WARNING,
+                              "open",
+                              tmp);
+  for (pp = flush_head; NULL != pp; pp = pp->next)
+    journal_append ((const struct DataMessage *) &pp[1]);
+  for (pp = pp_head; NULL != pp; pp = pp->next)
+    journal_append ((const struct DataMessage *) &pp[1]);
+  if ( (NULL != journal_fh) &&
+       (0 != RENAME (tmp, journal_name)) )
+  {
+    GNUNET_log_strerror_file (GNUNET_ERROR_TYPE_WARNING,
+                              "rename",
+                              journal_name);
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (journal_fh));
+    journal_fh = NULL;
+  }
+  GNUNET_free (tmp);
 }
 
 
 /**
- * Function that will check if the given datastore entry
- * matches the put and if none match executes the put.
+ * Add an item to the list of items in the memtable.
  *
- * @param cls closure, pointer to the client (of type `struct PutContext`).
- * @param key key for the content
- * @param size number of bytes in data
- * @param data content stored
- * @param type type of the content
+ * @param pp item to add, must already be in the #memtable map
+ */
+static void
+memtable_link (struct PendingPut *pp)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  GNUNET_CONTAINER_DLL_insert_tail (pp_head, pp_tail, pp);
+  memtable_bytes += ntohl (dm->size) + GNUNET_DATASTORE_ENTRY_OVERHEAD;
+  GNUNET_STATISTICS_set (stats,
+                         gettext_noop ("# bytes in memtable"),
+                         memtable_bytes,
+                         GNUNET_NO);
+}
+
+
+/**
+ * Remove an item from the list of items in the memtable (it stays
+ * in the #memtable map).
+ *
+ * @param pp item to remove
+ */
+static void
+memtable_unlink (struct PendingPut *pp)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  GNUNET_CONTAINER_DLL_remove (pp_head, pp_tail, pp);
+  memtable_bytes -= ntohl (dm->size) + GNUNET_DATASTORE_ENTRY_OVERHEAD;
+  GNUNET_STATISTICS_set (stats,
+                         gettext_noop ("# bytes in memtable"),
+                         memtable_bytes,
+                         GNUNET_NO);
+}
+
+
+/**
+ * Remove a buffered item from the #memtable map.
+ *
+ * @param pp item to remove
+ */
+static void
+memtable_unmap (struct PendingPut *pp)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  GNUNET_assert (GNUNET_YES ==
+                 GNUNET_CONTAINER_multihashmap_remove (memtable,
+                                                       &dm->key,
+                                                       pp));
+}
+
+
+/**
+ * Add an item to the memtable.
+ *
+ * @param pp item to add
+ */
+static void
+memtable_insert (struct PendingPut *pp)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  GNUNET_CONTAINER_multihashmap_put (memtable,
+                                     &dm->key,
+                                     pp,
+                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE);
+  memtable_link (pp);
+}
+
+
+/**
+ * Remove an item from the memtable (without freeing it).
+ *
+ * @param pp item to remove
+ */
+static void
+memtable_remove (struct PendingPut *pp)
+{
+  memtable_unlink (pp);
+  memtable_unmap (pp);
+}
+
+
+/**
+ * Writing an item of the current flush to the database failed.
+ * Put it back into the memtable (it is still in the journal) so
+ * that the next flush retries it, unless we tried too often.
+ *
+ * @param pp item that was not written
+ */
+static void
+requeue_item (struct PendingPut *pp)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  GNUNET_CONTAINER_DLL_remove (flush_head, flush_tail, pp);
+  pp->in_flush = GNUNET_NO;
+  if (++pp->failures < MAX_FLUSH_ATTEMPTS)
+  {
+    memtable_link (pp);
+    return;
+  }
+  memtable_unmap (pp);
+  /* the client was already told that the PUT succeeded */
+  GNUNET_log (GNUNET_ERROR_TYPE_ERROR,
+              _("Giving up on storing buffered item under key `%s'\n"),
+              GNUNET_h2s (&dm->key));
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# buffered items lost"),
+                            1,
+                            GNUNET_NO);
+  GNUNET_free (pp);
+}
+
+
+/**
+ * Write the memtable to the database.
+ */
+static void
+memtable_flush (void);
+
+
+/**
+ * Make sure the memtable is written to the database eventually.
+ *
+ * @param now #GNUNET_YES to write it as soon as possible
+ */
+static void
+schedule_flush (int now);
+
+
+/**
+ * Run the requests that were waiting for the flushes that
+ * completed so far.
+ */
+static void
+run_deferred (void);
+
+
+/**
+ * The plugin transaction of a flush was committed (or failed to
+ * commit).  On success, forget about the items of the flush and
+ * rewrite the journal; otherwise, put them back into the memtable.
+ *
+ * @param cls NULL
+ * @param success #GNUNET_OK if the commit succeeded
+ */
+static void
+flush_committed (void *cls,
+                 int success)
+{
+  struct PendingPut *pp;
+
+  flush_pending = 0;
+  if (GNUNET_OK != success)
+  {
+    GNUNET_log (GNUNET_ERROR_TYPE_ERROR,
+                _("Failed to commit buffered items to database\n"));
+    while (NULL != flush_head)
+      requeue_item (flush_head);
+  }
+  else
+  {
+    while (NULL != (pp = flush_head))
+    {
+      GNUNET_CONTAINER_DLL_remove (flush_head, flush_tail, pp);
+      memtable_unmap (pp);
+      GNUNET_free (pp);
+    }
+    rewrite_journal ();
+  }
+  flushes_completed++;
+  run_deferred ();
+  if (GNUNET_YES == flush_again)
+  {
+    flush_again = GNUNET_NO;
+    memtable_flush ();
+  }
+  else if (NULL != pp_head)
+  {
+    schedule_flush (GNUNET_NO);
+  }
+}
+
+
+/**
+ * One database PUT of a flush completed (or we are done issuing
+ * them).  Once all completed, commit and rewrite the journal.
+ */
+static void
+flush_done ()
+{
+  if (0 != --flush_pending)
+    return;
+  /* the flush is in progress until it was committed */
+  flush_pending = 1;
+  if (GNUNET_YES != flush_in_transaction)
+  {
+    flush_committed (NULL, GNUNET_OK);
+    return;
+  }
+  flush_in_transaction = GNUNET_NO;
+  end_batch (&flush_committed, NULL);
+}
+
+
+/**
+ * Continuation called once an item of the memtable was written
+ * to the database.
+ *
+ * @param cls the `struct PendingPut`
+ * @param key key for the item stored
+ * @param size size of the item stored
+ * @param status #GNUNET_OK or #GNUNET_SYSERROR
+ * @param msg error message on error
+ */
+static void
+flush_continuation (void *cls,
+                    const struct GNUNET_HashCode *key,
+                    uint32_t size,
+                    int status,
+                    const char *msg)
+{
+  struct PendingPut *pp = cls;
+
+  if (GNUNET_OK == status)
+  {
+    GNUNET_STATISTICS_update (stats,
+                              gettext_noop ("# bytes stored"),
+                              size,
+                              GNUNET_YES);
+    GNUNET_CONTAINER_bloomfilter_add (filter, key);
+  }
+  else
+  {
+    GNUNET_log (GNUNET_ERROR_TYPE_WARNING,
+                _("Failed to store buffered item under key `%s': %s\n"),
+                GNUNET_h2s (key),
+                (NULL != msg) ? msg : "");
+    requeue_item (pp);
+  }
+  check_quota (size);
+  flush_done ();
+}
+
+
+/**
+ * Write the memtable to the database, using one plugin transaction
+ * for all items.
+ */
+static void
+memtable_flush ()
+{
+  struct PendingPut *pp;
+  struct PendingPut *next;
+  const struct DataMessage *dm;
+
+  if (NULL != flush_task)
+  {
+    GNUNET_SCHEDULER_cancel (flush_task);
+    flush_task = NULL;
+  }
+  if ( (NULL == pp_head) ||
+       (NULL == plugin) )
+    return;
+  if (0 != flush_pending)
+  {
+    flush_again = GNUNET_YES;
+    return;
+  }
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Writing %llu bytes from memtable to database\n",
+              memtable_bytes);
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# memtable flushes"),
+                            1,
+                            GNUNET_NO);
+  flushes_started++;
+  flush_in_transaction =
+    ( (NULL != plugin->api->begin_batch) &&
+      (GNUNET_OK == plugin->api->begin_batch (plugin->api->cls)) )
+    ? GNUNET_YES : GNUNET_NO;
+  flush_pending = 1;
+  /* failed items go back into the memtable, so move them all first */
+  while (NULL != (pp = pp_head))
+  {
+    memtable_unlink (pp);
+    pp->in_flush = GNUNET_YES;
+    GNUNET_CONTAINER_DLL_insert_tail (flush_head, flush_tail, pp);
+  }
+  for (pp = flush_head; NULL != pp; pp = next)
+  {
+    next = pp->next;
+    dm = (const struct DataMessage *) &pp[1];
+    flush_pending++;
+    plugin->api->put (plugin->api->cls, &dm->key, ntohl (dm->size), &dm[1],
+                      ntohl (dm->type), ntohl (dm->priority),
+                      ntohl (dm->anonymity), ntohl (dm->replication),
+                      GNUNET_TIME_absolute_ntoh (dm->expiration),
+                      &flush_continuation, pp);
+  }
+  flush_done ();
+}
+
+
+/**
+ * Task that writes the memtable to the database.
+ *
+ * @param cls NULL
+ * @param tc task context
+ */
+static void
+memtable_flush_task (void *cls,
+                     const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  flush_task = NULL;
+  memtable_flush ();
+}
+
+
+/**
+ * Make sure the memtable is written to the database eventually.
+ *
+ * @param now #GNUNET_YES to write it as soon as possible
+ */
+static void
+schedule_flush (int now)
+{
+  if (GNUNET_YES == now)
+  {
+    if (NULL != flush_task)
+      GNUNET_SCHEDULER_cancel (flush_task);
+    flush_task = GNUNET_SCHEDULER_add_now (&memtable_flush_task,
+                                           NULL);
+    return;
+  }
+  if (NULL == flush_task)
+    flush_task = GNUNET_SCHEDULER_add_delayed (MEMTABLE_FLUSH_DELAY,
+                                               &memtable_flush_task,
+                                               NULL);
+}
+
+
+/**
+ * All PUTs from the journal were processed after a restart.
+ */
+static void
+replay_done ()
+{
+  if (NULL == pp_head)
+    rewrite_journal ();
+  else
+    schedule_flush (GNUNET_YES);
+}
+
+
+/**
+ * Closure for #find_pending_it().
+ */
+struct FindPendingContext
+{
+  /**
+   * The PUT to look for.
+   */
+  const struct DataMessage *dm;
+
+  /**
+   * Set to the matching item.
+   */
+  struct PendingPut *result;
+};
+
+
+/**
+ * Check if an item in the memtable has the same content as a PUT.
+ *
+ * @param cls the `struct FindPendingContext`
+ * @param key key of the item
+ * @param value the `struct PendingPut`
+ * @return #GNUNET_NO if we found a match, #GNUNET_YES to continue
+ */
+static int
+find_pending_it (void *cls,
+                 const struct GNUNET_HashCode *key,
+                 void *value)
+{
+  struct FindPendingContext *fpc = cls;
+  struct PendingPut *pp = value;
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  /* the flush may already have written the item */
+  if (GNUNET_YES == pp->in_flush)
+    return GNUNET_YES;
+  if ( (dm->type != fpc->dm->type) ||
+       (dm->size != fpc->dm->size) ||
+       (0 != memcmp (&dm[1], &fpc->dm[1], ntohl (dm->size))) )
+    return GNUNET_YES;
+  fpc->result = pp;
+  return GNUNET_NO;
+}
+
+
+/**
+ * Add a PUT to an item with the same content in the memtable (like
+ * the database does for items that are already present).
+ *
+ * @param pc put context
+ * @return #GNUNET_YES if the PUT was merged into an item of the
+ *         memtable, #GNUNET_NO if there is no such item
+ */
+static int
+coalesce_put (struct PutContext *pc)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pc[1];
+  struct FindPendingContext fpc;
+  struct DataMessage *pdm;
+  struct GNUNET_TIME_Absolute expiration;
+
+  fpc.dm = dm;
+  fpc.result = NULL;
+  GNUNET_CONTAINER_multihashmap_get_multiple (memtable,
+                                              &dm->key,
+                                              &find_pending_it,
+                                              &fpc);
+  if (NULL == fpc.result)
+    return GNUNET_NO;
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Result already present in memtable\n");
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# PUT requests merged in memtable"),
+                            1,
+                            GNUNET_NO);
+  pdm = (struct DataMessage *) &fpc.result[1];
+  pdm->priority = htonl (ntohl (pdm->priority) + ntohl (dm->priority));
+  expiration = GNUNET_TIME_absolute_max (GNUNET_TIME_absolute_ntoh (pdm->expiration),
+                                         GNUNET_TIME_absolute_ntoh (dm->expiration));
+  pdm->expiration = GNUNET_TIME_absolute_hton (expiration);
+  /* replaying the PUT merges it again */
+  if (NULL != pc->client)
+    journal_append (dm);
+  put_done (pc, GNUNET_NO, NULL);
+  return GNUNET_YES;
+}
+
+
+/**
+ * Add a PUT to the memtable.
+ *
+ * @param pc put context
+ */
+static void
+buffer_put (struct PutContext *pc)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pc[1];
+  struct PendingPut *pp;
+  uint32_t size;
+
+  size = ntohl (dm->size);
+  pp = GNUNET_malloc (sizeof (struct PendingPut) +
+                      sizeof (struct DataMessage) + size);
+  memcpy (&pp[1], dm, sizeof (struct DataMessage) + size);
+  pp->uid = memtable_uid_gen++;
+  memtable_insert (pp);
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Buffered %u bytes under key `%s'\n",
+              size, GNUNET_h2s (&dm->key));
+  if (NULL != pc->client)
+    journal_append (dm);
+  put_done (pc, GNUNET_OK, NULL);
+  /* the memtable counts against the quota just like the database */
+  schedule_flush ( (memtable_bytes >= memtable_size) ||
+                   (quota - reserved - cache_size < payload + memtable_bytes) );
+}
+
+
+/**
+ * Actually put the data message.
+ *
+ * @param pc put context
+ */
+static void
+execute_put (struct PutContext *pc)
+{
+  const struct DataMessage *dm;
+
+  if (NULL != memtable)
+  {
+    /* the same content may have been buffered while we checked
+       the database */
+    if (GNUNET_YES != coalesce_put (pc))
+      buffer_put (pc);
+    return;
+  }
+  dm = (const struct DataMessage *) &pc[1];
+  plugin->api->put (plugin->api->cls, &dm->key, ntohl (dm->size), &dm[1],
+                    ntohl (dm->type), ntohl (dm->priority),
+                    ntohl (dm->anonymity), ntohl (dm->replication),
+                    GNUNET_TIME_absolute_ntoh (dm->expiration),
+                    &put_continuation, pc);
+}
+
+
+/**
+ * Continuation called after updating an item that was
+ * already present.
+ *
+ * @param cls the `struct PutContext`
+ * @param status #GNUNET_OK or #GNUNET_SYSERR
+ * @param msg error message on error
+ */
+static void
+check_present_continuation (void *cls,
+			    int status,
+			    const char *msg)
+{
+  struct PutContext *pc = cls;
+
+  put_done (pc, GNUNET_NO, NULL);
+}
+
+
+/**
+ * Function that will check if the given datastore entry
+ * matches the put and if none match executes the put.
+ *
+ * @param cls closure, pointer to the client (of type `struct PutContext`).
+ * @param key key for the content
+ * @param size number of bytes in data
+ * @param data content stored
+ * @param type type of the content
+ * @param priority priority of the content
+ * @param anonymity anonymity-level for the content
+ * @param expiration expiration time for the content
+ * @param uid unique identifier for the datum;
+ *        maybe 0 if no unique identifier is available
+ * @return #GNUNET_OK usually
+ *         #GNUNET_NO to delete the item
+ */
+static int
+check_present (void *cls,
+	       const struct GNUNET_HashCode *key,
+	       uint32_t size,
+               const void *data,
+	       enum GNUNET_BLOCK_Type type,
+	       uint32_t priority,
+               uint32_t anonymity,
+	       struct GNUNET_TIME_Absolute expiration,
+               uint64_t uid)
+{
+  struct PutContext *pc = cls;
+  const struct DataMessage *dm;
+
+  dm = (const struct DataMessage *) &pc[1];
+  if (key == NULL)
+  {
+    execute_put (pc);
+    return GNUNET_OK;
+  }
+  if ((GNUNET_BLOCK_TYPE_FS_DBLOCK == type) ||
+      (GNUNET_BLOCK_TYPE_FS_IBLOCK == type) || ((size == ntohl (dm->size)) &&
+                                                (0 ==
+                                                 memcmp (&dm[1], data, size))))
+  {
+    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+                "Result already present in datastore\n");
+    /* FIXME: change API to allow increasing 'replication' counter */
+    if ((ntohl (dm->priority) > 0) ||
+        (GNUNET_TIME_absolute_ntoh (dm->expiration).abs_value_us >
+         expiration.abs_value_us))
+      plugin->api->update (plugin->api->cls,
+			   uid,
+                           (int32_t) ntohl (dm->priority),
+                           GNUNET_TIME_absolute_ntoh (dm->expiration),
+                           &check_present_continuation,
+			   pc);
+    else
+      put_done (pc, GNUNET_NO, NULL);
+  }
+  else
+  {
+    execute_put (pc);
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Store a PUT unless the same content is already present.
+ *
+ * @param pc put context
+ */
+static void
+start_put (struct PutContext *pc)
+{
+  const struct DataMessage *dm = (const struct DataMessage *) &pc[1];
+  struct GNUNET_HashCode vhash;
+
+  if ( (NULL != memtable) &&
+       (GNUNET_YES == coalesce_put (pc)) )
+    return;
+  if (GNUNET_YES == GNUNET_CONTAINER_bloomfilter_test (filter, &dm->key))
+  {
+    GNUNET_CRYPTO_hash (&dm[1], ntohl (dm->size), &vhash);
+    plugin->api->get_key (plugin->api->cls,
+			  0,
+			  &dm->key,
+			  &vhash,
+                          ntohl (dm->type),
+			  &check_present,
+			  pc);
+    return;
+  }
+  execute_put (pc);
+}
+
+
+/**
+ * Handle PUT-message.
+ *
+ * @param cls closure
+ * @param client identification of the client
+ * @param message the actual message
+ */
+static void
+handle_put (void *cls, struct GNUNET_SERVER_Client *client,
+            const struct GNUNET_MessageHeader *message)
+{
+  const struct DataMessage *dm = check_data (message);
+  int rid;
+  struct ReservationList *pos;
+  struct PutContext *pc;
+  struct PutBatch *batch;
+  uint32_t size;
+
+  if ((dm == NULL) || (ntohl (dm->type) == 0))
+  {
+    GNUNET_break (0);
+    GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
+    return;
+  }
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Processing `%s' request for `%s' of type %u\n", "PUT",
+              GNUNET_h2s (&dm->key), ntohl (dm->type));
+  rid = ntohl (dm->rid);
+  size = ntohl (dm->size);
+  if (rid > 0)
+  {
+    pos = reservations;
+    while ((NULL != pos) && (rid != pos->rid))
+      pos = pos->next;
+    GNUNET_break (pos != NULL);
+    if (NULL != pos)
+    {
+      GNUNET_break (pos->entries > 0);
+      GNUNET_break (pos->amount >= size);
+      pos->entries--;
+      pos->amount -= size;
+      reserved -= (size + GNUNET_DATASTORE_ENTRY_OVERHEAD);
+      GNUNET_STATISTICS_set (stats,
+                             gettext_noop ("# reserved"),
+                             reserved,
+                             GNUNET_NO);
+    }
+  }
+  pc = GNUNET_malloc (sizeof (struct PutContext) + size +
+                      sizeof (struct DataMessage));
+  pc->client = client;
+  GNUNET_SERVER_client_keep (client);
+  memcpy (&pc[1], dm, size + sizeof (struct DataMessage));
+  batch = find_batch (client);
+  if (NULL == batch)
+  {
+    start_put (pc);
+    return;
+  }
+  pc->batch = batch;
+  pc->index = batch->received;
+  batch->puts[batch->received++] = pc;
+  if (batch->received < batch->count)
+  {
+    GNUNET_SERVER_receive_done (client, GNUNET_OK);
+    return;
+  }
+  /* batch complete, the status message will let the client continue */
+  GNUNET_CONTAINER_DLL_remove (batch_head, batch_tail, batch);
+  GNUNET_CONTAINER_DLL_insert_tail (ready_head, ready_tail, batch);
+  schedule_next_batch ();
+}
+
+
+/**
+ * Handle PUT_MULTIPLE-message.  Opens a batch for the client; the
+ * following PUT messages of the client are buffered until all of
+ * them arrived, stored within one plugin transaction and answered
+ * with a single status message.
+ *
+ * @param cls closure
+ * @param client identification of the client
+ * @param message the actual message
+ */
+static void
+handle_put_multiple (void *cls, struct GNUNET_SERVER_Client *client,
+                     const struct GNUNET_MessageHeader *message)
+{
+  const struct PutMultipleMessage *pm;
+  struct PutBatch *batch;
+  uint32_t count;
+
+  pm = (const struct PutMultipleMessage *) message;
+  count = ntohl (pm->count);
+  if ( (0 == count) ||
+       (count > GNUNET_DATASTORE_MAX_BATCH_SIZE) ||
+       (NULL != find_batch (client)) )
+  {
+    GNUNET_break (0);
+    GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
+    return;
+  }
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Processing `%s' request for %u items\n",
+              "PUT_MULTIPLE", (unsigned int) count);
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# PUT MULTIPLE requests received"),
+                            1,
+                            GNUNET_NO);
+  batch = GNUNET_new (struct PutBatch);
+  batch->client = client;
+  batch->count = count;
+  batch->puts = GNUNET_new_array (count, struct PutContext *);
+  batch->status = GNUNET_malloc (count * sizeof (int32_t));
+  GNUNET_CONTAINER_DLL_insert_tail (batch_head, batch_tail, batch);
+  GNUNET_SERVER_receive_done (client, GNUNET_OK);
+}
+
+
+/**
+ * Closure for #lookup_pending_it().
+ */
+struct LookupPendingContext
+{
+  /**
+   * Desired content type.
+   */
+  enum GNUNET_BLOCK_Type type;
+
+  /**
+   * Data the item must have for a REMOVE, NULL for a GET.
+   */
+  const struct DataMessage *dm;
+
+  /**
+   * Number of matching items to skip before we take one, only
+   * used once @e count is known.
+   */
+  uint64_t skip;
+
+  /**
+   * Number of matching items.
+   */
+  unsigned int count;
+
+  /**
+   * #GNUNET_YES if we are selecting an item, #GNUNET_NO while
+   * we are counting.
+   */
+  int select;
+
+  /**
+   * #GNUNET_YES if a matching item is being written by the
+   * running flush.
+   */
+  int in_flush;
+
+  /**
+   * Set to the selected item.
+   */
+  struct PendingPut *result;
+};
+
+
+/**
+ * Count or select the buffered items that match a GET or REMOVE.
+ *
+ * @param cls the `struct LookupPendingContext`
+ * @param key key of the item
+ * @param value the `struct PendingPut`
+ * @return #GNUNET_YES to continue, #GNUNET_NO if we are done
+ */
+static int
+lookup_pending_it (void *cls,
+                   const struct GNUNET_HashCode *key,
+                   void *value)
+{
+  struct LookupPendingContext *lpc = cls;
+  struct PendingPut *pp = value;
+  const struct DataMessage *dm = (const struct DataMessage *) &pp[1];
+
+  if ( (GNUNET_BLOCK_TYPE_ANY != lpc->type) &&
+       (lpc->type != ntohl (dm->type)) )
+    return GNUNET_YES;
+  if ( (NULL != lpc->dm) &&
+       ( (dm->size != lpc->dm->size) ||
+         (0 != memcmp (&dm[1], &lpc->dm[1], ntohl (dm->size))) ) )
+    return GNUNET_YES;
+  if (GNUNET_YES == pp->in_flush)
+  {
+    lpc->in_flush = GNUNET_YES;
+    return GNUNET_YES;
+  }
+  if (GNUNET_NO == lpc->select)
+  {
+    lpc->count++;
+    return GNUNET_YES;
+  }
+  if (0 != lpc->skip--)
+    return GNUNET_YES;
+  lpc->result = pp;
+  return GNUNET_NO;
+}
+
+
+/**
+ * Select the buffered item that answers a GET for a key.  This works
+ * if the matching items are in the memtable and the database has
+ * nothing under the key.  If the database has to answer the GET
+ * together with the memtable, the memtable has to be written first.
+ *
+ * @param key key to look up
+ * @param type desired content type
+ * @param offset offset of the result
+ * @param result set to the selected item
+ * @return #GNUNET_YES if an item was selected, #GNUNET_NO if the
+ *         database can answer the GET alone, #GNUNET_SYSERR if it
+ *         has to wait until the memtable was written
+ */
+static int
+select_pending (const struct GNUNET_HashCode *key,
+                enum GNUNET_BLOCK_Type type,
+                uint64_t offset,
+                struct PendingPut **result)
+{
+  struct LookupPendingContext lpc;
+
+  memset (&lpc, 0, sizeof (lpc));
+  lpc.type = type;
+  GNUNET_CONTAINER_multihashmap_get_multiple (memtable,
+                                              key,
+                                              &lookup_pending_it,
+                                              &lpc);
+  if ( (0 == lpc.count) &&
+       (GNUNET_NO == lpc.in_flush) )
+    return GNUNET_NO;
+  if ( (GNUNET_YES == lpc.in_flush) ||
+       (GNUNET_YES == GNUNET_CONTAINER_bloomfilter_test (filter, key)) )
+    return GNUNET_SYSERR;
+  lpc.select = GNUNET_YES;
+  lpc.skip = offset % lpc.count;
+  GNUNET_CONTAINER_multihashmap_get_multiple (memtable,
+                                              key,
+                                              &lookup_pending_it,
+                                              &lpc);
+  *result = lpc.result;
+  return GNUNET_YES;
+}
+
+
+/**
+ * Answer a GET for a key from the memtable.
+ *
+ * @param client client that made the request
+ * @param key key to look up
+ * @param type desired content type
+ * @param offset offset of the result
+ * @return #GNUNET_YES if the GET was answered, #GNUNET_NO if the
+ *         database can answer it alone, #GNUNET_SYSERR if it has
+ *         to wait until the memtable was written
+ */
+static int
+get_pending (struct GNUNET_SERVER_Client *client,
+             const struct GNUNET_HashCode *key,
+             enum GNUNET_BLOCK_Type type,
+             uint64_t offset)
+{
+  struct PendingPut *pp;
+  const struct DataMessage *dm;
+  int ret;
+
+  ret = select_pending (key, type, offset, &pp);
+  if (GNUNET_YES != ret)
+    return ret;
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# GET requests answered from memtable"),
+                            1,
+                            GNUNET_NO);
+  dm = (const struct DataMessage *) &pp[1];
+  transmit_item (client, &dm->key, ntohl (dm->size), &dm[1],
+                 ntohl (dm->type), ntohl (dm->priority),
+                 ntohl (dm->anonymity),
+                 GNUNET_TIME_absolute_ntoh (dm->expiration),
+                 pp->uid);
+  return GNUNET_YES;
+}
+
+
+/**
+ * Remove an item from the memtable for a REMOVE request.
+ *
+ * @param client client that made the request
+ * @param dm the request
+ * @return #GNUNET_YES if the item was removed from the memtable,
+ *         #GNUNET_NO if the database has to process the REMOVE,
+ *         #GNUNET_SYSERR if it has to wait until the item was
+ *         written to the database
+ */
+static int
+remove_pending (struct GNUNET_SERVER_Client *client,
+                const struct DataMessage *dm)
+{
+  struct LookupPendingContext lpc;
+
+  memset (&lpc, 0, sizeof (lpc));
+  lpc.type = ntohl (dm->type);
+  lpc.dm = dm;
+  lpc.select = GNUNET_YES;
+  GNUNET_CONTAINER_multihashmap_get_multiple (memtable,
+                                              &dm->key,
+                                              &lookup_pending_it,
+                                              &lpc);
+  if (NULL == lpc.result)
+    return (GNUNET_YES == lpc.in_flush) ? GNUNET_SYSERR : GNUNET_NO;
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Buffered item matches `%s' request for key `%s'\n",
+              "REMOVE",
+              GNUNET_h2s (&dm->key));
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# REMOVE requests answered from memtable"),
+                            1,
+                            GNUNET_NO);
+  memtable_remove (lpc.result);
+  GNUNET_free (lpc.result);
+  /* replaying the journal must not bring the item back */
+  rewrite_journal ();
+  transmit_status (client, GNUNET_OK, NULL);
+  GNUNET_SERVER_client_drop (client);
+  return GNUNET_YES;
+}
+
+
+/**
+ * Check if a request has to wait until the memtable was written to
+ * the database (so that the database sees all PUTs that we accepted
+ * before the request), and if so queue it.  Writing the memtable is
+ * started as needed.
+ *
+ * @param client client that made the request
+ * @param message the request
+ * @return #GNUNET_YES if the request was queued, #GNUNET_NO if it
+ *         can be processed right away
+ */
+static int
+defer_request (struct GNUNET_SERVER_Client *client,
+               const struct GNUNET_MessageHeader *message)
+{
+  struct DeferredRequest *dr;
+  unsigned int flush_gen;
+
+  /* a running flush writes the items it took from the memtable,
+     the next flush the ones that are in the memtable now */
+  flush_gen = flushes_started;
+  if (NULL != pp_head)
+  {
+    flush_gen++;
+    memtable_flush ();
+  }
+  if (flush_gen == flushes_completed)
+    return GNUNET_NO;
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# requests waiting for memtable flush"),
+                            1,
+                            GNUNET_NO);
+  dr = GNUNET_malloc (sizeof (struct DeferredRequest) +
+                      ntohs (message->size));
+  dr->client = client;
+  dr->flush_gen = flush_gen;
+  memcpy (&dr[1], message, ntohs (message->size));
+  GNUNET_CONTAINER_DLL_insert_tail (deferred_head, deferred_tail, dr);
+  return GNUNET_YES;
+}
+
+
+/**
+ * Process a GET request.
+ *
+ * @param client identification of the client
+ * @param msg the request
+ */
+static void
+execute_get (struct GNUNET_SERVER_Client *client,
+             const struct GetMessage *msg)
+{
+  uint16_t size;
+
+  size = ntohs (msg->header.size);
+  if ((size == sizeof (struct GetMessage)) &&
+      (GNUNET_YES != GNUNET_CONTAINER_bloomfilter_test (filter, &msg->key)))
+  {
+    /* don't bother database... */
+    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+                "Empty result set for `%s' request for `%s' (bloomfilter).\n",
+                "GET", GNUNET_h2s (&msg->key));
+    GNUNET_STATISTICS_update (stats,
+                              gettext_noop
+                              ("# requests filtered by bloomfilter"),
+                              1,
+                              GNUNET_NO);
+    transmit_item (client, NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS,
+                   0);
+    return;
+  }
+  plugin->api->get_key (plugin->api->cls, GNUNET_ntohll (msg->offset),
+                        ((size ==
+                          sizeof (struct GetMessage)) ? &msg->key : NULL), NULL,
+                        ntohl (msg->type), &transmit_item, client);
+}
+
+
+/**
+ * Handle GET-message.
+ *
+ * @param cls closure
+ * @param client identification of the client
+ * @param message the actual message
+ */
+static void
+handle_get (void *cls, struct GNUNET_SERVER_Client *client,
+            const struct GNUNET_MessageHeader *message)
+{
+  const struct GetMessage *msg;
+  uint16_t size;
+
+  size = ntohs (message->size);
+  if ((size != sizeof (struct GetMessage)) &&
+      (size != sizeof (struct GetMessage) - sizeof (struct GNUNET_HashCode)))
+  {
+    GNUNET_break (0);
+    GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
+    return;
+  }
+  msg = (const struct GetMessage *) message;
+  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+              "Processing `%s' request for `%s' of type %u\n", "GET",
+              GNUNET_h2s (&msg->key), ntohl (msg->type));
+  GNUNET_STATISTICS_update (stats,
+                            gettext_noop ("# GET requests received"),
+                            1,
+                            GNUNET_NO);
+  GNUNET_SERVER_client_keep (client);
+  if ( (NULL != memtable) &&
+       (size == sizeof (struct GetMessage)) )
+  {
+    switch (get_pending (client, &msg->key, ntohl (msg->type),
+                         GNUNET_ntohll (msg->offset)))
+    {
+    case GNUNET_YES:
+      return;
+    case GNUNET_NO:
+      execute_get (client, msg);
+      return;
+    default:
+      break;
+    }
+  }
+  if (GNUNET_YES == defer_request (client, message))
+    return;
+  execute_get (client, msg);
+}
+
+
+/**
+ * Context for a GET_MULTIPLE request.
+ */
+struct GetMultipleContext
+{
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct GetMultipleContext *next;
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct GetMultipleContext *prev;
+
+  /**
+   * Client that made the request.
+   */
+  struct GNUNET_SERVER_Client *client;
+
+  /**
+   * Task to look up the next key, NULL if not scheduled.
+   */
+  struct GNUNET_SCHEDULER_Task *task;
+
+  /**
+   * Offset of the result for each key.
+   */
+  uint64_t offset;
+
+  /**
+   * Desired content type.
+   */
+  enum GNUNET_BLOCK_Type type;
+
+  /**
+   * Number of keys in the request.
+   */
+  unsigned int count;
+
+  /**
+   * Index of the next key to look up.
+   */
+  unsigned int pos;
+
+  /* followed by 'count' keys */
+};
+
+
+/**
+ * Head of the list of active GET_MULTIPLE requests.
+ */
+static struct GetMultipleContext *gmc_head;
+
+/**
+ * Tail of the list of active GET_MULTIPLE requests.
+ */
+static struct GetMultipleContext *gmc_tail;
+
+
+/**
+ * Free a GET_MULTIPLE context.
+ *
+ * @param gmc context to free
+ */
+static void
+free_get_multiple (struct GetMultipleContext *gmc)
+{
+  GNUNET_CONTAINER_DLL_remove (gmc_head, gmc_tail, gmc);
+  if (NULL != gmc->task)
+    GNUNET_SCHEDULER_cancel (gmc->task);
+  GNUNET_SERVER_client_drop (gmc->client);
+  GNUNET_free (gmc);
+}
+
+
+/**
+ * Look up the next key of a GET_MULTIPLE request, or finish the
+ * request with a DATA_END message if all keys were processed.
+ *
+ * @param cls the `struct GetMultipleContext`
+ * @param tc scheduler context
+ */
+static void
+get_multiple_next (void *cls,
+                   const struct GNUNET_SCHEDULER_TaskContext *tc);
+
+
+/**
+ * Called once a result of a GET_MULTIPLE request was transmitted.
+ *
+ * @param cls the `struct GetMultipleContext`
+ * @param success #GNUNET_OK if the result was transmitted
+ */
+static void
+get_multiple_transmitted (void *cls,
+                          int success)
+{
+  struct GetMultipleContext *gmc = cls;
+
+  if (GNUNET_OK != success)
+  {
+    free_get_multiple (gmc);
+    return;
+  }
+  gmc->task = GNUNET_SCHEDULER_add_now (&get_multiple_next, gmc);
+}
+
+
+/**
+ * Function that will transmit a result of a GET_MULTIPLE
+ * request to the client.
+ *
+ * @param cls the `struct GetMultipleContext`
+ * @param key key for the content, NULL if there was no match
+ * @param size number of bytes in data
+ * @param data content stored
+ * @param type type of the content
  * @param priority priority of the content
  * @param anonymity anonymity-level for the content
  * @param expiration expiration time for the content
  * @param uid unique identifier for the datum;
  *        maybe 0 if no unique identifier is available
- * @return #GNUNET_OK usually
- *         #GNUNET_NO to delete the item
+ * @return #GNUNET_OK
  */
 static int
-check_present (void *cls,
-	       const struct GNUNET_HashCode *key,
-	       uint32_t size,
-               const void *data,
-	       enum GNUNET_BLOCK_Type type,
-	       uint32_t priority,
-               uint32_t anonymity,
-	       struct GNUNET_TIME_Absolute expiration,
-               uint64_t uid)
+transmit_multiple_item (void *cls, const struct GNUNET_HashCode *key,
+                        uint32_t size, const void *data,
+                        enum GNUNET_BLOCK_Type type, uint32_t priority,
+                        uint32_t anonymity,
+                        struct GNUNET_TIME_Absolute expiration,
+                        uint64_t uid)
 {
-  struct PutContext *pc = cls;
-  const struct DataMessage *dm;
+  struct GetMultipleContext *gmc = cls;
+  struct DataMessage *dm;
 
-  dm = (const struct DataMessage *) &pc[1];
-  if (key == NULL)
+  if (NULL == key)
   {
-    execute_put (pc);
+    /* no match for this key, move on to the next one */
+    gmc->task = GNUNET_SCHEDULER_add_now (&get_multiple_next, gmc);
     return GNUNET_OK;
   }
-  if ((GNUNET_BLOCK_TYPE_FS_DBLOCK == type) ||
-      (GNUNET_BLOCK_TYPE_FS_IBLOCK == type) || ((size == ntohl (dm->size)) &&
-                                                (0 ==
-                                                 memcmp (&dm[1], data, size))))
+  dm = make_data_message (key, size, data, type, priority, anonymity,
+                          expiration, uid);
+  transmit_more (gmc->client, &dm->header,
+                 &get_multiple_transmitted, gmc);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Look up the next key of a GET_MULTIPLE request, or finish the
+ * request with a DATA_END message if all keys were processed.
+ *
+ * @param cls the `struct GetMultipleContext`
+ * @param tc scheduler context
+ */
+static void
+get_multiple_next (void *cls,
+                   const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct GetMultipleContext *gmc = cls;
+  const struct GNUNET_HashCode *keys = (const struct GNUNET_HashCode *) &gmc[1];
+  const struct GNUNET_HashCode *key;
+  const struct DataMessage *pdm;
+  struct DataMessage *dm;
+  struct PendingPut *pp;
+
+  gmc->task = NULL;
+  while (gmc->pos < gmc->count)
   {
-    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-                "Result already present in datastore\n");
-    /* FIXME: change API to allow increasing 'replication' counter */
-    if ((ntohl (dm->priority) > 0) ||
-        (GNUNET_TIME_absolute_ntoh (dm->expiration).abs_value_us >
-         expiration.abs_value_us))
-      plugin->api->update (plugin->api->cls,
-			   uid,
-                           (int32_t) ntohl (dm->priority),
-                           GNUNET_TIME_absolute_ntoh (dm->expiration),
-                           &check_present_continuation,
-			   pc->client);
-    else
+    key = &keys[gmc->pos++];
+    if ( (NULL != memtable) &&
+         (GNUNET_YES == select_pending (key, gmc->type, gmc->offset, &pp)) )
     {
-      transmit_status (pc->client, GNUNET_NO, NULL);
-      GNUNET_SERVER_client_drop (pc->client);
+      GNUNET_STATISTICS_update (stats,
+                                gettext_noop ("# GET requests answered from memtable"),
+                                1,
+                                GNUNET_NO);
+      pdm = (const struct DataMessage *) &pp[1];
+      dm = make_data_message (key, ntohl (pdm->size), &pdm[1],
+                              ntohl (pdm->type), ntohl (pdm->priority),
+                              ntohl (pdm->anonymity),
+                              GNUNET_TIME_absolute_ntoh (pdm->expiration),
+                              pp->uid);
+      transmit_more (gmc->client, &dm->header,
+                     &get_multiple_transmitted, gmc);
+      return;
     }
-    GNUNET_free (pc);
-  }
-  else
-  {
-    execute_put (pc);
+    if (GNUNET_YES == GNUNET_CONTAINER_bloomfilter_test (filter, key))
+    {
+      plugin->api->get_key (plugin->api->cls, gmc->offset, key, NULL,
+                            gmc->type, &transmit_multiple_item, gmc);
+      return;
+    }
+    /* don't bother database... */
+    GNUNET_STATISTICS_update (stats,
+                              gettext_noop
+                              ("# requests filtered by bloomfilter"),
+                              1,
+                              GNUNET_NO);
   }
-  return GNUNET_OK;
+  GNUNET_SERVER_client_keep (gmc->client);
+  transmit_item (gmc->client, NULL, 0, NULL, 0, 0, 0,
+                 GNUNET_TIME_UNIT_ZERO_ABS, 0);
+  free_get_multiple (gmc);
 }
 
 
 /**
- * Handle PUT-message.
+ * Process a GET_MULTIPLE request.
  *
- * @param cls closure
  * @param client identification of the client
- * @param message the actual message
+ * @param msg the request
  */
 static void
-handle_put (void *cls, struct GNUNET_SERVER_Client *client,
-            const struct GNUNET_MessageHeader *message)
+execute_get_multiple (struct GNUNET_SERVER_Client *client,
+                      const struct GetMultipleMessage *msg)
 {
-  const struct DataMessage *dm = check_data (message);
-  int rid;
-  struct ReservationList *pos;
-  struct PutContext *pc;
-  struct GNUNET_HashCode vhash;
-  uint32_t size;
-
-  if ((dm == NULL) || (ntohl (dm->type) == 0))
-  {
-    GNUNET_break (0);
-    GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
-    return;
-  }
-  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-              "Processing `%s' request for `%s' of type %u\n", "PUT",
-              GNUNET_h2s (&dm->key), ntohl (dm->type));
-  rid = ntohl (dm->rid);
-  size = ntohl (dm->size);
-  if (rid > 0)
-  {
-    pos = reservations;
-    while ((NULL != pos) && (rid != pos->rid))
-      pos = pos->next;
-    GNUNET_break (pos != NULL);
-    if (NULL != pos)
-    {
-      GNUNET_break (pos->entries > 0);
-      GNUNET_break (pos->amount >= size);
-      pos->entries--;
-      pos->amount -= size;
-      reserved -= (size + GNUNET_DATASTORE_ENTRY_OVERHEAD);
-      GNUNET_STATISTICS_set (stats,
-                             gettext_noop ("# reserved"),
-                             reserved,
-                             GNUNET_NO);
-    }
-  }
-  pc = GNUNET_malloc (sizeof (struct PutContext) + size +
-                      sizeof (struct DataMessage));
-  pc->client = client;
-  GNUNET_SERVER_client_keep (client);
-  memcpy (&pc[1], dm, size + sizeof (struct DataMessage));
-  if (GNUNET_YES == GNUNET_CONTAINER_bloomfilter_test (filter, &dm->key))
-  {
-    GNUNET_CRYPTO_hash (&dm[1], size, &vhash);
-    plugin->api->get_key (plugin->api->cls,
-			  0,
-			  &dm->key,
-			  &vhash,
-                          ntohl (dm->type),
-			  &check_present,
-			  pc);
-    return;
-  }
-  execute_put (pc);
+  struct GetMultipleContext *gmc;
+  uint32_t count;
+
+  count = ntohl (msg->count);
+  gmc = GNUNET_malloc (sizeof (struct GetMultipleContext) +
+                       count * sizeof (struct GNUNET_HashCode));
+  gmc->client = client;
+  gmc->offset = GNUNET_ntohll (msg->offset);
+  gmc->type = (enum GNUNET_BLOCK_Type) ntohl (msg->type);
+  gmc->count = count;
+  memcpy (&gmc[1], &msg[1], count * sizeof (struct GNUNET_HashCode));
+  GNUNET_CONTAINER_DLL_insert (gmc_head, gmc_tail, gmc);
+  get_multiple_next (gmc, NULL);
 }
 
 
 /**
- * Handle GET-message.
+ * Handle GET_MULTIPLE-message.
  *
  * @param cls closure
  * @param client identification of the client
  * @param message the actual message
  */
 static void
-handle_get (void *cls, struct GNUNET_SERVER_Client *client,
-            const struct GNUNET_MessageHeader *message)
+handle_get_multiple (void *cls, struct GNUNET_SERVER_Client *client,
+                     const struct GNUNET_MessageHeader *message)
 {
-  const struct GetMessage *msg;
+  const struct GetMultipleMessage *msg;
+  const struct GNUNET_HashCode *keys;
+  struct PendingPut *pp;
   uint16_t size;
+  uint32_t count;
+  uint32_t i;
 
   size = ntohs (message->size);
-  if ((size != sizeof (struct GetMessage)) &&
-      (size != sizeof (struct GetMessage) - sizeof (struct GNUNET_HashCode)))
+  if (size < sizeof (struct GetMultipleMessage))
+  {
+    GNUNET_break (0);
+    GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
+    return;
+  }
+  msg = (const struct GetMultipleMessage *) message;
+  count = ntohl (msg->count);
+  if ( (0 == count) ||
+       (count > GNUNET_DATASTORE_MAX_BATCH_SIZE) ||
+       (size != sizeof (struct GetMultipleMessage) +
+        count * sizeof (struct GNUNET_HashCode)) )
   {
     GNUNET_break (0);
     GNUNET_SERVER_receive_done (client, GNUNET_SYSERR);
     return;
   }
-  msg = (const struct GetMessage *) message;
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-              "Processing `%s' request for `%s' of type %u\n", "GET",
-              GNUNET_h2s (&msg->key), ntohl (msg->type));
+              "Processing `%s' request for %u keys of type %u\n",
+              "GET_MULTIPLE", (unsigned int) count, ntohl (msg->type));
   GNUNET_STATISTICS_update (stats,
-                            gettext_noop ("# GET requests received"),
+                            gettext_noop ("# GET MULTIPLE requests received"),
                             1,
                             GNUNET_NO);
   GNUNET_SERVER_client_keep (client);
-  if ((size == sizeof (struct GetMessage)) &&
-      (GNUNET_YES != GNUNET_CONTAINER_bloomfilter_test (filter, &msg->key)))
+  if (NULL != memtable)
   {
-    /* don't bother database... */
-    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-                "Empty result set for `%s' request for `%s' (bloomfilter).\n",
-                "GET", GNUNET_h2s (&msg->key));
-    GNUNET_STATISTICS_update (stats,
-                              gettext_noop
-                              ("# requests filtered by bloomfilter"),
-                              1,
-                              GNUNET_NO);
-    transmit_item (client, NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS,
-                   0);
-    return;
+    /* keys that the memtable cannot answer alone have to wait
+       until it was written */
+    keys = (const struct GNUNET_HashCode *) &msg[1];
+    for (i = 0; i < count; i++)
+      if (GNUNET_SYSERR ==
+          select_pending (&keys[i], ntohl (msg->type),
+                          GNUNET_ntohll (msg->offset), &pp))
+        break;
+    if ( (i < count) &&
+         (GNUNET_YES == defer_request (client, message)) )
+      return;
   }
-  plugin->api->get_key (plugin->api->cls, GNUNET_ntohll (msg->offset),
-                        ((size ==
-                          sizeof (struct GetMessage)) ? &msg->key : NULL), NULL,
-                        ntohl (msg->type), &transmit_item, client);
+  execute_get_multiple (client, msg);
 }
 
 
@@ -1133,6 +3141,9 @@ handle_update (void *cls, struct GNUNET_SERVER_Client *client,
                const struct GNUNET_MessageHeader *message)
 {
   const struct UpdateMessage *msg;
+  struct PendingPut *pp;
+  struct DataMessage *dm;
+  struct GNUNET_TIME_Absolute expiration;
 
   GNUNET_STATISTICS_update (stats,
                             gettext_noop ("# UPDATE requests received"),
@@ -1141,6 +3152,21 @@ handle_update (void *cls, struct GNUNET_SERVER_Client *client,
   msg = (const struct UpdateMessage *) message;
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG, "Processing `%s' request for %llu\n",
               "UPDATE", (unsigned long long) GNUNET_ntohll (msg->uid));
+  for (pp = pp_head; NULL != pp; pp = pp->next)
+    if (pp->uid == GNUNET_ntohll (msg->uid))
+      break;
+  if (NULL != pp)
+  {
+    dm = (struct DataMessage *) &pp[1];
+    dm->priority = htonl (ntohl (dm->priority) + ntohl (msg->priority));
+    expiration = GNUNET_TIME_absolute_max (GNUNET_TIME_absolute_ntoh (dm->expiration),
+                                           GNUNET_TIME_absolute_ntoh (msg->expiration));
+    dm->expiration = GNUNET_TIME_absolute_hton (expiration);
+    /* replaying the journal must see the new values */
+    rewrite_journal ();
+    transmit_status (client, GNUNET_OK, NULL);
+    return;
+  }
   GNUNET_SERVER_client_keep (client);
   plugin->api->update (plugin->api->cls, GNUNET_ntohll (msg->uid),
                        (int32_t) ntohl (msg->priority),
@@ -1168,6 +3194,7 @@ handle_get_replication (void *cls, struct GNUNET_SERVER_Client *client,
                             1,
                             GNUNET_NO);
   GNUNET_SERVER_client_keep (client);
+  memtable_flush ();
   plugin->api->get_replication (plugin->api->cls, &transmit_item, client);
 }
 
@@ -1202,6 +3229,7 @@ handle_get_zero_anonymity (void *cls, struct GNUNET_SERVER_Client *client,
                             1,
                             GNUNET_NO);
   GNUNET_SERVER_client_keep (client);
+  memtable_flush ();
   plugin->api->get_zero_anonymity (plugin->api->cls,
                                    GNUNET_ntohll (msg->offset), type,
                                    &transmit_item, client);
@@ -1248,6 +3276,25 @@ remove_callback (void *cls, const struct GNUNET_HashCode * key, uint32_t size,
 }
 
 
+/**
+ * Process a REMOVE request.
+ *
+ * @param client identification of the client
+ * @param dm the request
+ */
+static void
+execute_remove (struct GNUNET_SERVER_Client *client,
+                const struct DataMessage *dm)
+{
+  struct GNUNET_HashCode vhash;
+
+  GNUNET_CRYPTO_hash (&dm[1], ntohl (dm->size), &vhash);
+  plugin->api->get_key (plugin->api->cls, 0, &dm->key, &vhash,
+                        (enum GNUNET_BLOCK_Type) ntohl (dm->type),
+                        &remove_callback, client);
+}
+
+
 /**
  * Handle REMOVE-message.
  *
@@ -1260,7 +3307,6 @@ handle_remove (void *cls, struct GNUNET_SERVER_Client *client,
                const struct GNUNET_MessageHeader *message)
 {
   const struct DataMessage *dm = check_data (message);
-  struct GNUNET_HashCode vhash;
 
   if (dm == NULL)
   {
@@ -1274,10 +3320,55 @@ handle_remove (void *cls, struct GNUNET_SERVER_Client *client,
   GNUNET_STATISTICS_update (stats, gettext_noop ("# REMOVE requests received"),
                             1, GNUNET_NO);
   GNUNET_SERVER_client_keep (client);
-  GNUNET_CRYPTO_hash (&dm[1], ntohl (dm->size), &vhash);
-  plugin->api->get_key (plugin->api->cls, 0, &dm->key, &vhash,
-                        (enum GNUNET_BLOCK_Type) ntohl (dm->type),
-                        &remove_callback, client);
+  if (NULL != memtable)
+  {
+    switch (remove_pending (client, dm))
+    {
+    case GNUNET_YES:
+      return;
+    case GNUNET_NO:
+      execute_remove (client, dm);
+      return;
+    default:
+      break;
+    }
+  }
+  if (GNUNET_YES == defer_request (client, message))
+    return;
+  execute_remove (client, dm);
+}
+
+
+/**
+ * Run the requests that were waiting for the flushes that
+ * completed so far.
+ */
+static void
+run_deferred ()
+{
+  struct DeferredRequest *dr;
+  const struct GNUNET_MessageHeader *message;
+
+  while ( (NULL != (dr = deferred_head)) &&
+          (dr->flush_gen <= flushes_completed) )
+  {
+    GNUNET_CONTAINER_DLL_remove (deferred_head, deferred_tail, dr);
+    message = (const struct GNUNET_MessageHeader *) &dr[1];
+    switch (ntohs (message->type))
+    {
+    case GNUNET_MESSAGE_TYPE_DATASTORE_GET:
+      execute_get (dr->client, (const struct GetMessage *) message);
+      break;
+    case GNUNET_MESSAGE_TYPE_DATASTORE_GET_MULTIPLE:
+      execute_get_multiple (dr->client,
+                            (const struct GetMultipleMessage *) message);
+      break;
+    default:
+      execute_remove (dr->client, (const struct DataMessage *) message);
+      break;
+    }
+    GNUNET_free (dr);
+  }
 }
 
 
@@ -1372,6 +3463,17 @@ load_plugin ()
   ret->env.cfg = cfg;
   ret->env.duc = &disk_utilization_change_cb;
   ret->env.cls = NULL;
+  if (GNUNET_YES ==
+      GNUNET_CONFIGURATION_get_value_yesno (cfg,
+                                            "DATASTORE",
+                                            "DATABASE_THREAD"))
+    worker = GSD_worker_create_ (&disk_utilization_change_cb,
+                                 NULL);
+  if (NULL != worker)
+  {
+    ret->env.duc = &GSD_worker_duc_;
+    ret->env.cls = worker;
+  }
   GNUNET_log (GNUNET_ERROR_TYPE_INFO,
               _("Loading `%s' datastore plugin\n"),
               plugin_name);
@@ -1380,17 +3482,36 @@ load_plugin ()
                    plugin_name);
   ret->short_name = GNUNET_strdup (plugin_name);
   ret->lib_name = libname;
-  ret->api = GNUNET_PLUGIN_load (libname, &ret->env);
-  if (NULL == ret->api)
+  ret->lib_api = GNUNET_PLUGIN_load (libname, &ret->env);
+  if (NULL == ret->lib_api)
   {
     GNUNET_log (GNUNET_ERROR_TYPE_ERROR,
                 _("Failed to load datastore plugin for `%s'\n"),
                 plugin_name);
+    if (NULL != worker)
+    {
+      GSD_worker_destroy_ (worker);
+      worker = NULL;
+    }
     GNUNET_free (ret->short_name);
     GNUNET_free (libname);
     GNUNET_free (ret);
     return NULL;
   }
+  ret->api = ret->lib_api;
+  if (NULL != worker)
+  {
+    ret->api = GSD_worker_start_ (worker, ret->lib_api);
+    if (NULL == ret->api)
+    {
+      /* run the plugin in the main thread after all */
+      ret->env.duc = &disk_utilization_change_cb;
+      ret->env.cls = NULL;
+      GSD_worker_destroy_ (worker);
+      worker = NULL;
+      ret->api = ret->lib_api;
+    }
+  }
   return ret;
 }
 
@@ -1406,7 +3527,14 @@ unload_plugin (struct DatastorePlugin *plug)
 {
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "Datastore service is unloading plugin...\n");
-  GNUNET_break (NULL == GNUNET_PLUGIN_unload (plug->lib_name, plug->api));
+  if (NULL != worker)
+  {
+    GSD_worker_destroy_ (worker);
+    worker = NULL;
+    plug->env.duc = &disk_utilization_change_cb;
+    plug->env.cls = NULL;
+  }
+  GNUNET_break (NULL == GNUNET_PLUGIN_unload (plug->lib_name, plug->lib_api));
   GNUNET_free (plug->lib_name);
   GNUNET_free (plug->short_name);
   GNUNET_free (plug);
@@ -1423,6 +3551,9 @@ static const struct GNUNET_SERVER_MessageHandler handlers[] = {
   {&handle_update, NULL, GNUNET_MESSAGE_TYPE_DATASTORE_UPDATE,
    sizeof (struct UpdateMessage)},
   {&handle_get, NULL, GNUNET_MESSAGE_TYPE_DATASTORE_GET, 0},
+  {&handle_get_multiple, NULL, GNUNET_MESSAGE_TYPE_DATASTORE_GET_MULTIPLE, 0},
+  {&handle_put_multiple, NULL, GNUNET_MESSAGE_TYPE_DATASTORE_PUT_MULTIPLE,
+   sizeof (struct PutMultipleMessage)},
   {&handle_get_replication, NULL,
    GNUNET_MESSAGE_TYPE_DATASTORE_GET_REPLICATION,
    sizeof (struct GNUNET_MessageHeader)},
@@ -1436,6 +3567,109 @@ static const struct GNUNET_SERVER_MessageHandler handlers[] = {
 };
 
 
+/**
+ * Task that periodically writes the changes to the bloomfilter
+ * to disk.
+ *
+ * @param cls NULL
+ * @param tc task context
+ */
+static void
+sync_bloomfilter (void *cls,
+                  const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  bf_sync_task = GNUNET_SCHEDULER_add_delayed (BF_SYNC_FREQUENCY,
+                                               &sync_bloomfilter,
+                                               NULL);
+  GNUNET_CONTAINER_bloomfilter_sync (filter);
+}
+
+
+/**
+ * Process the PUTs that were in the memtable when we stopped (or
+ * crashed) last time.  The journal is kept until all of them are
+ * in the database again.
+ */
+static void
+replay_journal ()
+{
+  const struct DataMessage *dm;
+  struct PutContext *pc;
+  uint64_t fsize;
+  ssize_t len;
+  size_t off;
+  uint16_t msize;
+  unsigned int count;
+  char *buf;
+
+  if (NULL == journal_name)
+    return;
+  buf = NULL;
+  len = 0;
+  if ( (GNUNET_YES == GNUNET_DISK_file_test (journal_name)) &&
+       (GNUNET_OK ==
+        GNUNET_DISK_file_size (journal_name, &fsize, GNUNET_YES, GNUNET_YES)) &&
+       (fsize > 0) &&
+       (fsize < SIZE_MAX) &&
+       (NULL != (buf = GNUNET_malloc_large ((size_t) fsize))) )
+    len = GNUNET_DISK_fn_read (journal_name, buf, (size_t) fsize);
+  journal_fh = GNUNET_DISK_file_open (journal_name,
+                                      GNUNET_DISK_OPEN_WRITE |
+                                      GNUNET_DISK_OPEN_CREATE |
+                                      GNUNET_DISK_OPEN_APPEND,
+                                      GNUNET_DISK_PERM_USER_READ |
+                                      GNUNET_DISK_PERM_USER_WRITE);
+  if (NULL == journal_fh)
+    GNUNET_log_strerror_file (GNUNET_ERROR_TYPE_WARNING,
+                              "open",
+                              journal_name);
+  replay_pending = 1;
+  count = 0;
+  off = 0;
+  while ( (len > 0) &&
+          (off + sizeof (struct DataMessage) <= (size_t) len) )
+  {
+    dm = (const struct DataMessage *) &buf[off];
+    msize = ntohs (dm->header.size);
+    if ( (GNUNET_MESSAGE_TYPE_DATASTORE_PUT != ntohs (dm->header.type)) ||
+         (msize != sizeof (struct DataMessage) + ntohl (dm->size)) ||
+         (off + msize > (size_t) len) )
+      break;                    /* last record was cut short by a crash */
+    pc = GNUNET_malloc (sizeof (struct PutContext) + msize);
+    memcpy (&pc[1], dm, msize);
+    replay_pending++;
+    count++;
+    start_put (pc);
+    off += msize;
+  }
+  GNUNET_free_non_null (buf);
+  if (count > 0)
+    GNUNET_log (GNUNET_ERROR_TYPE_INFO,
+                _("Recovered %u items from journal `%s'\n"),
+                count,
+                journal_name);
+  if (0 == --replay_pending)
+    replay_done ();
+}
+
+
+/**
+ * The database and the bloomfilter are ready, start processing
+ * requests.
+ */
+static void
+start_processing ()
+{
+  replay_journal ();
+  GNUNET_SERVER_add_handlers (server, handlers);
+  GNUNET_SERVER_resume (server);
+  expired_kill_task
+    = GNUNET_SCHEDULER_add_with_priority (GNUNET_SCHEDULER_PRIORITY_IDLE,
+                                          &delete_expired,
+                                          NULL);
+}
+
+
 /**
  * Adds a given @a key to the bloomfilter in @a cls @a count times.
  *
@@ -1454,12 +3688,7 @@ add_key_to_bloomfilter (void *cls,
   {
     GNUNET_log (GNUNET_ERROR_TYPE_INFO,
 		_("Bloomfilter construction complete.\n"));
-    GNUNET_SERVER_add_handlers (server, handlers);
-    GNUNET_SERVER_resume (server);
-    expired_kill_task
-      = GNUNET_SCHEDULER_add_with_priority (GNUNET_SCHEDULER_PRIORITY_IDLE,
-                                            &delete_expired,
-                                            NULL);
+    start_processing ();
     return;
   }
 
@@ -1518,13 +3747,7 @@ process_stat_done (void *cls,
     GNUNET_log (GNUNET_ERROR_TYPE_INFO,
 		_("Bloomfilter construction complete.\n"));
   }
-
-  GNUNET_SERVER_add_handlers (server, handlers);
-  GNUNET_SERVER_resume (server);
-  expired_kill_task
-    = GNUNET_SCHEDULER_add_with_priority (GNUNET_SCHEDULER_PRIORITY_IDLE,
-                                          &delete_expired,
-                                          NULL);
+  start_processing ();
 }
 
 
@@ -1536,6 +3759,9 @@ cleaning_task (void *cls,
                const struct GNUNET_SCHEDULER_TaskContext *tc)
 {
   struct TransmitCallbackContext *tcc;
+  struct PutBatch *batch;
+  struct PendingPut *pp;
+  struct DeferredRequest *dr;
 
   cleaning_done = GNUNET_YES;
   while (NULL != (tcc = tcc_head))
@@ -1546,21 +3772,93 @@ cleaning_task (void *cls,
       GNUNET_SERVER_notify_transmit_ready_cancel (tcc->th);
       GNUNET_SERVER_client_drop (tcc->client);
     }
+    if (NULL != tcc->cont)
+      tcc->cont (tcc->cont_cls, GNUNET_SYSERR);
     GNUNET_free (tcc->msg);
     GNUNET_free (tcc);
   }
+  if (GNUNET_YES != do_drop)
+    memtable_flush ();
+  if (NULL != worker)
+    GSD_worker_drain_ (worker);
+  while (NULL != gmc_head)
+    free_get_multiple (gmc_head);
+  while (NULL != (batch = batch_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (batch_head, batch_tail, batch);
+    discard_batch (batch);
+  }
+  while (NULL != (batch = ready_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (ready_head, ready_tail, batch);
+    discard_batch (batch);
+  }
+  if (NULL != active_batch)
+    active_batch->client = NULL;
   if (NULL != expired_kill_task)
   {
     GNUNET_SCHEDULER_cancel (expired_kill_task);
     expired_kill_task = NULL;
   }
+  if (NULL != purge_task)
+  {
+    GNUNET_SCHEDULER_cancel (purge_task);
+    purge_task = NULL;
+  }
+  if (NULL != batch_task)
+  {
+    GNUNET_SCHEDULER_cancel (batch_task);
+    batch_task = NULL;
+  }
+  while (NULL != (dr = deferred_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (deferred_head, deferred_tail, dr);
+    GNUNET_SERVER_client_drop (dr->client);
+    GNUNET_free (dr);
+  }
+  while (NULL != (pp = pp_head))
+  {
+    memtable_remove (pp);
+    GNUNET_free (pp);
+  }
+  while (NULL != (pp = flush_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (flush_head, flush_tail, pp);
+    memtable_unmap (pp);
+    GNUNET_free (pp);
+  }
+  if (NULL != flush_task)
+  {
+    GNUNET_SCHEDULER_cancel (flush_task);
+    flush_task = NULL;
+  }
   if (GNUNET_YES == do_drop)
+  {
+    rewrite_journal ();
     plugin->api->drop (plugin->api->cls);
+  }
+  if (NULL != journal_fh)
+  {
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (journal_fh));
+    journal_fh = NULL;
+  }
+  GNUNET_free_non_null (journal_name);
+  journal_name = NULL;
+  if (NULL != memtable)
+  {
+    GNUNET_CONTAINER_multihashmap_destroy (memtable);
+    memtable = NULL;
+  }
   if (NULL != plugin)
   {
     unload_plugin (plugin);
     plugin = NULL;
   }
+  if (NULL != bf_sync_task)
+  {
+    GNUNET_SCHEDULER_cancel (bf_sync_task);
+    bf_sync_task = NULL;
+  }
   if (NULL != filter)
   {
     GNUNET_CONTAINER_bloomfilter_free (filter);
@@ -1630,6 +3928,38 @@ cleanup_reservations (void *cls,
 }
 
 
+/**
+ * Function that drops the PUT batches of the given client that
+ * we did not start to store yet.
+ *
+ * @param cls closure
+ * @param client identification of the client
+ */
+static void
+cleanup_batches (void *cls,
+                 struct GNUNET_SERVER_Client *client)
+{
+  struct PutBatch *batch;
+
+  if (NULL == client)
+    return;
+  if (NULL != (batch = find_batch (client)))
+  {
+    GNUNET_CONTAINER_DLL_remove (batch_head, batch_tail, batch);
+    discard_batch (batch);
+  }
+  while (NULL != (batch = find_batch_in (ready_head, client)))
+  {
+    GNUNET_CONTAINER_DLL_remove (ready_head, ready_tail, batch);
+    discard_batch (batch);
+  }
+  /* the batch we are storing is freed once it was committed */
+  if ( (NULL != active_batch) &&
+       (active_batch->client == client) )
+    active_batch->client = NULL;
+}
+
+
 /**
  * Process datastore requests.
  *
@@ -1645,6 +3975,7 @@ run (void *cls,
   char *fn;
   char *pfn;
   unsigned int bf_size;
+  int bf_clean;
 
   server = serv;
   cfg = c;
@@ -1681,6 +4012,32 @@ run (void *cls,
     bf_size = (1 << 31);          /* absolute limit: ~2 GB, beyond that BF just won't help anyway */
   else
     bf_size = quota / (32 * 1024LL);         /* 8 bit per entry, 1 bit per 32 kb in DB */
+  if ( (GNUNET_OK ==
+        GNUNET_CONFIGURATION_get_value_size (cfg,
+                                             "DATASTORE",
+                                             "MEMTABLE_SIZE",
+                                             &memtable_size)) &&
+       (memtable_size > 0) )
+  {
+    memtable = GNUNET_CONTAINER_multihashmap_create (1024, GNUNET_NO);
+    fn = NULL;
+    if ((GNUNET_OK !=
+         GNUNET_CONFIGURATION_get_value_filename (cfg,
+                                                  "DATASTORE",
+                                                  "JOURNAL",
+                                                  &fn)) ||
+        (GNUNET_OK != GNUNET_DISK_directory_create_for_file (fn)))
+    {
+      GNUNET_log (GNUNET_ERROR_TYPE_WARNING,
+                  _("Could not use specified filename `%s' for journal, buffered items will be lost on crashes.\n"),
+                  NULL != fn ? fn : "");
+    }
+    else
+    {
+      GNUNET_asprintf (&journal_name, "%s.%s", fn, plugin_name);
+    }
+    GNUNET_free_non_null (fn);
+  }
   fn = NULL;
   if ((GNUNET_OK !=
        GNUNET_CONFIGURATION_get_value_filename (cfg,
@@ -1700,7 +4057,7 @@ run (void *cls,
     GNUNET_asprintf (&pfn, "%s.%s", fn, plugin_name);
     if (GNUNET_YES == GNUNET_DISK_file_test (pfn))
     {
-      filter = GNUNET_CONTAINER_bloomfilter_load (pfn, bf_size, 5);        /* approx. 3% false positives at max use */
+      filter = GNUNET_CONTAINER_bloomfilter_load_mapped (pfn, bf_size, 5, &bf_clean);        /* approx. 3% false positives at max use */
       if (NULL == filter)
       {
 	/* file exists but not valid, remove and try again, but refresh */
@@ -1718,7 +4075,7 @@ run (void *cls,
 	else
 	{
 	  /* try again after remove */
-	  filter = GNUNET_CONTAINER_bloomfilter_load (pfn, bf_size, 5);        /* approx. 3% false positives at max use */
+	  filter = GNUNET_CONTAINER_bloomfilter_load_mapped (pfn, bf_size, 5, NULL);        /* approx. 3% false positives at max use */
 	  refresh_bf = GNUNET_YES;
 	  if (NULL == filter)
 	  {
@@ -1732,15 +4089,24 @@ run (void *cls,
 	  }
 	}
       }
-      else
+      else if (GNUNET_YES == bf_clean)
       {
 	/* normal case: have an existing valid bf file, no need to refresh */
 	refresh_bf = GNUNET_NO;
       }
+      else
+      {
+	/* we did not sync the file before we stopped, rebuild it */
+	GNUNET_log (GNUNET_ERROR_TYPE_WARNING,
+		    _("Bloomfilter file `%s' was not synced, rebuilding it\n"),
+		    pfn);
+	GNUNET_CONTAINER_bloomfilter_clear (filter);
+	refresh_bf = GNUNET_YES;
+      }
     }
     else
     {
-      filter = GNUNET_CONTAINER_bloomfilter_load (pfn, bf_size, 5);        /* approx. 3% false positives at max use */
+      filter = GNUNET_CONTAINER_bloomfilter_load_mapped (pfn, bf_size, 5, NULL);        /* approx. 3% false positives at max use */
       refresh_bf = GNUNET_YES;
     }
     GNUNET_free (pfn);
@@ -1762,6 +4128,9 @@ run (void *cls,
     }
     return;
   }
+  bf_sync_task = GNUNET_SCHEDULER_add_delayed (BF_SYNC_FREQUENCY,
+                                               &sync_bloomfilter,
+                                               NULL);
   GNUNET_SERVER_suspend (server);
   stat_get =
       GNUNET_STATISTICS_get (stats,
@@ -1776,6 +4145,9 @@ run (void *cls,
   GNUNET_SERVER_disconnect_notify (server,
                                    &cleanup_reservations,
                                    NULL);
+  GNUNET_SERVER_disconnect_notify (server,
+                                   &cleanup_batches,
+                                   NULL);
   GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_UNIT_FOREVER_REL,
                                 &cleaning_task,
                                 NULL);
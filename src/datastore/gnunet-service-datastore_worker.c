@@ -0,0 +1,1338 @@
+/*
+     This file is part of GNUnet.
+     Copyright (C) 2016 GNUnet e.V.
+
+     GNUnet is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with GNUnet; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file datastore/gnunet-service-datastore_worker.c
+ * @brief run the datastore plugin on a separate thread
+ *
+ * The main thread queues the plugin operations as jobs for the
+ * worker thread, which runs them one after the other (the plugins
+ * are not thread-safe).  The results are queued as events for the
+ * main thread, which is woken up through a pipe.  Datum processors
+ * decide whether the plugin deletes an item, so the worker waits
+ * for the main thread to run them; the main thread handles events
+ * whenever it waits for the worker, so this cannot deadlock.
+ * The plugins may log from the worker thread, as the logger and
+ * the debug string functions (#GNUNET_h2s() etc.) are thread-safe.
+ */
+#include "platform.h"
+#include "gnunet-service-datastore_worker.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if HAVE_PTHREAD_H
+
+/**
+ * Types of jobs for the worker.
+ */
+enum JobType
+{
+  JOB_PUT,
+  JOB_UPDATE,
+  JOB_GET_KEY,
+  JOB_GET_ZERO_ANONYMITY,
+  JOB_GET_REPLICATION,
+  JOB_GET_EXPIRATION,
+  JOB_GET_KEYS,
+  JOB_ESTIMATE_SIZE,
+  JOB_DROP,
+  JOB_BEGIN_BATCH,
+  JOB_END_BATCH,
+  JOB_BARRIER,
+  JOB_STOP
+};
+
+
+/**
+ * A plugin operation for the worker.
+ */
+struct Job
+{
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct Job *next;
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct Job *prev;
+
+  /**
+   * Worker running the job.
+   */
+  struct GSD_Worker *worker;
+
+  /**
+   * What to do.
+   */
+  enum JobType type;
+
+  /**
+   * Key of the operation.
+   */
+  struct GNUNET_HashCode key;
+
+  /**
+   * Hash of the value of the operation.
+   */
+  struct GNUNET_HashCode vhash;
+
+  /**
+   * Data to store (allocated at the end of the job).
+   */
+  const void *data;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  uint32_t size;
+
+  /**
+   * Type of the content.
+   */
+  enum GNUNET_BLOCK_Type btype;
+
+  /**
+   * Priority of the content.
+   */
+  uint32_t priority;
+
+  /**
+   * Anonymity level of the content.
+   */
+  uint32_t anonymity;
+
+  /**
+   * Replication level of the content.
+   */
+  uint32_t replication;
+
+  /**
+   * Change of the priority for updates.
+   */
+  int delta;
+
+  /**
+   * Expiration time of the content.
+   */
+  struct GNUNET_TIME_Absolute expiration;
+
+  /**
+   * Offset for GETs, unique identifier for updates.
+   */
+  uint64_t offset;
+
+  /**
+   * #GNUNET_YES if @e key is set.
+   */
+  int have_key;
+
+  /**
+   * #GNUNET_YES if @e vhash is set.
+   */
+  int have_vhash;
+
+  /**
+   * Continuation for PUTs.
+   */
+  PluginPutCont put_cont;
+
+  /**
+   * Continuation for updates.
+   */
+  PluginUpdateCont update_cont;
+
+  /**
+   * Processor for GETs.
+   */
+  PluginDatumProcessor proc;
+
+  /**
+   * Processor for the keys.
+   */
+  PluginKeyProcessor key_proc;
+
+  /**
+   * Continuation for commits.
+   */
+  GSD_BatchContinuation batch_cont;
+
+  /**
+   * Closure for the continuation or processor.
+   */
+  void *cont_cls;
+
+  /**
+   * Result of size estimates.
+   */
+  unsigned long long estimate;
+
+  /**
+   * Result of transactions.
+   */
+  int status;
+
+  /**
+   * #GNUNET_YES if the main thread waits for the job.
+   */
+  int sync;
+
+  /**
+   * #GNUNET_YES once the main thread learned that the job is done.
+   */
+  int done;
+
+};
+
+
+/**
+ * Types of events for the main thread.
+ */
+enum EventType
+{
+  EVENT_DUC,
+  EVENT_PUT,
+  EVENT_UPDATE,
+  EVENT_ITEM,
+  EVENT_KEY,
+  EVENT_DONE
+};
+
+
+/**
+ * Result of a plugin operation for the main thread.
+ */
+struct Event
+{
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct Event *next;
+
+  /**
+   * This is a doubly-linked list.
+   */
+  struct Event *prev;
+
+  /**
+   * What happened.
+   */
+  enum EventType type;
+
+  /**
+   * Job the event belongs to, NULL for #EVENT_DUC.
+   */
+  struct Job *job;
+
+  /**
+   * Key of the result, NULL for none.
+   */
+  const struct GNUNET_HashCode *key;
+
+  /**
+   * Copy of the key, for events the worker does not wait for.
+   */
+  struct GNUNET_HashCode key_buf;
+
+  /**
+   * Data of an item (only valid while the worker waits).
+   */
+  const void *data;
+
+  /**
+   * Number of bytes of the item.
+   */
+  uint32_t size;
+
+  /**
+   * Type of the item.
+   */
+  enum GNUNET_BLOCK_Type btype;
+
+  /**
+   * Priority of the item.
+   */
+  uint32_t priority;
+
+  /**
+   * Anonymity level of the item.
+   */
+  uint32_t anonymity;
+
+  /**
+   * Expiration time of the item.
+   */
+  struct GNUNET_TIME_Absolute expiration;
+
+  /**
+   * Unique identifier of the item.
+   */
+  uint64_t uid;
+
+  /**
+   * Number of occurences of the key.
+   */
+  unsigned int count;
+
+  /**
+   * Change of the disk utilization.
+   */
+  int delta;
+
+  /**
+   * Status of the operation, or the result of the processor
+   * for items.
+   */
+  int status;
+
+  /**
+   * Error message, NULL for none.
+   */
+  char *msg;
+
+  /**
+   * #GNUNET_YES once the main thread processed the item.
+   */
+  int replied;
+
+};
+
+
+/**
+ * Thread that runs the database operations of a plugin.
+ */
+struct GSD_Worker
+{
+
+  /**
+   * The API we give to the service.
+   */
+  struct GNUNET_DATASTORE_PluginFunctions proxy;
+
+  /**
+   * API of the plugin.
+   */
+  struct GNUNET_DATASTORE_PluginFunctions *api;
+
+  /**
+   * Function to call with changes of the disk utilization.
+   */
+  GNUNET_DATASTORE_DiskUtilizationChange duc;
+
+  /**
+   * Closure for @e duc.
+   */
+  void *duc_cls;
+
+  /**
+   * Jobs for the worker.
+   */
+  struct Job *job_head;
+
+  /**
+   * Jobs for the worker.
+   */
+  struct Job *job_tail;
+
+  /**
+   * Events for the main thread.
+   */
+  struct Event *event_head;
+
+  /**
+   * Events for the main thread.
+   */
+  struct Event *event_tail;
+
+  /**
+   * Pipe used to wake up the scheduler of the main thread.
+   */
+  struct GNUNET_DISK_PipeHandle *wakeup;
+
+  /**
+   * Task reading from @e wakeup.
+   */
+  struct GNUNET_SCHEDULER_Task *wakeup_task;
+
+  /**
+   * Number of jobs submitted so far.
+   */
+  unsigned long long submitted;
+
+  /**
+   * Lock protecting the queues.
+   */
+  pthread_mutex_t lock;
+
+  /**
+   * Signalled when a job was queued.
+   */
+  pthread_cond_t job_cond;
+
+  /**
+   * Signalled when an event was queued.
+   */
+  pthread_cond_t event_cond;
+
+  /**
+   * Signalled when the main thread processed an item.
+   */
+  pthread_cond_t reply_cond;
+
+  /**
+   * The worker thread.
+   */
+  pthread_t thread;
+
+  /**
+   * #GNUNET_YES if the thread is running.
+   */
+  int running;
+
+  /**
+   * #GNUNET_YES while the main thread runs the processor for an
+   * item (the worker thread waits for its result meanwhile).
+   */
+  int in_proc;
+
+  /**
+   * #GNUNET_YES if the worker started a transaction that was not
+   * yet committed (only used by the worker thread).
+   */
+  int in_batch;
+
+};
+
+
+/**
+ * Queue an event for the main thread.  Must be called by the
+ * worker thread with the lock held.
+ *
+ * @param w the worker
+ * @param ev the event
+ */
+static void
+post_event (struct GSD_Worker *w,
+            struct Event *ev)
+{
+  static const char c = 0;
+  int wake;
+
+  wake = (NULL == w->event_head);
+  GNUNET_CONTAINER_DLL_insert_tail (w->event_head, w->event_tail, ev);
+  GNUNET_assert (0 == pthread_cond_broadcast (&w->event_cond));
+  if (wake)
+    (void) GNUNET_DISK_file_write (GNUNET_DISK_pipe_handle (w->wakeup,
+                                                            GNUNET_DISK_PIPE_END_WRITE),
+                                   &c,
+                                   sizeof (c));
+}
+
+
+/**
+ * Queue an event for the main thread that we do not wait for.
+ *
+ * @param w the worker
+ * @param ev the event, will be freed by the main thread
+ */
+static void
+post_event_async (struct GSD_Worker *w,
+                  struct Event *ev)
+{
+  GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+  post_event (w, ev);
+  GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+}
+
+
+/**
+ * Put continuation run by the worker.
+ *
+ * @param cls the `struct Job`
+ * @param key key for the item stored
+ * @param size size of the item stored
+ * @param status #GNUNET_OK or #GNUNET_SYSERR
+ * @param msg error message on error
+ */
+static void
+worker_put_cont (void *cls,
+                 const struct GNUNET_HashCode *key,
+                 uint32_t size,
+                 int status,
+                 const char *msg)
+{
+  struct Job *job = cls;
+  struct Event *ev;
+
+  ev = GNUNET_new (struct Event);
+  ev->type = EVENT_PUT;
+  ev->job = job;
+  ev->key_buf = *key;
+  ev->key = &ev->key_buf;
+  ev->size = size;
+  ev->status = status;
+  if (NULL != msg)
+    ev->msg = GNUNET_strdup (msg);
+  post_event_async (job->worker, ev);
+}
+
+
+/**
+ * Update continuation run by the worker.
+ *
+ * @param cls the `struct Job`
+ * @param status #GNUNET_OK or #GNUNET_SYSERR
+ * @param msg error message on error
+ */
+static void
+worker_update_cont (void *cls,
+                    int status,
+                    const char *msg)
+{
+  struct Job *job = cls;
+  struct Event *ev;
+
+  ev = GNUNET_new (struct Event);
+  ev->type = EVENT_UPDATE;
+  ev->job = job;
+  ev->status = status;
+  if (NULL != msg)
+    ev->msg = GNUNET_strdup (msg);
+  post_event_async (job->worker, ev);
+}
+
+
+/**
+ * Datum processor run by the worker, waits for the main thread
+ * to run the processor of the job.
+ *
+ * @param cls the `struct Job`
+ * @param key key for the content
+ * @param size number of bytes in data
+ * @param data content stored
+ * @param type type of the content
+ * @param priority priority of the content
+ * @param anonymity anonymity-level for the content
+ * @param expiration expiration time for the content
+ * @param uid unique identifier for the datum
+ * @return result of the processor of the job
+ */
+static int
+worker_proc (void *cls,
+             const struct GNUNET_HashCode *key,
+             uint32_t size,
+             const void *data,
+             enum GNUNET_BLOCK_Type type,
+             uint32_t priority,
+             uint32_t anonymity,
+             struct GNUNET_TIME_Absolute expiration,
+             uint64_t uid)
+{
+  struct Job *job = cls;
+  struct GSD_Worker *w = job->worker;
+  struct Event ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.type = EVENT_ITEM;
+  ev.job = job;
+  ev.key = key;
+  ev.size = size;
+  ev.data = data;
+  ev.btype = type;
+  ev.priority = priority;
+  ev.anonymity = anonymity;
+  ev.expiration = expiration;
+  ev.uid = uid;
+  GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+  post_event (w, &ev);
+  while (GNUNET_NO == ev.replied)
+    GNUNET_assert (0 == pthread_cond_wait (&w->reply_cond, &w->lock));
+  GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+  return ev.status;
+}
+
+
+/**
+ * Key processor run by the worker.
+ *
+ * @param cls the `struct Job`
+ * @param key key in the data store, NULL at the end
+ * @param count number of times the key occurs
+ */
+static void
+worker_key_proc (void *cls,
+                 const struct GNUNET_HashCode *key,
+                 unsigned int count)
+{
+  struct Job *job = cls;
+  struct Event *ev;
+
+  ev = GNUNET_new (struct Event);
+  ev->type = EVENT_KEY;
+  ev->job = job;
+  if (NULL != key)
+  {
+    ev->key_buf = *key;
+    ev->key = &ev->key_buf;
+  }
+  ev->count = count;
+  post_event_async (job->worker, ev);
+}
+
+
+/**
+ * Run a job on the worker thread.
+ *
+ * @param w the worker
+ * @param job the job
+ */
+static void
+run_job (struct GSD_Worker *w,
+         struct Job *job)
+{
+  struct GNUNET_DATASTORE_PluginFunctions *api = w->api;
+
+  switch (job->type)
+  {
+  case JOB_PUT:
+    api->put (api->cls, &job->key, job->size, job->data, job->btype,
+              job->priority, job->anonymity, job->replication,
+              job->expiration, &worker_put_cont, job);
+    break;
+  case JOB_UPDATE:
+    api->update (api->cls, job->offset, job->delta, job->expiration,
+                 &worker_update_cont, job);
+    break;
+  case JOB_GET_KEY:
+    api->get_key (api->cls, job->offset,
+                  (GNUNET_YES == job->have_key) ? &job->key : NULL,
+                  (GNUNET_YES == job->have_vhash) ? &job->vhash : NULL,
+                  job->btype, &worker_proc, job);
+    break;
+  case JOB_GET_ZERO_ANONYMITY:
+    api->get_zero_anonymity (api->cls, job->offset, job->btype,
+                             &worker_proc, job);
+    break;
+  case JOB_GET_REPLICATION:
+    api->get_replication (api->cls, &worker_proc, job);
+    break;
+  case JOB_GET_EXPIRATION:
+    api->get_expiration (api->cls, &worker_proc, job);
+    break;
+  case JOB_GET_KEYS:
+    api->get_keys (api->cls, &worker_key_proc, job);
+    break;
+  case JOB_ESTIMATE_SIZE:
+    api->estimate_size (api->cls, &job->estimate);
+    break;
+  case JOB_DROP:
+    api->drop (api->cls);
+    break;
+  case JOB_BEGIN_BATCH:
+    /* transactions do not nest, the caller that opened the current
+       one owns it until it commits */
+    if (GNUNET_YES == w->in_batch)
+    {
+      job->status = GNUNET_SYSERR;
+      break;
+    }
+    job->status = api->begin_batch (api->cls);
+    if (GNUNET_OK == job->status)
+      w->in_batch = GNUNET_YES;
+    break;
+  case JOB_END_BATCH:
+    if (GNUNET_YES != w->in_batch)
+    {
+      job->status = GNUNET_SYSERR;
+      break;
+    }
+    job->status = api->end_batch (api->cls);
+    w->in_batch = GNUNET_NO;
+    break;
+  case JOB_BARRIER:
+  case JOB_STOP:
+    break;
+  }
+}
+
+
+/**
+ * Main function of the worker thread.
+ *
+ * @param cls the `struct GSD_Worker`
+ * @return NULL
+ */
+static void *
+worker_main (void *cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+  struct Event *ev;
+  enum JobType type;
+
+  GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+  do
+  {
+    while (NULL == (job = w->job_head))
+      GNUNET_assert (0 == pthread_cond_wait (&w->job_cond, &w->lock));
+    GNUNET_CONTAINER_DLL_remove (w->job_head, w->job_tail, job);
+    GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+    type = job->type;
+    run_job (w, job);
+    ev = GNUNET_new (struct Event);
+    ev->type = EVENT_DONE;
+    ev->job = job;
+    GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+    post_event (w, ev);
+  }
+  while (JOB_STOP != type);
+  GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+  return NULL;
+}
+
+
+/**
+ * Handle an event in the main thread.
+ *
+ * @param w the worker
+ * @param ev the event
+ */
+static void
+handle_event (struct GSD_Worker *w,
+              struct Event *ev)
+{
+  struct Job *job = ev->job;
+  int ret;
+
+  switch (ev->type)
+  {
+  case EVENT_DUC:
+    w->duc (w->duc_cls, ev->delta);
+    break;
+  case EVENT_PUT:
+    job->put_cont (job->cont_cls, ev->key, ev->size, ev->status, ev->msg);
+    break;
+  case EVENT_UPDATE:
+    job->update_cont (job->cont_cls, ev->status, ev->msg);
+    break;
+  case EVENT_ITEM:
+    w->in_proc = GNUNET_YES;
+    ret = job->proc (job->cont_cls, ev->key, ev->size, ev->data,
+                     ev->btype, ev->priority, ev->anonymity,
+                     ev->expiration, ev->uid);
+    w->in_proc = GNUNET_NO;
+    GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+    ev->status = ret;
+    ev->replied = GNUNET_YES;
+    GNUNET_assert (0 == pthread_cond_broadcast (&w->reply_cond));
+    GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+    /* owned by the worker */
+    return;
+  case EVENT_KEY:
+    job->key_proc (job->cont_cls, ev->key, ev->count);
+    break;
+  case EVENT_DONE:
+    if ( (JOB_END_BATCH == job->type) &&
+         (NULL != job->batch_cont) )
+      job->batch_cont (job->cont_cls, job->status);
+    if (GNUNET_YES == job->sync)
+      job->done = GNUNET_YES;   /* freed by the waiting caller */
+    else
+      GNUNET_free (job);
+    break;
+  }
+  GNUNET_free_non_null (ev->msg);
+  GNUNET_free (ev);
+}
+
+
+/**
+ * Handle the events for the main thread, until there are none
+ * left or until the given job is done.
+ *
+ * @param w the worker
+ * @param until job to wait for, NULL to just handle the events
+ *        that are queued
+ */
+static void
+handle_events (struct GSD_Worker *w,
+               struct Job *until)
+{
+  struct Event *ev;
+
+  GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+  while ( (NULL == until) ||
+          (GNUNET_NO == until->done) )
+  {
+    if (NULL == (ev = w->event_head))
+    {
+      if (NULL == until)
+        break;
+      GNUNET_assert (0 == pthread_cond_wait (&w->event_cond, &w->lock));
+      continue;
+    }
+    GNUNET_CONTAINER_DLL_remove (w->event_head, w->event_tail, ev);
+    GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+    handle_event (w, ev);
+    GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+  }
+  GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+}
+
+
+/**
+ * The worker woke us up, handle its events.
+ *
+ * @param cls the `struct GSD_Worker`
+ * @param tc scheduler context
+ */
+static void
+wakeup_cb (void *cls,
+           const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct GSD_Worker *w = cls;
+  const struct GNUNET_DISK_FileHandle *rfd;
+  char buf[64];
+
+  rfd = GNUNET_DISK_pipe_handle (w->wakeup,
+                                 GNUNET_DISK_PIPE_END_READ);
+  while (0 < GNUNET_DISK_file_read_non_blocking (rfd, buf, sizeof (buf)))
+    ;
+  w->wakeup_task = GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                                   rfd,
+                                                   &wakeup_cb,
+                                                   w);
+  handle_events (w, NULL);
+}
+
+
+/**
+ * Create a job for the worker.
+ *
+ * @param w the worker
+ * @param type what to do
+ * @param size number of bytes of data to allocate with the job
+ * @return the job
+ */
+static struct Job *
+make_job (struct GSD_Worker *w,
+          enum JobType type,
+          size_t size)
+{
+  struct Job *job;
+
+  job = GNUNET_malloc (sizeof (struct Job) + size);
+  job->worker = w;
+  job->type = type;
+  return job;
+}
+
+
+/**
+ * Queue a job for the worker.
+ *
+ * @param w the worker
+ * @param job the job
+ */
+static void
+submit (struct GSD_Worker *w,
+        struct Job *job)
+{
+  w->submitted++;
+  GNUNET_assert (0 == pthread_mutex_lock (&w->lock));
+  GNUNET_CONTAINER_DLL_insert_tail (w->job_head, w->job_tail, job);
+  GNUNET_assert (0 == pthread_cond_signal (&w->job_cond));
+  GNUNET_assert (0 == pthread_mutex_unlock (&w->lock));
+}
+
+
+/**
+ * Queue a job for the worker and wait until it is done.  Must not
+ * be called from a processor for an item, as the worker waits for
+ * the processor and would never get to the job.
+ *
+ * @param w the worker
+ * @param job the job, to be freed by the caller
+ */
+static void
+submit_and_wait (struct GSD_Worker *w,
+                 struct Job *job)
+{
+  GNUNET_assert (GNUNET_NO == w->in_proc);
+  job->sync = GNUNET_YES;
+  submit (w, job);
+  handle_events (w, job);
+}
+
+
+/**
+ * Proxy for #PluginEstimateSize.
+ */
+static void
+proxy_estimate_size (void *cls,
+                     unsigned long long *estimate)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_ESTIMATE_SIZE, 0);
+  submit_and_wait (w, job);
+  if (NULL != estimate)
+    *estimate = job->estimate;
+  GNUNET_free (job);
+}
+
+
+/**
+ * Proxy for #PluginPut.
+ */
+static void
+proxy_put (void *cls,
+           const struct GNUNET_HashCode *key,
+           uint32_t size,
+           const void *data,
+           enum GNUNET_BLOCK_Type type,
+           uint32_t priority,
+           uint32_t anonymity,
+           uint32_t replication,
+           struct GNUNET_TIME_Absolute expiration,
+           PluginPutCont cont,
+           void *cont_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_PUT, size);
+  job->key = *key;
+  memcpy (&job[1], data, size);
+  job->data = &job[1];
+  job->size = size;
+  job->btype = type;
+  job->priority = priority;
+  job->anonymity = anonymity;
+  job->replication = replication;
+  job->expiration = expiration;
+  job->put_cont = cont;
+  job->cont_cls = cont_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginUpdate.
+ */
+static void
+proxy_update (void *cls,
+              uint64_t uid,
+              int delta,
+              struct GNUNET_TIME_Absolute expire,
+              PluginUpdateCont cont,
+              void *cont_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_UPDATE, 0);
+  job->offset = uid;
+  job->delta = delta;
+  job->expiration = expire;
+  job->update_cont = cont;
+  job->cont_cls = cont_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginGetKey.
+ */
+static void
+proxy_get_key (void *cls,
+               uint64_t offset,
+               const struct GNUNET_HashCode *key,
+               const struct GNUNET_HashCode *vhash,
+               enum GNUNET_BLOCK_Type type,
+               PluginDatumProcessor proc,
+               void *proc_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_GET_KEY, 0);
+  job->offset = offset;
+  if (NULL != key)
+  {
+    job->key = *key;
+    job->have_key = GNUNET_YES;
+  }
+  if (NULL != vhash)
+  {
+    job->vhash = *vhash;
+    job->have_vhash = GNUNET_YES;
+  }
+  job->btype = type;
+  job->proc = proc;
+  job->cont_cls = proc_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginGetType.
+ */
+static void
+proxy_get_zero_anonymity (void *cls,
+                          uint64_t offset,
+                          enum GNUNET_BLOCK_Type type,
+                          PluginDatumProcessor proc,
+                          void *proc_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_GET_ZERO_ANONYMITY, 0);
+  job->offset = offset;
+  job->btype = type;
+  job->proc = proc;
+  job->cont_cls = proc_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginGetRandom (replication).
+ */
+static void
+proxy_get_replication (void *cls,
+                       PluginDatumProcessor proc,
+                       void *proc_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_GET_REPLICATION, 0);
+  job->proc = proc;
+  job->cont_cls = proc_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginGetRandom (expiration).
+ */
+static void
+proxy_get_expiration (void *cls,
+                      PluginDatumProcessor proc,
+                      void *proc_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_GET_EXPIRATION, 0);
+  job->proc = proc;
+  job->cont_cls = proc_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginGetKeys.
+ */
+static void
+proxy_get_keys (void *cls,
+                PluginKeyProcessor proc,
+                void *proc_cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_GET_KEYS, 0);
+  job->key_proc = proc;
+  job->cont_cls = proc_cls;
+  submit (w, job);
+}
+
+
+/**
+ * Proxy for #PluginDrop.
+ */
+static void
+proxy_drop (void *cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+
+  job = make_job (w, JOB_DROP, 0);
+  submit_and_wait (w, job);
+  GNUNET_free (job);
+}
+
+
+/**
+ * Proxy for #PluginBatch (begin).
+ */
+static int
+proxy_begin_batch (void *cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+  int ret;
+
+  job = make_job (w, JOB_BEGIN_BATCH, 0);
+  submit_and_wait (w, job);
+  ret = job->status;
+  GNUNET_free (job);
+  return ret;
+}
+
+
+/**
+ * Proxy for #PluginBatch (end).
+ */
+static int
+proxy_end_batch (void *cls)
+{
+  struct GSD_Worker *w = cls;
+  struct Job *job;
+  int ret;
+
+  job = make_job (w, JOB_END_BATCH, 0);
+  submit_and_wait (w, job);
+  ret = job->status;
+  GNUNET_free (job);
+  return ret;
+}
+
+#endif
+
+
+/**
+ * Create a worker.  The plugin must be loaded with
+ * #GSD_worker_duc_() as its disk utilization callback and the
+ * worker as its closure, then handed to #GSD_worker_start_().
+ *
+ * @param duc function to call (in the main thread) with changes
+ *        of the disk utilization
+ * @param duc_cls closure for @a duc
+ * @return NULL if we cannot use threads on this platform
+ */
+struct GSD_Worker *
+GSD_worker_create_ (GNUNET_DATASTORE_DiskUtilizationChange duc,
+                    void *duc_cls)
+{
+#if HAVE_PTHREAD_H
+  struct GSD_Worker *w;
+
+  w = GNUNET_new (struct GSD_Worker);
+  w->duc = duc;
+  w->duc_cls = duc_cls;
+  w->wakeup = GNUNET_DISK_pipe (GNUNET_NO, GNUNET_NO, GNUNET_NO, GNUNET_NO);
+  if (NULL == w->wakeup)
+  {
+    GNUNET_free (w);
+    return NULL;
+  }
+  GNUNET_assert (0 == pthread_mutex_init (&w->lock, NULL));
+  GNUNET_assert (0 == pthread_cond_init (&w->job_cond, NULL));
+  GNUNET_assert (0 == pthread_cond_init (&w->event_cond, NULL));
+  GNUNET_assert (0 == pthread_cond_init (&w->reply_cond, NULL));
+  return w;
+#else
+  return NULL;
+#endif
+}
+
+
+/**
+ * Disk utilization callback for plugins run by a worker, passes
+ * the change on to the main thread.
+ *
+ * @param cls the `struct GSD_Worker`
+ * @param delta change in disk utilization, 0 for "reset to empty"
+ */
+void
+GSD_worker_duc_ (void *cls,
+                 int delta)
+{
+#if HAVE_PTHREAD_H
+  struct GSD_Worker *w = cls;
+  struct Event *ev;
+
+  if ( (GNUNET_NO == w->running) ||
+       (! pthread_equal (pthread_self (), w->thread)) )
+  {
+    /* called while loading or unloading the plugin */
+    w->duc (w->duc_cls, delta);
+    return;
+  }
+  ev = GNUNET_new (struct Event);
+  ev->type = EVENT_DUC;
+  ev->delta = delta;
+  post_event_async (w, ev);
+#endif
+}
+
+
+/**
+ * Start running the database operations of a plugin on the
+ * worker's thread.  All callbacks of the returned API are called
+ * in the main thread; operations that return their result
+ * directly (estimating the size, dropping the database, starting
+ * and committing transactions) wait for the worker.
+ *
+ * @param w the worker
+ * @param api API of the plugin
+ * @return API to use instead of @a api, NULL on error
+ */
+struct GNUNET_DATASTORE_PluginFunctions *
+GSD_worker_start_ (struct GSD_Worker *w,
+                   struct GNUNET_DATASTORE_PluginFunctions *api)
+{
+#if HAVE_PTHREAD_H
+  w->api = api;
+  w->proxy.cls = w;
+  w->proxy.estimate_size = &proxy_estimate_size;
+  w->proxy.put = &proxy_put;
+  w->proxy.update = &proxy_update;
+  w->proxy.get_key = &proxy_get_key;
+  w->proxy.get_zero_anonymity = &proxy_get_zero_anonymity;
+  w->proxy.get_replication = &proxy_get_replication;
+  w->proxy.get_expiration = &proxy_get_expiration;
+  w->proxy.drop = &proxy_drop;
+  if (NULL != api->get_keys)
+    w->proxy.get_keys = &proxy_get_keys;
+  if ( (NULL != api->begin_batch) &&
+       (NULL != api->end_batch) )
+  {
+    w->proxy.begin_batch = &proxy_begin_batch;
+    w->proxy.end_batch = &proxy_end_batch;
+  }
+  if (0 != pthread_create (&w->thread, NULL, &worker_main, w))
+  {
+    GNUNET_log_strerror (GNUNET_ERROR_TYPE_WARNING,
+                         "pthread_create");
+    return NULL;
+  }
+  w->running = GNUNET_YES;
+  w->wakeup_task
+    = GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                      GNUNET_DISK_pipe_handle (w->wakeup,
+                                                               GNUNET_DISK_PIPE_END_READ),
+                                      &wakeup_cb,
+                                      w);
+  return &w->proxy;
+#else
+  return NULL;
+#endif
+}
+
+
+/**
+ * Commit the current plugin transaction without waiting for it.
+ *
+ * @param w the worker
+ * @param cont function to call once the transaction was committed,
+ *        can be NULL
+ * @param cont_cls closure for @a cont
+ */
+void
+GSD_worker_end_batch_ (struct GSD_Worker *w,
+                       GSD_BatchContinuation cont,
+                       void *cont_cls)
+{
+#if HAVE_PTHREAD_H
+  struct Job *job;
+
+  job = make_job (w, JOB_END_BATCH, 0);
+  job->batch_cont = cont;
+  job->cont_cls = cont_cls;
+  submit (w, job);
+#endif
+}
+
+
+/**
+ * Wait until the worker completed all operations, including those
+ * started by the callbacks of the operations.
+ *
+ * @param w the worker
+ */
+void
+GSD_worker_drain_ (struct GSD_Worker *w)
+{
+#if HAVE_PTHREAD_H
+  struct Job *job;
+  unsigned long long submitted;
+
+  if (GNUNET_NO == w->running)
+    return;
+  do
+  {
+    submitted = w->submitted;
+    job = make_job (w, JOB_BARRIER, 0);
+    submit_and_wait (w, job);
+    GNUNET_free (job);
+  }
+  /* callbacks run while waiting may have started more jobs */
+  while (submitted + 1 != w->submitted);
+#endif
+}
+
+
+/**
+ * Stop a worker, after it completed all pending operations.
+ *
+ * @param w the worker to destroy
+ */
+void
+GSD_worker_destroy_ (struct GSD_Worker *w)
+{
+#if HAVE_PTHREAD_H
+  struct Job *job;
+
+  if (GNUNET_YES == w->running)
+  {
+    GSD_worker_drain_ (w);
+    job = make_job (w, JOB_STOP, 0);
+    submit_and_wait (w, job);
+    GNUNET_free (job);
+    GNUNET_assert (0 == pthread_join (w->thread, NULL));
+    w->running = GNUNET_NO;
+  }
+  if (NULL != w->wakeup_task)
+  {
+    GNUNET_SCHEDULER_cancel (w->wakeup_task);
+    w->wakeup_task = NULL;
+  }
+  GNUNET_break (NULL == w->event_head);
+  GNUNET_assert (0 == pthread_cond_destroy (&w->reply_cond));
+  GNUNET_assert (0 == pthread_cond_destroy (&w->event_cond));
+  GNUNET_assert (0 == pthread_cond_destroy (&w->job_cond));
+  GNUNET_assert (0 == pthread_mutex_destroy (&w->lock));
+  GNUNET_DISK_pipe_close (w->wakeup);
+  GNUNET_free (w);
+#endif
+}
+
+
+/* end of gnunet-service-datastore_worker.c */
@@ -0,0 +1,127 @@
+/*
+     This file is part of GNUnet.
+     Copyright (C) 2016 GNUnet e.V.
+
+     GNUnet is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with GNUnet; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file datastore/gnunet-service-datastore_worker.h
+ * @brief run the datastore plugin on a separate thread
+ */
+#ifndef GNUNET_SERVICE_DATASTORE_WORKER_H
+#define GNUNET_SERVICE_DATASTORE_WORKER_H
+
+#include "gnunet_util_lib.h"
+#include "gnunet_datastore_plugin.h"
+
+
+/**
+ * Thread that runs the database operations of a plugin.
+ */
+struct GSD_Worker;
+
+
+/**
+ * Function called once a transaction was committed.
+ *
+ * @param cls closure
+ * @param status #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+typedef void
+(*GSD_BatchContinuation) (void *cls,
+                          int status);
+
+
+/**
+ * Create a worker.  The plugin must be loaded with
+ * #GSD_worker_duc_() as its disk utilization callback and the
+ * worker as its closure, then handed to #GSD_worker_start_().
+ *
+ * @param duc function to call (in the main thread) with changes
+ *        of the disk utilization
+ * @param duc_cls closure for @a duc
+ * @return NULL if we cannot use threads on this platform
+ */
+struct GSD_Worker *
+GSD_worker_create_ (GNUNET_DATASTORE_DiskUtilizationChange duc,
+                    void *duc_cls);
+
+
+/**
+ * Disk utilization callback for plugins run by a worker, passes
+ * the change on to the main thread.
+ *
+ * @param cls the `struct GSD_Worker`
+ * @param delta change in disk utilization, 0 for "reset to empty"
+ */
+void
+GSD_worker_duc_ (void *cls,
+                 int delta);
+
+
+/**
+ * Start running the database operations of a plugin on the
+ * worker's thread.  All callbacks of the returned API are called
+ * in the main thread; operations that return their result
+ * directly (estimating the size, dropping the database, starting
+ * and committing transactions) wait for the worker and return its
+ * result.  These must not be called from a processor for an item.
+ *
+ * @param w the worker
+ * @param api API of the plugin
+ * @return API to use instead of @a api, NULL on error
+ */
+struct GNUNET_DATASTORE_PluginFunctions *
+GSD_worker_start_ (struct GSD_Worker *w,
+                   struct GNUNET_DATASTORE_PluginFunctions *api);
+
+
+/**
+ * Commit the current plugin transaction without waiting for it.
+ *
+ * @param w the worker
+ * @param cont function to call once the transaction was committed,
+ *        can be NULL
+ * @param cont_cls closure for @a cont
+ */
+void
+GSD_worker_end_batch_ (struct GSD_Worker *w,
+                       GSD_BatchContinuation cont,
+                       void *cont_cls);
+
+
+/**
+ * Wait until the worker completed all operations, including those
+ * started by the callbacks of the operations.
+ *
+ * @param w the worker
+ */
+void
+GSD_worker_drain_ (struct GSD_Worker *w);
+
+
+/**
+ * Stop a worker, after it completed all pending operations.
+ *
+ * @param w the worker to destroy
+ */
+void
+GSD_worker_destroy_ (struct GSD_Worker *w);
+
+
+#endif
+/* end of gnunet-service-datastore_worker.h */
@@ -0,0 +1,2117 @@
+/*
+     This file is part of GNUnet
+     Copyright (C) 2016 GNUnet e.V.
+
+     GNUnet is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with GNUnet; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file datastore/plugin_datastore_log.c
+ * @brief log-structured datastore backend
+ *
+ * All changes to the database are appended to a log that is split
+ * into segment files of (at most) SEGMENT_SIZE bytes.  A put appends
+ * the value, updates and deletions append small records that refer to
+ * the record ID of the value.  The index (key to value, expiration
+ * and replication heaps, zero-anonymity arrays) is kept in memory, in
+ * the same way as in the heap plugin, and is rebuilt on startup by
+ * replaying the log.  Only the value data stays on disk.
+ *
+ * Space is reclaimed by compacting the oldest segment: its live
+ * values are appended to the log again (with their current metadata),
+ * the copies are synced to disk and the segment is deleted.  Update
+ * and deletion records in later segments may still refer to values of
+ * a deleted segment; on replay, they either refer to values that no
+ * longer exist (deleted values are not copied) or come before the
+ * copy of the value, so they are ignored.  Compaction is done a few
+ * records at a time whenever the service asks for values to expire or
+ * replicate, and only if a sufficient fraction of the log is garbage.
+ *
+ * The payload is not reported to the service while replaying the log
+ * on startup, as the service restores it from its statistics (or from
+ * our size estimate), just like with the other plugins.
+ */
+
+#include "platform.h"
+#include "gnunet_datastore_plugin.h"
+
+#define LOG(kind,...) GNUNET_log_from (kind, "datastore-log", __VA_ARGS__)
+
+#define LOG_STRERROR_FILE(kind,syscall,filename) GNUNET_log_from_strerror_file (kind, "datastore-log", syscall, filename)
+
+/**
+ * Magic number at the beginning of each record.
+ */
+#define RECORD_MAGIC 0x474E4C47
+
+/**
+ * Maximum number of bytes we copy in one compaction step.
+ */
+#define COMPACT_STEP_BYTES (1024 * 1024)
+
+/**
+ * Types of records in the log.
+ */
+enum RecordKind
+{
+  /**
+   * A value, followed by its data.
+   */
+  RECORD_PUT = 1,
+
+  /**
+   * New priority, replication level and expiration
+   * time of a value.
+   */
+  RECORD_UPDATE = 2,
+
+  /**
+   * Deletion of a value.
+   */
+  RECORD_DELETE = 3,
+
+  /**
+   * End of the usable part of a segment, written when we
+   * find a partially written record after a crash.
+   */
+  RECORD_END = 4
+};
+
+
+GNUNET_NETWORK_STRUCT_BEGIN
+
+/**
+ * Header of a record in the log.  All fields are in NBO.
+ */
+struct RecordHeader
+{
+  /**
+   * Always #RECORD_MAGIC.
+   */
+  uint32_t magic GNUNET_PACKED;
+
+  /**
+   * An `enum RecordKind`.
+   */
+  uint32_t kind GNUNET_PACKED;
+
+  /**
+   * CRC32 over the record (with this field set to zero)
+   * and the data that follows it.
+   */
+  uint32_t crc GNUNET_PACKED;
+
+  /**
+   * Number of bytes of data following this header; only
+   * non-zero for #RECORD_PUT.
+   */
+  uint32_t size GNUNET_PACKED;
+
+  /**
+   * ID of the value this record is about.
+   */
+  uint64_t rid GNUNET_PACKED;
+
+  /**
+   * Type of the value.
+   */
+  uint32_t type GNUNET_PACKED;
+
+  /**
+   * Priority of the value.
+   */
+  uint32_t priority GNUNET_PACKED;
+
+  /**
+   * Anonymity level of the value.
+   */
+  uint32_t anonymity GNUNET_PACKED;
+
+  /**
+   * Replication level of the value.
+   */
+  uint32_t replication GNUNET_PACKED;
+
+  /**
+   * Expiration time of the value.
+   */
+  struct GNUNET_TIME_AbsoluteNBO expiration;
+
+  /**
+   * Key of the value.
+   */
+  struct GNUNET_HashCode key;
+
+};
+
+GNUNET_NETWORK_STRUCT_END
+
+
+/**
+ * A segment of the log.
+ */
+struct Segment
+{
+
+  /**
+   * We keep segments in a DLL, oldest first.
+   */
+  struct Segment *next;
+
+  /**
+   * We keep segments in a DLL, oldest first.
+   */
+  struct Segment *prev;
+
+  /**
+   * Handle of the segment file.
+   */
+  struct GNUNET_DISK_FileHandle *fh;
+
+  /**
+   * Number of bytes in the segment.
+   */
+  uint64_t size;
+
+  /**
+   * Number of bytes in the segment used by live values.
+   */
+  uint64_t live;
+
+  /**
+   * Number of the segment; segments are numbered in
+   * the order in which they are created.
+   */
+  uint32_t id;
+
+  /**
+   * #GNUNET_YES if we appended to the segment since it
+   * was last synced to disk.
+   */
+  int unsynced;
+
+};
+
+
+/**
+ * A value that we are storing.
+ */
+struct Value
+{
+
+  /**
+   * Key for the value.
+   */
+  struct GNUNET_HashCode key;
+
+  /**
+   * Segment the value is stored in.
+   */
+  struct Segment *segment;
+
+  /**
+   * Offset of the value's record in the @e segment.
+   */
+  uint64_t offset;
+
+  /**
+   * Record ID of the value, also used as its UID.
+   */
+  uint64_t rid;
+
+  /**
+   * First 64 bits of the hash of the data, so that lookups by
+   * value hash do not have to read the data of every candidate.
+   */
+  uint64_t vhash_prefix;
+
+  /**
+   * Entry for this value in the 'expire' heap.
+   */
+  struct GNUNET_CONTAINER_HeapNode *expire_heap;
+
+  /**
+   * Entry for this value in the 'replication' heap.
+   */
+  struct GNUNET_CONTAINER_HeapNode *replication_heap;
+
+  /**
+   * Expiration time for this value.
+   */
+  struct GNUNET_TIME_Absolute expiration;
+
+  /**
+   * Offset of this value in the array of the 'struct ZeroAnonByType';
+   * only used if anonymity is zero.
+   */
+  unsigned int zero_anon_offset;
+
+  /**
+   * Number of bytes of data.
+   */
+  uint32_t size;
+
+  /**
+   * Priority of the value.
+   */
+  uint32_t priority;
+
+  /**
+   * Anonymity level for the value.
+   */
+  uint32_t anonymity;
+
+  /**
+   * Replication level for the value.
+   */
+  uint32_t replication;
+
+  /**
+   * Type of the data.
+   */
+  enum GNUNET_BLOCK_Type type;
+
+};
+
+
+/**
+ * We organize 0-anonymity values in arrays "by type".
+ */
+struct ZeroAnonByType
+{
+
+  /**
+   * We keep these in a DLL.
+   */
+  struct ZeroAnonByType *next;
+
+  /**
+   * We keep these in a DLL.
+   */
+  struct ZeroAnonByType *prev;
+
+  /**
+   * Array of 0-anonymity items of the given type.
+   */
+  struct Value **array;
+
+  /**
+   * Allocated size of the array.
+   */
+  unsigned int array_size;
+
+  /**
+   * First unused offset in 'array'.
+   */
+  unsigned int array_pos;
+
+  /**
+   * Type of all of the values in 'array'.
+   */
+  enum GNUNET_BLOCK_Type type;
+};
+
+
+/**
+ * Context for all functions in this plugin.
+ */
+struct Plugin
+{
+  /**
+   * Our execution environment.
+   */
+  struct GNUNET_DATASTORE_PluginEnvironment *env;
+
+  /**
+   * Directory with the segment files.
+   */
+  char *dir;
+
+  /**
+   * Mapping from keys to 'struct Value's.
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *keyvalue;
+
+  /**
+   * Mapping from (the lower 32 bits of) record IDs to 'struct Value's.
+   */
+  struct GNUNET_CONTAINER_MultiHashMap32 *by_rid;
+
+  /**
+   * Heap organized by minimum expiration time.
+   */
+  struct GNUNET_CONTAINER_Heap *by_expiration;
+
+  /**
+   * Heap organized by maximum replication value.
+   */
+  struct GNUNET_CONTAINER_Heap *by_replication;
+
+  /**
+   * Head of list of arrays containing zero-anonymity values by type.
+   */
+  struct ZeroAnonByType *zero_head;
+
+  /**
+   * Tail of list of arrays containing zero-anonymity values by type.
+   */
+  struct ZeroAnonByType *zero_tail;
+
+  /**
+   * Oldest segment.
+   */
+  struct Segment *seg_head;
+
+  /**
+   * Newest segment, the one we append to.
+   */
+  struct Segment *seg_tail;
+
+  /**
+   * Offset of the next record to look at in the oldest segment,
+   * if we are compacting it.
+   */
+  uint64_t compact_offset;
+
+  /**
+   * Number of bytes in all segments.
+   */
+  uint64_t disk_size;
+
+  /**
+   * Number of bytes in all segments used by live values.
+   */
+  uint64_t live_size;
+
+  /**
+   * Maximum size of a segment.
+   */
+  unsigned long long segment_size;
+
+  /**
+   * Record ID to use for the next value.
+   */
+  uint64_t next_rid;
+
+};
+
+
+/**
+ * Size of the record of a value on disk.
+ *
+ * @param value the value
+ * @return number of bytes
+ */
+static uint64_t
+record_size (const struct Value *value)
+{
+  return sizeof (struct RecordHeader) + value->size;
+}
+
+
+/**
+ * Get the name of a segment file.
+ *
+ * @param plugin the plugin
+ * @param id number of the segment
+ * @return file name, to be freed by the caller
+ */
+static char *
+segment_filename (struct Plugin *plugin,
+                  uint32_t id)
+{
+  char *fn;
+
+  GNUNET_asprintf (&fn,
+                   "%s%ssegment-%08u.dat",
+                   plugin->dir,
+                   DIR_SEPARATOR_STR,
+                   (unsigned int) id);
+  return fn;
+}
+
+
+/**
+ * Open a segment file and add it to the end of the list of segments.
+ *
+ * @param plugin the plugin
+ * @param id number of the segment
+ * @return NULL on error
+ */
+static struct Segment *
+segment_open (struct Plugin *plugin,
+              uint32_t id)
+{
+  struct Segment *seg;
+  char *fn;
+  off_t size;
+
+  fn = segment_filename (plugin, id);
+  seg = GNUNET_new (struct Segment);
+  seg->id = id;
+  seg->fh = GNUNET_DISK_file_open (fn,
+                                   GNUNET_DISK_OPEN_READWRITE | GNUNET_DISK_OPEN_CREATE,
+                                   GNUNET_DISK_PERM_USER_READ | GNUNET_DISK_PERM_USER_WRITE);
+  if (NULL == seg->fh)
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_ERROR, "open", fn);
+    GNUNET_free (fn);
+    GNUNET_free (seg);
+    return NULL;
+  }
+  if (GNUNET_OK != GNUNET_DISK_file_handle_size (seg->fh, &size))
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_ERROR, "fstat", fn);
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (seg->fh));
+    GNUNET_free (fn);
+    GNUNET_free (seg);
+    return NULL;
+  }
+  GNUNET_free (fn);
+  seg->size = size;
+  plugin->disk_size += seg->size;
+  GNUNET_CONTAINER_DLL_insert_tail (plugin->seg_head,
+                                    plugin->seg_tail,
+                                    seg);
+  return seg;
+}
+
+
+/**
+ * Close a segment and remove it from the list of segments.
+ *
+ * @param plugin the plugin
+ * @param seg segment to close
+ * @param do_unlink #GNUNET_YES to also delete the segment file
+ */
+static void
+segment_close (struct Plugin *plugin,
+               struct Segment *seg,
+               int do_unlink)
+{
+  char *fn;
+
+  GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (seg->fh));
+  if (GNUNET_YES == do_unlink)
+  {
+    fn = segment_filename (plugin, seg->id);
+    if (0 != UNLINK (fn))
+      LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING, "unlink", fn);
+    GNUNET_free (fn);
+  }
+  if (seg == plugin->seg_head)
+    plugin->compact_offset = 0;
+  GNUNET_CONTAINER_DLL_remove (plugin->seg_head,
+                               plugin->seg_tail,
+                               seg);
+  plugin->disk_size -= seg->size;
+  GNUNET_free (seg);
+}
+
+
+/**
+ * Read from a segment.
+ *
+ * @param seg segment to read from
+ * @param offset where to start reading
+ * @param buf where to write the data
+ * @param size number of bytes to read
+ * @return #GNUNET_OK on success
+ */
+static int
+segment_read (struct Segment *seg,
+              uint64_t offset,
+              void *buf,
+              size_t size)
+{
+  if ( (offset != GNUNET_DISK_file_seek (seg->fh,
+                                         offset,
+                                         GNUNET_DISK_SEEK_SET)) ||
+       (size != GNUNET_DISK_file_read (seg->fh,
+                                       buf,
+                                       size)) )
+    return GNUNET_SYSERR;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Append a record to the log, starting a new segment if
+ * the current one is full.
+ *
+ * @param plugin the plugin
+ * @param hdr header of the record, crc is filled in
+ * @param data data to append after the header
+ * @param size number of bytes in @a data
+ * @param seg set to the segment the record was written to
+ * @param offset set to the offset of the record in @a seg
+ * @return #GNUNET_OK on success
+ */
+static int
+append_record (struct Plugin *plugin,
+               struct RecordHeader *hdr,
+               const void *data,
+               uint32_t size,
+               struct Segment **seg,
+               uint64_t *offset)
+{
+  struct Segment *tail;
+  size_t rsize;
+  char *buf;
+
+  tail = plugin->seg_tail;
+  rsize = sizeof (struct RecordHeader) + size;
+  if ( (NULL == tail) ||
+       ( (tail->size > 0) &&
+         (tail->size + rsize > plugin->segment_size) ) )
+  {
+    tail = segment_open (plugin,
+                         (NULL == tail) ? 1 : tail->id + 1);
+    if (NULL == tail)
+      return GNUNET_SYSERR;
+  }
+  hdr->magic = htonl (RECORD_MAGIC);
+  hdr->size = htonl (size);
+  hdr->crc = htonl (0);
+  buf = GNUNET_malloc (rsize);
+  memcpy (buf, hdr, sizeof (struct RecordHeader));
+  if (0 != size)
+    memcpy (&buf[sizeof (struct RecordHeader)], data, size);
+  hdr->crc = htonl (GNUNET_CRYPTO_crc32_n (buf, rsize));
+  memcpy (buf, hdr, sizeof (struct RecordHeader));
+  if ( (tail->size != GNUNET_DISK_file_seek (tail->fh,
+                                             tail->size,
+                                             GNUNET_DISK_SEEK_SET)) ||
+       (rsize != GNUNET_DISK_file_write (tail->fh,
+                                         buf,
+                                         rsize)) )
+  {
+    LOG (GNUNET_ERROR_TYPE_ERROR,
+         _("Failed to append to segment %u: %s\n"),
+         (unsigned int) tail->id,
+         STRERROR (errno));
+    GNUNET_free (buf);
+    return GNUNET_SYSERR;
+  }
+  GNUNET_free (buf);
+  if (NULL != seg)
+    *seg = tail;
+  if (NULL != offset)
+    *offset = tail->size;
+  tail->unsynced = GNUNET_YES;
+  tail->size += rsize;
+  plugin->disk_size += rsize;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Fill in the metadata of a record header from a value.
+ *
+ * @param value the value
+ * @param kind kind of the record
+ * @param hdr header to initialize
+ */
+static void
+value_to_header (const struct Value *value,
+                 enum RecordKind kind,
+                 struct RecordHeader *hdr)
+{
+  memset (hdr, 0, sizeof (struct RecordHeader));
+  hdr->kind = htonl (kind);
+  hdr->rid = GNUNET_htonll (value->rid);
+  hdr->type = htonl (value->type);
+  hdr->priority = htonl (value->priority);
+  hdr->anonymity = htonl (value->anonymity);
+  hdr->replication = htonl (value->replication);
+  hdr->expiration = GNUNET_TIME_absolute_hton (value->expiration);
+  hdr->key = value->key;
+}
+
+
+/**
+ * Log new metadata of a value.  The caller must only change
+ * the value once this succeeded.
+ *
+ * @param plugin the plugin
+ * @param value the value
+ * @param priority new priority
+ * @param replication new replication level
+ * @param expiration new expiration time
+ * @return #GNUNET_OK on success
+ */
+static int
+log_update (struct Plugin *plugin,
+            const struct Value *value,
+            uint32_t priority,
+            uint32_t replication,
+            struct GNUNET_TIME_Absolute expiration)
+{
+  struct RecordHeader hdr;
+
+  value_to_header (value, RECORD_UPDATE, &hdr);
+  hdr.priority = htonl (priority);
+  hdr.replication = htonl (replication);
+  hdr.expiration = GNUNET_TIME_absolute_hton (expiration);
+  return append_record (plugin, &hdr, NULL, 0, NULL, NULL);
+}
+
+
+/**
+ * Closure for #find_value_it.
+ */
+struct FindContext
+{
+  /**
+   * Record ID we are looking for.
+   */
+  uint64_t rid;
+
+  /**
+   * Set to the value with that ID.
+   */
+  struct Value *value;
+};
+
+
+/**
+ * Check if a value has the record ID we are looking for.
+ *
+ * @param cls the `struct FindContext`
+ * @param key lower 32 bits of the record ID
+ * @param val the `struct Value`
+ * @return #GNUNET_NO if we found the value
+ */
+static int
+find_value_it (void *cls,
+               uint32_t key,
+               void *val)
+{
+  struct FindContext *fc = cls;
+  struct Value *value = val;
+
+  if (value->rid != fc->rid)
+    return GNUNET_OK;
+  fc->value = value;
+  return GNUNET_NO;
+}
+
+
+/**
+ * Get the first 64 bits of a hash.
+ *
+ * @param hc the hash
+ * @return its first 64 bits
+ */
+static uint64_t
+hash_prefix (const struct GNUNET_HashCode *hc)
+{
+  uint64_t prefix;
+
+  memcpy (&prefix, hc, sizeof (prefix));
+  return prefix;
+}
+
+
+/**
+ * Hash data and get the first 64 bits of the hash.
+ *
+ * @param data the data
+ * @param size number of bytes in @a data
+ * @return first 64 bits of the hash of @a data
+ */
+static uint64_t
+data_hash_prefix (const void *data,
+                  uint32_t size)
+{
+  struct GNUNET_HashCode vh;
+
+  GNUNET_CRYPTO_hash (data, size, &vh);
+  return hash_prefix (&vh);
+}
+
+
+/**
+ * Find a value by its record ID.
+ *
+ * @param plugin the plugin
+ * @param rid the record ID
+ * @return NULL if there is no such value
+ */
+static struct Value *
+find_value (struct Plugin *plugin,
+            uint64_t rid)
+{
+  struct FindContext fc;
+
+  fc.rid = rid;
+  fc.value = NULL;
+  GNUNET_CONTAINER_multihashmap32_get_multiple (plugin->by_rid,
+                                                (uint32_t) rid,
+                                                &find_value_it,
+                                                &fc);
+  return fc.value;
+}
+
+
+/**
+ * Add a value to the in-memory index.
+ *
+ * @param plugin the plugin
+ * @param value the value, all fields except the heap nodes
+ *        and the zero-anonymity offset must be initialized
+ */
+static void
+index_value (struct Plugin *plugin,
+             struct Value *value)
+{
+  value->expire_heap = GNUNET_CONTAINER_heap_insert (plugin->by_expiration,
+						     value,
+						     value->expiration.abs_value_us);
+  value->replication_heap = GNUNET_CONTAINER_heap_insert (plugin->by_replication,
+							  value,
+							  value->replication);
+  if (0 == value->anonymity)
+  {
+    struct ZeroAnonByType *zabt;
+
+    for (zabt = plugin->zero_head; NULL != zabt; zabt = zabt->next)
+      if (zabt->type == value->type)
+	break;
+    if (NULL == zabt)
+    {
+      zabt = GNUNET_new (struct ZeroAnonByType);
+      zabt->type = value->type;
+      GNUNET_CONTAINER_DLL_insert (plugin->zero_head,
+				   plugin->zero_tail,
+				   zabt);
+    }
+    if (zabt->array_size == zabt->array_pos)
+    {
+      GNUNET_array_grow (zabt->array,
+			 zabt->array_size,
+			 zabt->array_size * 2 + 4);
+    }
+    value->zero_anon_offset = zabt->array_pos;
+    zabt->array[zabt->array_pos++] = value;
+  }
+  GNUNET_CONTAINER_multihashmap_put (plugin->keyvalue,
+				     &value->key,
+				     value,
+				     GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE);
+  GNUNET_CONTAINER_multihashmap32_put (plugin->by_rid,
+                                       (uint32_t) value->rid,
+                                       value,
+                                       GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE);
+  value->segment->live += record_size (value);
+  plugin->live_size += record_size (value);
+}
+
+
+/**
+ * Remove a value from the in-memory index and free it.
+ *
+ * @param plugin the plugin
+ * @param value value to remove
+ */
+static void
+unindex_value (struct Plugin *plugin,
+               struct Value *value)
+{
+  GNUNET_assert (GNUNET_YES ==
+		 GNUNET_CONTAINER_multihashmap_remove (plugin->keyvalue,
+						       &value->key,
+						       value));
+  GNUNET_assert (GNUNET_YES ==
+		 GNUNET_CONTAINER_multihashmap32_remove (plugin->by_rid,
+                                                         (uint32_t) value->rid,
+                                                         value));
+  GNUNET_assert (value == GNUNET_CONTAINER_heap_remove_node (value->expire_heap));
+  GNUNET_assert (value == GNUNET_CONTAINER_heap_remove_node (value->replication_heap));
+  if (0 == value->anonymity)
+  {
+    struct ZeroAnonByType *zabt;
+
+    for (zabt = plugin->zero_head; NULL != zabt; zabt = zabt->next)
+      if (zabt->type == value->type)
+	break;
+    GNUNET_assert (NULL != zabt);
+    zabt->array[value->zero_anon_offset] = zabt->array[--zabt->array_pos];
+    zabt->array[value->zero_anon_offset]->zero_anon_offset = value->zero_anon_offset;
+    if (0 == zabt->array_pos)
+    {
+      GNUNET_array_grow (zabt->array,
+			 zabt->array_size,
+			 0);
+      GNUNET_CONTAINER_DLL_remove (plugin->zero_head,
+				   plugin->zero_tail,
+				   zabt);
+      GNUNET_free (zabt);
+    }
+  }
+  value->segment->live -= record_size (value);
+  plugin->live_size -= record_size (value);
+  GNUNET_free (value);
+}
+
+
+/**
+ * Delete the given value, logging the deletion and removing it from
+ * the plugin's data structures.
+ *
+ * @param plugin the plugin
+ * @param value value to delete
+ */
+static void
+delete_value (struct Plugin *plugin,
+	      struct Value *value)
+{
+  struct RecordHeader hdr;
+
+  value_to_header (value, RECORD_DELETE, &hdr);
+  if (GNUNET_OK !=
+      append_record (plugin, &hdr, NULL, 0, NULL, NULL))
+    GNUNET_break (0);
+  plugin->env->duc (plugin->env->cls,
+                    - (value->size + GNUNET_DATASTORE_ENTRY_OVERHEAD));
+  unindex_value (plugin, value);
+}
+
+
+/**
+ * Change the replication level of a value.
+ *
+ * @param plugin the plugin
+ * @param value the value
+ * @param replication new replication level
+ */
+static void
+set_replication (struct Plugin *plugin,
+                 struct Value *value,
+                 uint32_t replication)
+{
+  value->replication = replication;
+  GNUNET_CONTAINER_heap_update_cost (plugin->by_replication,
+                                     value->replication_heap,
+                                     replication);
+}
+
+
+/**
+ * Change the expiration time of a value.
+ *
+ * @param plugin the plugin
+ * @param value the value
+ * @param expiration new expiration time
+ */
+static void
+set_expiration (struct Plugin *plugin,
+                struct Value *value,
+                struct GNUNET_TIME_Absolute expiration)
+{
+  value->expiration = expiration;
+  GNUNET_CONTAINER_heap_update_cost (plugin->by_expiration,
+                                     value->expire_heap,
+                                     expiration.abs_value_us);
+}
+
+
+/**
+ * Read the data of a value and pass it to a processor.  If the
+ * processor returns #GNUNET_NO, the value is deleted.
+ *
+ * @param plugin the plugin
+ * @param value the value
+ * @param proc function to call with the value
+ * @param proc_cls closure for @a proc
+ */
+static void
+return_value (struct Plugin *plugin,
+              struct Value *value,
+              PluginDatumProcessor proc,
+              void *proc_cls)
+{
+  char *data;
+
+  data = GNUNET_malloc (value->size + 1);
+  if (GNUNET_OK !=
+      segment_read (value->segment,
+                    value->offset + sizeof (struct RecordHeader),
+                    data,
+                    value->size))
+  {
+    LOG (GNUNET_ERROR_TYPE_ERROR,
+         _("Failed to read from segment %u: %s\n"),
+         (unsigned int) value->segment->id,
+         STRERROR (errno));
+    GNUNET_free (data);
+    proc (proc_cls,
+	  NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS, 0);
+    return;
+  }
+  if (GNUNET_NO ==
+      proc (proc_cls,
+	    &value->key,
+	    value->size,
+	    data,
+	    value->type,
+	    value->priority,
+	    value->anonymity,
+	    value->expiration,
+	    value->rid))
+    delete_value (plugin, value);
+  GNUNET_free (data);
+}
+
+
+/**
+ * Sync all segments we appended to (and the directory
+ * holding them) to disk.
+ *
+ * @param plugin the plugin
+ * @return #GNUNET_OK on success
+ */
+static int
+sync_segments (struct Plugin *plugin)
+{
+  struct Segment *seg;
+  char *fn;
+  int ret;
+
+  ret = GNUNET_OK;
+  for (seg = plugin->seg_head; NULL != seg; seg = seg->next)
+  {
+    if (GNUNET_YES != seg->unsynced)
+      continue;
+    if (GNUNET_OK != GNUNET_DISK_file_sync (seg->fh))
+    {
+      LOG (GNUNET_ERROR_TYPE_ERROR,
+           _("Failed to sync segment %u: %s\n"),
+           (unsigned int) seg->id,
+           STRERROR (errno));
+      return GNUNET_SYSERR;
+    }
+    seg->unsynced = GNUNET_NO;
+  }
+  fn = segment_filename (plugin, plugin->seg_tail->id);
+  if (GNUNET_OK != GNUNET_DISK_directory_sync_for_file (fn))
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_ERROR, "fsync", fn);
+    ret = GNUNET_SYSERR;
+  }
+  GNUNET_free (fn);
+  return ret;
+}
+
+
+/**
+ * Copy some of the live values of the oldest segment to the end of
+ * the log, and delete the segment once all of them have been copied.
+ * Does nothing unless enough of the log is garbage.
+ *
+ * @param plugin the plugin
+ */
+static void
+compact_step (struct Plugin *plugin)
+{
+  struct Segment *seg;
+  struct Segment *nseg;
+  struct RecordHeader hdr;
+  struct Value *value;
+  uint64_t done;
+  uint64_t noff;
+  char *data;
+
+  seg = plugin->seg_head;
+  if (NULL == seg)
+    return;
+  if ( (0 == plugin->compact_offset) &&
+       (plugin->disk_size - plugin->live_size < plugin->disk_size / 4) )
+    return;
+  if (seg == plugin->seg_tail)
+  {
+    /* need to start a new segment to copy the live values to */
+    if (0 == seg->live)
+    {
+      /* nothing left, simply start from scratch */
+      segment_close (plugin, seg, GNUNET_YES);
+      return;
+    }
+    if (NULL == segment_open (plugin, seg->id + 1))
+      return;
+  }
+  done = 0;
+  while ( (done < COMPACT_STEP_BYTES) &&
+          (0 != seg->live) &&
+          (plugin->compact_offset + sizeof (hdr) <= seg->size) )
+  {
+    if (GNUNET_OK !=
+        segment_read (seg, plugin->compact_offset, &hdr, sizeof (hdr)))
+    {
+      LOG (GNUNET_ERROR_TYPE_ERROR,
+           _("Failed to read from segment %u: %s\n"),
+           (unsigned int) seg->id,
+           STRERROR (errno));
+      return;
+    }
+    if ( (RECORD_MAGIC != ntohl (hdr.magic)) ||
+         (RECORD_END == ntohl (hdr.kind)) )
+      break;
+    value = NULL;
+    if (RECORD_PUT == ntohl (hdr.kind))
+      value = find_value (plugin, GNUNET_ntohll (hdr.rid));
+    if ( (NULL != value) &&
+         (value->segment == seg) &&
+         (value->offset == plugin->compact_offset) )
+    {
+      data = GNUNET_malloc (value->size + 1);
+      if (GNUNET_OK !=
+          segment_read (seg,
+                        plugin->compact_offset + sizeof (hdr),
+                        data,
+                        value->size))
+      {
+        LOG (GNUNET_ERROR_TYPE_ERROR,
+             _("Failed to read from segment %u: %s\n"),
+             (unsigned int) seg->id,
+             STRERROR (errno));
+        GNUNET_free (data);
+        return;
+      }
+      value_to_header (value, RECORD_PUT, &hdr);
+      if (GNUNET_OK !=
+          append_record (plugin, &hdr, data, value->size, &nseg, &noff))
+      {
+        GNUNET_free (data);
+        return;
+      }
+      GNUNET_free (data);
+      seg->live -= record_size (value);
+      nseg->live += record_size (value);
+      value->segment = nseg;
+      value->offset = noff;
+      done += record_size (value);
+    }
+    plugin->compact_offset += sizeof (hdr) + ntohl (hdr.size);
+  }
+  if (0 != seg->live)
+    return;
+  /* the copies must be on disk before the originals are gone */
+  if (GNUNET_OK != sync_segments (plugin))
+    return;
+  LOG (GNUNET_ERROR_TYPE_DEBUG,
+       "Compacted segment %u\n",
+       (unsigned int) seg->id);
+  segment_close (plugin, seg, GNUNET_YES);
+}
+
+
+/**
+ * Get an estimate of how much space the database is
+ * currently using.
+ *
+ * @param cls our "struct Plugin*"
+ * @return number of bytes used on disk
+ */
+static void
+log_plugin_estimate_size (void *cls, unsigned long long *estimate)
+{
+  struct Plugin *plugin = cls;
+
+  if (NULL != estimate)
+    *estimate = plugin->disk_size;
+}
+
+
+/**
+ * Store an item in the datastore.
+ *
+ * @param cls closure
+ * @param key key for the item
+ * @param size number of bytes in data
+ * @param data content stored
+ * @param type type of the content
+ * @param priority priority of the content
+ * @param anonymity anonymity-level for the content
+ * @param replication replication-level for the content
+ * @param expiration expiration time for the content
+ * @param cont continuation called with success or failure status
+ * @param cont_cls continuation closure
+ */
+static void
+log_plugin_put (void *cls,
+		const struct GNUNET_HashCode * key,
+		uint32_t size,
+		const void *data,
+		enum GNUNET_BLOCK_Type type,
+		uint32_t priority, uint32_t anonymity,
+		uint32_t replication,
+		struct GNUNET_TIME_Absolute expiration,
+		PluginPutCont cont,
+		void *cont_cls)
+{
+  struct Plugin *plugin = cls;
+  struct RecordHeader hdr;
+  struct Value *value;
+
+  value = GNUNET_new (struct Value);
+  value->key = *key;
+  value->rid = plugin->next_rid++;
+  value->vhash_prefix = data_hash_prefix (data, size);
+  value->expiration = expiration;
+  value->size = size;
+  value->priority = priority;
+  value->anonymity = anonymity;
+  value->replication = replication;
+  value->type = type;
+  value_to_header (value, RECORD_PUT, &hdr);
+  if (GNUNET_OK !=
+      append_record (plugin, &hdr, data, size,
+                     &value->segment, &value->offset))
+  {
+    GNUNET_free (value);
+    cont (cont_cls, key, size, GNUNET_SYSERR,
+          _("Failed to write to log"));
+    return;
+  }
+  index_value (plugin, value);
+  plugin->env->duc (plugin->env->cls,
+                    size + GNUNET_DATASTORE_ENTRY_OVERHEAD);
+  cont (cont_cls, key, size, GNUNET_OK, NULL);
+}
+
+
+/**
+ * Closure for iterator called during 'get_key'.
+ */
+struct GetContext
+{
+
+  /**
+   * Desired result offset / number of results.
+   */
+  uint64_t offset;
+
+  /**
+   * The plugin.
+   */
+  struct Plugin *plugin;
+
+  /**
+   * Requested value hash.
+   */
+  const struct GNUNET_HashCode * vhash;
+
+  /**
+   * First 64 bits of @e vhash.
+   */
+  uint64_t vhash_prefix;
+
+  /**
+   * #GNUNET_YES to check @e vhash against the data on disk, not
+   * just against the cached prefix.
+   */
+  int exact;
+
+  /**
+   * Matching value, set by #get_iterator.
+   */
+  struct Value *value;
+
+  /**
+   * Requested type.
+   */
+  enum GNUNET_BLOCK_Type type;
+
+};
+
+
+/**
+ * Check the hash of a value's data against @a vhash by reading
+ * the data from disk.
+ *
+ * @param value the value to check
+ * @param vhash expected hash of the data
+ * @return #GNUNET_YES if the data hashes to @a vhash
+ */
+static int
+check_vhash (const struct Value *value,
+             const struct GNUNET_HashCode *vhash)
+{
+  struct GNUNET_HashCode vh;
+  char *data;
+
+  data = GNUNET_malloc (value->size + 1);
+  if (GNUNET_OK !=
+      segment_read (value->segment,
+                    value->offset + sizeof (struct RecordHeader),
+                    data,
+                    value->size))
+  {
+    GNUNET_free (data);
+    return GNUNET_NO;
+  }
+  GNUNET_CRYPTO_hash (data, value->size, &vh);
+  GNUNET_free (data);
+  if (0 != memcmp (&vh, vhash, sizeof (struct GNUNET_HashCode)))
+    return GNUNET_NO;
+  return GNUNET_YES;
+}
+
+
+/**
+ * Test if a value matches the specification from the 'get' context
+ *
+ * @param gc query
+ * @param value the value to check against the query
+ * @return #GNUNET_YES if the value matches
+ */
+static int
+match (const struct GetContext *gc,
+       struct Value *value)
+{
+  if ( (gc->type != GNUNET_BLOCK_TYPE_ANY) &&
+       (gc->type != value->type) )
+    return GNUNET_NO;
+  if (NULL != gc->vhash)
+  {
+    if (gc->vhash_prefix != value->vhash_prefix)
+      return GNUNET_NO;
+    if ( (GNUNET_YES == gc->exact) &&
+         (GNUNET_YES != check_vhash (value, gc->vhash)) )
+      return GNUNET_NO;
+  }
+  return GNUNET_YES;
+}
+
+
+/**
+ * Count number of matching values.
+ *
+ * @param cls the 'struct GetContext'
+ * @param key unused
+ * @param val the 'struct Value'
+ * @return #GNUNET_YES (continue iteration)
+ */
+static int
+count_iterator (void *cls,
+		const struct GNUNET_HashCode *key,
+		void *val)
+{
+  struct GetContext *gc = cls;
+  struct Value *value = val;
+
+  if (GNUNET_NO == match (gc, value))
+    return GNUNET_OK;
+  gc->offset++;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Obtain matching value at 'offset'.
+ *
+ * @param cls the 'struct GetContext'
+ * @param key unused
+ * @param val the 'struct Value'
+ * @return #GNUNET_YES (continue iteration), #GNUNET_NO if result was found
+ */
+static int
+get_iterator (void *cls,
+	      const struct GNUNET_HashCode *key,
+	      void *val)
+{
+  struct GetContext *gc = cls;
+  struct Value *value = val;
+
+  if (GNUNET_NO == match (gc, value))
+    return GNUNET_OK;
+  if (0 != gc->offset--)
+    return GNUNET_OK;
+  gc->value = value;
+  return GNUNET_NO;
+}
+
+
+/**
+ * Find the matching value at position @a offset (modulo the number
+ * of matches) and store it in the @e value of @a gc.
+ *
+ * @param plugin the plugin
+ * @param gc query, @e value is set to NULL if nothing matches
+ * @param key maybe NULL (to match all entries)
+ * @param offset offset of the result
+ */
+static void
+find_value_at (struct Plugin *plugin,
+               struct GetContext *gc,
+               const struct GNUNET_HashCode *key,
+               uint64_t offset)
+{
+  gc->offset = 0;
+  gc->value = NULL;
+  if (NULL == key)
+  {
+    GNUNET_CONTAINER_multihashmap_iterate (plugin->keyvalue,
+					   &count_iterator,
+					   gc);
+    if (0 != gc->offset)
+    {
+      gc->offset = offset % gc->offset;
+      GNUNET_CONTAINER_multihashmap_iterate (plugin->keyvalue,
+                                             &get_iterator,
+                                             gc);
+    }
+  }
+  else
+  {
+    GNUNET_CONTAINER_multihashmap_get_multiple (plugin->keyvalue,
+						key,
+						&count_iterator,
+						gc);
+    if (0 != gc->offset)
+    {
+      gc->offset = offset % gc->offset;
+      GNUNET_CONTAINER_multihashmap_get_multiple (plugin->keyvalue,
+                                                  key,
+                                                  &get_iterator,
+                                                  gc);
+    }
+  }
+}
+
+
+/**
+ * Get one of the results for a particular key in the datastore.
+ *
+ * @param cls closure
+ * @param offset offset of the result (modulo num-results);
+ *               specific ordering does not matter for the offset
+ * @param key maybe NULL (to match all entries)
+ * @param vhash hash of the value, maybe NULL (to
+ *        match all values that have the right key).
+ *        Note that for DBlocks there is no difference
+ *        betwen key and vhash, but for other blocks
+ *        there may be!
+ * @param type entries of which type are relevant?
+ *     Use 0 for any type.
+ * @param proc function to call on each matching value;
+ *        will be called with NULL if nothing matches
+ * @param proc_cls closure for proc
+ */
+static void
+log_plugin_get_key (void *cls, uint64_t offset,
+		    const struct GNUNET_HashCode *key,
+		    const struct GNUNET_HashCode *vhash,
+		    enum GNUNET_BLOCK_Type type, PluginDatumProcessor proc,
+		    void *proc_cls)
+{
+  struct Plugin *plugin = cls;
+  struct GetContext gc;
+
+  gc.plugin = plugin;
+  gc.vhash = vhash;
+  if (NULL != vhash)
+    gc.vhash_prefix = hash_prefix (vhash);
+  gc.exact = GNUNET_NO;
+  gc.type = type;
+  find_value_at (plugin, &gc, key, offset);
+  if ( (NULL != gc.value) &&
+       (NULL != vhash) &&
+       (GNUNET_YES != check_vhash (gc.value, vhash)) )
+  {
+    /* another value's hash starts with the same 64 bits (or
+       reading failed); search again, checking every candidate */
+    gc.exact = GNUNET_YES;
+    find_value_at (plugin, &gc, key, offset);
+  }
+  if (NULL == gc.value)
+  {
+    proc (proc_cls,
+	  NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS, 0);
+    return;
+  }
+  return_value (plugin, gc.value, proc, proc_cls);
+}
+
+
+/**
+ * Get a random item for replication.  Returns a single, not expired,
+ * random item from those with the highest replication counters.  The
+ * item's replication counter is decremented by one IF it was positive
+ * before.  Call 'proc' with all values ZERO or NULL if the datastore
+ * is empty.
+ *
+ * @param cls closure
+ * @param proc function to call the value (once only).
+ * @param proc_cls closure for proc
+ */
+static void
+log_plugin_get_replication (void *cls,
+			    PluginDatumProcessor proc,
+			    void *proc_cls)
+{
+  struct Plugin *plugin = cls;
+  struct Value *value;
+
+  compact_step (plugin);
+  value = GNUNET_CONTAINER_heap_peek (plugin->by_replication);
+  if (NULL == value)
+  {
+    proc (proc_cls,
+	  NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS, 0);
+    return;
+  }
+  if (value->replication > 0)
+  {
+    if (GNUNET_OK ==
+        log_update (plugin, value,
+                    value->priority,
+                    value->replication - 1,
+                    value->expiration))
+      set_replication (plugin, value, value->replication - 1);
+  }
+  else
+  {
+    /* need a better way to pick a random item, replication level is always 0 */
+    value = GNUNET_CONTAINER_heap_walk_get_next (plugin->by_replication);
+  }
+  return_value (plugin, value, proc, proc_cls);
+}
+
+
+/**
+ * Get a random item for expiration.  Call 'proc' with all values ZERO
+ * or NULL if the datastore is empty.
+ *
+ * @param cls closure
+ * @param proc function to call the value (once only).
+ * @param proc_cls closure for proc
+ */
+static void
+log_plugin_get_expiration (void *cls, PluginDatumProcessor proc,
+			   void *proc_cls)
+{
+  struct Plugin *plugin = cls;
+  struct Value *value;
+
+  compact_step (plugin);
+  value = GNUNET_CONTAINER_heap_peek (plugin->by_expiration);
+  if (NULL == value)
+  {
+    proc (proc_cls,
+	  NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS, 0);
+    return;
+  }
+  return_value (plugin, value, proc, proc_cls);
+}
+
+
+/**
+ * Update the priority for a particular key in the datastore.  If
+ * the expiration time in value is different than the time found in
+ * the datastore, the higher value should be kept.  For the
+ * anonymity level, the lower value is to be used.  The specified
+ * priority should be added to the existing priority, ignoring the
+ * priority in value.
+ *
+ * @param cls our "struct Plugin*"
+ * @param uid unique identifier of the datum
+ * @param delta by how much should the priority
+ *     change?  If priority + delta < 0 the
+ *     priority should be set to 0 (never go
+ *     negative).
+ * @param expire new expiration time should be the
+ *     MAX of any existing expiration time and
+ *     this value
+ * @param cont continuation called with success or failure status
+ * @param cons_cls continuation closure
+ */
+static void
+log_plugin_update (void *cls,
+		   uint64_t uid,
+		   int delta,
+		   struct GNUNET_TIME_Absolute expire,
+		   PluginUpdateCont cont,
+		   void *cont_cls)
+{
+  struct Plugin *plugin = cls;
+  struct Value *value;
+  uint32_t priority;
+
+  value = find_value (plugin, uid);
+  if (NULL == value)
+  {
+    cont (cont_cls, GNUNET_SYSERR, _("No such value"));
+    return;
+  }
+  if (value->expiration.abs_value_us > expire.abs_value_us)
+    expire = value->expiration;
+  if ( (delta < 0) && (value->priority < - delta) )
+    priority = 0;
+  else
+    priority = value->priority + delta;
+  if (GNUNET_OK !=
+      log_update (plugin, value,
+                  priority,
+                  value->replication,
+                  expire))
+  {
+    cont (cont_cls, GNUNET_SYSERR, _("Failed to write to log"));
+    return;
+  }
+  value->priority = priority;
+  set_expiration (plugin, value, expire);
+  cont (cont_cls, GNUNET_OK, NULL);
+}
+
+
+/**
+ * Call the given processor on an item with zero anonymity.
+ *
+ * @param cls our "struct Plugin*"
+ * @param offset offset of the result (modulo num-results);
+ *               specific ordering does not matter for the offset
+ * @param type entries of which type should be considered?
+ *        Use 0 for any type.
+ * @param proc function to call on each matching value;
+ *        will be called  with NULL if no value matches
+ * @param proc_cls closure for proc
+ */
+static void
+log_plugin_get_zero_anonymity (void *cls, uint64_t offset,
+			       enum GNUNET_BLOCK_Type type,
+			       PluginDatumProcessor proc, void *proc_cls)
+{
+  struct Plugin *plugin = cls;
+  struct ZeroAnonByType *zabt;
+  uint64_t count;
+
+  count = 0;
+  for (zabt = plugin->zero_head; NULL != zabt; zabt = zabt->next)
+  {
+    if ( (type != GNUNET_BLOCK_TYPE_ANY) &&
+	 (type != zabt->type) )
+      continue;
+    count += zabt->array_pos;
+  }
+  if (0 == count)
+  {
+    proc (proc_cls,
+	  NULL, 0, NULL, 0, 0, 0, GNUNET_TIME_UNIT_ZERO_ABS, 0);
+    return;
+  }
+  offset = offset % count;
+  for (zabt = plugin->zero_head; NULL != zabt; zabt = zabt->next)
+  {
+    if ( (type != GNUNET_BLOCK_TYPE_ANY) &&
+	 (type != zabt->type) )
+      continue;
+    if (offset >= zabt->array_pos)
+    {
+      offset -= zabt->array_pos;
+      continue;
+    }
+    break;
+  }
+  GNUNET_assert (NULL != zabt);
+  return_value (plugin, zabt->array[offset], proc, proc_cls);
+}
+
+
+/**
+ * Callback invoked to free a value.
+ *
+ * @param cls the plugin
+ * @param key unused
+ * @param val the value
+ * @return #GNUNET_OK (continue to iterate)
+ */
+static int
+free_value (void *cls,
+	    const struct GNUNET_HashCode *key,
+	    void *val)
+{
+  struct Plugin *plugin = cls;
+  struct Value *value = val;
+
+  unindex_value (plugin, value);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Drop database.
+ *
+ * @param cls our "struct Plugin*"
+ */
+static void
+log_plugin_drop (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  GNUNET_CONTAINER_multihashmap_iterate (plugin->keyvalue,
+					 &free_value,
+					 plugin);
+  while (NULL != plugin->seg_head)
+    segment_close (plugin, plugin->seg_head, GNUNET_YES);
+  if (GNUNET_OK != GNUNET_DISK_directory_remove (plugin->dir))
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING, "rmdir", plugin->dir);
+}
+
+
+/**
+ * Closure for the 'return_key' function.
+ */
+struct GetAllContext
+{
+  /**
+   * Function to call.
+   */
+  PluginKeyProcessor proc;
+
+  /**
+   * Closure for 'proc'.
+   */
+  void *proc_cls;
+};
+
+
+/**
+ * Callback invoked to call callback on each value.
+ *
+ * @param cls the plugin
+ * @param key unused
+ * @param val the value
+ * @return #GNUNET_OK (continue to iterate)
+ */
+static int
+return_key (void *cls,
+	    const struct GNUNET_HashCode *key,
+	    void *val)
+{
+  struct GetAllContext *gac = cls;
+
+  gac->proc (gac->proc_cls,
+	     key,
+	     1);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Get all of the keys in the datastore.
+ *
+ * @param cls closure
+ * @param proc function to call on each key
+ * @param proc_cls closure for proc
+ */
+static void
+log_get_keys (void *cls,
+	      PluginKeyProcessor proc,
+	      void *proc_cls)
+{
+  struct Plugin *plugin = cls;
+  struct GetAllContext gac;
+
+  gac.proc = proc;
+  gac.proc_cls = proc_cls;
+  GNUNET_CONTAINER_multihashmap_iterate (plugin->keyvalue,
+					 &return_key,
+					 &gac);
+  proc (proc_cls, NULL, 0);
+}
+
+
+/**
+ * Apply a record found while replaying the log to the index.
+ *
+ * @param plugin the plugin
+ * @param seg segment the record is in
+ * @param offset offset of the record in @a seg
+ * @param hdr the record
+ * @param data the data following @a hdr
+ */
+static void
+replay_record (struct Plugin *plugin,
+               struct Segment *seg,
+               uint64_t offset,
+               const struct RecordHeader *hdr,
+               const void *data)
+{
+  struct Value *value;
+  uint64_t rid;
+
+  rid = GNUNET_ntohll (hdr->rid);
+  if (rid >= plugin->next_rid)
+    plugin->next_rid = rid + 1;
+  value = find_value (plugin, rid);
+  switch (ntohl (hdr->kind))
+  {
+  case RECORD_PUT:
+    if (NULL != value)
+    {
+      /* copy made by compaction that was interrupted */
+      unindex_value (plugin, value);
+    }
+    value = GNUNET_new (struct Value);
+    value->key = hdr->key;
+    value->segment = seg;
+    value->offset = offset;
+    value->rid = rid;
+    value->expiration = GNUNET_TIME_absolute_ntoh (hdr->expiration);
+    value->size = ntohl (hdr->size);
+    value->vhash_prefix = data_hash_prefix (data, value->size);
+    value->priority = ntohl (hdr->priority);
+    value->anonymity = ntohl (hdr->anonymity);
+    value->replication = ntohl (hdr->replication);
+    value->type = ntohl (hdr->type);
+    index_value (plugin, value);
+    break;
+  case RECORD_UPDATE:
+    if (NULL == value)
+      break;
+    value->priority = ntohl (hdr->priority);
+    set_replication (plugin, value, ntohl (hdr->replication));
+    set_expiration (plugin, value,
+                    GNUNET_TIME_absolute_ntoh (hdr->expiration));
+    break;
+  case RECORD_DELETE:
+    if (NULL == value)
+      break;
+    unindex_value (plugin, value);
+    break;
+  default:
+    GNUNET_break (0);
+    break;
+  }
+}
+
+
+/**
+ * Replay all records of a segment.  In the last segment, which may
+ * have been partially written when we crashed, we also check the
+ * CRCs and mark the end of the usable part if a record is damaged.
+ *
+ * @param plugin the plugin
+ * @param seg segment to replay
+ * @return #GNUNET_OK on success, #GNUNET_NO if the segment had
+ *         a damaged record, #GNUNET_SYSERR on read errors
+ */
+static int
+replay_segment (struct Plugin *plugin,
+                struct Segment *seg)
+{
+  struct RecordHeader hdr;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t crc;
+  char *buf;
+  int check;
+
+  check = (seg == plugin->seg_tail);
+  offset = 0;
+  while (offset < seg->size)
+  {
+    if ( (offset + sizeof (hdr) > seg->size) ||
+         (GNUNET_OK != segment_read (seg, offset, &hdr, sizeof (hdr))) ||
+         (RECORD_MAGIC != ntohl (hdr.magic)) )
+      break;
+    size = ntohl (hdr.size);
+    if (RECORD_END == ntohl (hdr.kind))
+      return GNUNET_OK;
+    if (offset + sizeof (hdr) + size > seg->size)
+      break;
+    /* we need the data of PUTs to index the hash of their value */
+    buf = GNUNET_malloc (sizeof (hdr) + size);
+    if ( (check) ||
+         (RECORD_PUT == ntohl (hdr.kind)) )
+    {
+      if (GNUNET_OK !=
+          segment_read (seg, offset, buf, sizeof (hdr) + size))
+      {
+        GNUNET_free (buf);
+        break;
+      }
+    }
+    if (check)
+    {
+      crc = ntohl (hdr.crc);
+      ((struct RecordHeader *) buf)->crc = htonl (0);
+      if (crc != GNUNET_CRYPTO_crc32_n (buf, sizeof (hdr) + size))
+      {
+        GNUNET_free (buf);
+        break;
+      }
+    }
+    replay_record (plugin, seg, offset, &hdr, &buf[sizeof (hdr)]);
+    GNUNET_free (buf);
+    offset += sizeof (hdr) + size;
+  }
+  if (offset == seg->size)
+    return GNUNET_OK;
+  LOG (GNUNET_ERROR_TYPE_WARNING,
+       _("Segment %u is damaged at offset %llu, ignoring the rest\n"),
+       (unsigned int) seg->id,
+       (unsigned long long) offset);
+  if (! check)
+    return GNUNET_NO;
+  /* mark the end, so we do not look at the garbage again
+     once this is no longer the last segment */
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.magic = htonl (RECORD_MAGIC);
+  hdr.kind = htonl (RECORD_END);
+  if ( (offset != GNUNET_DISK_file_seek (seg->fh,
+                                         offset,
+                                         GNUNET_DISK_SEEK_SET)) ||
+       (sizeof (hdr) != GNUNET_DISK_file_write (seg->fh,
+                                                &hdr,
+                                                sizeof (hdr))) ||
+       (GNUNET_OK != GNUNET_DISK_file_sync (seg->fh)) )
+    return GNUNET_SYSERR;
+  return GNUNET_NO;
+}
+
+
+/**
+ * Closure for #find_segment.
+ */
+struct SegmentScanContext
+{
+  /**
+   * Numbers of the segments found.
+   */
+  uint32_t *ids;
+
+  /**
+   * Number of entries in @e ids.
+   */
+  unsigned int ids_len;
+};
+
+
+/**
+ * Function called for each file in the log directory.
+ *
+ * @param cls the `struct SegmentScanContext`
+ * @param filename name of the file
+ * @return #GNUNET_OK (continue to iterate)
+ */
+static int
+find_segment (void *cls,
+              const char *filename)
+{
+  struct SegmentScanContext *ssc = cls;
+  const char *base;
+  unsigned int id;
+  char dummy;
+
+  base = strrchr (filename, DIR_SEPARATOR);
+  base = (NULL == base) ? filename : base + 1;
+  if (1 != SSCANF (base, "segment-%u.dat%c", &id, &dummy))
+    return GNUNET_OK;
+  GNUNET_array_append (ssc->ids,
+                       ssc->ids_len,
+                       (uint32_t) id);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Compare two segment numbers, for qsort().
+ *
+ * @param a first segment number
+ * @param b second segment number
+ * @return -1, 0 or 1
+ */
+static int
+cmp_segment_ids (const void *a,
+                 const void *b)
+{
+  uint32_t ia = *(const uint32_t *) a;
+  uint32_t ib = *(const uint32_t *) b;
+
+  if (ia < ib)
+    return -1;
+  if (ia > ib)
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Open all segments and rebuild the index from them.
+ *
+ * @param plugin the plugin
+ * @return #GNUNET_OK on success
+ */
+static int
+database_setup (struct Plugin *plugin)
+{
+  struct SegmentScanContext ssc;
+  struct Segment *seg;
+  unsigned int i;
+  int ret;
+
+  if (GNUNET_OK != GNUNET_DISK_directory_create (plugin->dir))
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_ERROR, "mkdir", plugin->dir);
+    return GNUNET_SYSERR;
+  }
+  memset (&ssc, 0, sizeof (ssc));
+  GNUNET_DISK_directory_scan (plugin->dir,
+                              &find_segment,
+                              &ssc);
+  if (0 == ssc.ids_len)
+    return GNUNET_OK;
+  qsort (ssc.ids, ssc.ids_len, sizeof (uint32_t), &cmp_segment_ids);
+  for (i = 0; i < ssc.ids_len; i++)
+  {
+    if (NULL == segment_open (plugin, ssc.ids[i]))
+    {
+      GNUNET_array_grow (ssc.ids, ssc.ids_len, 0);
+      return GNUNET_SYSERR;
+    }
+  }
+  GNUNET_array_grow (ssc.ids, ssc.ids_len, 0);
+  for (seg = plugin->seg_head; NULL != seg; seg = seg->next)
+  {
+    ret = replay_segment (plugin, seg);
+    if (GNUNET_SYSERR == ret)
+      return GNUNET_SYSERR;
+    if ( (GNUNET_NO == ret) &&
+         (seg == plugin->seg_tail) )
+    {
+      /* do not append after the garbage */
+      if (NULL == segment_open (plugin, seg->id + 1))
+        return GNUNET_SYSERR;
+      break;
+    }
+  }
+  LOG (GNUNET_ERROR_TYPE_INFO,
+       _("Loaded %u values (%llu of %llu bytes live) from the log\n"),
+       GNUNET_CONTAINER_multihashmap_size (plugin->keyvalue),
+       (unsigned long long) plugin->live_size,
+       (unsigned long long) plugin->disk_size);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Free all resources of the plugin, except for the API.
+ *
+ * @param plugin the plugin
+ */
+static void
+plugin_cleanup (struct Plugin *plugin)
+{
+  GNUNET_CONTAINER_multihashmap_iterate (plugin->keyvalue,
+					 &free_value,
+					 plugin);
+  while (NULL != plugin->seg_head)
+    segment_close (plugin, plugin->seg_head, GNUNET_NO);
+  GNUNET_CONTAINER_multihashmap_destroy (plugin->keyvalue);
+  GNUNET_CONTAINER_multihashmap32_destroy (plugin->by_rid);
+  GNUNET_CONTAINER_heap_destroy (plugin->by_expiration);
+  GNUNET_CONTAINER_heap_destroy (plugin->by_replication);
+  GNUNET_free (plugin->dir);
+  GNUNET_free (plugin);
+}
+
+
+/**
+ * Entry point for the plugin.
+ *
+ * @param cls the "struct GNUNET_DATASTORE_PluginEnvironment*"
+ * @return our "struct Plugin*"
+ */
+void *
+libgnunet_plugin_datastore_log_init (void *cls)
+{
+  struct GNUNET_DATASTORE_PluginEnvironment *env = cls;
+  struct GNUNET_DATASTORE_PluginFunctions *api;
+  struct Plugin *plugin;
+  unsigned long long esize;
+
+  plugin = GNUNET_new (struct Plugin);
+  plugin->env = env;
+  plugin->next_rid = 1;
+  if (GNUNET_OK !=
+      GNUNET_CONFIGURATION_get_value_filename (env->cfg,
+                                               "datastore-log",
+                                               "DIRECTORY",
+                                               &plugin->dir))
+  {
+    GNUNET_log_config_missing (GNUNET_ERROR_TYPE_ERROR,
+			       "datastore-log", "DIRECTORY");
+    GNUNET_free (plugin);
+    return NULL;
+  }
+  if (GNUNET_OK !=
+      GNUNET_CONFIGURATION_get_value_size (env->cfg,
+                                           "datastore-log",
+                                           "SEGMENT_SIZE",
+                                           &plugin->segment_size))
+    plugin->segment_size = 64 * 1024 * 1024;
+  if (GNUNET_OK !=
+      GNUNET_CONFIGURATION_get_value_number (env->cfg,
+					     "datastore-log",
+					     "HASHMAPSIZE",
+					     &esize))
+    esize = 128 * 1024;
+  plugin->keyvalue = GNUNET_CONTAINER_multihashmap_create (esize, GNUNET_YES);
+  plugin->by_rid = GNUNET_CONTAINER_multihashmap32_create (esize);
+  plugin->by_expiration = GNUNET_CONTAINER_heap_create (GNUNET_CONTAINER_HEAP_ORDER_MIN);
+  plugin->by_replication = GNUNET_CONTAINER_heap_create (GNUNET_CONTAINER_HEAP_ORDER_MAX);
+  if (GNUNET_OK != database_setup (plugin))
+  {
+    plugin_cleanup (plugin);
+    return NULL;
+  }
+  api = GNUNET_new (struct GNUNET_DATASTORE_PluginFunctions);
+  api->cls = plugin;
+  api->estimate_size = &log_plugin_estimate_size;
+  api->put = &log_plugin_put;
+  api->update = &log_plugin_update;
+  api->get_key = &log_plugin_get_key;
+  api->get_replication = &log_plugin_get_replication;
+  api->get_expiration = &log_plugin_get_expiration;
+  api->get_zero_anonymity = &log_plugin_get_zero_anonymity;
+  api->drop = &log_plugin_drop;
+  api->get_keys = &log_get_keys;
+  LOG (GNUNET_ERROR_TYPE_INFO,
+       _("Log database running\n"));
+  return api;
+}
+
+
+/**
+ * Exit point from the plugin.
+ * @param cls our "struct Plugin*"
+ * @return always NULL
+ */
+void *
+libgnunet_plugin_datastore_log_done (void *cls)
+{
+  struct GNUNET_DATASTORE_PluginFunctions *api = cls;
+  struct Plugin *plugin = api->cls;
+
+  plugin_cleanup (plugin);
+  GNUNET_free (api);
+  return NULL;
+}
+
+/* end of plugin_datastore_log.c */
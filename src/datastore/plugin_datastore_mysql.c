@@ -947,6 +947,36 @@ mysql_plugin_drop (void *cls)
 }
 
 
+/**
+ * Start a batch of operations by opening a transaction.
+ *
+ * @param cls the "struct Plugin*"
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+static int
+mysql_plugin_begin_batch (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  return GNUNET_MYSQL_statement_run (plugin->mc, "START TRANSACTION");
+}
+
+
+/**
+ * End a batch of operations by committing the transaction.
+ *
+ * @param cls the "struct Plugin*"
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+static int
+mysql_plugin_end_batch (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  return GNUNET_MYSQL_statement_run (plugin->mc, "COMMIT");
+}
+
+
 /**
  * Entry point for the plugin.
  *
@@ -1032,6 +1062,8 @@ libgnunet_plugin_datastore_mysql_init (void *cls)
   api->get_zero_anonymity = &mysql_plugin_get_zero_anonymity;
   api->get_keys = &mysql_plugin_get_keys;
   api->drop = &mysql_plugin_drop;
+  api->begin_batch = &mysql_plugin_begin_batch;
+  api->end_batch = &mysql_plugin_end_batch;
   GNUNET_log_from (GNUNET_ERROR_TYPE_INFO, "mysql",
                    _("Mysql database running\n"));
   return api;
@@ -977,6 +977,36 @@ postgres_plugin_drop (void *cls)
 }
 
 
+/**
+ * Start a batch of operations by opening a transaction.
+ *
+ * @param cls closure with the `struct Plugin *`
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+static int
+postgres_plugin_begin_batch (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  return GNUNET_POSTGRES_exec (plugin->dbh, "BEGIN");
+}
+
+
+/**
+ * End a batch of operations by committing the transaction.
+ *
+ * @param cls closure with the `struct Plugin *`
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+static int
+postgres_plugin_end_batch (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  return GNUNET_POSTGRES_exec (plugin->dbh, "COMMIT");
+}
+
+
 /**
  * Entry point for the plugin.
  *
@@ -1008,6 +1038,8 @@ libgnunet_plugin_datastore_postgres_init (void *cls)
   api->get_zero_anonymity = &postgres_plugin_get_zero_anonymity;
   api->get_keys = &postgres_plugin_get_keys;
   api->drop = &postgres_plugin_drop;
+  api->begin_batch = &postgres_plugin_begin_batch;
+  api->end_batch = &postgres_plugin_end_batch;
   GNUNET_log_from (GNUNET_ERROR_TYPE_INFO, "datastore-postgres",
                    _("Postgres database running\n"));
   return api;
@@ -1157,6 +1157,48 @@ sqlite_plugin_drop (void *cls)
 }
 
 
+/**
+ * Start a batch of operations by opening a transaction.
+ *
+ * @param cls our plugin context
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+static int
+sqlite_plugin_begin_batch (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  if (SQLITE_OK !=
+      sqlite3_exec (plugin->dbh, "BEGIN", NULL, NULL, NULL))
+  {
+    LOG_SQLITE (plugin, GNUNET_ERROR_TYPE_ERROR, "sqlite3_exec");
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * End a batch of operations by committing the transaction.
+ *
+ * @param cls our plugin context
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+static int
+sqlite_plugin_end_batch (void *cls)
+{
+  struct Plugin *plugin = cls;
+
+  if (SQLITE_OK !=
+      sqlite3_exec (plugin->dbh, "COMMIT", NULL, NULL, NULL))
+  {
+    LOG_SQLITE (plugin, GNUNET_ERROR_TYPE_ERROR, "sqlite3_exec");
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
 /**
  * Get an estimate of how much space the database is
  * currently using.
@@ -1241,6 +1283,8 @@ libgnunet_plugin_datastore_sqlite_init (void *cls)
   api->get_zero_anonymity = &sqlite_plugin_get_zero_anonymity;
   api->get_keys = &sqlite_plugin_get_keys;
   api->drop = &sqlite_plugin_drop;
+  api->begin_batch = &sqlite_plugin_begin_batch;
+  api->end_batch = &sqlite_plugin_end_batch;
   GNUNET_log_from (GNUNET_ERROR_TYPE_INFO, "sqlite",
                    _("Sqlite database running\n"));
   return api;
@@ -40,6 +40,11 @@
 
 #define ITERATIONS 256
 
+/**
+ * Number of items in the batched PUT and GET.
+ */
+#define BATCH_SIZE 64
+
 /**
  * Handle to the datastore.
  */
@@ -131,6 +136,8 @@ enum RunPhase
   RP_GET_MULTIPLE_NEXT = 10,
   RP_UPDATE = 11,
   RP_UPDATE_VALIDATE = 12,
+  RP_PUT_BATCH = 13,
+  RP_GET_BATCH = 14,
 
   /**
    * Execution failed with some kind of error.
@@ -160,6 +167,7 @@ struct CpsRunContext
   uint64_t uid;
   uint64_t offset;
   uint64_t first_uid;
+  unsigned int found;
 };
 
 
@@ -379,7 +387,7 @@ check_update (void *cls,
   GNUNET_assert (key != NULL);
   if ((anonymity == get_anonymity (42)) && (size == get_size (42)) &&
       (priority == get_priority (42) + 100))
-    crc->phase = RP_DONE;
+    crc->phase = RP_PUT_BATCH;
   else
   {
     GNUNET_assert (size == get_size (43));
@@ -389,6 +397,69 @@ check_update (void *cls,
 }
 
 
+static void
+check_batch_success (void *cls,
+                     unsigned int count,
+                     const int32_t *success,
+                     struct GNUNET_TIME_Absolute min_expiration,
+                     const char *msg)
+{
+  struct CpsRunContext *crc = cls;
+  unsigned int i;
+
+  GNUNET_assert (BATCH_SIZE == count);
+  for (i = 0; i < count; i++)
+    if (GNUNET_OK != success[i])
+    {
+      GNUNET_log (GNUNET_ERROR_TYPE_ERROR,
+                  "Batched PUT %u not successfull: `%s'\n",
+                  i,
+                  msg);
+      crc->phase = RP_ERROR;
+    }
+  GNUNET_SCHEDULER_add_now (&run_continuation, crc);
+}
+
+
+static void
+check_batch_value (void *cls,
+                   const struct GNUNET_HashCode *key,
+                   size_t size,
+                   const void *data,
+                   enum GNUNET_BLOCK_Type type,
+                   uint32_t priority,
+                   uint32_t anonymity,
+                   struct GNUNET_TIME_Absolute expiration,
+                   uint64_t uid)
+{
+  struct CpsRunContext *crc = cls;
+  unsigned int i;
+
+  if (NULL == key)
+  {
+    if (BATCH_SIZE != crc->found)
+    {
+      GNUNET_log (GNUNET_ERROR_TYPE_ERROR,
+                  "Batched GET found %u/%u results\n",
+                  crc->found,
+                  BATCH_SIZE);
+      crc->phase = RP_ERROR;
+    }
+    else
+      crc->phase = RP_DONE;
+    GNUNET_SCHEDULER_add_now (&run_continuation, crc);
+    return;
+  }
+  i = type - 1;
+  GNUNET_assert (i < BATCH_SIZE);
+  GNUNET_assert (size == get_size (i));
+  GNUNET_assert ((0 == size) ||
+                 (0 == memcmp (data, get_data (i), size)));
+  GNUNET_assert (priority == get_priority (i));
+  crc->found++;
+}
+
+
 /**
  * Main state machine.  Executes the next step of the test
  * depending on the current state.
@@ -401,6 +472,11 @@ run_continuation (void *cls,
                   const struct GNUNET_SCHEDULER_TaskContext *tc)
 {
   struct CpsRunContext *crc = cls;
+  struct GNUNET_DATASTORE_PutItem items[BATCH_SIZE];
+  struct GNUNET_HashCode keys[BATCH_SIZE + 1];
+  static char bdata[BATCH_SIZE][8 * BATCH_SIZE];
+  int i;
+  int j;
 
   ok = (int) crc->phase;
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
@@ -542,6 +618,44 @@ run_continuation (void *cls,
                                              TIMEOUT,
                                              &check_update, crc));
     break;
+  case RP_PUT_BATCH:
+    crc->phase = RP_GET_BATCH;
+    for (i = 0; i < BATCH_SIZE; i++)
+    {
+      j = ITERATIONS + i;
+      GNUNET_CRYPTO_hash (&j, sizeof (int), &items[i].key);
+      memcpy (bdata[i], get_data (i), get_size (i));
+      items[i].data = bdata[i];
+      items[i].size = get_size (i);
+      items[i].type = get_type (i);
+      items[i].priority = get_priority (i);
+      items[i].anonymity = get_anonymity (i);
+      items[i].replication = 0;
+      items[i].expiration = get_expiration (i);
+    }
+    GNUNET_assert (NULL !=
+                   GNUNET_DATASTORE_put_multiple (datastore, 0,
+                                                  BATCH_SIZE, items,
+                                                  1, 1, TIMEOUT,
+                                                  &check_batch_success,
+                                                  crc));
+    break;
+  case RP_GET_BATCH:
+    for (i = 0; i <= BATCH_SIZE; i++)
+    {
+      /* the last key was never stored */
+      j = ITERATIONS + i;
+      GNUNET_CRYPTO_hash (&j, sizeof (int), &keys[i]);
+    }
+    crc->found = 0;
+    GNUNET_assert (NULL !=
+                   GNUNET_DATASTORE_get_multiple (datastore, 0,
+                                                  BATCH_SIZE + 1, keys,
+                                                  GNUNET_BLOCK_TYPE_ANY,
+                                                  1, 1, TIMEOUT,
+                                                  &check_batch_value,
+                                                  crc));
+    break;
   case RP_DONE:
     GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
                 "Finished, disconnecting\n");
@@ -70,10 +70,28 @@
 #define MAXIMUM_REPLICATION_LEVEL 16
 
 /**
- * Maximum allowed number of pending messages per peer.
+ * Maximum allowed number of pending messages per peer (and message
+ * class, see `enum MessageClass`).
  */
 #define MAXIMUM_PENDING_PER_PEER 64
 
+/**
+ * How long do we wait for more messages to a peer before we ask
+ * CORE to transmit the ones we have?
+ */
+#define BATCH_DELAY GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MILLISECONDS, 5)
+
+/**
+ * How many bytes of messages do we try to pass to CORE at once?
+ * Once this much is queued for a peer, we do not wait any longer.
+ */
+#define MAX_BATCH_SIZE (32 * 1024)
+
+/**
+ * How many bytes does each message class get to send per round?
+ */
+#define BATCH_QUANTUM 1024
+
 /**
  * How long at least to wait before sending another find peer request.
  */
@@ -290,6 +308,63 @@ struct P2PPendingMessage
 };
 
 
+/**
+ * Classes of messages we queue separately for each peer, so that a
+ * flood of one kind of message does not starve the others.  Lower
+ * classes are served first in each round.
+ */
+enum MessageClass
+{
+  /**
+   * Replies to GET requests.
+   */
+  MC_RESULT = 0,
+
+  /**
+   * GET requests (including FIND PEER).
+   */
+  MC_GET = 1,
+
+  /**
+   * PUT requests.
+   */
+  MC_PUT = 2,
+
+  /**
+   * Number of message classes.
+   */
+  MC_COUNT = 3
+};
+
+
+/**
+ * Messages of one class waiting for transmission to a peer.
+ */
+struct MessageQueue
+{
+  /**
+   * Head of pending messages of this class.
+   */
+  struct P2PPendingMessage *head;
+
+  /**
+   * Tail of pending messages of this class.
+   */
+  struct P2PPendingMessage *tail;
+
+  /**
+   * Number of messages in the queue.
+   */
+  unsigned int count;
+
+  /**
+   * Number of bytes the class may still send in the current round
+   * (deficit round robin).
+   */
+  size_t deficit;
+};
+
+
 /**
  * Entry for a peer in a bucket.
  */
@@ -306,30 +381,36 @@ struct PeerInfo
   struct PeerInfo *prev;
 
   /**
-   * Count of outstanding messages for peer.
+   * Messages to be sent to this peer, by `enum MessageClass`.
    */
-  unsigned int pending_count;
+  struct MessageQueue queues[MC_COUNT];
 
   /**
-   * Head of pending messages to be sent to this peer.
+   * Number of bytes in all of @e queues.
    */
-  struct P2PPendingMessage *head;
+  size_t pending_bytes;
 
   /**
-   * Tail of pending messages to be sent to this peer.
+   * Core handle for sending messages to this peer.
    */
-  struct P2PPendingMessage *tail;
+  struct GNUNET_CORE_TransmitHandle *th;
 
   /**
-   * Core handle for sending messages to this peer.
+   * Task that asks CORE to transmit our messages once the batching
+   * delay is over.
    */
-  struct GNUNET_CORE_TransmitHandle *th;
+  struct GNUNET_SCHEDULER_Task *batch_task;
 
   /**
    * What is the identity of the peer?
    */
   struct GNUNET_PeerIdentity id;
 
+  /**
+   * Hash of @e id, the peer's position in the DHT.
+   */
+  struct GNUNET_HashCode phash;
+
 #if 0
   /**
    * What is the average latency for replies received?
@@ -421,6 +502,44 @@ static int disable_try_connect;
  */
 static struct PeerBucket k_buckets[MAX_BUCKETS];
 
+/**
+ * Connected peers in the order of #k_buckets (bucket 0 first, within a
+ * bucket in list order), so that routing decisions can scan an array
+ * instead of the bucket lists.  Rebuilt whenever a peer connects or
+ * disconnects.  Has #rt_size entries, of which #rt_count are used.
+ */
+static struct PeerInfo **rt_peers;
+
+/**
+ * The hashes of the identities of the peers in #rt_peers, in the
+ * same order.
+ */
+static struct GNUNET_HashCode *rt_hashes;
+
+/**
+ * Scratch space for the results of testing #rt_hashes against a
+ * Bloom filter, same order as #rt_peers.
+ */
+static int *rt_filtered;
+
+/**
+ * Offset of the first peer of each bucket in #rt_peers; the peers of
+ * bucket @e i are at offsets `rt_bucket_start[i]` to
+ * `rt_bucket_start[i + 1] - 1`.
+ */
+static unsigned int rt_bucket_start[MAX_BUCKETS + 1];
+
+/**
+ * Number of entries allocated in #rt_peers, #rt_hashes and
+ * #rt_filtered.
+ */
+static unsigned int rt_size;
+
+/**
+ * Number of peers in #rt_peers.
+ */
+static unsigned int rt_count;
+
 /**
  * Hash map of all CORE-connected peers, for easy removal from
  * #k_buckets on disconnect.  Values are of type `struct PeerInfo`.
@@ -764,6 +883,43 @@ send_find_peer_message (void *cls,
 }
 
 
+/**
+ * Rebuild #rt_peers and #rt_hashes from #k_buckets.
+ */
+static void
+rebuild_route_table ()
+{
+  struct PeerInfo *pos;
+  unsigned int count;
+  unsigned int bc;
+
+  count = GNUNET_CONTAINER_multipeermap_size (all_connected_peers);
+  if (count > rt_size)
+  {
+    rt_size = GNUNET_MAX (2 * rt_size, count);
+    GNUNET_free_non_null (rt_peers);
+    GNUNET_free_non_null (rt_hashes);
+    GNUNET_free_non_null (rt_filtered);
+    rt_peers = GNUNET_new_array (rt_size, struct PeerInfo *);
+    rt_hashes = GNUNET_new_array (rt_size, struct GNUNET_HashCode);
+    rt_filtered = GNUNET_new_array (rt_size, int);
+  }
+  rt_count = 0;
+  for (bc = 0; bc < MAX_BUCKETS; bc++)
+  {
+    rt_bucket_start[bc] = rt_count;
+    for (pos = k_buckets[bc].head; NULL != pos; pos = pos->next)
+    {
+      GNUNET_assert (rt_count < rt_size);
+      rt_peers[rt_count] = pos;
+      rt_hashes[rt_count] = pos->phash;
+      rt_count++;
+    }
+  }
+  rt_bucket_start[MAX_BUCKETS] = rt_count;
+}
+
+
 /**
  * Method called whenever a peer connects.
  *
@@ -775,7 +931,6 @@ handle_core_connect (void *cls,
                      const struct GNUNET_PeerIdentity *peer)
 {
   struct PeerInfo *ret;
-  struct GNUNET_HashCode phash;
   int peer_bucket;
 
   /* Check for connect to self message */
@@ -795,17 +950,17 @@ handle_core_connect (void *cls,
                             gettext_noop ("# peers connected"),
                             1,
                             GNUNET_NO);
-  GNUNET_CRYPTO_hash (peer,
-		      sizeof (struct GNUNET_PeerIdentity),
-		      &phash);
-  peer_bucket = find_bucket (&phash);
-  GNUNET_assert ((peer_bucket >= 0) && (peer_bucket < MAX_BUCKETS));
   ret = GNUNET_new (struct PeerInfo);
 #if 0
   ret->latency = latency;
   ret->distance = distance;
 #endif
   ret->id = *peer;
+  GNUNET_CRYPTO_hash (peer,
+		      sizeof (struct GNUNET_PeerIdentity),
+		      &ret->phash);
+  peer_bucket = find_bucket (&ret->phash);
+  GNUNET_assert ((peer_bucket >= 0) && (peer_bucket < MAX_BUCKETS));
   GNUNET_CONTAINER_DLL_insert_tail (k_buckets[peer_bucket].head,
                                     k_buckets[peer_bucket].tail,
                                     ret);
@@ -817,6 +972,7 @@ handle_core_connect (void *cls,
                                                     peer,
                                                     ret,
                                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY));
+  rebuild_route_table ();
   if ( (peer_bucket > 0) &&
        (k_buckets[peer_bucket].peers_size <= bucket_size))
   {
@@ -847,7 +1003,7 @@ handle_core_disconnect (void *cls,
   int current_bucket;
   struct P2PPendingMessage *pos;
   unsigned int discarded;
-  struct GNUNET_HashCode phash;
+  unsigned int c;
 
   /* Check for disconnect from self message */
   if (0 == memcmp (&my_identity,
@@ -873,16 +1029,14 @@ handle_core_disconnect (void *cls,
                  GNUNET_CONTAINER_multipeermap_remove (all_connected_peers,
                                                        peer,
                                                        to_remove));
-  GNUNET_CRYPTO_hash (peer,
-		      sizeof (struct GNUNET_PeerIdentity),
-		      &phash);
-  current_bucket = find_bucket (&phash);
+  current_bucket = find_bucket (&to_remove->phash);
   GNUNET_assert (current_bucket >= 0);
   GNUNET_CONTAINER_DLL_remove (k_buckets[current_bucket].head,
                                k_buckets[current_bucket].tail,
                                to_remove);
   GNUNET_assert (k_buckets[current_bucket].peers_size > 0);
   k_buckets[current_bucket].peers_size--;
+  rebuild_route_table ();
   while ( (closest_bucket > 0) &&
           (0 == k_buckets[closest_bucket].peers_size) )
     closest_bucket--;
@@ -891,14 +1045,22 @@ handle_core_disconnect (void *cls,
     GNUNET_CORE_notify_transmit_ready_cancel (to_remove->th);
     to_remove->th = NULL;
   }
+  if (NULL != to_remove->batch_task)
+  {
+    GNUNET_SCHEDULER_cancel (to_remove->batch_task);
+    to_remove->batch_task = NULL;
+  }
   discarded = 0;
-  while (NULL != (pos = to_remove->head))
+  for (c = 0; c < MC_COUNT; c++)
   {
-    GNUNET_CONTAINER_DLL_remove (to_remove->head,
-                                 to_remove->tail,
-                                 pos);
-    discarded++;
-    GNUNET_free (pos);
+    while (NULL != (pos = to_remove->queues[c].head))
+    {
+      GNUNET_CONTAINER_DLL_remove (to_remove->queues[c].head,
+                                   to_remove->queues[c].tail,
+                                   pos);
+      discarded++;
+      GNUNET_free (pos);
+    }
   }
   if (k_buckets[current_bucket].peers_size < bucket_size)
     update_connect_preferences ();
@@ -910,9 +1072,112 @@ handle_core_disconnect (void *cls,
 }
 
 
+/**
+ * Remove a message from the queue of a peer.
+ *
+ * @param peer the peer
+ * @param q queue of @a peer with the message
+ * @param pending message to remove, the caller must free it
+ */
+static void
+dequeue_message (struct PeerInfo *peer,
+                 struct MessageQueue *q,
+                 struct P2PPendingMessage *pending)
+{
+  GNUNET_CONTAINER_DLL_remove (q->head,
+                               q->tail,
+                               pending);
+  q->count--;
+  peer->pending_bytes -= ntohs (pending->msg->size);
+}
+
+
+/**
+ * Drop the messages for a peer that timed out.  Only the heads of
+ * the queues are checked, the messages behind them will be checked
+ * once they get to the head.
+ *
+ * @param peer the peer
+ */
+static void
+drop_expired_messages (struct PeerInfo *peer)
+{
+  struct MessageQueue *q;
+  struct P2PPendingMessage *pending;
+  unsigned int c;
+
+  for (c = 0; c < MC_COUNT; c++)
+  {
+    q = &peer->queues[c];
+    while ((NULL != (pending = q->head)) &&
+           (0 == GNUNET_TIME_absolute_get_remaining (pending->timeout).rel_value_us))
+    {
+      GNUNET_STATISTICS_update (GDS_stats,
+                                gettext_noop
+                                ("# Messages dropped (CORE timeout)"),
+                                1,
+                                GNUNET_NO);
+      dequeue_message (peer, q, pending);
+      GNUNET_free (pending);
+    }
+  }
+}
+
+
+static size_t
+core_transmit_notify (void *cls,
+                      size_t size,
+                      void *buf);
+
+
+/**
+ * Ask CORE to transmit the messages queued for a peer, as many as fit
+ * into #MAX_BATCH_SIZE (but at least the largest message at the head
+ * of a queue).
+ *
+ * @param peer the peer, must have messages queued
+ */
+static void
+request_transmission (struct PeerInfo *peer)
+{
+  struct P2PPendingMessage *pending;
+  struct GNUNET_TIME_Absolute timeout;
+  size_t msize;
+  unsigned int c;
+
+  msize = GNUNET_MIN (peer->pending_bytes,
+                      MAX_BATCH_SIZE);
+  timeout = GNUNET_TIME_UNIT_FOREVER_ABS;
+  for (c = 0; c < MC_COUNT; c++)
+  {
+    if (NULL == (pending = peer->queues[c].head))
+      continue;
+    msize = GNUNET_MAX (msize,
+                        ntohs (pending->msg->size));
+    timeout = GNUNET_TIME_absolute_min (timeout,
+                                        pending->timeout);
+  }
+  GNUNET_STATISTICS_update (GDS_stats,
+                            gettext_noop
+                            ("# Bytes of bandwidth requested from core"),
+                            msize, GNUNET_NO);
+  peer->th =
+      GNUNET_CORE_notify_transmit_ready (core_api, GNUNET_NO,
+                                         GNUNET_CORE_PRIO_BEST_EFFORT,
+                                         GNUNET_TIME_absolute_get_remaining (timeout),
+                                         &peer->id,
+                                         msize,
+                                         &core_transmit_notify,
+                                         peer);
+  GNUNET_break (NULL != peer->th);
+}
+
+
 /**
  * Called when core is ready to send a message we asked for
- * out to the destination.
+ * out to the destination.  Fills the buffer with the queued
+ * messages, sharing it between the message classes by deficit
+ * round robin.
  *
  * @param cls the 'struct PeerInfo' of the target peer
  * @param size number of bytes available in @a buf
@@ -926,104 +1191,148 @@ core_transmit_notify (void *cls,
 {
   struct PeerInfo *peer = cls;
   char *cbuf = buf;
+  struct MessageQueue *q;
   struct P2PPendingMessage *pending;
   size_t off;
   size_t msize;
+  unsigned int c;
+  unsigned int sent;
+  int fits;
 
   peer->th = NULL;
-  while ((NULL != (pending = peer->head)) &&
-         (0 == GNUNET_TIME_absolute_get_remaining (pending->timeout).rel_value_us))
-  {
-    GNUNET_STATISTICS_update (GDS_stats,
-                              gettext_noop
-                              ("# Messages dropped (CORE timeout)"),
-                              1,
-                              GNUNET_NO);
-    peer->pending_count--;
-    GNUNET_CONTAINER_DLL_remove (peer->head, peer->tail, pending);
-    GNUNET_free (pending);
-  }
-  if (NULL == pending)
+  drop_expired_messages (peer);
+  if (0 == peer->pending_bytes)
   {
     /* no messages pending */
     return 0;
   }
   if (NULL == buf)
   {
-    peer->th =
-        GNUNET_CORE_notify_transmit_ready (core_api, GNUNET_NO,
-                                           GNUNET_CORE_PRIO_BEST_EFFORT,
-                                           GNUNET_TIME_absolute_get_remaining
-                                           (pending->timeout), &peer->id,
-                                           ntohs (pending->msg->size),
-                                           &core_transmit_notify, peer);
-    GNUNET_break (NULL != peer->th);
+    request_transmission (peer);
     return 0;
   }
   off = 0;
-  while ((NULL != (pending = peer->head)) &&
-         (size - off >= (msize = ntohs (pending->msg->size))))
-  {
-    GNUNET_STATISTICS_update (GDS_stats,
-                              gettext_noop
-                              ("# Bytes transmitted to other peers"), msize,
-                              GNUNET_NO);
-    memcpy (&cbuf[off], pending->msg, msize);
-    off += msize;
-    peer->pending_count--;
-    GNUNET_CONTAINER_DLL_remove (peer->head,
-				 peer->tail,
-				 pending);
-    GNUNET_free (pending);
-  }
-  if (NULL != (pending = peer->head))
+  sent = 0;
+  while (1)
   {
-    /* technically redundant, but easier to read and
-       avoids bogus gcc warning... */
-    msize = ntohs (pending->msg->size);
-    peer->th =
-      GNUNET_CORE_notify_transmit_ready (core_api,
-					 GNUNET_NO,
-					 GNUNET_CORE_PRIO_BEST_EFFORT,
-					 GNUNET_TIME_absolute_get_remaining (pending->timeout),
-					 &peer->id,
-					 msize,
-					 &core_transmit_notify,
-					 peer);
-    GNUNET_break (NULL != peer->th);
+    fits = GNUNET_NO;
+    for (c = 0; c < MC_COUNT; c++)
+      if ( (NULL != (pending = peer->queues[c].head)) &&
+           (ntohs (pending->msg->size) <= size - off) )
+        fits = GNUNET_YES;
+    if (GNUNET_NO == fits)
+      break;
+    for (c = 0; c < MC_COUNT; c++)
+    {
+      q = &peer->queues[c];
+      if (NULL == q->head)
+        continue;
+      q->deficit += BATCH_QUANTUM;
+      while ((NULL != (pending = q->head)) &&
+             ((msize = ntohs (pending->msg->size)) <= q->deficit) &&
+             (msize <= size - off))
+      {
+        GNUNET_STATISTICS_update (GDS_stats,
+                                  gettext_noop
+                                  ("# Bytes transmitted to other peers"), msize,
+                                  GNUNET_NO);
+        memcpy (&cbuf[off], pending->msg, msize);
+        off += msize;
+        q->deficit -= msize;
+        sent++;
+        dequeue_message (peer, q, pending);
+        GNUNET_free (pending);
+      }
+      if (NULL == q->head)
+        q->deficit = 0;
+    }
   }
+  GNUNET_STATISTICS_update (GDS_stats,
+                            gettext_noop
+                            ("# P2P messages transmitted in batches"), sent,
+                            GNUNET_NO);
+  GNUNET_STATISTICS_update (GDS_stats,
+                            gettext_noop
+                            ("# P2P batches transmitted"), 1,
+                            GNUNET_NO);
+  /* whatever is left has been waiting long enough */
+  if (0 != peer->pending_bytes)
+    request_transmission (peer);
   return off;
 }
 
 
 /**
- * Transmit all messages in the peer's message queue.
+ * Ask CORE to transmit the messages queued for a peer after the
+ * batching delay.
+ *
+ * @param cls the `struct PeerInfo`
+ * @param tc scheduler context
+ */
+static void
+batch_timeout (void *cls,
+               const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct PeerInfo *peer = cls;
+
+  peer->batch_task = NULL;
+  if ( (NULL == peer->th) &&
+       (0 != peer->pending_bytes) )
+    request_transmission (peer);
+}
+
+
+/**
+ * Transmit all messages in the peer's message queue.  Unless
+ * enough messages are queued to fill a batch, we wait for
+ * #BATCH_DELAY for more messages first.
  *
  * @param peer message queue to process
  */
 static void
 process_peer_queue (struct PeerInfo *peer)
 {
-  struct P2PPendingMessage *pending;
-
-  if (NULL == (pending = peer->head))
+  if (0 == peer->pending_bytes)
     return;
   if (NULL != peer->th)
     return;
-  GNUNET_STATISTICS_update (GDS_stats,
-                            gettext_noop
-                            ("# Bytes of bandwidth requested from core"),
-                            ntohs (pending->msg->size), GNUNET_NO);
-  peer->th =
-      GNUNET_CORE_notify_transmit_ready (core_api, GNUNET_NO,
-                                         GNUNET_CORE_PRIO_BEST_EFFORT,
-                                         GNUNET_TIME_absolute_get_remaining
-                                         (pending->timeout),
-                                         &peer->id,
-                                         ntohs (pending->msg->size),
-                                         &core_transmit_notify,
-                                         peer);
-  GNUNET_break (NULL != peer->th);
+  if (peer->pending_bytes >= MAX_BATCH_SIZE)
+  {
+    if (NULL != peer->batch_task)
+    {
+      GNUNET_SCHEDULER_cancel (peer->batch_task);
+      peer->batch_task = NULL;
+    }
+    request_transmission (peer);
+    return;
+  }
+  if (NULL == peer->batch_task)
+    peer->batch_task = GNUNET_SCHEDULER_add_delayed (BATCH_DELAY,
+                                                     &batch_timeout,
+                                                     peer);
+}
+
+
+/**
+ * Queue a message for transmission to a peer.
+ *
+ * @param peer the peer
+ * @param mc class of the message
+ * @param pending the message
+ */
+static void
+queue_message (struct PeerInfo *peer,
+               enum MessageClass mc,
+               struct P2PPendingMessage *pending)
+{
+  struct MessageQueue *q = &peer->queues[mc];
+
+  GNUNET_CONTAINER_DLL_insert_tail (q->head,
+                                    q->tail,
+                                    pending);
+  q->count++;
+  peer->pending_bytes += ntohs (pending->msg->size);
+  process_peer_queue (peer);
 }
 
 
@@ -1153,35 +1462,24 @@ am_closest_peer (const struct GNUNET_HashCode *key,
   int bits;
   int other_bits;
   int bucket_num;
-  int count;
-  struct PeerInfo *pos;
-  struct GNUNET_HashCode phash;
+  unsigned int i;
 
   if (0 == memcmp (&my_identity_hash, key, sizeof (struct GNUNET_HashCode)))
     return GNUNET_YES;
   bucket_num = find_bucket (key);
   GNUNET_assert (bucket_num >= 0);
   bits = GNUNET_CRYPTO_hash_matching_bits (&my_identity_hash, key);
-  pos = k_buckets[bucket_num].head;
-  count = 0;
-  while ((NULL != pos) && (count < bucket_size))
+  for (i = rt_bucket_start[bucket_num]; i < rt_bucket_start[bucket_num + 1]; i++)
   {
-    GNUNET_CRYPTO_hash (&pos->id,
-			sizeof (struct GNUNET_PeerIdentity),
-			&phash);
     if ((NULL != bloom) &&
         (GNUNET_YES ==
-         GNUNET_CONTAINER_bloomfilter_test (bloom, &phash)))
-    {
-      pos = pos->next;
+         GNUNET_CONTAINER_bloomfilter_test (bloom, &rt_hashes[i])))
       continue;                 /* Skip already checked entries */
-    }
-    other_bits = GNUNET_CRYPTO_hash_matching_bits (&phash, key);
+    other_bits = GNUNET_CRYPTO_hash_matching_bits (&rt_hashes[i], key);
     if (other_bits > bits)
       return GNUNET_NO;
     if (other_bits == bits)     /* We match the same number of bits */
       return GNUNET_YES;
-    pos = pos->next;
   }
   /* No peers closer, we are the closest! */
   return GNUNET_YES;
@@ -1189,146 +1487,40 @@ am_closest_peer (const struct GNUNET_HashCode *key,
 
 
 /**
- * Select a peer from the routing table that would be a good routing
- * destination for sending a message for "key".  The resulting peer
- * must not be in the set of blocked peers.<p>
- *
- * Note that we should not ALWAYS select the closest peer to the
- * target, peers further away from the target should be chosen with
- * exponentially declining probability.
- *
- * FIXME: double-check that this is fine
- *
+ * Select the closest peer to @a key from the routing table, unless
+ * that peer is in the Bloom filter.  Only the first #bucket_size
+ * peers of each bucket are considered.
  *
  * @param key the key we are selecting a peer to route to
- * @param bloom a bloomfilter containing entries this request has seen already
- * @param hops how many hops has this message traversed thus far
- * @return Peer to route to, or NULL on error
- */
-static struct PeerInfo *
-select_peer (const struct GNUNET_HashCode *key,
-             const struct GNUNET_CONTAINER_BloomFilter *bloom,
-             uint32_t hops)
+ * @return offset of the peer in #rt_peers, or -1 if the closest
+ *         peer was already routed to (or we have no peers)
+ */
+static int
+select_closest_peer (const struct GNUNET_HashCode *key)
 {
   unsigned int bc;
-  unsigned int count;
-  unsigned int selected;
-  struct PeerInfo *pos;
+  unsigned int i;
+  unsigned int end;
   unsigned int dist;
   unsigned int smallest_distance;
-  struct PeerInfo *chosen;
-  struct GNUNET_HashCode phash;
+  int chosen;
 
-  if (hops >= GDS_NSE_get ())
-  {
-    /* greedy selection (closest peer that is not in bloomfilter) */
-    smallest_distance = UINT_MAX;
-    chosen = NULL;
-    for (bc = 0; bc <= closest_bucket; bc++)
-    {
-      pos = k_buckets[bc].head;
-      count = 0;
-      while ((pos != NULL) && (count < bucket_size))
-      {
-	GNUNET_CRYPTO_hash (&pos->id,
-			    sizeof (struct GNUNET_PeerIdentity),
-			    &phash);
-        if ((bloom == NULL) ||
-            (GNUNET_NO ==
-             GNUNET_CONTAINER_bloomfilter_test (bloom, &phash)))
-        {
-          dist = get_distance (key, &phash);
-          if (dist < smallest_distance)
-          {
-            chosen = pos;
-            smallest_distance = dist;
-          }
-        }
-        else
-        {
-          GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-                      "Excluded peer `%s' due to BF match in greedy routing for %s\n",
-                      GNUNET_i2s (&pos->id), GNUNET_h2s (key));
-          GNUNET_STATISTICS_update (GDS_stats,
-                                    gettext_noop
-                                    ("# Peers excluded from routing due to Bloomfilter"),
-                                    1, GNUNET_NO);
-          dist = get_distance (key, &phash);
-          if (dist < smallest_distance)
-          {
-            chosen = NULL;
-            smallest_distance = dist;
-          }
-        }
-        count++;
-        pos = pos->next;
-      }
-    }
-    if (NULL == chosen)
-      GNUNET_STATISTICS_update (GDS_stats,
-                                gettext_noop ("# Peer selection failed"), 1,
-                                GNUNET_NO);
-    return chosen;
-  }
-
-  /* select "random" peer */
-  /* count number of peers that are available and not filtered */
-  count = 0;
+  smallest_distance = UINT_MAX;
+  chosen = -1;
   for (bc = 0; bc <= closest_bucket; bc++)
   {
-    pos = k_buckets[bc].head;
-    while ((pos != NULL) && (count < bucket_size))
+    end = GNUNET_MIN (rt_bucket_start[bc + 1],
+                      rt_bucket_start[bc] + bucket_size);
+    for (i = rt_bucket_start[bc]; i < end; i++)
     {
-      GNUNET_CRYPTO_hash (&pos->id,
-			  sizeof (struct GNUNET_PeerIdentity),
-			  &phash);
-      if ((bloom != NULL) &&
-          (GNUNET_YES ==
-           GNUNET_CONTAINER_bloomfilter_test (bloom, &phash)))
-      {
-        GNUNET_STATISTICS_update (GDS_stats,
-                                  gettext_noop
-                                  ("# Peers excluded from routing due to Bloomfilter"),
-                                  1, GNUNET_NO);
-        GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-                    "Excluded peer `%s' due to BF match in random routing for %s\n",
-                    GNUNET_i2s (&pos->id), GNUNET_h2s (key));
-        pos = pos->next;
-        continue;               /* Ignore bloomfiltered peers */
-      }
-      count++;
-      pos = pos->next;
-    }
-  }
-  if (0 == count)               /* No peers to select from! */
-  {
-    GNUNET_STATISTICS_update (GDS_stats,
-                              gettext_noop ("# Peer selection failed"), 1,
-                              GNUNET_NO);
-    return NULL;
-  }
-  /* Now actually choose a peer */
-  selected = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_WEAK, count);
-  count = 0;
-  for (bc = 0; bc <= closest_bucket; bc++)
-  {
-    for (pos = k_buckets[bc].head; ((pos != NULL) && (count < bucket_size)); pos = pos->next)
-    {
-      GNUNET_CRYPTO_hash (&pos->id,
-			  sizeof (struct GNUNET_PeerIdentity),
-			  &phash);
-      if ((bloom != NULL) &&
-          (GNUNET_YES ==
-           GNUNET_CONTAINER_bloomfilter_test (bloom, &phash)))
-      {
-        continue;               /* Ignore bloomfiltered peers */
-      }
-      if (0 == selected--)
-        return pos;
+      dist = get_distance (key, &rt_hashes[i]);
+      if (dist >= smallest_distance)
+        continue;
+      smallest_distance = dist;
+      chosen = (GNUNET_YES == rt_filtered[i]) ? -1 : (int) i;
     }
   }
-  GNUNET_break (0);
-  return NULL;
+  return chosen;
 }
 
 
@@ -1336,6 +1528,16 @@ select_peer (const struct GNUNET_HashCode *key,
  * Compute the set of peers that the given request should be
  * forwarded to.
  *
+ * Once the request has traversed about as many hops as there are
+ * peers in the network (in bits), we route greedily to the closest
+ * peer, unless it was already routed to.  Before that, each target
+ * is picked at random among the first #bucket_size peers not yet
+ * routed to.
+ *
+ * All peers are tested against the Bloom filter in a single pass
+ * over #rt_hashes; the targets we select are marked in the scratch
+ * results instead of testing the filter again after adding them.
+ *
  * @param key routing key
  * @param bloom bloom filter excluding peers as targets, all selected
  *        peers will be added to the bloom filter
@@ -1353,9 +1555,13 @@ get_target_peers (const struct GNUNET_HashCode *key,
 {
   unsigned int ret;
   unsigned int off;
+  unsigned int excluded;
+  unsigned int available;
+  unsigned int i;
+  unsigned int j;
+  unsigned int selected;
+  int chosen;
   struct PeerInfo **rtargets;
-  struct PeerInfo *nxt;
-  struct GNUNET_HashCode nhash;
 
   GNUNET_assert (NULL != bloom);
   ret = get_forward_count (hop_count, target_replication);
@@ -1364,21 +1570,52 @@ get_target_peers (const struct GNUNET_HashCode *key,
     *targets = NULL;
     return 0;
   }
+  excluded = GNUNET_CONTAINER_bloomfilter_test_many (bloom,
+                                                     rt_hashes,
+                                                     rt_count,
+                                                     rt_filtered);
+  if (0 != excluded)
+    GNUNET_STATISTICS_update (GDS_stats,
+                              gettext_noop
+                              ("# Peers excluded from routing due to Bloomfilter"),
+                              excluded, GNUNET_NO);
   rtargets = GNUNET_malloc (sizeof (struct PeerInfo *) * ret);
-  for (off = 0; off < ret; off++)
+  off = 0;
+  if (hop_count >= GDS_NSE_get ())
   {
-    nxt = select_peer (key, bloom, hop_count);
-    if (NULL == nxt)
-      break;
-    rtargets[off] = nxt;
-    GNUNET_CRYPTO_hash (&nxt->id,
-			sizeof (struct GNUNET_PeerIdentity),
-			&nhash);
-    GNUNET_break (GNUNET_NO ==
-                  GNUNET_CONTAINER_bloomfilter_test (bloom,
-                                                     &nhash));
-    GNUNET_CONTAINER_bloomfilter_add (bloom, &nhash);
+    /* greedy selection; once the closest peer is selected, it is
+       in the filter and no other peer will be chosen */
+    chosen = select_closest_peer (key);
+    if (-1 != chosen)
+      rtargets[off++] = rt_peers[chosen];
   }
+  else
+  {
+    /* random selection without replacement; compact the offsets of
+       the peers that are not filtered to the front of the scratch
+       array, preserving their order */
+    available = 0;
+    for (i = 0; i < rt_count; i++)
+      if (GNUNET_NO == rt_filtered[i])
+        rt_filtered[available++] = i;
+    while ( (off < ret) &&
+            (0 != available) )
+    {
+      selected = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_WEAK,
+                                           GNUNET_MIN (available,
+                                                       bucket_size));
+      rtargets[off++] = rt_peers[rt_filtered[selected]];
+      for (j = selected + 1; j < available; j++)
+        rt_filtered[j - 1] = rt_filtered[j];
+      available--;
+    }
+  }
+  if (off < ret)
+    GNUNET_STATISTICS_update (GDS_stats,
+                              gettext_noop ("# Peer selection failed"), 1,
+                              GNUNET_NO);
+  for (i = 0; i < off; i++)
+    GNUNET_CONTAINER_bloomfilter_add (bloom, &rtargets[i]->phash);
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "Selected %u/%u peers at hop %u for %s (target was %u)\n",
               off,
@@ -1442,7 +1679,6 @@ GDS_NEIGHBOURS_handle_put (enum GNUNET_BLOCK_Type type,
   size_t msize;
   struct PeerPutMessage *ppm;
   struct GNUNET_PeerIdentity *pp;
-  struct GNUNET_HashCode thash;
   unsigned int skip_count;
 
   GNUNET_assert (NULL != bf);
@@ -1485,7 +1721,7 @@ GDS_NEIGHBOURS_handle_put (enum GNUNET_BLOCK_Type type,
   for (i = 0; i < target_count; i++)
   {
     target = targets[i];
-    if (target->pending_count >= MAXIMUM_PENDING_PER_PEER)
+    if (target->queues[MC_PUT].count >= MAXIMUM_PENDING_PER_PEER)
     {
       /* skip */
       GNUNET_STATISTICS_update (GDS_stats,
@@ -1510,12 +1746,9 @@ GDS_NEIGHBOURS_handle_put (enum GNUNET_BLOCK_Type type,
     ppm->desired_replication_level = htonl (desired_replication_level);
     ppm->put_path_length = htonl (put_path_length);
     ppm->expiration_time = GNUNET_TIME_absolute_hton (expiration_time);
-    GNUNET_CRYPTO_hash (&target->id,
-			sizeof (struct GNUNET_PeerIdentity),
-			&thash);
     GNUNET_break (GNUNET_YES ==
                   GNUNET_CONTAINER_bloomfilter_test (bf,
-                                                     &thash));
+                                                     &target->phash));
     GNUNET_assert (GNUNET_OK ==
                    GNUNET_CONTAINER_bloomfilter_get_raw_data (bf,
                                                               ppm->bloomfilter,
@@ -1525,9 +1758,7 @@ GDS_NEIGHBOURS_handle_put (enum GNUNET_BLOCK_Type type,
     memcpy (pp, put_path,
             sizeof (struct GNUNET_PeerIdentity) * put_path_length);
     memcpy (&pp[put_path_length], data, data_size);
-    GNUNET_CONTAINER_DLL_insert_tail (target->head, target->tail, pending);
-    target->pending_count++;
-    process_peer_queue (target);
+    queue_message (target, MC_PUT, pending);
   }
   GNUNET_free (targets);
   return (skip_count < target_count) ? GNUNET_OK : GNUNET_NO;
@@ -1571,7 +1802,6 @@ GDS_NEIGHBOURS_handle_get (enum GNUNET_BLOCK_Type type,
   struct PeerGetMessage *pgm;
   char *xq;
   size_t reply_bf_size;
-  struct GNUNET_HashCode thash;
   unsigned int skip_count;
 
   GNUNET_assert (NULL != peer_bf);
@@ -1609,7 +1839,7 @@ GDS_NEIGHBOURS_handle_get (enum GNUNET_BLOCK_Type type,
   for (i = 0; i < target_count; i++)
   {
     target = targets[i];
-    if (target->pending_count >= MAXIMUM_PENDING_PER_PEER)
+    if (target->queues[MC_GET].count >= MAXIMUM_PENDING_PER_PEER)
     {
       /* skip */
       GNUNET_STATISTICS_update (GDS_stats,
@@ -1634,12 +1864,9 @@ GDS_NEIGHBOURS_handle_get (enum GNUNET_BLOCK_Type type,
     pgm->desired_replication_level = htonl (desired_replication_level);
     pgm->xquery_size = htonl (xquery_size);
     pgm->bf_mutator = reply_bf_mutator;
-    GNUNET_CRYPTO_hash (&target->id,
-			sizeof (struct GNUNET_PeerIdentity),
-			&thash);
     GNUNET_break (GNUNET_YES ==
                   GNUNET_CONTAINER_bloomfilter_test (peer_bf,
-                                                     &thash));
+                                                     &target->phash));
     GNUNET_assert (GNUNET_OK ==
                    GNUNET_CONTAINER_bloomfilter_get_raw_data (peer_bf,
                                                               pgm->bloomfilter,
@@ -1653,9 +1880,7 @@ GDS_NEIGHBOURS_handle_get (enum GNUNET_BLOCK_Type type,
                                                                 &xq
                                                                 [xquery_size],
                                                                 reply_bf_size));
-    GNUNET_CONTAINER_DLL_insert_tail (target->head, target->tail, pending);
-    target->pending_count++;
-    process_peer_queue (target);
+    queue_message (target, MC_GET, pending);
   }
   GNUNET_free (targets);
   return (skip_count < target_count) ? GNUNET_OK : GNUNET_NO;
@@ -1717,7 +1942,7 @@ GDS_NEIGHBOURS_handle_reply (const struct GNUNET_PeerIdentity *target,
     /* peer disconnected in the meantime, drop reply */
     return;
   }
-  if (pi->pending_count >= MAXIMUM_PENDING_PER_PEER)
+  if (pi->queues[MC_RESULT].count >= MAXIMUM_PENDING_PER_PEER)
   {
     /* skip */
     GNUNET_STATISTICS_update (GDS_stats, gettext_noop ("# P2P messages dropped due to full queue"),
@@ -1747,9 +1972,7 @@ GDS_NEIGHBOURS_handle_reply (const struct GNUNET_PeerIdentity *target,
   memcpy (&paths[put_path_length], get_path,
           get_path_length * sizeof (struct GNUNET_PeerIdentity));
   memcpy (&paths[put_path_length + get_path_length], data, data_size);
-  GNUNET_CONTAINER_DLL_insert (pi->head, pi->tail, pending);
-  pi->pending_count++;
-  process_peer_queue (pi);
+  queue_message (pi, MC_RESULT, pending);
 }
 
 
@@ -1966,7 +2189,6 @@ handle_find_peer (const struct GNUNET_PeerIdentity *sender,
   struct PeerBucket *bucket;
   struct PeerInfo *peer;
   unsigned int choice;
-  struct GNUNET_HashCode phash;
   struct GNUNET_HashCode mhash;
   const struct GNUNET_HELLO_Message *hello;
 
@@ -2028,8 +2250,7 @@ handle_find_peer (const struct GNUNET_PeerIdentity *sender,
       return;                   /* no non-masked peer available */
     if (peer == NULL)
       peer = bucket->head;
-    GNUNET_CRYPTO_hash (&peer->id, sizeof (struct GNUNET_PeerIdentity), &phash);
-    GNUNET_BLOCK_mingle_hash (&phash, bf_mutator, &mhash);
+    GNUNET_BLOCK_mingle_hash (&peer->phash, bf_mutator, &mhash);
     hello = GDS_HELLO_get (&peer->id);
   }
   while ((hello == NULL) ||
@@ -2431,6 +2652,14 @@ GDS_NEIGHBOURS_done ()
   GNUNET_assert (0 == GNUNET_CONTAINER_multipeermap_size (all_connected_peers));
   GNUNET_CONTAINER_multipeermap_destroy (all_connected_peers);
   all_connected_peers = NULL;
+  GNUNET_free_non_null (rt_peers);
+  rt_peers = NULL;
+  GNUNET_free_non_null (rt_hashes);
+  rt_hashes = NULL;
+  GNUNET_free_non_null (rt_filtered);
+  rt_filtered = NULL;
+  rt_size = 0;
+  rt_count = 0;
   GNUNET_CONTAINER_multipeermap_iterate (all_desired_peers,
                                          &free_connect_info,
                                          NULL);
@@ -424,11 +424,11 @@ void
 GDS_DATACACHE_get_successors (const struct GNUNET_HashCode *trail_id,
                               const struct GNUNET_HashCode *key)
 {
-  (void) GNUNET_DATACACHE_get_closest (datacache,
-                                       key,
-                                       NUM_CLOSEST,
-                                       &datacache_get_successors_iterator,
-                                       (void *) trail_id);
+  (void) GNUNET_DATACACHE_get_successors (datacache,
+                                          key,
+                                          NUM_CLOSEST,
+                                          &datacache_get_successors_iterator,
+                                          (void *) trail_id);
 }
 
 
@@ -41,10 +41,10 @@
 
 /**
  * Blocksize to use when hashing files for indexing (blocksize for IO,
- * not for the DBlocks).  Larger blocksizes can be more efficient but
- * will be more disruptive as far as the scheduler is concerned.
+ * not for the DBlocks).  Hashing happens in a worker thread, so larger
+ * blocksizes do not disrupt the scheduler.
  */
-#define HASHING_BLOCKSIZE (1024 * 128)
+#define HASHING_BLOCKSIZE (1024 * 1024)
 
 
 /**
@@ -2284,9 +2284,10 @@ deserialize_unindex_file (void *cls,
   {
   case UNINDEX_STATE_HASHING:
     uc->fhc =
-        GNUNET_CRYPTO_hash_file (GNUNET_SCHEDULER_PRIORITY_IDLE, uc->filename,
-                                 HASHING_BLOCKSIZE,
-                                 &GNUNET_FS_unindex_process_hash_, uc);
+        GNUNET_CRYPTO_hash_file_threaded (GNUNET_SCHEDULER_PRIORITY_IDLE,
+                                          uc->filename,
+                                          HASHING_BLOCKSIZE,
+                                          &GNUNET_FS_unindex_process_hash_, uc);
     break;
   case UNINDEX_STATE_FS_NOTIFY:
     uc->state = UNINDEX_STATE_HASHING;
@@ -2533,7 +2534,7 @@ signal_download_resume (struct GNUNET_FS_DownloadContext *dc)
     signal_download_resume (dcc);
     dcc = dcc->next;
   }
-  if (NULL != dc->pending_head)
+  if (NULL != dc->pending)
     GNUNET_FS_download_start_downloading_ (dc);
 }
 
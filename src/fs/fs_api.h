@@ -1284,6 +1284,22 @@ struct GNUNET_FS_PublishContext
    */
   struct GNUNET_DATASTORE_QueueEntry *qre;
 
+  /**
+   * Blocks of the current file that we did not give to the
+   * datastore yet; NULL until we encode the first block.
+   */
+  struct GNUNET_DATASTORE_PutItem *put_items;
+
+  /**
+   * Buffer with the data of @e put_items.
+   */
+  char *put_data;
+
+  /**
+   * Number of valid entries in @e put_items.
+   */
+  unsigned int put_count;
+
   /**
    * Context for SKS publishing operation that is part of this publishing operation
    * (NULL if not active).
@@ -1745,12 +1761,16 @@ enum BlockRequestState
 struct DownloadRequest
 {
   /**
-   * While pending, we keep all download requests in a doubly-linked list.
+   * While in the request window (or after timing out of it), we keep
+   * all download requests in a doubly-linked list (sorted by
+   * @e transmission_time).
    */
   struct DownloadRequest *next;
 
   /**
-   * While pending, we keep all download requests in a doubly-linked list.
+   * While in the request window (or after timing out of it), we keep
+   * all download requests in a doubly-linked list (sorted by
+   * @e transmission_time).
    */
   struct DownloadRequest *prev;
 
@@ -1798,9 +1818,27 @@ struct DownloadRequest
   enum BlockRequestState state;
 
   /**
-   * #GNUNET_YES if this entry is in the pending list.
+   * Entry in the pending heap, NULL if we are not waiting to
+   * transmit this request to the FS service.
    */
-  int is_pending;
+  struct GNUNET_CONTAINER_HeapNode *hn;
+
+  /**
+   * When did we last transmit this request to the FS service?
+   */
+  struct GNUNET_TIME_Absolute transmission_time;
+
+  /**
+   * #GNUNET_YES if this entry is in the request window (transmitted,
+   * not yet answered and not yet timed out).
+   */
+  int in_window;
+
+  /**
+   * #GNUNET_YES if this entry timed out of the request window but
+   * was not yet answered (the FS service is still working on it).
+   */
+  int timed_out;
 
 };
 
@@ -1944,14 +1982,34 @@ struct GNUNET_FS_DownloadContext
   struct GNUNET_CONTAINER_MultiHashMap *active;
 
   /**
-   * Head of linked list of pending requests.
+   * Heap of pending requests (those we still need to transmit to
+   * the FS service), IBLOCKs closest to the root first, then by
+   * offset.  NULL if there are no pending requests.
+   */
+  struct GNUNET_CONTAINER_Heap *pending;
+
+  /**
+   * Head of the list of requests in the request window, oldest
+   * transmission first.
    */
-  struct DownloadRequest *pending_head;
+  struct DownloadRequest *window_head;
 
   /**
-   * Head of linked list of pending requests.
+   * Tail of the list of requests in the request window.
    */
-  struct DownloadRequest *pending_tail;
+  struct DownloadRequest *window_tail;
+
+  /**
+   * Head of the list of requests that timed out of the request
+   * window but are still active at the FS service.
+   */
+  struct DownloadRequest *timed_out_head;
+
+  /**
+   * Tail of the list of requests that timed out of the request
+   * window.
+   */
+  struct DownloadRequest *timed_out_tail;
 
   /**
    * Top-level download request.
@@ -1974,6 +2032,18 @@ struct GNUNET_FS_DownloadContext
    */
   struct GNUNET_SCHEDULER_Task *task;
 
+  /**
+   * Task that removes requests from the request window if the
+   * FS service did not answer them in time.
+   */
+  struct GNUNET_SCHEDULER_Task *window_task;
+
+  /**
+   * Moving average of the time it took the FS service to answer
+   * requests in the request window.
+   */
+  struct GNUNET_TIME_Relative avg_latency;
+
   /**
    * What is the first offset that we're interested
    * in?
@@ -2020,6 +2090,23 @@ struct GNUNET_FS_DownloadContext
    */
   unsigned int treedepth;
 
+  /**
+   * How many requests may be in the request window at most (grows
+   * while the FS service answers quickly, shrinks on timeouts).
+   */
+  unsigned int window_size;
+
+  /**
+   * Number of requests currently in the request window.
+   */
+  unsigned int window_count;
+
+  /**
+   * Number of requests that timed out of the request window but
+   * are still active at the FS service.
+   */
+  unsigned int timed_out_count;
+
   /**
    * Options for the download.
    */
@@ -54,6 +54,11 @@ struct GNUNET_FS_DirScanner
    */
   char *ex_arg;
 
+  /**
+   * Third argument to helper process, NULL for none.
+   */
+  char *cache_arg;
+
   /**
    * The function that will be called every time there's a progress
    * message.
@@ -85,7 +90,7 @@ struct GNUNET_FS_DirScanner
   /**
    * Arguments for helper.
    */
-  char *args[4];
+  char *args[5];
 
 };
 
@@ -109,6 +114,7 @@ GNUNET_FS_directory_scan_abort (struct GNUNET_FS_DirScanner *ds)
   if (NULL != ds->stop_task)
     GNUNET_SCHEDULER_cancel (ds->stop_task);
   GNUNET_free_non_null (ds->ex_arg);
+  GNUNET_free_non_null (ds->cache_arg);
   GNUNET_free (ds->filename_expanded);
   GNUNET_free (ds);
 }
@@ -436,21 +442,26 @@ helper_died_cb (void *cls)
 
 
 /**
- * Start a directory scanner thread.
+ * Start a directory scanner that remembers the meta data it extracted
+ * in a scan cache.
  *
  * @param filename name of the directory to scan
  * @param disable_extractor #GNUNET_YES to not run libextractor on files (only
  *        build a tree)
  * @param ex if not NULL, must be a list of extra plugins for extractor
+ * @param cache_filename name of the file to use as the scan cache,
+ *        NULL to not use a cache
  * @param cb the callback to call when there are scanning progress messages
  * @param cb_cls closure for 'cb'
  * @return directory scanner object to be used for controlling the scanner
  */
 struct GNUNET_FS_DirScanner *
-GNUNET_FS_directory_scan_start (const char *filename,
-				int disable_extractor, const char *ex,
-				GNUNET_FS_DirScannerProgressCallback cb,
-				void *cb_cls)
+GNUNET_FS_directory_scan_start_cached (const char *filename,
+                                       int disable_extractor,
+                                       const char *ex,
+                                       const char *cache_filename,
+                                       GNUNET_FS_DirScannerProgressCallback cb,
+                                       void *cb_cls)
 {
   struct stat sbuf;
   char *filename_expanded;
@@ -470,12 +481,20 @@ GNUNET_FS_directory_scan_start (const char *filename,
   ds->filename_expanded = filename_expanded;
   if (disable_extractor)
     ds->ex_arg = GNUNET_strdup ("-");
+  else if (NULL != ex)
+    ds->ex_arg = GNUNET_strdup (ex);
+  else if (NULL != cache_filename)
+    ds->ex_arg = GNUNET_strdup (""); /* defaults, but we need the next argument */
   else
-    ds->ex_arg = (NULL != ex) ? GNUNET_strdup (ex) : NULL;
+    ds->ex_arg = NULL;
+  if ( (NULL != cache_filename) &&
+       (! disable_extractor) )
+    ds->cache_arg = GNUNET_STRINGS_filename_expand (cache_filename);
   ds->args[0] = "gnunet-helper-fs-publish";
   ds->args[1] = ds->filename_expanded;
   ds->args[2] = ds->ex_arg;
-  ds->args[3] = NULL;
+  ds->args[3] = ds->cache_arg;
+  ds->args[4] = NULL;
   ds->helper = GNUNET_HELPER_start (GNUNET_NO,
 				    "gnunet-helper-fs-publish",
 				    ds->args,
@@ -483,6 +502,8 @@ GNUNET_FS_directory_scan_start (const char *filename,
 				    &helper_died_cb, ds);
   if (NULL == ds->helper)
     {
+    GNUNET_free_non_null (ds->ex_arg);
+    GNUNET_free_non_null (ds->cache_arg);
     GNUNET_free (filename_expanded);
     GNUNET_free (ds);
     return NULL;
@@ -491,4 +512,30 @@ GNUNET_FS_directory_scan_start (const char *filename,
 }
 
 
+/**
+ * Start a directory scanner thread.
+ *
+ * @param filename name of the directory to scan
+ * @param disable_extractor #GNUNET_YES to not run libextractor on files (only
+ *        build a tree)
+ * @param ex if not NULL, must be a list of extra plugins for extractor
+ * @param cb the callback to call when there are scanning progress messages
+ * @param cb_cls closure for 'cb'
+ * @return directory scanner object to be used for controlling the scanner
+ */
+struct GNUNET_FS_DirScanner *
+GNUNET_FS_directory_scan_start (const char *filename,
+				int disable_extractor, const char *ex,
+				GNUNET_FS_DirScannerProgressCallback cb,
+				void *cb_cls)
+{
+  return GNUNET_FS_directory_scan_start_cached (filename,
+                                                disable_extractor,
+                                                ex,
+                                                NULL,
+                                                cb,
+                                                cb_cls);
+}
+
+
 /* end of fs_dirmetascan.c */
@@ -28,6 +28,42 @@
 #include "fs_api.h"
 #include "fs_tree.h"
 
+/**
+ * How many requests do we put into the request window of a
+ * download initially?
+ */
+#define INITIAL_WINDOW_SIZE 32
+
+/**
+ * Lower bound for the size of the request window.
+ */
+#define MIN_WINDOW_SIZE 4
+
+/**
+ * Upper bound for the size of the request window.
+ */
+#define MAX_WINDOW_SIZE 1024
+
+/**
+ * Upper bound for the number of requests the FS service may be
+ * working on for one download, including requests that timed out
+ * of the request window but are still active at the service.
+ */
+#define MAX_OUTSTANDING_REQUESTS 1024
+
+/**
+ * Lower bound for how long we wait for the FS service to answer a
+ * request before we take it out of the request window.
+ */
+#define MIN_WINDOW_TIMEOUT GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5)
+
+/**
+ * Upper bound for how long we wait for the FS service to answer a
+ * request before we take it out of the request window.  Also used
+ * as long as we have no latency estimate.
+ */
+#define MAX_WINDOW_TIMEOUT GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MINUTES, 2)
+
 
 /**
  * Determine if the given download (options and meta data) should cause
@@ -145,6 +181,293 @@ static size_t
 transmit_download_request (void *cls, size_t size, void *buf);
 
 
+/**
+ * Compute the priority of a request in the pending heap (lower is
+ * more urgent).  IBLOCKs closer to the root go first as each of them
+ * allows us to issue many more requests; within the same level of
+ * the tree, we download in the order of the file.
+ *
+ * @param dc download the request belongs to
+ * @param dr the request
+ * @return cost of @a dr in the pending heap
+ */
+static GNUNET_CONTAINER_HeapCostType
+get_request_priority (const struct GNUNET_FS_DownloadContext *dc,
+                      const struct DownloadRequest *dr)
+{
+  GNUNET_CONTAINER_HeapCostType level;
+
+  level = (dr->depth < dc->treedepth) ? dc->treedepth - dr->depth : 0;
+  return (level << 56) | ((dr->offset / DBLOCK_SIZE) & ((1LLU << 56) - 1));
+}
+
+
+/**
+ * Add a request to the heap of requests waiting to be transmitted
+ * to the FS service.
+ *
+ * @param dc download the request belongs to
+ * @param dr request to add
+ */
+static void
+add_pending_request (struct GNUNET_FS_DownloadContext *dc,
+                     struct DownloadRequest *dr)
+{
+  if (NULL != dr->hn)
+    return;                     /* already pending */
+  if (NULL == dc->pending)
+    dc->pending = GNUNET_CONTAINER_heap_create (GNUNET_CONTAINER_HEAP_ORDER_MIN);
+  dr->hn = GNUNET_CONTAINER_heap_insert (dc->pending, dr,
+                                         get_request_priority (dc, dr));
+}
+
+
+/**
+ * Remove a request from the pending heap and the request window
+ * (as applicable).
+ *
+ * @param dc download the request belongs to
+ * @param dr request to remove
+ */
+static void
+remove_request (struct GNUNET_FS_DownloadContext *dc,
+                struct DownloadRequest *dr)
+{
+  if (NULL != dr->hn)
+  {
+    GNUNET_CONTAINER_heap_remove_node (dr->hn);
+    dr->hn = NULL;
+  }
+  if (GNUNET_YES == dr->in_window)
+  {
+    GNUNET_CONTAINER_DLL_remove (dc->window_head, dc->window_tail, dr);
+    dr->in_window = GNUNET_NO;
+    dc->window_count--;
+  }
+  if (GNUNET_YES == dr->timed_out)
+  {
+    GNUNET_CONTAINER_DLL_remove (dc->timed_out_head, dc->timed_out_tail, dr);
+    dr->timed_out = GNUNET_NO;
+    dc->timed_out_count--;
+  }
+}
+
+
+/**
+ * Forget about all pending requests, the request window and the
+ * requests that timed out of it, for example because we lost our
+ * connection to the FS service.  The requests remain in the 'active'
+ * map.
+ *
+ * @param dc download to reset
+ */
+static void
+clear_requests (struct GNUNET_FS_DownloadContext *dc)
+{
+  struct DownloadRequest *dr;
+
+  if (NULL != dc->window_task)
+  {
+    GNUNET_SCHEDULER_cancel (dc->window_task);
+    dc->window_task = NULL;
+  }
+  while (NULL != (dr = dc->window_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (dc->window_head, dc->window_tail, dr);
+    dr->in_window = GNUNET_NO;
+  }
+  dc->window_count = 0;
+  while (NULL != (dr = dc->timed_out_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (dc->timed_out_head, dc->timed_out_tail, dr);
+    dr->timed_out = GNUNET_NO;
+  }
+  dc->timed_out_count = 0;
+  if (NULL != dc->pending)
+  {
+    while (NULL != (dr = GNUNET_CONTAINER_heap_remove_root (dc->pending)))
+      dr->hn = NULL;
+    GNUNET_CONTAINER_heap_destroy (dc->pending);
+    dc->pending = NULL;
+  }
+}
+
+
+/**
+ * Check if we may transmit another request to the FS service: there
+ * must be room in the request window, and the service must not be
+ * working on too many requests for us (the requests that timed out
+ * of the window are still active at the service).
+ *
+ * @param dc download to check
+ * @return #GNUNET_YES if another request may be transmitted
+ */
+static int
+window_has_room (const struct GNUNET_FS_DownloadContext *dc)
+{
+  if (dc->window_count >= dc->window_size)
+    return GNUNET_NO;
+  if (dc->window_count + dc->timed_out_count >= MAX_OUTSTANDING_REQUESTS)
+    return GNUNET_NO;
+  return GNUNET_YES;
+}
+
+
+/**
+ * Ask for transmission to the FS service if we have pending requests
+ * and there is room in the request window.
+ *
+ * @param dc download to transmit requests for
+ */
+static void
+schedule_transmission (struct GNUNET_FS_DownloadContext *dc)
+{
+  if ( (NULL == dc->client) ||
+       (NULL != dc->th) ||
+       (NULL == dc->pending) ||
+       (0 == GNUNET_CONTAINER_heap_get_size (dc->pending)) ||
+       (GNUNET_YES != window_has_room (dc)) )
+    return;
+  dc->th =
+      GNUNET_CLIENT_notify_transmit_ready (dc->client,
+                                           sizeof (struct SearchMessage),
+                                           GNUNET_CONSTANTS_SERVICE_TIMEOUT,
+                                           GNUNET_NO,
+                                           &transmit_download_request, dc);
+  GNUNET_assert (NULL != dc->th);
+}
+
+
+/**
+ * How long do we wait for an answer to a request in the request
+ * window before we give up on it (for the purpose of the window)?
+ *
+ * @param dc download to compute the timeout for
+ * @return timeout based on the observed latency
+ */
+static struct GNUNET_TIME_Relative
+get_window_timeout (const struct GNUNET_FS_DownloadContext *dc)
+{
+  if (0 == dc->avg_latency.rel_value_us)
+    return MAX_WINDOW_TIMEOUT;
+  return GNUNET_TIME_relative_min (MAX_WINDOW_TIMEOUT,
+                                   GNUNET_TIME_relative_max (MIN_WINDOW_TIMEOUT,
+                                                             GNUNET_TIME_relative_multiply (dc->avg_latency, 4)));
+}
+
+
+/**
+ * Task run when the oldest request in the request window timed out.
+ *
+ * @param cls the `struct GNUNET_FS_DownloadContext`
+ * @param tc scheduler context
+ */
+static void
+window_timeout (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc);
+
+
+/**
+ * Make sure the timeout task for the oldest request in the request
+ * window is running.
+ *
+ * @param dc download to run the task for
+ */
+static void
+schedule_window_task (struct GNUNET_FS_DownloadContext *dc)
+{
+  if ( (NULL != dc->window_task) ||
+       (NULL == dc->window_head) )
+    return;
+  dc->window_task =
+      GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_absolute_get_remaining
+                                    (GNUNET_TIME_absolute_add
+                                     (dc->window_head->transmission_time,
+                                      get_window_timeout (dc))),
+                                    &window_timeout, dc);
+}
+
+
+/**
+ * Task run when the oldest request in the request window timed out.
+ * The FS service keeps looking for the block, but we take the
+ * request out of the window (so that we can issue others) and shrink
+ * the window as the service is evidently not keeping up.  As there
+ * is no way to cancel an individual request at the service, the
+ * request still counts against #MAX_OUTSTANDING_REQUESTS until it
+ * is answered or we reconnect.
+ *
+ * @param cls the `struct GNUNET_FS_DownloadContext`
+ * @param tc scheduler context
+ */
+static void
+window_timeout (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct GNUNET_FS_DownloadContext *dc = cls;
+  struct GNUNET_TIME_Relative timeout;
+  struct DownloadRequest *dr;
+  unsigned int expired;
+
+  dc->window_task = NULL;
+  timeout = get_window_timeout (dc);
+  expired = 0;
+  while ( (NULL != (dr = dc->window_head)) &&
+          (0 == GNUNET_TIME_absolute_get_remaining
+           (GNUNET_TIME_absolute_add (dr->transmission_time,
+                                      timeout)).rel_value_us) )
+  {
+    GNUNET_CONTAINER_DLL_remove (dc->window_head, dc->window_tail, dr);
+    dr->in_window = GNUNET_NO;
+    dc->window_count--;
+    GNUNET_CONTAINER_DLL_insert_tail (dc->timed_out_head, dc->timed_out_tail, dr);
+    dr->timed_out = GNUNET_YES;
+    dc->timed_out_count++;
+    expired++;
+  }
+  if (0 != expired)
+  {
+    dc->window_size = GNUNET_MAX (MIN_WINDOW_SIZE, dc->window_size / 2);
+    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+                "%u requests timed out, shrinking request window to %u\n",
+                expired, dc->window_size);
+  }
+  schedule_transmission (dc);
+  schedule_window_task (dc);
+}
+
+
+/**
+ * We got an answer for a request.  Update the latency estimate and
+ * the size of the request window and take the request out of the
+ * pending heap and the window.
+ *
+ * @param dc download the request belongs to
+ * @param dr request that was answered
+ */
+static void
+request_answered (struct GNUNET_FS_DownloadContext *dc,
+                  struct DownloadRequest *dr)
+{
+  struct GNUNET_TIME_Relative latency;
+
+  if (GNUNET_YES == dr->in_window)
+  {
+    latency = GNUNET_TIME_absolute_get_duration (dr->transmission_time);
+    if (0 == dc->avg_latency.rel_value_us)
+      dc->avg_latency = latency;
+    else
+      dc->avg_latency =
+          GNUNET_TIME_relative_divide (GNUNET_TIME_relative_add
+                                       (GNUNET_TIME_relative_multiply
+                                        (dc->avg_latency, 7),
+                                        latency), 8);
+    if (dc->window_size < MAX_WINDOW_SIZE)
+      dc->window_size++;
+  }
+  remove_request (dc, dr);
+  schedule_transmission (dc);
+}
+
+
 /**
  * Closure for iterator processing results.
  */
@@ -773,15 +1096,8 @@ schedule_block_download (struct GNUNET_FS_DownloadContext *dc,
                                      GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE);
   if (NULL == dc->client)
     return;                     /* download not active */
-  GNUNET_CONTAINER_DLL_insert (dc->pending_head, dc->pending_tail, dr);
-  dr->is_pending = GNUNET_YES;
-  if (NULL == dc->th)
-    dc->th =
-        GNUNET_CLIENT_notify_transmit_ready (dc->client,
-                                             sizeof (struct SearchMessage),
-                                             GNUNET_CONSTANTS_SERVICE_TIMEOUT,
-                                             GNUNET_NO,
-                                             &transmit_download_request, dc);
+  add_pending_request (dc, dr);
+  schedule_transmission (dc);
 }
 
 
@@ -1000,11 +1316,7 @@ process_result_with_request (void *cls, const struct GNUNET_HashCode * key,
   }
 
   (void) GNUNET_CONTAINER_multihashmap_remove (dc->active, &prc->query, dr);
-  if (GNUNET_YES == dr->is_pending)
-  {
-    GNUNET_CONTAINER_DLL_remove (dc->pending_head, dc->pending_tail, dr);
-    dr->is_pending = GNUNET_NO;
-  }
+  request_answered (dc, dr);
 
   GNUNET_CRYPTO_hash_to_aes_key (&dr->chk.key, &skey, &iv);
   if (-1 == GNUNET_CRYPTO_symmetric_decrypt (prc->data, prc->size, &skey, &iv, pt))
@@ -1202,6 +1514,7 @@ signal_error:
   GNUNET_CLIENT_disconnect (dc->client);
   dc->in_receive = GNUNET_NO;
   dc->client = NULL;
+  clear_requests (dc);
   GNUNET_FS_free_download_request_ (dc->top_request);
   dc->top_request = NULL;
   GNUNET_CONTAINER_multihashmap_destroy (dc->active);
@@ -1211,8 +1524,6 @@ signal_error:
     GNUNET_FS_dequeue_ (dc->job_queue);
     dc->job_queue = NULL;
   }
-  dc->pending_head = NULL;
-  dc->pending_tail = NULL;
   GNUNET_FS_download_sync_ (dc);
   return GNUNET_NO;
 }
@@ -1311,6 +1622,7 @@ transmit_download_request (void *cls, size_t size, void *buf)
   size_t msize;
   struct SearchMessage *sm;
   struct DownloadRequest *dr;
+  struct GNUNET_TIME_Absolute now;
 
   dc->th = NULL;
   if (NULL == buf)
@@ -1323,9 +1635,13 @@ transmit_download_request (void *cls, size_t size, void *buf)
   GNUNET_assert (size >= sizeof (struct SearchMessage));
   msize = 0;
   sm = buf;
-  while ((NULL != (dr = dc->pending_head)) &&
-         (size >= msize + sizeof (struct SearchMessage)))
+  now = GNUNET_TIME_absolute_get ();
+  while ((NULL != dc->pending) &&
+         (GNUNET_YES == window_has_room (dc)) &&
+         (size >= msize + sizeof (struct SearchMessage)) &&
+         (NULL != (dr = GNUNET_CONTAINER_heap_remove_root (dc->pending))))
   {
+    dr->hn = NULL;
     GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
                 "Transmitting download request for `%s' to `%s'-service\n",
                 GNUNET_h2s (&dr->chk.query), "FS");
@@ -1343,21 +1659,15 @@ transmit_download_request (void *cls, size_t size, void *buf)
     sm->anonymity_level = htonl (dc->anonymity);
     sm->target = dc->target;
     sm->query = dr->chk.query;
-    GNUNET_CONTAINER_DLL_remove (dc->pending_head, dc->pending_tail, dr);
-    dr->is_pending = GNUNET_NO;
+    dr->transmission_time = now;
+    GNUNET_CONTAINER_DLL_insert_tail (dc->window_head, dc->window_tail, dr);
+    dr->in_window = GNUNET_YES;
+    dc->window_count++;
     msize += sizeof (struct SearchMessage);
     sm++;
   }
-  if (NULL != dc->pending_head)
-  {
-    dc->th =
-        GNUNET_CLIENT_notify_transmit_ready (dc->client,
-                                             sizeof (struct SearchMessage),
-                                             GNUNET_CONSTANTS_SERVICE_TIMEOUT,
-                                             GNUNET_NO,
-                                             &transmit_download_request, dc);
-    GNUNET_assert (NULL != dc->th);
-  }
+  schedule_transmission (dc);
+  schedule_window_task (dc);
   if (GNUNET_NO == dc->in_receive)
   {
     dc->in_receive = GNUNET_YES;
@@ -1390,21 +1700,12 @@ do_reconnect (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
     return;
   }
   dc->client = client;
-  if (NULL != dc->pending_head)
-  {
-    dc->th =
-        GNUNET_CLIENT_notify_transmit_ready (client,
-                                             sizeof (struct SearchMessage),
-                                             GNUNET_CONSTANTS_SERVICE_TIMEOUT,
-                                             GNUNET_NO,
-                                             &transmit_download_request, dc);
-    GNUNET_assert (NULL != dc->th);
-  }
+  schedule_transmission (dc);
 }
 
 
 /**
- * Add entries to the pending list.
+ * Add entries to the pending heap.
  *
  * @param cls our download context
  * @param key unused
@@ -1417,10 +1718,7 @@ retry_entry (void *cls, const struct GNUNET_HashCode * key, void *entry)
   struct GNUNET_FS_DownloadContext *dc = cls;
   struct DownloadRequest *dr = entry;
 
-  dr->next = NULL;
-  dr->prev = NULL;
-  GNUNET_CONTAINER_DLL_insert (dc->pending_head, dc->pending_tail, dr);
-  dr->is_pending = GNUNET_YES;
+  add_pending_request (dc, dr);
   return GNUNET_OK;
 }
 
@@ -1445,9 +1743,8 @@ try_reconnect (struct GNUNET_FS_DownloadContext *dc)
       GNUNET_CLIENT_notify_transmit_ready_cancel (dc->th);
       dc->th = NULL;
     }
-    /* full reset of the pending list */
-    dc->pending_head = NULL;
-    dc->pending_tail = NULL;
+    /* full reset of the pending heap and the request window */
+    clear_requests (dc);
     GNUNET_CONTAINER_multihashmap_iterate (dc->active, &retry_entry, dc);
     GNUNET_CLIENT_disconnect (dc->client);
     dc->in_receive = GNUNET_NO;
@@ -1487,21 +1784,13 @@ activate_fs_download (void *cls, struct GNUNET_CLIENT_Connection *client)
   dc->client = client;
   pi.status = GNUNET_FS_STATUS_DOWNLOAD_ACTIVE;
   GNUNET_FS_download_make_status_ (&pi, dc);
-  dc->pending_head = NULL;
-  dc->pending_tail = NULL;
+  clear_requests (dc);
+  if (0 == dc->window_size)
+    dc->window_size = INITIAL_WINDOW_SIZE;
   GNUNET_CONTAINER_multihashmap_iterate (dc->active, &retry_entry, dc);
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "Asking for transmission to FS service\n");
-  if (NULL != dc->pending_head)
-  {
-    dc->th =
-        GNUNET_CLIENT_notify_transmit_ready (dc->client,
-                                             sizeof (struct SearchMessage),
-                                             GNUNET_CONSTANTS_SERVICE_TIMEOUT,
-                                             GNUNET_NO,
-                                             &transmit_download_request, dc);
-    GNUNET_assert (NULL != dc->th);
-  }
+  schedule_transmission (dc);
 }
 
 
@@ -1528,8 +1817,7 @@ deactivate_fs_download (void *cls)
     dc->in_receive = GNUNET_NO;
     dc->client = NULL;
   }
-  dc->pending_head = NULL;
-  dc->pending_tail = NULL;
+  clear_requests (dc);
   pi.status = GNUNET_FS_STATUS_DOWNLOAD_INACTIVE;
   GNUNET_FS_download_make_status_ (&pi, dc);
 }
@@ -1750,11 +2038,12 @@ reconstruct_cb (void *cls, const struct ContentHashKey *chk, uint64_t offset,
        * this request is done! */
       dr->state = BRS_DOWNLOAD_UP;
       (void) GNUNET_CONTAINER_multihashmap_remove (dc->active, &dr->chk.query, dr);
-      if (GNUNET_YES == dr->is_pending)
+      if ( (NULL != dr->hn) ||
+           (GNUNET_YES == dr->in_window) ||
+           (GNUNET_YES == dr->timed_out) )
       {
 	GNUNET_break (0); /* how did we get here? */
-	GNUNET_CONTAINER_DLL_remove (dc->pending_head, dc->pending_tail, dr);
-	dr->is_pending = GNUNET_NO;
+	remove_request (dc, dr);
       }
       /* calculate how many bytes of payload this block
        * corresponds to */
@@ -2045,6 +2334,7 @@ GNUNET_FS_download_signal_suspend_ (void *cls)
     GNUNET_DISK_file_close (dc->rfh);
     dc->rfh = NULL;
   }
+  clear_requests (dc);
   GNUNET_FS_free_download_request_ (dc->top_request);
   if (NULL != dc->active)
   {
@@ -2377,6 +2667,7 @@ GNUNET_FS_download_stop (struct GNUNET_FS_DownloadContext *dc, int do_delete)
                                 dc->serialization);
   pi.status = GNUNET_FS_STATUS_DOWNLOAD_STOPPED;
   GNUNET_FS_download_make_status_ (&pi, dc);
+  clear_requests (dc);
   GNUNET_FS_free_download_request_ (dc->top_request);
   dc->top_request = NULL;
   if (NULL != dc->active)
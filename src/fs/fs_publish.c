@@ -32,6 +32,11 @@
 #include "fs_api.h"
 #include "fs_tree.h"
 
+/**
+ * Maximum number of blocks we give to the datastore at once.
+ */
+#define PUT_BATCH_SIZE 16
+
 
 /**
  * Fill in all of the generic fields for
@@ -98,30 +103,39 @@ publish_cleanup (struct GNUNET_FS_PublishContext *pc)
     pc->client = NULL;
   }
   GNUNET_assert (NULL == pc->upload_task);
+  GNUNET_free_non_null (pc->put_items);
+  GNUNET_free_non_null (pc->put_data);
   GNUNET_free (pc);
 }
 
 
 /**
  * Function called by the datastore API with
- * the result from the PUT request.
+ * the result from the batched PUT request.
  *
  * @param cls the `struct GNUNET_FS_PublishContext *`
- * @param success #GNUNET_OK on success
+ * @param count number of blocks in the batch
+ * @param success status for each of the blocks
  * @param min_expiration minimum expiration time required for content to be stored
  * @param msg error message (or NULL)
  */
 static void
 ds_put_cont (void *cls,
-             int success,
+             unsigned int count,
+             const int32_t *success,
 	     struct GNUNET_TIME_Absolute min_expiration,
 	     const char *msg)
 {
   struct GNUNET_FS_PublishContext *pc = cls;
   struct GNUNET_FS_ProgressInfo pi;
+  unsigned int i;
 
   pc->qre = NULL;
-  if (GNUNET_SYSERR == success)
+  pc->put_count = 0;
+  for (i = 0; i < count; i++)
+    if (GNUNET_SYSERR == success[i])
+      break;
+  if (i < count)
   {
     GNUNET_asprintf (&pc->fi_pos->emsg,
                      _("Publishing failed: %s"),
@@ -491,7 +505,10 @@ block_proc (void *cls,
 {
   struct GNUNET_FS_PublishContext *pc = cls;
   struct GNUNET_FS_FileInformation *p;
+  struct GNUNET_DATASTORE_PutItem *item;
   struct OnDemandBlock odb;
+  char *data;
+  uint64_t size;
 
   p = pc->fi_pos;
   if (NULL == pc->dsh)
@@ -503,7 +520,20 @@ block_proc (void *cls,
         (GNUNET_SCHEDULER_PRIORITY_BACKGROUND, &GNUNET_FS_publish_main_, pc);
     return;
   }
-
+  if (NULL == pc->put_items)
+  {
+    pc->put_items = GNUNET_new_array (PUT_BATCH_SIZE,
+                                      struct GNUNET_DATASTORE_PutItem);
+    pc->put_data = GNUNET_malloc (PUT_BATCH_SIZE * DBLOCK_SIZE);
+  }
+  item = &pc->put_items[pc->put_count];
+  data = &pc->put_data[pc->put_count * DBLOCK_SIZE];
+  item->key = chk->query;
+  item->data = data;
+  item->priority = p->bo.content_priority;
+  item->anonymity = p->bo.anonymity_level;
+  item->replication = p->bo.replication_level;
+  item->expiration = p->bo.expiration_time;
   if ( (GNUNET_YES != p->is_directory) &&
        (GNUNET_YES == p->data.file.do_index) &&
        (GNUNET_BLOCK_TYPE_FS_DBLOCK == type) )
@@ -514,43 +544,43 @@ block_proc (void *cls,
                 sizeof (struct OnDemandBlock));
     odb.offset = GNUNET_htonll (offset);
     odb.file_id = p->data.file.file_id;
-    GNUNET_assert (pc->qre == NULL);
-    pc->qre =
-        GNUNET_DATASTORE_put (pc->dsh,
-                              (p->is_directory == GNUNET_YES) ? 0 : pc->rid,
-                              &chk->query,
-                              sizeof (struct OnDemandBlock),
-                              &odb,
-                              GNUNET_BLOCK_TYPE_FS_ONDEMAND,
-                              p->bo.content_priority,
-                              p->bo.anonymity_level,
-                              p->bo.replication_level,
-                              p->bo.expiration_time,
-                              -2, 1,
-                              GNUNET_CONSTANTS_SERVICE_TIMEOUT,
-                              &ds_put_cont, pc);
+    memcpy (data, &odb, sizeof (struct OnDemandBlock));
+    item->size = sizeof (struct OnDemandBlock);
+    item->type = GNUNET_BLOCK_TYPE_FS_ONDEMAND;
+  }
+  else
+  {
+    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+                "Publishing block `%s' for offset %llu with size %u\n",
+                GNUNET_h2s (&chk->query),
+                (unsigned long long) offset,
+                (unsigned int) block_size);
+    memcpy (data, block, block_size);
+    item->size = block_size;
+    item->type = type;
+  }
+  pc->put_count++;
+  size = (GNUNET_YES == p->is_directory) ? p->data.dir.dir_size : p->data.file.file_size;
+  if ( (pc->put_count < PUT_BATCH_SIZE) &&
+       (depth + 1 < GNUNET_FS_compute_depth (size)) )
+  {
+    /* not the root block, collect more blocks first */
+    GNUNET_assert (NULL == pc->upload_task);
+    pc->upload_task =
+        GNUNET_SCHEDULER_add_with_priority
+        (GNUNET_SCHEDULER_PRIORITY_BACKGROUND, &GNUNET_FS_publish_main_, pc);
     return;
   }
-  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-              "Publishing block `%s' for offset %llu with size %u\n",
-              GNUNET_h2s (&chk->query),
-              (unsigned long long) offset,
-              (unsigned int) block_size);
-  GNUNET_assert (pc->qre == NULL);
+  GNUNET_assert (NULL == pc->qre);
   pc->qre =
-      GNUNET_DATASTORE_put (pc->dsh, (p->is_directory == GNUNET_YES) ? 0 : pc->rid,
-                            &chk->query,
-                            block_size,
-                            block,
-                            type,
-                            p->bo.content_priority,
-                            p->bo.anonymity_level,
-                            p->bo.replication_level,
-                            p->bo.expiration_time,
-                            -2, 1,
-                            GNUNET_CONSTANTS_SERVICE_TIMEOUT,
-                            &ds_put_cont,
-                            pc);
+      GNUNET_DATASTORE_put_multiple (pc->dsh,
+                                     (p->is_directory == GNUNET_YES) ? 0 : pc->rid,
+                                     pc->put_count,
+                                     pc->put_items,
+                                     -2, 1,
+                                     GNUNET_CONSTANTS_SERVICE_TIMEOUT,
+                                     &ds_put_cont,
+                                     pc);
 }
 
 
@@ -674,6 +704,8 @@ publish_content (struct GNUNET_FS_PublishContext *pc)
         GNUNET_FS_tree_encoder_create (pc->h, size, pc, &block_reader,
                                        &block_proc, &progress_proc,
                                        &encode_cont);
+    /* blocks we did not store before a suspension are encoded again */
+    pc->put_count = 0;
 
   }
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
@@ -1070,8 +1102,10 @@ GNUNET_FS_publish_main_ (void *cls,
     {
       p->start_time = GNUNET_TIME_absolute_get ();
       pc->fhc =
-          GNUNET_CRYPTO_hash_file (GNUNET_SCHEDULER_PRIORITY_IDLE, p->filename,
-                                   HASHING_BLOCKSIZE, &hash_for_index_cb, pc);
+          GNUNET_CRYPTO_hash_file_threaded (GNUNET_SCHEDULER_PRIORITY_IDLE,
+                                            p->filename,
+                                            HASHING_BLOCKSIZE,
+                                            &hash_for_index_cb, pc);
     }
     return;
   }
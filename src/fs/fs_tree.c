@@ -26,6 +26,99 @@
  */
 #include "platform.h"
 #include "fs_tree.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+
+/**
+ * Maximum number of DBLOCKs we read ahead and encode in parallel.
+ */
+#define BATCH_SIZE 64
+
+/**
+ * Maximum number of worker threads per encoder.
+ */
+#define MAX_WORKERS 8
+
+/**
+ * Number of DBLOCKs a worker hashes at once with
+ * #GNUNET_CRYPTO_hash_many().
+ */
+#define HASH_GROUP 8
+
+
+#if HAVE_PTHREAD_H
+/**
+ * A DBLOCK that is encoded ahead of time.
+ */
+struct EncodeJob
+{
+
+  /**
+   * Offset of the block in the file.
+   */
+  uint64_t offset;
+
+  /**
+   * CHK of the block.
+   */
+  struct ContentHashKey chk;
+
+  /**
+   * Size of the block.
+   */
+  uint16_t size;
+
+  /**
+   * Plaintext of the block.
+   */
+  char pt[DBLOCK_SIZE];
+
+  /**
+   * Encrypted block.
+   */
+  char enc[DBLOCK_SIZE];
+
+};
+
+
+/**
+ * A range of consecutive DBLOCKs that is encoded by
+ * the worker threads of an encoder.
+ */
+struct EncodeBatch
+{
+
+  /**
+   * The blocks, array of length @e max_jobs.
+   */
+  struct EncodeJob *jobs;
+
+  /**
+   * Number of entries allocated in @e jobs.
+   */
+  unsigned int max_jobs;
+
+  /**
+   * Number of valid entries in @e jobs.
+   */
+  unsigned int num_jobs;
+
+  /**
+   * Index of the first job no thread has claimed yet.
+   * Protected by the encoder's lock.
+   */
+  unsigned int next_job;
+
+  /**
+   * Number of jobs that have been encoded.
+   * Protected by the encoder's lock.
+   */
+  unsigned int done_jobs;
+
+};
+#endif
 
 
 /**
@@ -108,6 +201,57 @@ struct GNUNET_FS_TreeEncoder
    */
   struct ContentHashKey *chk_tree;
 
+#if HAVE_PTHREAD_H
+  /**
+   * Batch of DBLOCKs we are currently emitting, NULL if we do not
+   * encode DBLOCKs in parallel.
+   */
+  struct EncodeBatch *batch;
+
+  /**
+   * Batch of DBLOCKs following @e batch, which is encoded while
+   * we emit the blocks from @e batch.
+   */
+  struct EncodeBatch *next_batch;
+
+  /**
+   * Batch the workers should take jobs from, NULL for none.
+   * Protected by @e lock.
+   */
+  struct EncodeBatch *active;
+
+  /**
+   * Worker threads, kept for the lifetime of the encoder.
+   */
+  pthread_t workers[MAX_WORKERS];
+
+  /**
+   * Number of threads in @e workers.
+   */
+  unsigned int num_workers;
+
+  /**
+   * Protects the job counters of the batches, @e active
+   * and @e shutdown.
+   */
+  pthread_mutex_t lock;
+
+  /**
+   * Signalled when jobs are added to @e active or on shutdown.
+   */
+  pthread_cond_t work_cond;
+
+  /**
+   * Signalled when the last job of a batch was encoded.
+   */
+  pthread_cond_t done_cond;
+
+  /**
+   * Set to #GNUNET_YES to make the workers exit.
+   */
+  int shutdown;
+#endif
+
   /**
    * Are we currently in 'GNUNET_FS_tree_encoder_next'?
    * Flag used to prevent recursion.
@@ -249,6 +393,260 @@ GNUNET_FS_tree_calculate_block_size (uint64_t fsize, uint64_t offset,
 }
 
 
+/**
+ * CHK-encode a block: hash the plaintext to get the key,
+ * encrypt it and hash the ciphertext to get the query.
+ * Must be thread-safe.
+ *
+ * @param pt_block plaintext of the block
+ * @param pt_size number of bytes in @a pt_block
+ * @param chk set to the CHK of the block
+ * @param enc set to the encrypted block, @a pt_size bytes
+ */
+static void
+encode_block (const void *pt_block,
+              uint16_t pt_size,
+              struct ContentHashKey *chk,
+              void *enc)
+{
+  struct GNUNET_CRYPTO_SymmetricSessionKey sk;
+  struct GNUNET_CRYPTO_SymmetricInitializationVector iv;
+
+  GNUNET_CRYPTO_hash (pt_block, pt_size, &chk->key);
+  GNUNET_CRYPTO_hash_to_aes_key (&chk->key, &sk, &iv);
+  GNUNET_CRYPTO_symmetric_encrypt (pt_block, pt_size, &sk, &iv, enc);
+  GNUNET_CRYPTO_hash (enc, pt_size, &chk->query);
+}
+
+
+#if HAVE_PTHREAD_H
+/**
+ * CHK-encode @a count consecutive blocks of a batch, starting with
+ * block @a start.  Like encode_block(), but hashes #HASH_GROUP
+ * blocks at once.  Must be thread-safe.
+ *
+ * @param batch the batch
+ * @param start index of the first block to encode
+ * @param count number of blocks to encode, at most #HASH_GROUP
+ */
+static void
+encode_jobs (struct EncodeBatch *batch,
+             unsigned int start,
+             unsigned int count)
+{
+  struct GNUNET_CRYPTO_SymmetricSessionKey sk;
+  struct GNUNET_CRYPTO_SymmetricInitializationVector iv;
+  struct EncodeJob *group;
+  const void *blocks[HASH_GROUP];
+  size_t sizes[HASH_GROUP];
+  struct GNUNET_HashCode hc[HASH_GROUP];
+  unsigned int i;
+
+  if (0 == count)
+    return;
+  group = &batch->jobs[start];
+  for (i = 0; i < count; i++)
+  {
+    blocks[i] = group[i].pt;
+    sizes[i] = group[i].size;
+  }
+  GNUNET_CRYPTO_hash_many (blocks, sizes, count, hc);
+  for (i = 0; i < count; i++)
+  {
+    group[i].chk.key = hc[i];
+    GNUNET_CRYPTO_hash_to_aes_key (&hc[i], &sk, &iv);
+    GNUNET_CRYPTO_symmetric_encrypt (group[i].pt, group[i].size,
+                                     &sk, &iv, group[i].enc);
+    blocks[i] = group[i].enc;
+  }
+  GNUNET_CRYPTO_hash_many (blocks, sizes, count, hc);
+  for (i = 0; i < count; i++)
+    group[i].chk.query = hc[i];
+}
+
+
+/**
+ * Claim the next jobs of a batch and encode them.  Must be called
+ * with the encoder's lock held; releases it while encoding.
+ *
+ * @param te the tree encoder
+ * @param batch batch with unclaimed jobs
+ */
+static void
+encode_next_jobs (struct GNUNET_FS_TreeEncoder *te,
+                  struct EncodeBatch *batch)
+{
+  unsigned int start;
+  unsigned int count;
+
+  start = batch->next_job;
+  count = GNUNET_MIN (HASH_GROUP, batch->num_jobs - start);
+  batch->next_job += count;
+  (void) pthread_mutex_unlock (&te->lock);
+  encode_jobs (batch, start, count);
+  (void) pthread_mutex_lock (&te->lock);
+  batch->done_jobs += count;
+  if (batch->done_jobs == batch->num_jobs)
+    (void) pthread_cond_broadcast (&te->done_cond);
+}
+
+
+/**
+ * Main function of a worker thread: encode jobs of the active
+ * batch until the encoder shuts down.  Must not touch the
+ * scheduler or log.
+ *
+ * @param cls the `struct GNUNET_FS_TreeEncoder`
+ * @return NULL
+ */
+static void *
+batch_worker (void *cls)
+{
+  struct GNUNET_FS_TreeEncoder *te = cls;
+  struct EncodeBatch *batch;
+
+  (void) pthread_mutex_lock (&te->lock);
+  while (GNUNET_YES != te->shutdown)
+  {
+    batch = te->active;
+    if ( (NULL == batch) ||
+         (batch->next_job == batch->num_jobs) )
+    {
+      (void) pthread_cond_wait (&te->work_cond, &te->lock);
+      continue;
+    }
+    encode_next_jobs (te, batch);
+  }
+  (void) pthread_mutex_unlock (&te->lock);
+  return NULL;
+}
+
+
+/**
+ * Wait for all blocks of a batch to be encoded, helping
+ * the workers with the jobs they did not claim yet.
+ *
+ * @param te the tree encoder
+ * @param batch the batch
+ */
+static void
+batch_join (struct GNUNET_FS_TreeEncoder *te,
+            struct EncodeBatch *batch)
+{
+  GNUNET_assert (0 == pthread_mutex_lock (&te->lock));
+  while (batch->next_job < batch->num_jobs)
+    encode_next_jobs (te, batch);
+  while (batch->done_jobs < batch->num_jobs)
+    GNUNET_assert (0 == pthread_cond_wait (&te->done_cond, &te->lock));
+  if (te->active == batch)
+    te->active = NULL;
+  GNUNET_assert (0 == pthread_mutex_unlock (&te->lock));
+}
+
+
+/**
+ * Read up to #BATCH_SIZE DBLOCKs starting at @a offset and hand
+ * them to the worker threads.  If reading fails, the batch ends
+ * before the failing block; the error is then reported once the
+ * encoder reaches that block and reads it again.
+ *
+ * @param te the tree encoder
+ * @param batch batch to fill, must have been joined
+ * @param offset offset of the first block
+ */
+static void
+batch_start (struct GNUNET_FS_TreeEncoder *te,
+             struct EncodeBatch *batch,
+             uint64_t offset)
+{
+  struct EncodeJob *job;
+  unsigned int want;
+  char *emsg;
+
+  want = GNUNET_MIN (BATCH_SIZE,
+                     (te->size - offset + DBLOCK_SIZE - 1) / DBLOCK_SIZE);
+  if (batch->max_jobs < want)
+  {
+    GNUNET_free_non_null (batch->jobs);
+    batch->jobs = GNUNET_new_array (want, struct EncodeJob);
+    batch->max_jobs = want;
+  }
+  batch->num_jobs = 0;
+  while (batch->num_jobs < want)
+  {
+    job = &batch->jobs[batch->num_jobs];
+    job->offset = offset;
+    job->size = GNUNET_MIN (DBLOCK_SIZE, te->size - offset);
+    emsg = NULL;
+    if (job->size !=
+        te->reader (te->cls, offset, job->size, job->pt, &emsg))
+    {
+      GNUNET_free_non_null (emsg);
+      break;
+    }
+    offset += job->size;
+    batch->num_jobs++;
+  }
+  GNUNET_assert (0 == pthread_mutex_lock (&te->lock));
+  GNUNET_assert (NULL == te->active);
+  batch->next_job = 0;
+  batch->done_jobs = 0;
+  te->active = batch;
+  GNUNET_assert (0 == pthread_cond_broadcast (&te->work_cond));
+  GNUNET_assert (0 == pthread_mutex_unlock (&te->lock));
+}
+
+
+/**
+ * Find the encoded DBLOCK at the given offset, encoding it (and the
+ * blocks that follow it) if necessary.  Also starts encoding the next
+ * batch of blocks while we emit the ones in the current batch.
+ *
+ * @param te the tree encoder
+ * @param offset offset of the DBLOCK
+ * @return NULL if the block could not be read
+ */
+static struct EncodeJob *
+batch_get_job (struct GNUNET_FS_TreeEncoder *te,
+               uint64_t offset)
+{
+  struct EncodeBatch *batch;
+  unsigned int i;
+
+  batch = te->batch;
+  if ( (0 == batch->num_jobs) ||
+       (offset < batch->jobs[0].offset) ||
+       (offset > batch->jobs[batch->num_jobs - 1].offset) )
+  {
+    batch = te->next_batch;
+    batch_join (te, batch);
+    if ( (0 == batch->num_jobs) ||
+         (offset != batch->jobs[0].offset) )
+    {
+      /* first block, or we were moved elsewhere */
+      batch_start (te, batch, offset);
+      batch_join (te, batch);
+    }
+    /* swap */
+    te->next_batch = te->batch;
+    te->batch = batch;
+    te->next_batch->num_jobs = 0;
+    if (0 == batch->num_jobs)
+      return NULL;
+    if ( (BATCH_SIZE == batch->num_jobs) &&
+         (batch->jobs[BATCH_SIZE - 1].offset +
+          batch->jobs[BATCH_SIZE - 1].size < te->size) )
+      batch_start (te, te->next_batch,
+                   batch->jobs[BATCH_SIZE - 1].offset +
+                   batch->jobs[BATCH_SIZE - 1].size);
+  }
+  i = (offset - batch->jobs[0].offset) / DBLOCK_SIZE;
+  GNUNET_assert (batch->jobs[i].offset == offset);
+  return &batch->jobs[i];
+}
+#endif
+
+
 /**
  * Initialize a tree encoder.  This function will call @a proc and
  * "progress" on each block in the tree.  Once all blocks have been
@@ -288,6 +686,40 @@ GNUNET_FS_tree_encoder_create (struct GNUNET_FS_Handle *h, uint64_t size,
   te->chk_tree =
       GNUNET_malloc (te->chk_tree_depth * CHK_PER_INODE *
                      sizeof (struct ContentHashKey));
+#if HAVE_PTHREAD_H && defined(_SC_NPROCESSORS_ONLN)
+  {
+    long ncpu;
+
+    ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    if ( (ncpu > 1) &&
+         (size > DBLOCK_SIZE) )
+    {
+      /* the main thread helps when it waits for a batch, so with
+         only a few blocks we need fewer workers */
+      ncpu = GNUNET_MIN (ncpu, MAX_WORKERS);
+      ncpu = GNUNET_MIN (ncpu,
+                         (size + DBLOCK_SIZE - 1) / DBLOCK_SIZE - 1);
+      GNUNET_assert (0 == pthread_mutex_init (&te->lock, NULL));
+      GNUNET_assert (0 == pthread_cond_init (&te->work_cond, NULL));
+      GNUNET_assert (0 == pthread_cond_init (&te->done_cond, NULL));
+      while (te->num_workers < ncpu)
+      {
+        if (0 != pthread_create (&te->workers[te->num_workers],
+                                 NULL,
+                                 &batch_worker,
+                                 te))
+        {
+          /* we can do the work ourselves */
+          GNUNET_log_strerror (GNUNET_ERROR_TYPE_WARNING, "pthread_create");
+          break;
+        }
+        te->num_workers++;
+      }
+      te->batch = GNUNET_new (struct EncodeBatch);
+      te->next_batch = GNUNET_new (struct EncodeBatch);
+    }
+  }
+#endif
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
 	      "Created tree encoder for file with %llu bytes and depth %u\n",
 	      (unsigned long long) size,
@@ -333,12 +765,14 @@ GNUNET_FS_tree_encoder_next (struct GNUNET_FS_TreeEncoder *te)
 {
   struct ContentHashKey *mychk;
   const void *pt_block;
+  const void *enc_block;
   uint16_t pt_size;
   char iob[DBLOCK_SIZE];
   char enc[DBLOCK_SIZE];
-  struct GNUNET_CRYPTO_SymmetricSessionKey sk;
-  struct GNUNET_CRYPTO_SymmetricInitializationVector iv;
   unsigned int off;
+#if HAVE_PTHREAD_H
+  struct EncodeJob *job;
+#endif
 
   GNUNET_assert (GNUNET_NO == te->in_next);
   te->in_next = GNUNET_YES;
@@ -355,36 +789,50 @@ GNUNET_FS_tree_encoder_next (struct GNUNET_FS_TreeEncoder *te)
     te->cont (te->cls, NULL);
     return;
   }
-  if (0 == te->current_depth)
+  off = compute_chk_offset (te->current_depth, te->publish_offset);
+  mychk = &te->chk_tree[te->current_depth * CHK_PER_INODE + off];
+  pt_block = NULL;
+  enc_block = enc;
+#if HAVE_PTHREAD_H
+  if ( (0 == te->current_depth) &&
+       (NULL != te->batch) &&
+       (NULL != (job = batch_get_job (te, te->publish_offset))) )
   {
-    /* read DBLOCK */
-    pt_size = GNUNET_MIN (DBLOCK_SIZE, te->size - te->publish_offset);
-    if (pt_size !=
-        te->reader (te->cls, te->publish_offset, pt_size, iob, &te->emsg))
-    {
-      te->in_next = GNUNET_NO;
-      te->cont (te->cls, NULL);
-      return;
-    }
-    pt_block = iob;
+    /* DBLOCK was already encoded by a worker */
+    pt_size = job->size;
+    pt_block = job->pt;
+    enc_block = job->enc;
+    *mychk = job->chk;
   }
-  else
+#endif
+  if (NULL == pt_block)
   {
-    pt_size =
-        GNUNET_FS_tree_compute_iblock_size (te->current_depth,
-                                            te->publish_offset);
-    pt_block = &te->chk_tree[(te->current_depth - 1) * CHK_PER_INODE];
+    if (0 == te->current_depth)
+    {
+      /* read DBLOCK */
+      pt_size = GNUNET_MIN (DBLOCK_SIZE, te->size - te->publish_offset);
+      if (pt_size !=
+          te->reader (te->cls, te->publish_offset, pt_size, iob, &te->emsg))
+      {
+        te->in_next = GNUNET_NO;
+        te->cont (te->cls, NULL);
+        return;
+      }
+      pt_block = iob;
+    }
+    else
+    {
+      pt_size =
+          GNUNET_FS_tree_compute_iblock_size (te->current_depth,
+                                              te->publish_offset);
+      pt_block = &te->chk_tree[(te->current_depth - 1) * CHK_PER_INODE];
+    }
+    encode_block (pt_block, pt_size, mychk, enc);
   }
-  off = compute_chk_offset (te->current_depth, te->publish_offset);
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "TE is at offset %llu and depth %u with block size %u and target-CHK-offset %u\n",
               (unsigned long long) te->publish_offset, te->current_depth,
               (unsigned int) pt_size, (unsigned int) off);
-  mychk = &te->chk_tree[te->current_depth * CHK_PER_INODE + off];
-  GNUNET_CRYPTO_hash (pt_block, pt_size, &mychk->key);
-  GNUNET_CRYPTO_hash_to_aes_key (&mychk->key, &sk, &iv);
-  GNUNET_CRYPTO_symmetric_encrypt (pt_block, pt_size, &sk, &iv, enc);
-  GNUNET_CRYPTO_hash (enc, pt_size, &mychk->query);
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "TE calculates query to be `%s', stored at %u\n",
               GNUNET_h2s (&mychk->query),
@@ -393,7 +841,7 @@ GNUNET_FS_tree_encoder_next (struct GNUNET_FS_TreeEncoder *te)
     te->proc (te->cls, mychk, te->publish_offset, te->current_depth,
               (0 ==
                te->current_depth) ? GNUNET_BLOCK_TYPE_FS_DBLOCK :
-              GNUNET_BLOCK_TYPE_FS_IBLOCK, enc, pt_size);
+              GNUNET_BLOCK_TYPE_FS_IBLOCK, enc_block, pt_size);
   if (NULL != te->progress)
     te->progress (te->cls, te->publish_offset, pt_block, pt_size,
                   te->current_depth);
@@ -450,6 +898,28 @@ GNUNET_FS_tree_encoder_finish (struct GNUNET_FS_TreeEncoder *te,
     te->reader =  NULL;
   }
   GNUNET_assert (GNUNET_NO == te->in_next);
+#if HAVE_PTHREAD_H
+  if (NULL != te->batch)
+  {
+    unsigned int i;
+
+    batch_join (te, te->batch);
+    batch_join (te, te->next_batch);
+    GNUNET_assert (0 == pthread_mutex_lock (&te->lock));
+    te->shutdown = GNUNET_YES;
+    GNUNET_assert (0 == pthread_cond_broadcast (&te->work_cond));
+    GNUNET_assert (0 == pthread_mutex_unlock (&te->lock));
+    for (i = 0; i < te->num_workers; i++)
+      GNUNET_break (0 == pthread_join (te->workers[i], NULL));
+    GNUNET_break (0 == pthread_cond_destroy (&te->done_cond));
+    GNUNET_break (0 == pthread_cond_destroy (&te->work_cond));
+    GNUNET_break (0 == pthread_mutex_destroy (&te->lock));
+    GNUNET_free_non_null (te->batch->jobs);
+    GNUNET_free_non_null (te->next_batch->jobs);
+    GNUNET_free (te->batch);
+    GNUNET_free (te->next_batch);
+  }
+#endif
   if (NULL != te->uri)
     GNUNET_FS_uri_destroy (te->uri);
   if (emsg != NULL)
@@ -179,6 +179,34 @@ get_state_file ()
 }
 
 
+/**
+ * Compute the name of the file that 'gnunet-publish' should use to
+ * cache the meta data it extracts from the given work item.
+ *
+ * @param filename name of the work item
+ * @return name of the scan cache file
+ */
+static char *
+get_scan_cache_file (const char *filename)
+{
+  struct GNUNET_HashCode key;
+  struct GNUNET_CRYPTO_HashAsciiEncoded enc;
+  char *ret;
+
+  GNUNET_CRYPTO_hash (filename,
+		      strlen (filename),
+		      &key);
+  GNUNET_CRYPTO_hash_to_enc (&key, &enc);
+  GNUNET_asprintf (&ret,
+		   "%s%s.auto-share-scan%s%s",
+		   dir_name,
+		   (DIR_SEPARATOR == dir_name[strlen(dir_name)-1]) ? "" : DIR_SEPARATOR_STR,
+		   DIR_SEPARATOR_STR,
+		   (const char *) &enc);
+  return ret;
+}
+
+
 /**
  * Load the set of #work_finished items from disk.
  */
@@ -463,12 +491,13 @@ static void
 work (void *cls,
       const struct GNUNET_SCHEDULER_TaskContext *tc)
 {
-  static char *argv[14];
+  static char *argv[16];
   static char anon_level[20];
   static char content_prio[20];
   static char repl_level[20];
   struct WorkItem *wi;
   const struct GNUNET_DISK_FileHandle *pr;
+  char *scan_cache;
   int argc;
 
   run_task = NULL;
@@ -480,8 +509,19 @@ work (void *cls,
   argv[argc++] = "gnunet-publish";
   if (verbose)
     argv[argc++] = "-V";
+  scan_cache = NULL;
   if (disable_extractor)
+  {
     argv[argc++] = "-D";
+  }
+  else
+  {
+    /* remember extracted meta data so that we do not have to run
+       libextractor on all files again if only a few changed */
+    scan_cache = get_scan_cache_file (wi->filename);
+    argv[argc++] = "-C";
+    argv[argc++] = scan_cache;
+  }
   if (do_disable_creation_time)
     argv[argc++] = "-d";
   argv[argc++] = "-c";
@@ -508,6 +548,7 @@ work (void *cls,
                                               0, NULL, NULL, NULL,
 					      "gnunet-publish",
 					      argv);
+  GNUNET_free_non_null (scan_cache);
   if (NULL == publish_proc)
   {
     GNUNET_log (GNUNET_ERROR_TYPE_ERROR,
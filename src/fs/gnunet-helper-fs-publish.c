@@ -28,6 +28,33 @@
  */
 #include "platform.h"
 #include "gnunet_fs_service.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+
+/**
+ * Maximum number of threads we use for extracting meta data.
+ * Each thread has its own set of plugin processes, so keep this
+ * small.
+ */
+#define MAX_WORKERS 4
+
+/**
+ * How many files may the extraction threads be ahead of the
+ * file whose meta data we are currently reporting (per thread)?
+ */
+#define WORKER_WINDOW 4
+
+/**
+ * After how many records do we flush the scan cache to disk?
+ */
+#define CACHE_FLUSH_INTERVAL 128
+
+/**
+ * Version of the on-disk format of the scan cache.
+ */
+#define CACHE_VERSION 1
 
 
 /**
@@ -74,11 +101,57 @@ struct ScanTreeNode
    */
   uint64_t file_size;
 
+  /**
+   * Key of the file in the scan cache (hash over device, inode,
+   * modification time and size of the file).
+   */
+  struct GNUNET_HashCode cache_key;
+
+  /**
+   * Serialized meta data of the file, NULL for none.
+   */
+  char *meta_buf;
+
+  /**
+   * Number of bytes in @e meta_buf.
+   */
+  size_t meta_size;
+
   /**
    * #GNUNET_YES if this is a directory
    */
   int is_directory;
 
+  /**
+   * #GNUNET_YES once the meta data of the file is available.
+   */
+  int extracted;
+
+  /**
+   * #GNUNET_YES if @e meta_buf is owned by the scan cache.
+   */
+  int cached;
+
+  /**
+   * #GNUNET_YES if serializing the meta data failed (reported
+   * by the main thread, as extraction threads must not log).
+   */
+  int meta_failed;
+
+};
+
+
+/**
+ * Meta data of a file as stored in the scan cache.
+ */
+struct CacheEntry
+{
+
+  /**
+   * Number of bytes of serialized meta data following this struct.
+   */
+  size_t size;
+
 };
 
 
@@ -87,6 +160,21 @@ struct ScanTreeNode
  * List of libextractor plugins to use for extracting.
  */
 static struct EXTRACTOR_PluginList *plugins;
+#else
+struct EXTRACTOR_PluginList;
+#endif
+
+/**
+ * Extractor configuration given on the command line, NULL for defaults.
+ */
+static const char *ex_config;
+
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+/**
+ * Number of threads to use for extracting meta data, 0 to extract
+ * in the main thread.
+ */
+static unsigned int num_workers;
 #endif
 
 /**
@@ -94,6 +182,38 @@ static struct EXTRACTOR_PluginList *plugins;
  */
 static int output_stream;
 
+/**
+ * Name of the scan cache file, NULL if we do not use a cache.
+ */
+static const char *cache_filename;
+
+/**
+ * Name of the scan cache file we are currently writing.
+ */
+static char *cache_tmpname;
+
+/**
+ * Meta data of files from previous scans, maps `cache_key`s to
+ * `struct CacheEntry`s.
+ */
+static struct GNUNET_CONTAINER_MultiHashMap *cache_map;
+
+/**
+ * Handle for writing the scan cache, NULL if we do not use a cache.
+ */
+static struct GNUNET_BIO_WriteHandle *cache_wh;
+
+/**
+ * Number of records written to #cache_wh since the last flush.
+ */
+static unsigned int cache_unflushed;
+
+/**
+ * Hash over the extractor configuration; cached meta data is only
+ * used if it was extracted with the same configuration.
+ */
+static struct GNUNET_HashCode cache_tag;
+
 
 #if HAVE_LIBEXTRACTOR
 /**
@@ -160,6 +280,8 @@ free_tree (struct ScanTreeNode *tree)
     GNUNET_CONTAINER_DLL_remove (tree->parent->children_head,
 				 tree->parent->children_tail,
 				 tree);
+  if (GNUNET_NO == tree->cached)
+    GNUNET_free_non_null (tree->meta_buf);
   GNUNET_free (tree->filename);
   GNUNET_free (tree);
 }
@@ -340,6 +462,18 @@ preprocess_file (const char *filename,
   item->filename = GNUNET_strdup (filename);
   item->is_directory = (S_ISDIR (sbuf.st_mode)) ? GNUNET_YES : GNUNET_NO;
   item->file_size = fsize;
+  if (GNUNET_NO == item->is_directory)
+  {
+    uint64_t fattr[4];
+
+    fattr[0] = GNUNET_htonll ((uint64_t) sbuf.st_dev);
+    fattr[1] = GNUNET_htonll ((uint64_t) sbuf.st_ino);
+    fattr[2] = GNUNET_htonll ((uint64_t) sbuf.st_mtime);
+    fattr[3] = GNUNET_htonll (fsize);
+    GNUNET_CRYPTO_hash (fattr,
+                        sizeof (fattr),
+                        &item->cache_key);
+  }
   if (GNUNET_YES == item->is_directory)
   {
     struct RecursionContext rc;
@@ -364,35 +498,247 @@ preprocess_file (const char *filename,
 
 
 /**
- * Extract metadata from files.
+ * Free an entry of the scan cache.
  *
- * @param item entry we are processing
- * @return #GNUNET_OK on success, #GNUNET_SYSERR on fatal errors
+ * @param cls NULL
+ * @param key key of the entry (unused)
+ * @param value the `struct CacheEntry` to free
+ * @return #GNUNET_OK to continue to iterate
  */
 static int
-extract_files (struct ScanTreeNode *item)
+free_cache_entry (void *cls,
+                  const struct GNUNET_HashCode *key,
+                  void *value)
 {
-  struct GNUNET_CONTAINER_MetaData *meta;
-  ssize_t size;
-  size_t slen;
+  GNUNET_free (value);
+  return GNUNET_OK;
+}
 
-  if (GNUNET_YES == item->is_directory)
-  {
-    /* for directories, we simply only descent, no extraction, no
-       progress reporting */
-    struct ScanTreeNode *pos;
 
-    for (pos = item->children_head; NULL != pos; pos = pos->next)
+/**
+ * Load meta data extracted by a previous (possibly interrupted)
+ * scan from the given file into the #cache_map.
+ *
+ * @param fn name of the file to load
+ */
+static void
+load_cache (const char *fn)
+{
+  struct GNUNET_BIO_ReadHandle *rh;
+  struct GNUNET_HashCode tag;
+  struct GNUNET_HashCode key;
+  struct CacheEntry *ce;
+  uint32_t version;
+  uint32_t size;
+  char *emsg;
+
+  if (GNUNET_YES != GNUNET_DISK_file_test (fn))
+    return;
+  rh = GNUNET_BIO_read_open (fn);
+  if (NULL == rh)
+    return;
+  if ( (GNUNET_OK ==
+        GNUNET_BIO_read_int32 (rh, &version)) &&
+       (CACHE_VERSION == version) &&
+       (GNUNET_OK ==
+        GNUNET_BIO_read (rh, "cache tag", &tag, sizeof (tag))) &&
+       (0 == memcmp (&tag, &cache_tag, sizeof (tag))) )
+  {
+    /* the last record is truncated if the scan was interrupted */
+    while ( (GNUNET_OK ==
+             GNUNET_BIO_read (rh, "cache key", &key, sizeof (key))) &&
+            (GNUNET_OK ==
+             GNUNET_BIO_read_int32 (rh, &size)) &&
+            (size < UINT16_MAX) )
+    {
+      ce = GNUNET_malloc (sizeof (struct CacheEntry) + size);
+      ce->size = size;
       if (GNUNET_OK !=
-	  extract_files (pos))
-	return GNUNET_SYSERR;
-    return GNUNET_OK;
+          GNUNET_BIO_read (rh, "cached meta data", &ce[1], size))
+      {
+        GNUNET_free (ce);
+        break;
+      }
+      if (GNUNET_OK !=
+          GNUNET_CONTAINER_multihashmap_put (cache_map,
+                                             &key,
+                                             ce,
+                                             GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY))
+        GNUNET_free (ce);
+    }
+  }
+  emsg = NULL;
+  (void) GNUNET_BIO_read_close (rh, &emsg);
+  GNUNET_free_non_null (emsg);
+}
+
+
+/**
+ * Start using the scan cache: load the results of previous scans and
+ * start writing the new cache.  The new cache is written to a
+ * temporary file that only replaces the old cache once the scan is
+ * complete; if the scan is interrupted, the next scan picks up the
+ * results from the temporary file and resumes from there.
+ */
+static void
+open_cache ()
+{
+  if (NULL == ex_config)
+    GNUNET_CRYPTO_hash ("", 0, &cache_tag);
+  else
+    GNUNET_CRYPTO_hash (ex_config, strlen (ex_config), &cache_tag);
+  cache_map = GNUNET_CONTAINER_multihashmap_create (1024, GNUNET_NO);
+  GNUNET_asprintf (&cache_tmpname,
+                   "%s.tmp",
+                   cache_filename);
+  load_cache (cache_filename);
+  load_cache (cache_tmpname);
+  if (GNUNET_OK !=
+      GNUNET_DISK_directory_create_for_file (cache_tmpname))
+    return;
+  cache_wh = GNUNET_BIO_write_open (cache_tmpname);
+  if (NULL == cache_wh)
+    return;
+  if ( (GNUNET_OK !=
+        GNUNET_BIO_write_int32 (cache_wh, CACHE_VERSION)) ||
+       (GNUNET_OK !=
+        GNUNET_BIO_write (cache_wh, &cache_tag, sizeof (cache_tag))) )
+  {
+    (void) GNUNET_BIO_write_close (cache_wh);
+    cache_wh = NULL;
   }
+}
+
+
+/**
+ * Add the meta data of a file to the new scan cache.
+ *
+ * @param item file to add
+ */
+static void
+cache_record (const struct ScanTreeNode *item)
+{
+  if (NULL == cache_wh)
+    return;
+  if ( (GNUNET_OK ==
+        GNUNET_BIO_write (cache_wh,
+                          &item->cache_key,
+                          sizeof (struct GNUNET_HashCode))) &&
+       (GNUNET_OK ==
+        GNUNET_BIO_write_int32 (cache_wh, (int32_t) item->meta_size)) &&
+       ( (0 == item->meta_size) ||
+         (GNUNET_OK ==
+          GNUNET_BIO_write (cache_wh, item->meta_buf, item->meta_size)) ) )
+  {
+    if (++cache_unflushed < CACHE_FLUSH_INTERVAL)
+      return;
+    cache_unflushed = 0;
+    if (GNUNET_OK == GNUNET_BIO_flush (cache_wh))
+      return;
+  }
+  /* write error, stop updating the cache */
+  (void) GNUNET_BIO_write_close (cache_wh);
+  cache_wh = NULL;
+}
+
+
+/**
+ * Stop using the scan cache.
+ *
+ * @param commit #GNUNET_YES if the scan completed and the new cache
+ *        should replace the old one
+ */
+static void
+close_cache (int commit)
+{
+  if ( (NULL != cache_wh) &&
+       (GNUNET_OK == GNUNET_BIO_write_close (cache_wh)) &&
+       (GNUNET_YES == commit) &&
+       (0 != RENAME (cache_tmpname, cache_filename)) )
+    GNUNET_log_strerror_file (GNUNET_ERROR_TYPE_WARNING,
+                              "rename",
+                              cache_filename);
+  cache_wh = NULL;
+  if (NULL != cache_map)
+  {
+    GNUNET_CONTAINER_multihashmap_iterate (cache_map,
+                                           &free_cache_entry,
+                                           NULL);
+    GNUNET_CONTAINER_multihashmap_destroy (cache_map);
+    cache_map = NULL;
+  }
+  GNUNET_free_non_null (cache_tmpname);
+  cache_tmpname = NULL;
+}
+
+
+/**
+ * Use the meta data from the scan cache for a file, if the file
+ * did not change since it was last scanned.
+ *
+ * @param item file to look up
+ */
+static void
+lookup_cache (struct ScanTreeNode *item)
+{
+  struct CacheEntry *ce;
+
+  if (NULL == cache_map)
+    return;
+  ce = GNUNET_CONTAINER_multihashmap_get (cache_map,
+                                          &item->cache_key);
+  if (NULL == ce)
+    return;
+  if (ce->size > (UINT16_MAX - sizeof (struct GNUNET_MessageHeader)
+                  - strlen (item->filename) - 1))
+    return; /* renamed to a longer name, does not fit anymore */
+  item->meta_buf = (0 == ce->size) ? NULL : (char *) &ce[1];
+  item->meta_size = ce->size;
+  item->cached = GNUNET_YES;
+  item->extracted = GNUNET_YES;
+}
+
+
+#if HAVE_LIBEXTRACTOR
+/**
+ * Load the libextractor plugins selected on the command line.
+ *
+ * @return list of plugins
+ */
+static struct EXTRACTOR_PluginList *
+load_plugins ()
+{
+  struct EXTRACTOR_PluginList *pl;
+
+  pl = EXTRACTOR_plugin_add_defaults (EXTRACTOR_OPTION_DEFAULT_POLICY);
+  if (NULL != ex_config)
+    pl = EXTRACTOR_plugin_add_config (pl, ex_config,
+                                      EXTRACTOR_OPTION_DEFAULT_POLICY);
+  return pl;
+}
+#endif
+
+
+/**
+ * Extract the meta data of a file and store it in serialized form
+ * in the @a item.  Called from the extraction threads, so this must
+ * not touch anything but the @a item.
+ *
+ * @param pl plugins to use for extraction
+ * @param item file to extract the meta data from
+ */
+static void
+extract_item (struct EXTRACTOR_PluginList *pl,
+              struct ScanTreeNode *item)
+{
+  struct GNUNET_CONTAINER_MetaData *meta;
+  ssize_t size;
+  size_t slen;
+  char *dst;
 
-  /* this is the expensive operation, *afterwards* we'll check for aborts */
   meta = GNUNET_CONTAINER_meta_data_create ();
 #if HAVE_LIBEXTRACTOR
-  EXTRACTOR_extract (plugins,
+  EXTRACTOR_extract (pl,
                      item->filename,
                      NULL, 0,
                      &add_to_md,
@@ -400,42 +746,400 @@ extract_files (struct ScanTreeNode *item)
 #endif
   slen = strlen (item->filename) + 1;
   size = GNUNET_CONTAINER_meta_data_get_serialized_size (meta);
-  if (-1 == size)
+  if (size <= 0)
   {
     /* no meta data */
     GNUNET_CONTAINER_meta_data_destroy (meta);
-    if (GNUNET_OK !=
-	write_message (GNUNET_MESSAGE_TYPE_FS_PUBLISH_HELPER_META_DATA,
-		       item->filename, slen))
-      return GNUNET_SYSERR;
-    return GNUNET_OK;
+    return;
   }
-  else if (size > (UINT16_MAX - sizeof (struct GNUNET_MessageHeader) - slen))
+  if (size > (UINT16_MAX - sizeof (struct GNUNET_MessageHeader) - slen))
   {
     /* We can't transfer more than 64k bytes in one message. */
     size = UINT16_MAX - sizeof (struct GNUNET_MessageHeader) - slen;
   }
+  item->meta_buf = GNUNET_malloc (size);
+  dst = item->meta_buf;
+  size = GNUNET_CONTAINER_meta_data_serialize (meta,
+                                               &dst, size,
+                                               GNUNET_CONTAINER_META_DATA_SERIALIZE_PART);
+  GNUNET_CONTAINER_meta_data_destroy (meta);
+  if (size <= 0)
+  {
+    if (size < 0)
+      item->meta_failed = GNUNET_YES;
+    GNUNET_free (item->meta_buf);
+    item->meta_buf = NULL;
+    size = 0;
+  }
+  item->meta_size = size;
+}
+
+
+/**
+ * Report the meta data of a file to the parent.
+ *
+ * @param item file to report
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on fatal errors
+ */
+static int
+write_item (const struct ScanTreeNode *item)
+{
+  size_t slen;
+
+  slen = strlen (item->filename) + 1;
   {
-    char buf[size + slen];
-    char *dst = &buf[slen];
+    char buf[slen + item->meta_size];
 
     memcpy (buf, item->filename, slen);
-    size = GNUNET_CONTAINER_meta_data_serialize (meta,
-						 &dst, size,
-						 GNUNET_CONTAINER_META_DATA_SERIALIZE_PART);
-    if (size < 0)
+    if (0 != item->meta_size)
+      memcpy (&buf[slen], item->meta_buf, item->meta_size);
+    return write_message (GNUNET_MESSAGE_TYPE_FS_PUBLISH_HELPER_META_DATA,
+                          buf,
+                          slen + item->meta_size);
+  }
+}
+
+
+/**
+ * Count the files in a tree.
+ *
+ * @param item root of the tree
+ * @return number of files (not directories) in the tree
+ */
+static unsigned int
+count_files (const struct ScanTreeNode *item)
+{
+  const struct ScanTreeNode *pos;
+  unsigned int ret;
+
+  if (GNUNET_NO == item->is_directory)
+    return 1;
+  ret = 0;
+  for (pos = item->children_head; NULL != pos; pos = pos->next)
+    ret += count_files (pos);
+  return ret;
+}
+
+
+/**
+ * Store the files of a tree in the order in which the parent
+ * expects their meta data.
+ *
+ * @param item root of the tree
+ * @param files array to fill
+ * @param off next free offset in @a files, updated
+ */
+static void
+collect_files (struct ScanTreeNode *item,
+               struct ScanTreeNode **files,
+               unsigned int *off)
+{
+  struct ScanTreeNode *pos;
+
+  if (GNUNET_NO == item->is_directory)
+  {
+    files[(*off)++] = item;
+    return;
+  }
+  /* for directories, we simply only descent, no extraction, no
+     progress reporting */
+  for (pos = item->children_head; NULL != pos; pos = pos->next)
+    collect_files (pos, files, off);
+}
+
+
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+/**
+ * State shared between the main thread and the extraction threads.
+ */
+struct ExtractContext
+{
+
+  /**
+   * Files to process, in the order in which they are reported.
+   */
+  struct ScanTreeNode **files;
+
+  /**
+   * Number of entries in @e files.
+   */
+  unsigned int num_files;
+
+  /**
+   * Offset of the next file an extraction thread should pick up.
+   */
+  unsigned int next;
+
+  /**
+   * Number of files whose meta data was reported to the parent.
+   */
+  unsigned int written;
+
+  /**
+   * How far may @e next be ahead of @e written?
+   */
+  unsigned int window;
+
+  /**
+   * Set to #GNUNET_YES to make the extraction threads stop.
+   */
+  int stop;
+
+  /**
+   * Lock protecting this struct and the `extracted` fields of
+   * the files.
+   */
+  pthread_mutex_t lock;
+
+  /**
+   * Signalled when @e written advanced or @e stop was set.
+   */
+  pthread_cond_t work_cond;
+
+  /**
+   * Signalled when the meta data of a file was extracted.
+   */
+  pthread_cond_t done_cond;
+
+};
+
+
+/**
+ * Ignore the meta data found while starting the plugin processes
+ * of an extraction thread.
+ *
+ * @param cls NULL
+ * @param plugin_name name of the plugin that produced this value
+ * @param type libextractor-type describing the meta data
+ * @param format basic format information about data
+ * @param data_mime_type mime-type of data (not of the original file);
+ *        can be NULL (if mime-type is not known)
+ * @param data actual meta-data found
+ * @param data_len number of bytes in @a data
+ * @return always 0 to continue extracting
+ */
+static int
+discard_md (void *cls,
+            const char *plugin_name,
+            enum EXTRACTOR_MetaType type,
+            enum EXTRACTOR_MetaFormat format,
+            const char *data_mime_type,
+            const char *data,
+            size_t data_len)
+{
+  return 0;
+}
+
+
+/**
+ * An extraction thread.
+ */
+struct Worker
+{
+
+  /**
+   * Shared state.
+   */
+  struct ExtractContext *ec;
+
+  /**
+   * Plugins of this thread (libextractor plugin lists must not be
+   * used by multiple threads at the same time).  Each list runs
+   * its own plugin processes.
+   */
+  struct EXTRACTOR_PluginList *plugins;
+
+  /**
+   * The thread.
+   */
+  pthread_t thread;
+
+};
+
+
+/**
+ * Main function of an extraction thread.  Extracts the meta data
+ * of files until all files are done or we are told to stop.
+ *
+ * @param cls the `struct Worker`
+ * @return NULL
+ */
+static void *
+extract_worker (void *cls)
+{
+  struct Worker *w = cls;
+  struct ExtractContext *ec = w->ec;
+  struct ScanTreeNode *item;
+
+  GNUNET_assert (0 == pthread_mutex_lock (&ec->lock));
+  while (GNUNET_NO == ec->stop)
+  {
+    while ( (ec->next < ec->num_files) &&
+            (GNUNET_YES == ec->files[ec->next]->extracted) )
+      ec->next++;
+    if (ec->next == ec->num_files)
+      break;
+    if (ec->next >= ec->written + ec->window)
     {
-      GNUNET_break (0);
-      size = 0;
+      GNUNET_assert (0 == pthread_cond_wait (&ec->work_cond, &ec->lock));
+      continue;
     }
-    GNUNET_CONTAINER_meta_data_destroy (meta);
-    if (GNUNET_OK !=
-	write_message (GNUNET_MESSAGE_TYPE_FS_PUBLISH_HELPER_META_DATA,
-		       buf,
-		       slen + size))
-      return GNUNET_SYSERR;
+    item = ec->files[ec->next++];
+    GNUNET_assert (0 == pthread_mutex_unlock (&ec->lock));
+    extract_item (w->plugins, item);
+    GNUNET_assert (0 == pthread_mutex_lock (&ec->lock));
+    item->extracted = GNUNET_YES;
+    GNUNET_assert (0 == pthread_cond_broadcast (&ec->done_cond));
   }
-  return GNUNET_OK;
+  GNUNET_assert (0 == pthread_mutex_unlock (&ec->lock));
+  return NULL;
+}
+#endif
+
+
+/**
+ * Extract metadata from files and report it to the parent.  The
+ * expensive extraction is done by up to #num_workers threads in
+ * parallel, while the results are reported in the order of the
+ * tree as soon as they become available.
+ *
+ * @param root root of the tree we are processing
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on fatal errors
+ */
+static int
+extract_files (struct ScanTreeNode *root)
+{
+  struct ScanTreeNode **files;
+  struct ScanTreeNode *item;
+  unsigned int num_files;
+  unsigned int missing;
+  unsigned int i;
+  int ret;
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+  struct ExtractContext ec;
+  struct Worker *workers;
+  unsigned int loaded;
+  unsigned int started;
+#endif
+
+  num_files = count_files (root);
+  if (0 == num_files)
+    return GNUNET_OK;
+  files = GNUNET_malloc_large (num_files * sizeof (struct ScanTreeNode *));
+  if (NULL == files)
+    return GNUNET_SYSERR;
+  i = 0;
+  collect_files (root, files, &i);
+  missing = 0;
+  for (i = 0; i < num_files; i++)
+  {
+    lookup_cache (files[i]);
+    if (GNUNET_NO == files[i]->extracted)
+      missing++;
+  }
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+  started = 0;
+  workers = NULL;
+  if (num_workers > 1)
+  {
+    memset (&ec, 0, sizeof (ec));
+    ec.files = files;
+    ec.num_files = num_files;
+    ec.window = GNUNET_MIN (num_workers, missing) * WORKER_WINDOW;
+    GNUNET_assert (0 == pthread_mutex_init (&ec.lock, NULL));
+    GNUNET_assert (0 == pthread_cond_init (&ec.work_cond, NULL));
+    GNUNET_assert (0 == pthread_cond_init (&ec.done_cond, NULL));
+    workers = GNUNET_new_array (num_workers, struct Worker);
+    loaded = GNUNET_MIN (num_workers, missing);
+    for (i = 0; i < loaded; i++)
+    {
+      workers[i].ec = &ec;
+      workers[i].plugins = load_plugins ();
+      /* libextractor forks the plugin processes on first use; do
+         that now, while we are still single-threaded */
+      EXTRACTOR_extract (workers[i].plugins,
+                         NULL,
+                         "", 1,
+                         &discard_md,
+                         NULL);
+    }
+    while (started < loaded)
+    {
+      if (0 != pthread_create (&workers[started].thread,
+                               NULL,
+                               &extract_worker,
+                               &workers[started]))
+        break;
+      started++;
+    }
+    for (i = started; i < loaded; i++)
+      EXTRACTOR_plugin_remove_all (workers[i].plugins);
+  }
+#endif
+  ret = GNUNET_OK;
+  for (i = 0; i < num_files; i++)
+  {
+    item = files[i];
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+    if (0 != started)
+    {
+      GNUNET_assert (0 == pthread_mutex_lock (&ec.lock));
+      while (GNUNET_NO == item->extracted)
+        GNUNET_assert (0 == pthread_cond_wait (&ec.done_cond, &ec.lock));
+      GNUNET_assert (0 == pthread_mutex_unlock (&ec.lock));
+    }
+#endif
+    if (GNUNET_NO == item->extracted)
+    {
+      /* this is the expensive operation, *afterwards* we'll check for aborts */
+#if HAVE_LIBEXTRACTOR
+      extract_item (plugins, item);
+#else
+      extract_item (NULL, item);
+#endif
+      item->extracted = GNUNET_YES;
+    }
+    GNUNET_break (GNUNET_NO == item->meta_failed);
+    if (GNUNET_OK != write_item (item))
+    {
+      ret = GNUNET_SYSERR;
+      break;
+    }
+    cache_record (item);
+    /* we do not need the meta data anymore */
+    if (GNUNET_NO == item->cached)
+      GNUNET_free_non_null (item->meta_buf);
+    item->meta_buf = NULL;
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+    if (0 != started)
+    {
+      GNUNET_assert (0 == pthread_mutex_lock (&ec.lock));
+      ec.written = i + 1;
+      GNUNET_assert (0 == pthread_cond_broadcast (&ec.work_cond));
+      GNUNET_assert (0 == pthread_mutex_unlock (&ec.lock));
+    }
+#endif
+  }
+#if HAVE_LIBEXTRACTOR && HAVE_PTHREAD_H
+  if (NULL != workers)
+  {
+    GNUNET_assert (0 == pthread_mutex_lock (&ec.lock));
+    ec.stop = GNUNET_YES;
+    GNUNET_assert (0 == pthread_cond_broadcast (&ec.work_cond));
+    GNUNET_assert (0 == pthread_mutex_unlock (&ec.lock));
+    for (i = 0; i < started; i++)
+    {
+      GNUNET_assert (0 == pthread_join (workers[i].thread, NULL));
+      EXTRACTOR_plugin_remove_all (workers[i].plugins);
+    }
+    GNUNET_free (workers);
+    GNUNET_assert (0 == pthread_cond_destroy (&ec.done_cond));
+    GNUNET_assert (0 == pthread_cond_destroy (&ec.work_cond));
+    GNUNET_assert (0 == pthread_mutex_destroy (&ec.lock));
+  }
+#endif
+  GNUNET_free (files);
+  return ret;
 }
 
 
@@ -490,11 +1194,12 @@ make_dev_zero (int fd,
 /**
  * Main function of the helper process to extract meta data.
  *
- * @param argc should be 3
+ * @param argc should be 2, 3 or 4
  * @param argv [0] our binary name
  *             [1] name of the file or directory to process
- *             [2] "-" to disable extraction, NULL for defaults,
+ *             [2] "-" to disable extraction, NULL or "" for defaults,
  *                 otherwise custom plugins to load from LE
+ *             [3] name of the scan cache file, NULL for none
  * @return 0 on success
  */
 int
@@ -524,27 +1229,39 @@ main (int argc,
 #endif
 
   /* parse command line */
-  if ( (3 != argc) && (2 != argc) )
+  if ( (argc < 2) || (argc > 4) )
   {
     FPRINTF (stderr,
 	     "%s",
-	     "gnunet-helper-fs-publish needs exactly one or two arguments\n");
+	     "gnunet-helper-fs-publish needs one to three arguments\n");
 #if WINDOWS
     GNUNET_free ((void*) argv);
 #endif
     return 1;
   }
   filename_expanded = argv[1];
-  ex = argv[2];
+  ex = (argc > 2) ? argv[2] : NULL;
+  if ( (NULL != ex) &&
+       ('\0' == ex[0]) )
+    ex = NULL;
   if ( (NULL == ex) ||
        (0 != strcmp (ex, "-")) )
   {
+    ex_config = ex;
 #if HAVE_LIBEXTRACTOR
-    plugins = EXTRACTOR_plugin_add_defaults (EXTRACTOR_OPTION_DEFAULT_POLICY);
-    if (NULL != ex)
-      plugins = EXTRACTOR_plugin_add_config (plugins, ex,
-					     EXTRACTOR_OPTION_DEFAULT_POLICY);
+    plugins = load_plugins ();
+#if HAVE_PTHREAD_H && defined(_SC_NPROCESSORS_ONLN)
+    {
+      long ncpu;
+
+      ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+      if (ncpu > 1)
+        num_workers = GNUNET_MIN (ncpu, MAX_WORKERS);
+    }
+#endif
 #endif
+    if (argc > 3)
+      cache_filename = argv[3];
   }
 
   /* scan tree to find out how much work there is to be done */
@@ -575,11 +1292,14 @@ main (int argc,
   }
   if (NULL != root)
   {
+    if (NULL != cache_filename)
+      open_cache ();
     if (GNUNET_OK !=
 	extract_files (root))
     {
       (void) write_message (GNUNET_MESSAGE_TYPE_FS_PUBLISH_HELPER_ERROR, NULL, 0);
       free_tree (root);
+      close_cache (GNUNET_NO);
 #if HAVE_LIBEXTRACTOR
       EXTRACTOR_plugin_remove_all (plugins);
 #endif
@@ -589,6 +1309,7 @@ main (int argc,
       return 4;
     }
     free_tree (root);
+    close_cache (GNUNET_YES);
   }
   /* enable "clean" shutdown by telling parent that we are done */
   (void) write_message (GNUNET_MESSAGE_TYPE_FS_PUBLISH_HELPER_FINISHED, NULL, 0);
@@ -124,6 +124,11 @@ static int extract_only;
  */
 static int do_disable_creation_time;
 
+/**
+ * Command-line option specifying the scan cache to use.
+ */
+static char *scan_cache;
+
 /**
  * Handle to the directory scanner (for recursive insertions).
  */
@@ -752,10 +757,11 @@ identity_continuation (const char *args0)
     GNUNET_free_non_null (ex);
     return;
   }
-  ds = GNUNET_FS_directory_scan_start (args0,
-				       disable_extractor,
-				       ex,
-				       &directory_scan_cb, NULL);
+  ds = GNUNET_FS_directory_scan_start_cached (args0,
+                                              disable_extractor,
+                                              ex,
+                                              scan_cache,
+                                              &directory_scan_cb, NULL);
   if (NULL == ds)
   {
     FPRINTF (stderr,
@@ -900,6 +906,9 @@ main (int argc, char *const *argv)
     {'a', "anonymity", "LEVEL",
      gettext_noop ("set the desired LEVEL of sender-anonymity"),
      1, &GNUNET_GETOPT_set_uint, &bo.anonymity_level},
+    {'C', "scan-cache", "FILENAME",
+     gettext_noop ("remember extracted meta data in FILENAME to speed up future scans"),
+     1, &GNUNET_GETOPT_set_filename, &scan_cache},
     {'d', "disable-creation-time", NULL,
      gettext_noop
      ("disable adding the creation time to the metadata of the uploaded file"),
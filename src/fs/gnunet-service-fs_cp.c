@@ -117,6 +117,13 @@ struct GSF_PeerTransmitHandle
    */
   int was_reserved;
 
+  /**
+   * Number of queries in the transmission (we reserve bandwidth
+   * for as many replies), 0 if this is not a query.  Lowered if
+   * ATS does not let us reserve that much.
+   */
+  unsigned int num_queries;
+
   /**
    * Priority of this request.
    */
@@ -302,10 +309,15 @@ struct GSF_ConnectedPeer
   unsigned int last_request_times_off;
 
   /**
-   * #GNUNET_YES if we did successfully reserve 32k bandwidth,
-   * #GNUNET_NO if not.
+   * Number of replies (of up to 32k each) we reserved bandwidth
+   * for and did not use yet.
+   */
+  unsigned int did_reserve;
+
+  /**
+   * Number of replies the pending reservation (@e rc) is for.
    */
-  int did_reserve;
+  unsigned int rc_count;
 
   /**
    * Function called when the creation of this record is complete.
@@ -400,6 +412,29 @@ ats_reserve_callback (void *cls,
                       struct GNUNET_TIME_Relative res_delay);
 
 
+/**
+ * Ask ATS to reserve bandwidth for replies to our queries.
+ *
+ * @param cp peer to reserve from
+ * @param count number of replies (of up to #DBLOCK_SIZE bytes) to
+ *        reserve bandwidth for
+ */
+static void
+reserve_bandwidth (struct GSF_ConnectedPeer *cp,
+                   unsigned int count)
+{
+  struct GNUNET_PeerIdentity target;
+
+  GNUNET_PEER_resolve (cp->ppd.pid, &target);
+  cp->rc_count = count;
+  cp->rc = GNUNET_ATS_reserve_bandwidth (GSF_ats,
+                                         &target,
+                                         count * DBLOCK_SIZE,
+                                         &ats_reserve_callback,
+                                         cp);
+}
+
+
 /**
  * If ready (bandwidth reserved), try to schedule transmission via
  * core for the given handle.
@@ -431,18 +466,26 @@ schedule_transmission (struct GSF_PeerTransmitHandle *pth)
   if ( (GNUNET_YES == pth->is_query) &&
        (GNUNET_YES != pth->was_reserved) )
   {
-    /* query, need reservation */
-    if (GNUNET_YES != cp->did_reserve)
-      return;                   /* not ready */
-    cp->did_reserve = GNUNET_NO;
+    /* query, need reservation for all of its replies */
+    if (cp->did_reserve < pth->num_queries)
+    {
+      /* not ready */
+      if ( (NULL == cp->rc) &&
+           (NULL == cp->rc_delay_task) )
+        reserve_bandwidth (cp,
+                           pth->num_queries - cp->did_reserve);
+      return;
+    }
+    cp->did_reserve -= pth->num_queries;
     /* reservation already done! */
     pth->was_reserved = GNUNET_YES;
-    cp->rc = GNUNET_ATS_reserve_bandwidth (GSF_ats,
-                                           &target,
-                                           DBLOCK_SIZE,
-                                           &ats_reserve_callback,
-                                           cp);
-    return;
+    if ( (NULL == cp->rc) &&
+         (NULL == cp->rc_delay_task) )
+    {
+      /* reserve for the next query */
+      reserve_bandwidth (cp, 1);
+      return;
+    }
   }
   GNUNET_assert (NULL == cp->cth);
   cp->cth_in_progress++;
@@ -529,15 +572,9 @@ retry_reservation (void *cls,
                    const struct GNUNET_SCHEDULER_TaskContext *tc)
 {
   struct GSF_ConnectedPeer *cp = cls;
-  struct GNUNET_PeerIdentity target;
 
-  GNUNET_PEER_resolve (cp->ppd.pid, &target);
   cp->rc_delay_task = NULL;
-  cp->rc =
-    GNUNET_ATS_reserve_bandwidth (GSF_ats,
-                                  &target,
-                                  DBLOCK_SIZE,
-				  &ats_reserve_callback, cp);
+  reserve_bandwidth (cp, 1);
 }
 
 
@@ -565,33 +602,30 @@ ats_reserve_callback (void *cls,
               (int) amount,
 	      GNUNET_STRINGS_relative_time_to_string (res_delay, GNUNET_YES));
   cp->rc = NULL;
+  pth = cp->pth_head;
   if (0 == amount)
   {
+    if ( (cp->rc_count > 1) &&
+         (NULL != pth) &&
+         (GNUNET_YES == pth->is_query) &&
+         (GNUNET_YES != pth->was_reserved) )
+    {
+      /* no bandwidth for the whole batch, cap it at what we have */
+      pth->num_queries = GNUNET_MAX (1, cp->did_reserve);
+      schedule_transmission (pth);
+      return;
+    }
     cp->rc_delay_task =
         GNUNET_SCHEDULER_add_delayed (res_delay,
                                       &retry_reservation,
                                       cp);
     return;
   }
-  cp->did_reserve = GNUNET_YES;
-  pth = cp->pth_head;
-  if ( (NULL != pth) &&
-       (NULL == cp->cth) &&
-       (0 == cp->cth_in_progress) )
+  cp->did_reserve += cp->rc_count;
+  if (NULL != pth)
   {
     /* reservation success, try transmission now! */
-    cp->cth_in_progress++;
-    cp->cth =
-        GNUNET_CORE_notify_transmit_ready (GSF_core,
-                                           GNUNET_YES,
-                                           GNUNET_CORE_PRIO_BACKGROUND,
-                                           GNUNET_TIME_absolute_get_remaining (pth->timeout),
-                                           peer,
-                                           pth->size,
-                                           &peer_transmit_ready_cb,
-                                           cp);
-    GNUNET_assert (NULL != cp->cth);
-    GNUNET_assert (0 < cp->cth_in_progress--);
+    schedule_transmission (pth);
   }
 }
 
@@ -643,11 +677,7 @@ GSF_peer_connect_handler_ (const struct GNUNET_PeerIdentity *peer,
   cp = GNUNET_new (struct GSF_ConnectedPeer);
   cp->ppd.pid = GNUNET_PEER_intern (peer);
   cp->ppd.transmission_delay = GNUNET_LOAD_value_init (GNUNET_TIME_UNIT_ZERO);
-  cp->rc =
-      GNUNET_ATS_reserve_bandwidth (GSF_ats,
-                                    peer,
-                                    DBLOCK_SIZE,
-                                    &ats_reserve_callback, cp);
+  reserve_bandwidth (cp, 1);
   cp->request_map = GNUNET_CONTAINER_multihashmap_create (128,
                                                           GNUNET_YES);
   GNUNET_break (GNUNET_OK ==
@@ -1525,11 +1555,10 @@ peer_transmit_timeout (void *cls,
 
 /**
  * Transmit a message to the given peer as soon as possible.
- * If the peer disconnects before the transmission can happen,
- * the callback is invoked with a `NULL` @a buffer.
  *
  * @param cp target peer
  * @param is_query is this a query (#GNUNET_YES) or content (#GNUNET_NO) or neither (#GNUNET_SYSERR)
+ * @param num_queries number of queries in the message (if @a is_query)
  * @param priority how important is this request?
  * @param timeout when does this request timeout (call gmc with error)
  * @param size number of bytes we would like to send to the peer
@@ -1537,13 +1566,14 @@ peer_transmit_timeout (void *cls,
  * @param gmc_cls closure for @a gmc
  * @return handle to cancel request
  */
-struct GSF_PeerTransmitHandle *
-GSF_peer_transmit_ (struct GSF_ConnectedPeer *cp,
-                    int is_query,
-                    uint32_t priority,
-                    struct GNUNET_TIME_Relative timeout,
-                    size_t size,
-                    GSF_GetMessageCallback gmc, void *gmc_cls)
+static struct GSF_PeerTransmitHandle *
+peer_transmit (struct GSF_ConnectedPeer *cp,
+               int is_query,
+               unsigned int num_queries,
+               uint32_t priority,
+               struct GNUNET_TIME_Relative timeout,
+               size_t size,
+               GSF_GetMessageCallback gmc, void *gmc_cls)
 {
   struct GSF_PeerTransmitHandle *pth;
   struct GSF_PeerTransmitHandle *pos;
@@ -1556,6 +1586,7 @@ GSF_peer_transmit_ (struct GSF_ConnectedPeer *cp,
   pth->gmc_cls = gmc_cls;
   pth->size = size;
   pth->is_query = is_query;
+  pth->num_queries = (GNUNET_YES == is_query) ? num_queries : 0;
   pth->priority = priority;
   pth->cp = cp;
   /* insertion sort (by priority, descending) */
@@ -1583,6 +1614,77 @@ GSF_peer_transmit_ (struct GSF_ConnectedPeer *cp,
 }
 
 
+/**
+ * Transmit a message to the given peer as soon as possible.
+ * If the peer disconnects before the transmission can happen,
+ * the callback is invoked with a `NULL` @a buffer.
+ *
+ * @param cp target peer
+ * @param is_query is this a query (#GNUNET_YES) or content (#GNUNET_NO) or neither (#GNUNET_SYSERR)
+ * @param priority how important is this request?
+ * @param timeout when does this request timeout (call gmc with error)
+ * @param size number of bytes we would like to send to the peer
+ * @param gmc function to call to get the message
+ * @param gmc_cls closure for @a gmc
+ * @return handle to cancel request
+ */
+struct GSF_PeerTransmitHandle *
+GSF_peer_transmit_ (struct GSF_ConnectedPeer *cp,
+                    int is_query,
+                    uint32_t priority,
+                    struct GNUNET_TIME_Relative timeout,
+                    size_t size,
+                    GSF_GetMessageCallback gmc, void *gmc_cls)
+{
+  return peer_transmit (cp, is_query, 1, priority, timeout,
+                        size, gmc, gmc_cls);
+}
+
+
+/**
+ * Transmit several queries to the given peer in one message.
+ * Bandwidth for the replies to all of them is reserved first; if
+ * ATS does not let us reserve that much, fewer queries may go into
+ * the message (see #GSF_peer_transmit_get_num_queries_()).
+ *
+ * @param cp target peer
+ * @param num_queries number of queries we would like to send
+ * @param priority how important is this request?
+ * @param timeout when does this request timeout (call gmc with error)
+ * @param size number of bytes we would like to send to the peer
+ * @param gmc function to call to get the message
+ * @param gmc_cls closure for @a gmc
+ * @return handle to cancel request
+ */
+struct GSF_PeerTransmitHandle *
+GSF_peer_transmit_queries_ (struct GSF_ConnectedPeer *cp,
+                            unsigned int num_queries,
+                            uint32_t priority,
+                            struct GNUNET_TIME_Relative timeout,
+                            size_t size,
+                            GSF_GetMessageCallback gmc, void *gmc_cls)
+{
+  GNUNET_assert (0 < num_queries);
+  return peer_transmit (cp, GNUNET_YES, num_queries, priority, timeout,
+                        size, gmc, gmc_cls);
+}
+
+
+/**
+ * Get the number of queries that may go into a message (we reserved
+ * bandwidth for as many replies).  Only meaningful from within the
+ * callback that asks for the message.
+ *
+ * @param pth transmission request
+ * @return number of queries to put into the message
+ */
+unsigned int
+GSF_peer_transmit_get_num_queries_ (const struct GSF_PeerTransmitHandle *pth)
+{
+  return pth->num_queries;
+}
+
+
 /**
  * Cancel an earlier request for transmission.
  *
@@ -1606,6 +1708,9 @@ GSF_peer_transmit_cancel_ (struct GSF_PeerTransmitHandle *pth)
     GNUNET_assert (0 < cp->ppd.pending_queries--);
   else if (GNUNET_NO == pth->is_query)
     GNUNET_assert (0 < cp->ppd.pending_replies--);
+  /* keep the bandwidth for the next queries */
+  if (GNUNET_YES == pth->was_reserved)
+    cp->did_reserve += pth->num_queries;
   GNUNET_free (pth);
 }
 
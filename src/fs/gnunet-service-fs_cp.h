@@ -259,6 +259,42 @@ GSF_peer_transmit_ (struct GSF_ConnectedPeer *cp,
                     void *gmc_cls);
 
 
+/**
+ * Transmit several queries to the given peer in one message.
+ * Bandwidth for the replies to all of them is reserved first; if
+ * ATS does not let us reserve that much, fewer queries may go into
+ * the message (see #GSF_peer_transmit_get_num_queries_()).
+ *
+ * @param cp target peer
+ * @param num_queries number of queries we would like to send
+ * @param priority how important is this request?
+ * @param timeout when does this request timeout (call gmc with error)
+ * @param size number of bytes we would like to send to the peer
+ * @param gmc function to call to get the message
+ * @param gmc_cls closure for gmc
+ * @return handle to cancel request
+ */
+struct GSF_PeerTransmitHandle *
+GSF_peer_transmit_queries_ (struct GSF_ConnectedPeer *cp,
+                            unsigned int num_queries,
+                            uint32_t priority,
+                            struct GNUNET_TIME_Relative timeout,
+                            size_t size, GSF_GetMessageCallback gmc,
+                            void *gmc_cls);
+
+
+/**
+ * Get the number of queries that may go into a message (we reserved
+ * bandwidth for as many replies).  Only meaningful from within the
+ * callback that asks for the message.
+ *
+ * @param pth transmission request
+ * @return number of queries to put into the message
+ */
+unsigned int
+GSF_peer_transmit_get_num_queries_ (const struct GSF_PeerTransmitHandle *pth);
+
+
 /**
  * Cancel an earlier request for transmission.
  *
@@ -35,6 +35,48 @@
 #include "gnunet-service-fs_indexing.h"
 #include "fs.h"
 
+/**
+ * Default number of on-demand encoded blocks we keep in memory.
+ */
+#define DEFAULT_ONDEMAND_CACHE_SIZE 256
+
+/**
+ * Default number of indexed files we keep open at the same time.
+ */
+#define DEFAULT_ONDEMAND_FILE_HANDLES 16
+
+
+/**
+ * Information identifying a particular version of an indexed
+ * file on disk.  If any of these change, cached handles and
+ * blocks for the file must no longer be used.
+ */
+struct FileIdentity
+{
+
+  /**
+   * Device of the file.
+   */
+  uint64_t dev;
+
+  /**
+   * Inode of the file.
+   */
+  uint64_t ino;
+
+  /**
+   * Size of the file.
+   */
+  uint64_t size;
+
+  /**
+   * Modification time of the file.
+   */
+  int64_t mtime;
+
+};
+
+
 /**
  * In-memory information about indexed files (also available
  * on-disk).
@@ -69,6 +111,28 @@ struct IndexInfo
    */
   struct GNUNET_CRYPTO_FileHashContext *fhc;
 
+  /**
+   * This is a doubly linked list of indexed files with an
+   * open file handle, most recently used first.
+   */
+  struct IndexInfo *next_fh;
+
+  /**
+   * This is a doubly linked list of indexed files with an
+   * open file handle, most recently used first.
+   */
+  struct IndexInfo *prev_fh;
+
+  /**
+   * Open handle to the indexed file, NULL if not open.
+   */
+  struct GNUNET_DISK_FileHandle *fh;
+
+  /**
+   * Identity of the file at the time @e fh was opened.
+   */
+  struct FileIdentity fid;
+
   /**
    * Hash of the contents of the file.
    */
@@ -77,6 +141,52 @@ struct IndexInfo
 };
 
 
+/**
+ * An on-demand encoded block that we keep in memory so that
+ * popular indexed content does not have to be read and encrypted
+ * again for every request.
+ */
+struct CachedBlock
+{
+
+  /**
+   * This is a doubly linked list, most recently used first.
+   */
+  struct CachedBlock *next;
+
+  /**
+   * This is a doubly linked list, most recently used first.
+   */
+  struct CachedBlock *prev;
+
+  /**
+   * Query (hash of the encoded block).
+   */
+  struct GNUNET_HashCode query;
+
+  /**
+   * Hash of the indexed file the block was read from.
+   */
+  struct GNUNET_HashCode file_id;
+
+  /**
+   * Identity of the indexed file when the block was read.
+   */
+  struct FileIdentity fid;
+
+  /**
+   * Offset of the block in the indexed file.
+   */
+  uint64_t offset;
+
+  /**
+   * Number of bytes of encoded data following this struct.
+   */
+  size_t size;
+
+};
+
+
 /**
  * Head of linked list of indexed files.
  */
@@ -105,6 +215,261 @@ static const struct GNUNET_CONFIGURATION_Handle *cfg;
  */
 static struct GNUNET_DATASTORE_Handle *dsh;
 
+/**
+ * Head of the LRU list of indexed files with an open file handle.
+ */
+static struct IndexInfo *open_files_head;
+
+/**
+ * Tail of the LRU list of indexed files with an open file handle.
+ */
+static struct IndexInfo *open_files_tail;
+
+/**
+ * Number of entries in the 'open_files' list.
+ */
+static unsigned int open_files_count;
+
+/**
+ * Maximum number of entries in the 'open_files' list.
+ */
+static unsigned long long open_files_max;
+
+/**
+ * Maps queries to 'struct CachedBlock's.
+ */
+static struct GNUNET_CONTAINER_MultiHashMap *block_map;
+
+/**
+ * Head of the LRU list of cached on-demand blocks.
+ */
+static struct CachedBlock *block_head;
+
+/**
+ * Tail of the LRU list of cached on-demand blocks.
+ */
+static struct CachedBlock *block_tail;
+
+/**
+ * Number of entries in the 'block' list.
+ */
+static unsigned int block_count;
+
+/**
+ * Maximum number of entries in the 'block' list.
+ */
+static unsigned long long block_max;
+
+/**
+ * Running average of the time it took to produce an on-demand
+ * block from the cache (in microseconds).
+ */
+static uint64_t hit_latency_avg;
+
+/**
+ * Running average of the time it took to produce an on-demand
+ * block by reading and encoding the indexed file (in microseconds).
+ */
+static uint64_t miss_latency_avg;
+
+
+/**
+ * Obtain the identity of the given file on disk.
+ *
+ * @param fn name of the file
+ * @param fid set to the identity of the file
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR if we could not stat the file
+ */
+static int
+get_file_identity (const char *fn,
+                   struct FileIdentity *fid)
+{
+  struct stat sbuf;
+
+  if (0 != STAT (fn, &sbuf))
+    return GNUNET_SYSERR;
+  fid->dev = (uint64_t) sbuf.st_dev;
+  fid->ino = (uint64_t) sbuf.st_ino;
+  fid->size = (uint64_t) sbuf.st_size;
+  fid->mtime = (int64_t) sbuf.st_mtime;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Check if two file identities refer to the same version of a file.
+ *
+ * @param a first identity
+ * @param b second identity
+ * @return #GNUNET_YES if they are equal
+ */
+static int
+file_identity_equal (const struct FileIdentity *a,
+                     const struct FileIdentity *b)
+{
+  return ((a->dev == b->dev) &&
+          (a->ino == b->ino) &&
+          (a->size == b->size) &&
+          (a->mtime == b->mtime)) ? GNUNET_YES : GNUNET_NO;
+}
+
+
+/**
+ * Close the cached file handle of an indexed file (if any).
+ *
+ * @param ii indexed file to close
+ */
+static void
+close_file_handle (struct IndexInfo *ii)
+{
+  if (NULL == ii->fh)
+    return;
+  GNUNET_CONTAINER_MDLL_remove (fh, open_files_head,
+                                open_files_tail,
+                                ii);
+  GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (ii->fh));
+  ii->fh = NULL;
+  open_files_count--;
+}
+
+
+/**
+ * Get an open handle for reading an indexed file, reusing a
+ * cached handle if the file did not change since it was opened.
+ * The least recently used handle is closed if we have too many
+ * files open.
+ *
+ * @param ii indexed file to open
+ * @param fid current identity of the file
+ * @return NULL on error, handle is owned by @a ii (do not close)
+ */
+static struct GNUNET_DISK_FileHandle *
+get_file_handle (struct IndexInfo *ii,
+                 const struct FileIdentity *fid)
+{
+  if (NULL != ii->fh)
+  {
+    if (GNUNET_YES == file_identity_equal (&ii->fid, fid))
+    {
+      GNUNET_CONTAINER_MDLL_remove (fh, open_files_head,
+                                    open_files_tail,
+                                    ii);
+      GNUNET_CONTAINER_MDLL_insert (fh, open_files_head,
+                                    open_files_tail,
+                                    ii);
+      return ii->fh;
+    }
+    close_file_handle (ii);
+  }
+  ii->fh = GNUNET_DISK_file_open (ii->filename,
+                                  GNUNET_DISK_OPEN_READ,
+                                  GNUNET_DISK_PERM_NONE);
+  if (NULL == ii->fh)
+    return NULL;
+  ii->fid = *fid;
+  GNUNET_CONTAINER_MDLL_insert (fh, open_files_head,
+                                open_files_tail,
+                                ii);
+  open_files_count++;
+  while (open_files_count > open_files_max)
+    close_file_handle (open_files_tail);
+  return ii->fh;
+}
+
+
+/**
+ * Remove a block from the on-demand block cache.
+ *
+ * @param cb block to remove
+ */
+static void
+drop_cached_block (struct CachedBlock *cb)
+{
+  GNUNET_CONTAINER_DLL_remove (block_head,
+                               block_tail,
+                               cb);
+  GNUNET_break (GNUNET_OK ==
+                GNUNET_CONTAINER_multihashmap_remove (block_map,
+                                                      &cb->query,
+                                                      cb));
+  block_count--;
+  GNUNET_free (cb);
+}
+
+
+/**
+ * Add an on-demand encoded block to the cache, evicting the least
+ * recently used blocks if the cache is full.
+ *
+ * @param query query for the block
+ * @param file_id hash of the indexed file the block was read from
+ * @param offset offset of the block in the indexed file
+ * @param fid identity of the indexed file when the block was read
+ * @param data encoded block
+ * @param size number of bytes in @a data
+ */
+static void
+cache_block (const struct GNUNET_HashCode *query,
+             const struct GNUNET_HashCode *file_id,
+             uint64_t offset,
+             const struct FileIdentity *fid,
+             const void *data,
+             size_t size)
+{
+  struct CachedBlock *cb;
+
+  if (0 == block_max)
+    return;
+  cb = GNUNET_malloc (sizeof (struct CachedBlock) + size);
+  cb->query = *query;
+  cb->file_id = *file_id;
+  cb->fid = *fid;
+  cb->offset = offset;
+  cb->size = size;
+  memcpy (&cb[1], data, size);
+  GNUNET_assert (GNUNET_OK ==
+                 GNUNET_CONTAINER_multihashmap_put (block_map,
+                                                    &cb->query,
+                                                    cb,
+                                                    GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST));
+  GNUNET_CONTAINER_DLL_insert (block_head,
+                               block_tail,
+                               cb);
+  block_count++;
+  while (block_count > block_max)
+    drop_cached_block (block_tail);
+}
+
+
+/**
+ * Update the running average of the on-demand block latency.
+ *
+ * @param hit #GNUNET_YES if the block came from the cache
+ * @param start time when we started to work on the request
+ */
+static void
+update_latency (int hit,
+                struct GNUNET_TIME_Absolute start)
+{
+  uint64_t delay;
+  uint64_t *avg;
+
+  delay = GNUNET_TIME_absolute_get_duration (start).rel_value_us;
+  avg = (GNUNET_YES == hit) ? &hit_latency_avg : &miss_latency_avg;
+  if (0 == *avg)
+    *avg = delay;
+  else
+    *avg = (*avg * 7 + delay) / 8;
+  if (GNUNET_YES == hit)
+    GNUNET_STATISTICS_set (GSF_stats,
+                           gettext_noop ("# average on-demand block latency for cache hits (us)"),
+                           hit_latency_avg, GNUNET_NO);
+  else
+    GNUNET_STATISTICS_set (GSF_stats,
+                           gettext_noop ("# average on-demand block latency for cache misses (us)"),
+                           miss_latency_avg, GNUNET_NO);
+}
+
 
 /**
  * Write the current index information list to disk.
@@ -356,8 +721,9 @@ GNUNET_FS_handle_index_start (void *cls, struct GNUNET_SERVER_Client *client,
               (unsigned int) dev, (unsigned int) mydev);
   /* slow validation, need to hash full file (again) */
   ii->fhc =
-      GNUNET_CRYPTO_hash_file (GNUNET_SCHEDULER_PRIORITY_IDLE, fn,
-                               HASHING_BLOCKSIZE, &hash_for_index_val, ii);
+      GNUNET_CRYPTO_hash_file_threaded (GNUNET_SCHEDULER_PRIORITY_IDLE, fn,
+                                        HASHING_BLOCKSIZE,
+                                        &hash_for_index_val, ii);
   if (ii->fhc == NULL)
     hash_for_index_val (ii, NULL);
   GNUNET_free (fn);
@@ -441,6 +807,7 @@ GNUNET_FS_handle_unindex (void *cls, struct GNUNET_SERVER_Client *client,
       GNUNET_break (GNUNET_OK ==
                     GNUNET_CONTAINER_multihashmap_remove (ifm, &pos->file_id,
 							  pos));
+      close_file_handle (pos);
       GNUNET_free (pos);
       found = GNUNET_YES;
       break;
@@ -518,7 +885,11 @@ GNUNET_FS_handle_on_demand_block (const struct GNUNET_HashCode * key, uint32_t s
   struct GNUNET_DISK_FileHandle *fh;
   uint64_t off;
   struct IndexInfo *ii;
+  struct CachedBlock *cb;
+  struct FileIdentity fid;
+  struct GNUNET_TIME_Absolute start;
 
+  start = GNUNET_TIME_absolute_get ();
   if (size != sizeof (struct OnDemandBlock))
   {
     GNUNET_break (0);
@@ -535,7 +906,8 @@ GNUNET_FS_handle_on_demand_block (const struct GNUNET_HashCode * key, uint32_t s
     return GNUNET_SYSERR;
   }
   fn = ii->filename;
-  if ((NULL == fn) || (0 != ACCESS (fn, R_OK)))
+  if ((NULL == fn) || (0 != ACCESS (fn, R_OK)) ||
+      (GNUNET_OK != get_file_identity (fn, &fid)))
   {
     GNUNET_STATISTICS_update (GSF_stats,
                               gettext_noop
@@ -545,10 +917,38 @@ GNUNET_FS_handle_on_demand_block (const struct GNUNET_HashCode * key, uint32_t s
                              GNUNET_TIME_UNIT_FOREVER_REL, &remove_cont, NULL);
     return GNUNET_SYSERR;
   }
-  if ((NULL ==
-       (fh =
-        GNUNET_DISK_file_open (fn, GNUNET_DISK_OPEN_READ,
-                               GNUNET_DISK_PERM_NONE))) ||
+  cb = GNUNET_CONTAINER_multihashmap_get (block_map, key);
+  if (NULL != cb)
+  {
+    if ((off == cb->offset) &&
+        (0 == memcmp (&odb->file_id, &cb->file_id,
+                      sizeof (struct GNUNET_HashCode))) &&
+        (GNUNET_YES == file_identity_equal (&fid, &cb->fid)))
+    {
+      GNUNET_CONTAINER_DLL_remove (block_head,
+                                   block_tail,
+                                   cb);
+      GNUNET_CONTAINER_DLL_insert (block_head,
+                                   block_tail,
+                                   cb);
+      GNUNET_STATISTICS_update (GSF_stats,
+                                gettext_noop ("# on-demand block cache hits"),
+                                1, GNUNET_NO);
+      update_latency (GNUNET_YES, start);
+      GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+                  "Cached on-demand encoded block for query `%s'\n",
+                  GNUNET_h2s (key));
+      cont (cont_cls, key, cb->size, &cb[1], GNUNET_BLOCK_TYPE_FS_DBLOCK,
+            priority, anonymity, expiration, uid);
+      return GNUNET_OK;
+    }
+    /* stale (file changed) or from another file, re-encode */
+    drop_cached_block (cb);
+  }
+  GNUNET_STATISTICS_update (GSF_stats,
+                            gettext_noop ("# on-demand block cache misses"),
+                            1, GNUNET_NO);
+  if ((NULL == (fh = get_file_handle (ii, &fid))) ||
       (off != GNUNET_DISK_file_seek (fh, off, GNUNET_DISK_SEEK_SET)) ||
       (-1 == (nsize = GNUNET_DISK_file_read (fh, ndata, sizeof (ndata)))))
   {
@@ -557,13 +957,11 @@ GNUNET_FS_handle_on_demand_block (const struct GNUNET_HashCode * key, uint32_t s
                 ("Could not access indexed file `%s' (%s) at offset %llu: %s\n"),
                 GNUNET_h2s (&odb->file_id), fn, (unsigned long long) off,
                 (fn == NULL) ? _("not indexed") : STRERROR (errno));
-    if (fh != NULL)
-      GNUNET_DISK_file_close (fh);
+    close_file_handle (ii);
     GNUNET_DATASTORE_remove (dsh, key, size, data, -1, -1,
                              GNUNET_TIME_UNIT_FOREVER_REL, &remove_cont, NULL);
     return GNUNET_SYSERR;
   }
-  GNUNET_DISK_file_close (fh);
   GNUNET_CRYPTO_hash (ndata, nsize, &nkey);
   GNUNET_CRYPTO_hash_to_aes_key (&nkey, &skey, &iv);
   GNUNET_CRYPTO_symmetric_encrypt (ndata, nsize, &skey, &iv, edata);
@@ -577,6 +975,8 @@ GNUNET_FS_handle_on_demand_block (const struct GNUNET_HashCode * key, uint32_t s
                              GNUNET_TIME_UNIT_FOREVER_REL, &remove_cont, NULL);
     return GNUNET_SYSERR;
   }
+  cache_block (key, &odb->file_id, off, &fid, edata, nsize);
+  update_latency (GNUNET_NO, start);
   GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
               "On-demand encoded block for query `%s'\n", GNUNET_h2s (key));
   cont (cont_cls, key, nsize, edata, GNUNET_BLOCK_TYPE_FS_DBLOCK, priority,
@@ -600,6 +1000,7 @@ GNUNET_FS_indexing_done ()
 				 pos);
     if (pos->fhc != NULL)
       GNUNET_CRYPTO_hash_file_cancel (pos->fhc);
+    close_file_handle (pos);
     GNUNET_break (GNUNET_OK ==
 		  GNUNET_CONTAINER_multihashmap_remove (ifm,
 							&pos->file_id, pos));
@@ -607,6 +1008,10 @@ GNUNET_FS_indexing_done ()
   }
   GNUNET_CONTAINER_multihashmap_destroy (ifm);
   ifm = NULL;
+  while (NULL != block_head)
+    drop_cached_block (block_head);
+  GNUNET_CONTAINER_multihashmap_destroy (block_map);
+  block_map = NULL;
   cfg = NULL;
 }
 
@@ -624,6 +1029,17 @@ GNUNET_FS_indexing_init (const struct GNUNET_CONFIGURATION_Handle *c,
   cfg = c;
   dsh = d;
   ifm = GNUNET_CONTAINER_multihashmap_create (128, GNUNET_YES);
+  if (GNUNET_OK !=
+      GNUNET_CONFIGURATION_get_value_number (cfg, "fs", "ONDEMAND_CACHE_SIZE",
+                                             &block_max))
+    block_max = DEFAULT_ONDEMAND_CACHE_SIZE;
+  if ((GNUNET_OK !=
+       GNUNET_CONFIGURATION_get_value_number (cfg, "fs", "ONDEMAND_FILE_HANDLES",
+                                              &open_files_max)) ||
+      (0 == open_files_max))
+    open_files_max = DEFAULT_ONDEMAND_FILE_HANDLES;
+  block_map = GNUNET_CONTAINER_multihashmap_create (1 + block_max / 4,
+                                                    GNUNET_NO);
   read_index_list ();
   return GNUNET_OK;
 }
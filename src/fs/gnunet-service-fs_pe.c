@@ -34,6 +34,24 @@
  */
 #define INSANE_STATISTICS GNUNET_NO
 
+/**
+ * Maximum number of queries we pack into a single transmission
+ * to a peer.
+ */
+#define MAX_QUERIES_PER_TRANSMISSION 16
+
+/**
+ * Upper bound on the number of bytes we ask CORE for when batching
+ * queries (the first query is always transmitted, whatever its size).
+ */
+#define MAX_QUERY_BATCH_SIZE (16 * 1024)
+
+/**
+ * After how many plan operations do we update the profiling
+ * statistics (if profiling is enabled)?
+ */
+#define PROFILE_REPORT_FREQUENCY 64
+
 /**
  * List of GSF_PendingRequests this request plan
  * participates with.
@@ -152,6 +170,12 @@ struct GSF_RequestPlan
    */
   struct GNUNET_TIME_Absolute last_transmission;
 
+  /**
+   * Pending request with the highest TTL among those in the list
+   * starting at @e pe_head, NULL if we need to recompute it.
+   */
+  struct GSF_PendingRequest *latest;
+
   /**
    * Current priority for this request for this target.
    */
@@ -202,6 +226,11 @@ struct PeerPlan
    * Current task for executing the plan.
    */
   struct GNUNET_SCHEDULER_Task *task;
+
+  /**
+   * When will @e task run?  Only valid if @e task is not NULL.
+   */
+  struct GNUNET_TIME_Absolute task_time;
 };
 
 
@@ -220,6 +249,70 @@ static unsigned long long total_delay;
  */
 static unsigned long long plan_count;
 
+/**
+ * Are we measuring the cost of plan operations (option PROFILE_PLAN)?
+ */
+static int profile_plan;
+
+/**
+ * Number of plan operations measured so far.
+ */
+static unsigned long long profile_op_count;
+
+/**
+ * Total time spent in the plan operations measured so far (in us).
+ */
+static unsigned long long profile_op_time;
+
+
+/**
+ * Start measuring the cost of a plan operation.
+ *
+ * @return start time of the operation (zero if we are not profiling)
+ */
+static struct GNUNET_TIME_Absolute
+profile_start ()
+{
+  if (GNUNET_YES != profile_plan)
+    return GNUNET_TIME_UNIT_ZERO_ABS;
+  return GNUNET_TIME_absolute_get ();
+}
+
+
+/**
+ * Publish the profiling statistics.
+ */
+static void
+profile_flush ()
+{
+  GNUNET_STATISTICS_set (GSF_stats,
+                         gettext_noop ("# query plan operations (profiled)"),
+                         profile_op_count, GNUNET_NO);
+  GNUNET_STATISTICS_set (GSF_stats,
+                         gettext_noop ("# query plan operation time (us, profiled)"),
+                         profile_op_time, GNUNET_NO);
+}
+
+
+/**
+ * Finish measuring the cost of a plan operation.  Most operations
+ * take less than a microsecond; as the clock is read at the start
+ * and at the end, the rounding errors cancel out on average.
+ *
+ * @param start value returned by profile_start() for the operation
+ */
+static void
+profile_stop (struct GNUNET_TIME_Absolute start)
+{
+  if (GNUNET_YES != profile_plan)
+    return;
+  profile_op_count++;
+  profile_op_time += GNUNET_TIME_absolute_get_duration (start).rel_value_us;
+  if (0 != profile_op_count % PROFILE_REPORT_FREQUENCY)
+    return;
+  profile_flush ();
+}
+
 
 /**
  * Return the query (key in the plan_map) for the given request plan.
@@ -251,6 +344,42 @@ schedule_peer_transmission (void *cls,
                             const struct GNUNET_SCHEDULER_TaskContext *tc);
 
 
+/**
+ * Make sure the task executing the plan of the given peer runs in
+ * time for the most urgent request in the plan.  Does nothing while
+ * a transmission to the peer is pending, as we re-check the plan
+ * once the transmission is done.
+ *
+ * @param pp plan to execute
+ */
+static void
+update_plan_task (struct PeerPlan *pp)
+{
+  struct GSF_RequestPlan *rp;
+  struct GNUNET_TIME_Absolute when;
+
+  if (NULL != pp->pth)
+    return;
+  if (0 != GNUNET_CONTAINER_heap_get_size (pp->priority_heap))
+    when = GNUNET_TIME_UNIT_ZERO_ABS;
+  else if (NULL != (rp = GNUNET_CONTAINER_heap_peek (pp->delay_heap)))
+    when = rp->earliest_transmission;
+  else
+    return;                     /* both queues empty */
+  if (NULL != pp->task)
+  {
+    if (pp->task_time.abs_value_us <= when.abs_value_us)
+      return;                   /* task will run early enough */
+    GNUNET_SCHEDULER_cancel (pp->task);
+  }
+  pp->task_time = when;
+  pp->task =
+      GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_absolute_get_remaining (when),
+                                    &schedule_peer_transmission,
+                                    pp);
+}
+
+
 /**
  * Insert the given request plan into the heap with the appropriate weight.
  *
@@ -343,9 +472,7 @@ plan (struct PeerPlan *pp,
                  GNUNET_CONTAINER_multihashmap_contains_value (pp->plan_map,
                                                                get_rp_key (rp),
                                                                rp));
-  if (NULL != pp->task)
-    GNUNET_SCHEDULER_cancel (pp->task);
-  pp->task = GNUNET_SCHEDULER_add_now (&schedule_peer_transmission, pp);
+  update_plan_task (pp);
 #undef N
 }
 
@@ -385,90 +512,133 @@ get_latest (const struct GSF_RequestPlan *rp)
 
 
 /**
- * Function called to get a message for transmission.
+ * Get the pending request with the highest TTL from the given plan,
+ * using the cached result if possible.
  *
- * @param cls closure
+ * @param rp plan to investigate
+ * @return pending request with highest TTL
+ */
+static struct GSF_PendingRequest *
+get_latest_cached (struct GSF_RequestPlan *rp)
+{
+  if (NULL == rp->latest)
+    rp->latest = get_latest (rp);
+  return rp->latest;
+}
+
+
+/**
+ * Copy as many queries from the priority heap of the given plan
+ * into the buffer as fit (up to the number we reserved bandwidth
+ * for) and plan their retransmission.
+ *
+ * @param pp plan to execute
  * @param buf_size number of bytes available in @a buf
- * @param buf where to copy the message, NULL on error (peer disconnect)
+ * @param buf where to copy the messages, NULL on error (peer disconnect)
  * @return number of bytes copied to @a buf, can be 0 (without indicating an error)
  */
 static size_t
-transmit_message_callback (void *cls,
-                           size_t buf_size,
-                           void *buf)
+transmit_queries (struct PeerPlan *pp,
+                  size_t buf_size,
+                  void *buf)
 {
-  struct PeerPlan *pp = cls;
   struct GSF_RequestPlan *rp;
+  struct GNUNET_TIME_Absolute now;
+  char *cbuf = buf;
+  size_t off;
   size_t msize;
+  unsigned int count;
+  unsigned int max;
 
+  max = GSF_peer_transmit_get_num_queries_ (pp->pth);
   pp->pth = NULL;
   if (NULL == buf)
   {
     /* failed, try again... */
-    if (NULL != pp->task)
-      GNUNET_SCHEDULER_cancel (pp->task);
-
-    pp->task = GNUNET_SCHEDULER_add_now (&schedule_peer_transmission, pp);
+    update_plan_task (pp);
     GNUNET_STATISTICS_update (GSF_stats,
                               gettext_noop
                               ("# transmission failed (core has no bandwidth)"),
                               1, GNUNET_NO);
     return 0;
   }
-  rp = GNUNET_CONTAINER_heap_peek (pp->priority_heap);
-  if (NULL == rp)
+  now = GNUNET_TIME_absolute_get ();
+  off = 0;
+  count = 0;
+  while ( (count < max) &&
+          (NULL != (rp = GNUNET_CONTAINER_heap_peek (pp->priority_heap))) )
   {
-    if (NULL != pp->task)
-      GNUNET_SCHEDULER_cancel (pp->task);
-    pp->task = GNUNET_SCHEDULER_add_now (&schedule_peer_transmission, pp);
-    return 0;
+    msize = GSF_pending_request_get_message_ (get_latest_cached (rp),
+                                              buf_size - off,
+                                              &cbuf[off]);
+    if (msize > buf_size - off)
+      break;                    /* buffer too small (message changed), try again */
+    /* remove from root, add again elsewhere... */
+    GNUNET_assert (rp ==
+                   GNUNET_CONTAINER_heap_remove_root (pp->priority_heap));
+    rp->hn = NULL;
+    rp->last_transmission = now;
+    rp->transmission_counter++;
+    total_delay++;
+    GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
+                "Executing plan %p executed %u times, planning retransmission\n",
+                rp, rp->transmission_counter);
+    plan (pp, rp);
+    off += msize;
+    count++;
   }
-  msize = GSF_pending_request_get_message_ (get_latest (rp),
-                                            buf_size,
-                                            buf);
-  if (msize > buf_size)
-  {
-    if (NULL != pp->task)
-      GNUNET_SCHEDULER_cancel (pp->task);
-    /* buffer to small (message changed), try again */
-    pp->task = GNUNET_SCHEDULER_add_now (&schedule_peer_transmission, pp);
+  update_plan_task (pp);
+  if (0 == count)
     return 0;
-  }
-  /* remove from root, add again elsewhere... */
-  GNUNET_assert (rp ==
-                 GNUNET_CONTAINER_heap_remove_root (pp->priority_heap));
-  rp->hn = NULL;
-  rp->last_transmission = GNUNET_TIME_absolute_get ();
-  rp->transmission_counter++;
-  total_delay++;
-  GNUNET_log (GNUNET_ERROR_TYPE_DEBUG,
-              "Executing plan %p executed %u times, planning retransmission\n",
-              rp, rp->transmission_counter);
-  plan (pp, rp);
   GNUNET_STATISTICS_update (GSF_stats,
                             gettext_noop ("# query messages sent to other peers"),
+                            count,
+                            GNUNET_NO);
+  GNUNET_STATISTICS_update (GSF_stats,
+                            gettext_noop ("# query batches sent to other peers"),
                             1,
                             GNUNET_NO);
-  return msize;
+  return off;
+}
+
+
+/**
+ * Function called to get a message for transmission.
+ *
+ * @param cls closure
+ * @param buf_size number of bytes available in @a buf
+ * @param buf where to copy the message, NULL on error (peer disconnect)
+ * @return number of bytes copied to @a buf, can be 0 (without indicating an error)
+ */
+static size_t
+transmit_message_callback (void *cls,
+                           size_t buf_size,
+                           void *buf)
+{
+  struct PeerPlan *pp = cls;
+  struct GNUNET_TIME_Absolute start;
+  size_t ret;
+
+  start = profile_start ();
+  ret = transmit_queries (pp, buf_size, buf);
+  profile_stop (start);
+  return ret;
 }
 
 
 /**
  * Figure out when and how to transmit to the given peer.
  *
- * @param cls the `struct PeerPlan`
- * @param tc scheduler context
+ * @param pp plan to execute
  */
 static void
-schedule_peer_transmission (void *cls,
-                            const struct GNUNET_SCHEDULER_TaskContext *tc)
+execute_plan (struct PeerPlan *pp)
 {
-  struct PeerPlan *pp = cls;
   struct GSF_RequestPlan *rp;
   size_t msize;
+  unsigned int batch;
   struct GNUNET_TIME_Relative delay;
 
-  pp->task = NULL;
   if (NULL != pp->pth)
   {
     GSF_peer_transmit_cancel_ (pp->pth);
@@ -504,11 +674,7 @@ schedule_peer_transmission (void *cls,
     GNUNET_STATISTICS_set (GSF_stats,
                            gettext_noop ("# delay heap timeout (ms)"),
                            delay.rel_value_us / 1000LL, GNUNET_NO);
-
-    pp->task =
-        GNUNET_SCHEDULER_add_delayed (delay,
-                                      &schedule_peer_transmission,
-                                      pp);
+    update_plan_task (pp);
     return;
   }
 #if INSANE_STATISTICS
@@ -521,17 +687,45 @@ schedule_peer_transmission (void *cls,
               "Executing query plan %p\n",
               rp);
   GNUNET_assert (NULL != rp);
-  msize = GSF_pending_request_get_message_ (get_latest (rp), 0, NULL);
+  msize = GSF_pending_request_get_message_ (get_latest_cached (rp), 0, NULL);
+  /* ask for enough space to pack further queries of similar size
+     into the same transmission */
+  batch = GNUNET_MIN (GNUNET_CONTAINER_heap_get_size (pp->priority_heap),
+                      MAX_QUERIES_PER_TRANSMISSION);
+  batch = GNUNET_MAX (1,
+                      GNUNET_MIN (batch,
+                                  MAX_QUERY_BATCH_SIZE / msize));
+  msize *= batch;
   pp->pth =
-      GSF_peer_transmit_ (pp->cp, GNUNET_YES,
-                          rp->priority,
-                          GNUNET_TIME_UNIT_FOREVER_REL,
-                          msize,
-                          &transmit_message_callback, pp);
+      GSF_peer_transmit_queries_ (pp->cp, batch,
+                                  rp->priority,
+                                  GNUNET_TIME_UNIT_FOREVER_REL,
+                                  msize,
+                                  &transmit_message_callback, pp);
   GNUNET_assert (NULL != pp->pth);
 }
 
 
+/**
+ * Figure out when and how to transmit to the given peer.
+ *
+ * @param cls the `struct PeerPlan`
+ * @param tc scheduler context
+ */
+static void
+schedule_peer_transmission (void *cls,
+                            const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct PeerPlan *pp = cls;
+  struct GNUNET_TIME_Absolute start;
+
+  pp->task = NULL;
+  start = profile_start ();
+  execute_plan (pp);
+  profile_stop (start);
+}
+
+
 /**
  * Closure for merge_pr().
  */
@@ -579,6 +773,7 @@ merge_pr (void *cls,
                                           rp->pe_head->pr))
     return GNUNET_YES;
   /* merge new request with existing request plan */
+  latest = get_latest_cached (rp);
   bi = GNUNET_new (struct GSF_PendingRequestPlanBijection);
   bi->rp = rp;
   bi->pr = mpr->pr;
@@ -598,10 +793,10 @@ merge_pr (void *cls,
                             1,
                             GNUNET_NO);
 #endif
-  latest = get_latest (rp);
   if (GSF_pending_request_get_data_ (latest)->ttl.abs_value_us <
       prd->ttl.abs_value_us)
   {
+    rp->latest = mpr->pr;
 #if INSANE_STATISTICS
     GNUNET_STATISTICS_update (GSF_stats,
                               gettext_noop ("# requests refreshed"),
@@ -630,9 +825,11 @@ GSF_plan_add_ (struct GSF_ConnectedPeer *cp,
   struct GSF_RequestPlan *rp;
   struct GSF_PendingRequestPlanBijection *bi;
   struct MergeContext mpc;
+  struct GNUNET_TIME_Absolute start;
 
   GNUNET_assert (GNUNET_YES ==
                  GSF_pending_request_test_active_ (pr));
+  start = profile_start ();
   GNUNET_assert (NULL != cp);
   id = GSF_connected_peer_get_identity2_ (cp);
   pp = GNUNET_CONTAINER_multipeermap_get (plans, id);
@@ -659,7 +856,10 @@ GSF_plan_add_ (struct GSF_ConnectedPeer *cp,
                                               &merge_pr,
                                               &mpc);
   if (GNUNET_NO != mpc.merged)
+  {
+    profile_stop (start);
     return;
+  }
   plan_count++;
   GNUNET_STATISTICS_update (GSF_stats,
                             gettext_noop ("# query plan entries"),
@@ -689,6 +889,7 @@ GSF_plan_add_ (struct GSF_ConnectedPeer *cp,
                                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE));
   plan (pp,
         rp);
+  profile_stop (start);
 }
 
 
@@ -822,7 +1023,9 @@ GSF_plan_notify_request_done_ (struct GSF_PendingRequest *pr)
   struct GSF_RequestPlan *rp;
   struct GSF_PendingRequestData *prd;
   struct GSF_PendingRequestPlanBijection *bi;
+  struct GNUNET_TIME_Absolute start;
 
+  start = profile_start ();
   prd = GSF_pending_request_get_data_ (pr);
   while (NULL != (bi = prd->pr_head))
   {
@@ -836,6 +1039,8 @@ GSF_plan_notify_request_done_ (struct GSF_PendingRequest *pr)
                                   rp->pe_tail,
                                   bi);
     GNUNET_assert (bi->pr == pr);
+    if (rp->latest == pr)
+      rp->latest = NULL;
     if (NULL == rp->pe_head)
     {
       GNUNET_CONTAINER_heap_remove_node (rp->hn);
@@ -852,6 +1057,7 @@ GSF_plan_notify_request_done_ (struct GSF_PendingRequest *pr)
                          gettext_noop ("# query plan entries"),
                          plan_count,
                          GNUNET_NO);
+  profile_stop (start);
 }
 
 
@@ -863,6 +1069,9 @@ GSF_plan_init ()
 {
   plans = GNUNET_CONTAINER_multipeermap_create (256,
                                                 GNUNET_YES);
+  profile_plan = GNUNET_CONFIGURATION_get_value_yesno (GSF_cfg,
+                                                       "fs",
+                                                       "PROFILE_PLAN");
 }
 
 
@@ -874,6 +1083,8 @@ GSF_plan_done ()
 {
   GNUNET_assert (0 == GNUNET_CONTAINER_multipeermap_size (plans));
   GNUNET_CONTAINER_multipeermap_destroy (plans);
+  if (GNUNET_YES == profile_plan)
+    profile_flush ();
 }
 
 
@@ -96,6 +96,13 @@ struct GSF_PendingRequest
    */
   struct GNUNET_HashCode *replies_seen;
 
+  /**
+   * Set of the hash codes in @e replies_seen (for exact duplicate
+   * detection), only used if we are responsible for the bloomfilter
+   * (#GSF_PRO_BLOOMFILTER_FULL_REFRESH); NULL if no replies were seen.
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *replies_seen_map;
+
   /**
    * Bloomfilter masking replies we've already seen.
    */
@@ -199,6 +206,12 @@ struct GSF_PendingRequest
    */
   unsigned int have_first_uid;
 
+  /**
+   * #GNUNET_YES if @e bf does not reflect all of @e replies_seen
+   * and must be recalculated before we forward the request.
+   */
+  int bf_dirty;
+
 };
 
 
@@ -260,6 +273,49 @@ refresh_bloomfilter (struct GSF_PendingRequest *pr)
   pr->bf =
       GNUNET_BLOCK_construct_bloomfilter (pr->mingle, pr->replies_seen,
                                           pr->replies_seen_count);
+  pr->bf_dirty = GNUNET_NO;
+}
+
+
+/**
+ * Add replies to the set of replies seen for a request we are
+ * responsible for.  Duplicates are ignored.  The bloom filter is
+ * only marked for recalculation; we do this once we actually
+ * forward the request.
+ *
+ * @param pr request to update
+ * @param replies_seen hash codes of replies that we've seen
+ * @param replies_seen_count size of the @a replies_seen array
+ */
+static void
+add_replies_seen (struct GSF_PendingRequest *pr,
+                  const struct GNUNET_HashCode *replies_seen,
+                  unsigned int replies_seen_count)
+{
+  unsigned int i;
+
+  if (0 == replies_seen_count)
+    return;
+  if (NULL == pr->replies_seen_map)
+    pr->replies_seen_map =
+        GNUNET_CONTAINER_multihashmap_create (replies_seen_count, GNUNET_NO);
+  for (i = 0; i < replies_seen_count; i++)
+  {
+    if (GNUNET_YES ==
+        GNUNET_CONTAINER_multihashmap_contains (pr->replies_seen_map,
+                                                &replies_seen[i]))
+      continue;
+    if (pr->replies_seen_count == pr->replies_seen_size)
+      GNUNET_array_grow (pr->replies_seen, pr->replies_seen_size,
+                         pr->replies_seen_size * 2 + 4);
+    pr->replies_seen[pr->replies_seen_count++] = replies_seen[i];
+    GNUNET_assert (GNUNET_OK ==
+                   GNUNET_CONTAINER_multihashmap_put (pr->replies_seen_map,
+                                                      &replies_seen[i],
+                                                      pr,
+                                                      GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST));
+    pr->bf_dirty = GNUNET_YES;
+  }
 }
 
 
@@ -352,7 +408,11 @@ GSF_pending_request_create_ (enum GSF_PendingRequestOptions options,
                                        GNUNET_TIME_relative_multiply
                                        (GNUNET_TIME_UNIT_SECONDS,
                                         (uint32_t) (-ttl)));
-  if (replies_seen_count > 0)
+  if (0 != (options & GSF_PRO_BLOOMFILTER_FULL_REFRESH))
+  {
+    add_replies_seen (pr, replies_seen, replies_seen_count);
+  }
+  else if (replies_seen_count > 0)
   {
     pr->replies_seen_size = replies_seen_count;
     pr->replies_seen =
@@ -370,11 +430,6 @@ GSF_pending_request_create_ (enum GSF_PendingRequestOptions options,
                                            GNUNET_CONSTANTS_BLOOMFILTER_K);
     pr->mingle = mingle;
   }
-  else if ((replies_seen_count > 0) &&
-           (0 != (options & GSF_PRO_BLOOMFILTER_FULL_REFRESH)))
-  {
-    refresh_bloomfilter (pr);
-  }
   GNUNET_CONTAINER_multihashmap_put (pr_map,
 				     &pr->public_data.query,
                                      pr,
@@ -468,14 +523,8 @@ GSF_pending_request_update_ (struct GSF_PendingRequest *pr,
     return;                     /* integer overflow */
   if (0 != (pr->public_data.options & GSF_PRO_BLOOMFILTER_FULL_REFRESH))
   {
-    /* we're responsible for the BF, full refresh */
-    if (replies_seen_count + pr->replies_seen_count > pr->replies_seen_size)
-      GNUNET_array_grow (pr->replies_seen, pr->replies_seen_size,
-                         replies_seen_count + pr->replies_seen_count);
-    memcpy (&pr->replies_seen[pr->replies_seen_count], replies_seen,
-            sizeof (struct GNUNET_HashCode) * replies_seen_count);
-    pr->replies_seen_count += replies_seen_count;
-    refresh_bloomfilter (pr);
+    /* we're responsible for the BF, full refresh once we forward */
+    add_replies_seen (pr, replies_seen, replies_seen_count);
   }
   else
   {
@@ -493,7 +542,7 @@ GSF_pending_request_update_ (struct GSF_PendingRequest *pr,
     }
     else
     {
-      for (i = 0; i < pr->replies_seen_count; i++)
+      for (i = 0; i < replies_seen_count; i++)
       {
         GNUNET_BLOCK_mingle_hash (&replies_seen[i],
                                   pr->mingle,
@@ -558,6 +607,8 @@ GSF_pending_request_get_message_ (struct GSF_PendingRequest *pr,
     bm |= GET_MESSAGE_BIT_TRANSMIT_TO;
     k++;
   }
+  if (GNUNET_YES == pr->bf_dirty)
+    refresh_bloomfilter (pr);
   bf_size = GNUNET_CONTAINER_bloomfilter_get_size (pr->bf);
   msize = sizeof (struct GetMessage) + bf_size + k * sizeof (struct GNUNET_PeerIdentity);
   GNUNET_assert (msize < GNUNET_SERVER_MAX_MESSAGE_SIZE);
@@ -634,6 +685,11 @@ clean_request (void *cls,
   }
   GSF_plan_notify_request_done_ (pr);
   GNUNET_free_non_null (pr->replies_seen);
+  if (NULL != pr->replies_seen_map)
+  {
+    GNUNET_CONTAINER_multihashmap_destroy (pr->replies_seen_map);
+    pr->replies_seen_map = NULL;
+  }
   if (NULL != pr->bf)
   {
     GNUNET_CONTAINER_bloomfilter_free (pr->bf);
@@ -841,6 +897,7 @@ process_reply (void *cls,
   struct GSF_PendingRequest *pr = value;
   struct GNUNET_HashCode chash;
   struct GNUNET_TIME_Absolute last_transmission;
+  int have_chash;
 
   if (NULL == pr->rh)
     return GNUNET_YES;
@@ -851,17 +908,35 @@ process_reply (void *cls,
   GNUNET_STATISTICS_update (GSF_stats,
                             gettext_noop ("# replies received and matched"), 1,
                             GNUNET_NO);
-  prq->eval =
-      GNUNET_BLOCK_evaluate (GSF_block_ctx,
-                             prq->type,
-                             prq->eo,
-                             key,
-                             &pr->bf,
-                             pr->mingle,
-                             NULL,
-                             0,
-                             prq->data,
-                             prq->size);
+  /* if we are responsible for the bloomfilter, we know exactly which
+     replies we have seen and need not consult (or update) it */
+  have_chash = GNUNET_NO;
+  if (NULL != pr->replies_seen_map)
+  {
+    GNUNET_CRYPTO_hash (prq->data,
+                        prq->size,
+                        &chash);
+    have_chash = GNUNET_YES;
+  }
+  if ( (GNUNET_YES == have_chash) &&
+       (GNUNET_YES ==
+        GNUNET_CONTAINER_multihashmap_contains (pr->replies_seen_map,
+                                                &chash)) )
+    prq->eval = GNUNET_BLOCK_EVALUATION_OK_DUPLICATE;
+  else
+    prq->eval =
+        GNUNET_BLOCK_evaluate (GSF_block_ctx,
+                               prq->type,
+                               prq->eo,
+                               key,
+                               (0 != (pr->public_data.options &
+                                      GSF_PRO_BLOOMFILTER_FULL_REFRESH))
+                               ? NULL : &pr->bf,
+                               pr->mingle,
+                               NULL,
+                               0,
+                               prq->data,
+                               prq->size);
   switch (prq->eval)
   {
   case GNUNET_BLOCK_EVALUATION_OK_MORE:
@@ -915,9 +990,10 @@ process_reply (void *cls,
     return GNUNET_NO;
   }
   /* update bloomfilter */
-  GNUNET_CRYPTO_hash (prq->data,
-                      prq->size,
-                      &chash);
+  if (GNUNET_YES != have_chash)
+    GNUNET_CRYPTO_hash (prq->data,
+                        prq->size,
+                        &chash);
   GSF_pending_request_update_ (pr,
                                &chash,
                                1);
@@ -63,6 +63,16 @@ struct StatMaster
   struct GNUNET_TESTBED_Operation *op;
   unsigned int daemon;
   unsigned int value;
+
+  /**
+   * Number of query plan operations profiled by the current daemon.
+   */
+  uint64_t plan_ops;
+
+  /**
+   * Time the current daemon spent in those operations (in us).
+   */
+  uint64_t plan_time;
 };
 
 struct StatValues
@@ -87,6 +97,10 @@ static struct StatValues stats[] = {
   {"fs", "# P2P searches discarded (queue length bound)"},
   {"fs", "# replies received for local clients"},
   {"fs", "# queries retransmitted to same target"},
+  {"fs", "# query messages sent to other peers"},
+  {"fs", "# query batches sent to other peers"},
+  {"fs", "# query plan operations (profiled)"},
+  {"fs", "# query plan operation time (us, profiled)"},
   {"core", "# bytes decrypted"},
   {"core", "# bytes encrypted"},
   {"core", "# discarded CORE_SEND requests"},
@@ -122,6 +136,10 @@ print_stat (void *cls, const char *subsystem, const char *name, uint64_t value,
            subsystem,
            name,
            (unsigned long long) value);
+  if (0 == strcmp (name, "# query plan operations (profiled)"))
+    sm->plan_ops = value;
+  if (0 == strcmp (name, "# query plan operation time (us, profiled)"))
+    sm->plan_time = value;
   return GNUNET_OK;
 }
 
@@ -218,6 +236,14 @@ stat_run (void *cls,
     return;
   }
   GNUNET_TESTBED_operation_done (sm->op);
+  if (0 != sm->plan_ops)
+    FPRINTF (stderr,
+             "Peer %2u: %llu query plan operations took %llu ns on average\n",
+             sm->daemon,
+             (unsigned long long) sm->plan_ops,
+             (unsigned long long) (sm->plan_time * 1000LL / sm->plan_ops));
+  sm->plan_ops = 0;
+  sm->plan_time = 0;
   sm->value = 0;
   sm->daemon++;
   if (NUM_DAEMONS == sm->daemon)
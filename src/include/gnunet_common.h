@@ -197,6 +197,12 @@ extern "C"
  */
 #define GNUNET_NORETURN __attribute__((noreturn))
 
+/**
+ * gcc-ism to give each thread its own instance of a static
+ * variable (used for the buffers of the debug string functions).
+ */
+#define GNUNET_THREAD_LOCAL __thread
+
 #if MINGW
 #if __GNUC__ > 3
 /**
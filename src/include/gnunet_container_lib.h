@@ -209,6 +209,14 @@ extern "C"
 struct GNUNET_CONTAINER_BloomFilter;
 
 
+/**
+ * @ingroup bloomfilter
+ * Size (in bytes) of a block of a filter created with
+ * #GNUNET_CONTAINER_bloomfilter_init_blocked().
+ */
+#define GNUNET_CONTAINER_BLOOMFILTER_BLOCK_SIZE 64
+
+
 /**
  * @ingroup bloomfilter
  * Iterator over `struct GNUNET_HashCode`.
@@ -241,6 +249,43 @@ GNUNET_CONTAINER_bloomfilter_load (const char *filename,
                                    unsigned int k);
 
 
+/**
+ * @ingroup bloomfilter
+ * Load a Bloom filter from a file, mapping the file into memory
+ * instead of reading it.  Changes are only written to disk by
+ * #GNUNET_CONTAINER_bloomfilter_sync() and when the filter is freed.
+ *
+ * @param filename the name of the file (or the prefix)
+ * @param size the size of the bloom-filter (number of
+ *        bytes of storage space to use); will be rounded up
+ *        to next power of 2
+ * @param k the number of #GNUNET_CRYPTO_hash-functions to apply per
+ *        element (number of bits set per element in the set)
+ * @param[out] clean set to #GNUNET_NO if the filter was changed after
+ *        it was last synced (i.e. we crashed), so the file may be
+ *        inconsistent and the filter should be rebuilt
+ * @return the bloomfilter, NULL on error
+ */
+struct GNUNET_CONTAINER_BloomFilter *
+GNUNET_CONTAINER_bloomfilter_load_mapped (const char *filename,
+                                          size_t size,
+                                          unsigned int k,
+                                          int *clean);
+
+
+/**
+ * @ingroup bloomfilter
+ * Write the changes to a filter loaded with
+ * #GNUNET_CONTAINER_bloomfilter_load_mapped() to disk.
+ * Does nothing for other filters.
+ *
+ * @param bf the filter
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+int
+GNUNET_CONTAINER_bloomfilter_sync (struct GNUNET_CONTAINER_BloomFilter *bf);
+
+
 /**
  * @ingroup bloomfilter
  * Create a Bloom filter from raw bits.
@@ -261,6 +306,31 @@ GNUNET_CONTAINER_bloomfilter_init (const char *data,
                                    unsigned int k);
 
 
+/**
+ * @ingroup bloomfilter
+ * Create a Bloom filter using the blocked layout from raw bits.
+ * All bits for an element are within one cache line, which makes
+ * tests cheaper for large filters.  Blocked filters are not
+ * compatible with those created by #GNUNET_CONTAINER_bloomfilter_init()
+ * and must not be used in P2P messages.
+ *
+ * @param data the raw bits in memory (maybe NULL,
+ *        in which case all bits should be considered
+ *        to be zero).
+ * @param size the size of the bloom-filter (number of
+ *        bytes of storage space to use); also size of @a data
+ *        -- unless data is NULL.  Must be a multiple of
+ *        #GNUNET_CONTAINER_BLOOMFILTER_BLOCK_SIZE, but need not
+ *        be a power of two.
+ * @param k the number of bits to set per element (at most 512)
+ * @return the bloomfilter, NULL on error
+ */
+struct GNUNET_CONTAINER_BloomFilter *
+GNUNET_CONTAINER_bloomfilter_init_blocked (const char *data,
+                                           size_t size,
+                                           unsigned int k);
+
+
 /**
  * @ingroup bloomfilter
  * Copy the raw data of this Bloom filter into
@@ -289,6 +359,23 @@ GNUNET_CONTAINER_bloomfilter_test (const struct GNUNET_CONTAINER_BloomFilter *bf
                                    const struct GNUNET_HashCode *e);
 
 
+/**
+ * @ingroup bloomfilter
+ * Test if each of several elements is in the filter.
+ *
+ * @param bf the filter
+ * @param e the elements
+ * @param count number of elements in @a e
+ * @param[out] results set to #GNUNET_YES or #GNUNET_NO for each element
+ * @return number of elements that are in the filter
+ */
+unsigned int
+GNUNET_CONTAINER_bloomfilter_test_many (const struct GNUNET_CONTAINER_BloomFilter *bf,
+                                        const struct GNUNET_HashCode *e,
+                                        unsigned int count,
+                                        int *results);
+
+
 /**
  * @ingroup bloomfilter
  * Add an element to the filter.
@@ -788,6 +875,61 @@ GNUNET_CONTAINER_multihashmap_create (unsigned int len,
 				      int do_not_copy_keys);
 
 
+/**
+ * @ingroup hashmap
+ * Flags selecting the implementation of a multi hash map.
+ */
+enum GNUNET_CONTAINER_MultiHashMapFlags
+{
+
+  /**
+   * @ingroup hashmap
+   * Default implementation: buckets with chained entries.
+   */
+  GNUNET_CONTAINER_MULTIHASHMAPFLAG_NONE = 0,
+
+  /**
+   * @ingroup hashmap
+   * Use open addressing: all entries are kept in one array and
+   * found by probing groups of slots using a byte of metadata per
+   * slot (with SSE2 if available).  Avoids one allocation per entry
+   * and the pointer chasing of the chained buckets, which matters
+   * for maps with millions of entries.  Iteration order differs
+   * from the default implementation.
+   */
+  GNUNET_CONTAINER_MULTIHASHMAPFLAG_OPEN_ADDRESSING = 1,
+
+  /**
+   * @ingroup hashmap
+   * Grow the map incrementally: when the map needs to grow, the
+   * entries are moved to the larger table a few buckets at a time by
+   * subsequent calls to #GNUNET_CONTAINER_multihashmap_put(), instead
+   * of all at once.  This bounds the latency of each put for very
+   * large maps, at the expense of looking at two tables while the
+   * migration is in progress.  Each put during the migration
+   * invalidates iterators.  Ignored for maps using open addressing.
+   */
+  GNUNET_CONTAINER_MULTIHASHMAPFLAG_INCREMENTAL_RESIZE = 2
+};
+
+
+/**
+ * @ingroup hashmap
+ * Create a multi hash map, selecting the implementation to use.
+ * The resulting map supports the same operations as maps created
+ * with #GNUNET_CONTAINER_multihashmap_create().
+ *
+ * @param len initial size (map will grow as needed)
+ * @param do_not_copy_keys see #GNUNET_CONTAINER_multihashmap_create()
+ * @param flags which implementation to use and how it grows
+ * @return NULL on error
+ */
+struct GNUNET_CONTAINER_MultiHashMap *
+GNUNET_CONTAINER_multihashmap_create_with_flags (unsigned int len,
+                                                 int do_not_copy_keys,
+                                                 enum GNUNET_CONTAINER_MultiHashMapFlags flags);
+
+
 /**
  * @ingroup hashmap
  * Destroy a hash map.  Will not free any values
@@ -159,9 +159,9 @@ GNUNET_DATACACHE_get_random (struct GNUNET_DATACACHE_Handle *h,
 
 /**
  * Iterate over the results that are "close" to a particular key in
- * the datacache.  "close" is defined as numerically larger than @a
- * key (when interpreted as a circular address space), with small
- * distance.
+ * the datacache.  "close" is defined as a small XOR distance to @a
+ * key (distances compare like memcmp()), results are returned
+ * closest first.  @a iter must not modify the datacache.
  *
  * @param h handle to the datacache
  * @param key area of the keyspace to look into
@@ -178,6 +178,28 @@ GNUNET_DATACACHE_get_closest (struct GNUNET_DATACACHE_Handle *h,
                               void *iter_cls);
 
 
+/**
+ * Iterate over the results that are numerically larger than or
+ * equal to a particular key in the datacache, treating the key space
+ * as circular.  Results are returned in ascending order of their
+ * keys, starting at @a key and wrapping around to the smallest key.
+ * @a iter must not modify the datacache.
+ *
+ * @param h handle to the datacache
+ * @param key where in the keyspace to start
+ * @param num_results number of results that should be returned to @a iter
+ * @param iter maybe NULL (to just count)
+ * @param iter_cls closure for @a iter
+ * @return the number of results found
+ */
+unsigned int
+GNUNET_DATACACHE_get_successors (struct GNUNET_DATACACHE_Handle *h,
+                                 const struct GNUNET_HashCode *key,
+                                 unsigned int num_results,
+                                 GNUNET_DATACACHE_Iterator iter,
+                                 void *iter_cls);
+
+
 #if 0                           /* keep Emacsens' auto-indent happy */
 {
 #endif
@@ -133,6 +133,7 @@ struct GNUNET_DATACACHE_PluginFunctions
    * @param cls closure (internal context for the plugin)
    * @param key key to look for
    * @param type entries of which type are relevant?
+   *        #GNUNET_BLOCK_TYPE_ANY for all types
    * @param iter maybe NULL (to just count)
    * @param iter_cls closure for @a iter
    * @return the number of results found
@@ -164,26 +165,6 @@ struct GNUNET_DATACACHE_PluginFunctions
                               GNUNET_DATACACHE_Iterator iter,
                               void *iter_cls);
 
-
-  /**
-   * Iterate over the results that are "close" to a particular key in
-   * the datacache.  "close" is defined as numerically larger than @a
-   * key (when interpreted as a circular address space), with small
-   * distance.
-   *
-   * @param cls closure (internal context for the plugin)
-   * @param key area of the keyspace to look into
-   * @param num_results number of results that should be returned to @a iter
-   * @param iter maybe NULL (to just count)
-   * @param iter_cls closure for @a iter
-   * @return the number of results found
-   */
-  unsigned int (*get_closest) (void *cls,
-                               const struct GNUNET_HashCode *key,
-                               unsigned int num_results,
-                               GNUNET_DATACACHE_Iterator iter,
-                               void *iter_cls);
-
 };
 
 
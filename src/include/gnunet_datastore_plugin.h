@@ -313,6 +313,18 @@ typedef void
 (*PluginDrop) (void *cls);
 
 
+/**
+ * Start or end a batch of operations.  All operations between
+ * the start and the end of a batch may be executed within a
+ * single database transaction.
+ *
+ * @param cls closure
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+typedef int
+(*PluginBatch) (void *cls);
+
+
 /**
  * Each plugin is required to return a pointer to a struct of this
  * type as the return value from its entry point.
@@ -387,6 +399,18 @@ struct GNUNET_DATASTORE_PluginFunctions
    */
   PluginGetKeys get_keys;
 
+  /**
+   * Start a batch of operations (used for batched PUT requests).
+   * Can be NULL if the plugin does not benefit from batching.
+   */
+  PluginBatch begin_batch;
+
+  /**
+   * Commit a batch of operations started with @e begin_batch.
+   * Must be non-NULL if @e begin_batch is non-NULL.
+   */
+  PluginBatch end_batch;
+
 };
 
 #endif
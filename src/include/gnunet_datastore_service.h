@@ -174,6 +174,117 @@ GNUNET_DATASTORE_put (struct GNUNET_DATASTORE_Handle *h,
                       void *cont_cls);
 
 
+/**
+ * Maximum number of items in a single batch passed to
+ * #GNUNET_DATASTORE_put_multiple or #GNUNET_DATASTORE_get_multiple.
+ */
+#define GNUNET_DATASTORE_MAX_BATCH_SIZE 256
+
+
+/**
+ * An item to be stored with #GNUNET_DATASTORE_put_multiple.
+ */
+struct GNUNET_DATASTORE_PutItem
+{
+  /**
+   * Key for the value.
+   */
+  struct GNUNET_HashCode key;
+
+  /**
+   * Content to store.
+   */
+  const void *data;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t size;
+
+  /**
+   * Type of the content.
+   */
+  enum GNUNET_BLOCK_Type type;
+
+  /**
+   * Priority of the content.
+   */
+  uint32_t priority;
+
+  /**
+   * Anonymity-level for the content.
+   */
+  uint32_t anonymity;
+
+  /**
+   * How often should the content be replicated to other peers?
+   */
+  uint32_t replication;
+
+  /**
+   * Expiration time for the content.
+   */
+  struct GNUNET_TIME_Absolute expiration;
+};
+
+
+/**
+ * Continuation called to notify client about the result of a
+ * batched PUT operation.
+ *
+ * @param cls closure
+ * @param count number of items in the batch
+ * @param success array of length @a count with the status for each
+ *                item, using the same values as for
+ *                #GNUNET_DATASTORE_ContinuationWithStatus; all
+ *                entries are #GNUNET_SYSERR if the batch failed as a whole
+ * @param min_expiration minimum expiration time required for 0-priority content to be stored
+ *                by the datacache at this time, zero for unknown, forever if we have no
+ *                space for 0-priority content
+ * @param msg NULL on success, otherwise the first error message
+ */
+typedef void
+(*GNUNET_DATASTORE_ContinuationWithMultiStatus) (void *cls,
+                                                 unsigned int count,
+                                                 const int32_t *success,
+                                                 struct GNUNET_TIME_Absolute min_expiration,
+                                                 const char *msg);
+
+
+/**
+ * Store a batch of items in the datastore.  The items are sent to
+ * the service back-to-back and are stored within a single database
+ * transaction (if the plugin supports it), saving a round trip per
+ * item compared to #GNUNET_DATASTORE_put.  Otherwise the semantics
+ * for each item are the same as for #GNUNET_DATASTORE_put.
+ *
+ * @param h handle to the datastore
+ * @param rid reservation ID to use (from "reserve"); use 0 if no
+ *            prior reservation was made
+ * @param count number of items in @a items, at most
+ *            #GNUNET_DATASTORE_MAX_BATCH_SIZE
+ * @param items the items to store
+ * @param queue_priority ranking of this request in the priority queue
+ * @param max_queue_size at what queue size should this request be dropped
+ *        (if other requests of higher priority are in the queue)
+ * @param timeout timeout for the operation
+ * @param cont continuation to call when done
+ * @param cont_cls closure for @a cont
+ * @return NULL if the entry was not queued, otherwise a handle that can be used to
+ *         cancel
+ */
+struct GNUNET_DATASTORE_QueueEntry *
+GNUNET_DATASTORE_put_multiple (struct GNUNET_DATASTORE_Handle *h,
+                               uint32_t rid,
+                               unsigned int count,
+                               const struct GNUNET_DATASTORE_PutItem *items,
+                               unsigned int queue_priority,
+                               unsigned int max_queue_size,
+                               struct GNUNET_TIME_Relative timeout,
+                               GNUNET_DATASTORE_ContinuationWithMultiStatus cont,
+                               void *cont_cls);
+
+
 /**
  * Signal that all of the data for which a reservation was made has
  * been stored and that whatever excess space might have been reserved
@@ -324,6 +435,41 @@ GNUNET_DATASTORE_get_key (struct GNUNET_DATASTORE_Handle *h,
                           void *proc_cls);
 
 
+/**
+ * Get results for several keys from the datastore with a single
+ * request.  For each key, the processor is called with the result at
+ * the given @a offset (if any); results are streamed back as they are
+ * found, keys without a match are skipped.
+ *
+ * @param h handle to the datastore
+ * @param offset offset of the result (modulo num-results) for each key
+ * @param count number of keys in @a keys, at most
+ *              #GNUNET_DATASTORE_MAX_BATCH_SIZE
+ * @param keys keys to look up
+ * @param type desired type, 0 for any
+ * @param queue_priority ranking of this request in the priority queue
+ * @param max_queue_size at what queue size should this request be dropped
+ *        (if other requests of higher priority are in the queue)
+ * @param timeout how long to wait at most for a response
+ * @param proc function to call on each matching value;
+ *        will be called once with a NULL value at the end
+ * @param proc_cls closure for @a proc
+ * @return NULL if the entry was not queued, otherwise a handle that can be used to
+ *         cancel
+ */
+struct GNUNET_DATASTORE_QueueEntry *
+GNUNET_DATASTORE_get_multiple (struct GNUNET_DATASTORE_Handle *h,
+                               uint64_t offset,
+                               unsigned int count,
+                               const struct GNUNET_HashCode *keys,
+                               enum GNUNET_BLOCK_Type type,
+                               unsigned int queue_priority,
+                               unsigned int max_queue_size,
+                               struct GNUNET_TIME_Relative timeout,
+                               GNUNET_DATASTORE_DatumProcessor proc,
+                               void *proc_cls);
+
+
 /**
  * Get a single zero-anonymity value from the datastore.
  * Note that some implementations can ignore the 'offset' and
@@ -850,6 +850,19 @@ GNUNET_DISK_file_map (const struct GNUNET_DISK_FileHandle *h,
 int
 GNUNET_DISK_file_unmap (struct GNUNET_DISK_MapHandle *h);
 
+/**
+ * Write changes to a range of a memory-mapped file to disk.
+ *
+ * @param h mapping handle
+ * @param off offset of the range in the mapping
+ * @param len length of the range
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR otherwise
+ */
+int
+GNUNET_DISK_file_map_sync (struct GNUNET_DISK_MapHandle *h,
+                           size_t off,
+                           size_t len);
+
 /**
  * Write file changes to disk
  * @param h handle to an open file
@@ -859,6 +872,18 @@ int
 GNUNET_DISK_file_sync (const struct GNUNET_DISK_FileHandle *h);
 
 
+/**
+ * Write the directory entries of the directory that contains
+ * @a filename to disk, so that creating, renaming or removing
+ * @a filename survives a crash.
+ *
+ * @param filename name of a file in the directory
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR otherwise
+ */
+int
+GNUNET_DISK_directory_sync_for_file (const char *filename);
+
+
 #if 0                           /* keep Emacsens' auto-indent happy */
 {
 #endif
@@ -2778,6 +2778,32 @@ GNUNET_FS_directory_scan_start (const char *filename,
 				void *cb_cls);
 
 
+/**
+ * Start a directory scanner that remembers the meta data it extracted
+ * in a scan cache.  Files whose device, inode, modification time and
+ * size did not change since the last scan with the same cache are not
+ * processed by libextractor again.  An interrupted scan resumes from
+ * where it stopped.
+ *
+ * @param filename name of the directory to scan
+ * @param disable_extractor #GNUNET_YES to not run libextractor on files (only
+ *        build a tree)
+ * @param ex if not NULL, must be a list of extra plugins for extractor
+ * @param cache_filename name of the file to use as the scan cache,
+ *        NULL to not use a cache
+ * @param cb the callback to call when there are scanning progress messages
+ * @param cb_cls closure for @a cb
+ * @return directory scanner object to be used for controlling the scanner
+ */
+struct GNUNET_FS_DirScanner *
+GNUNET_FS_directory_scan_start_cached (const char *filename,
+                                       int disable_extractor,
+                                       const char *ex,
+                                       const char *cache_filename,
+                                       GNUNET_FS_DirScannerProgressCallback cb,
+                                       void *cb_cls);
+
+
 /**
  * Abort the scan. Must not be called from within the progress_callback
  * function.
@@ -297,6 +297,21 @@ void
 GNUNET_MQ_discard (struct GNUNET_MQ_Envelope *mqm);
 
 
+/**
+ * Obtain statistics about the pool of envelopes MQ keeps for
+ * re-use.  Useful for services that want to export allocator
+ * behaviour via the statistics service.
+ *
+ * @param[out] allocs set to the number of envelopes allocated with malloc()
+ * @param[out] hits set to the number of envelopes taken from the pool
+ * @param[out] pooled set to the number of envelopes currently in the pool
+ */
+void
+GNUNET_MQ_get_pool_stats (unsigned long long *allocs,
+                          unsigned long long *hits,
+                          unsigned int *pooled);
+
+
 /**
  * Send a message with the give message queue.
  * May only be called once per message.
@@ -459,6 +459,23 @@ extern "C"
  */
 #define GNUNET_MESSAGE_TYPE_DATASTORE_DROP 103
 
+/**
+ * Message sent by datastore client to announce a batch of PUT
+ * messages that are to be stored in one transaction.
+ */
+#define GNUNET_MESSAGE_TYPE_DATASTORE_PUT_MULTIPLE 104
+
+/**
+ * Message sent by datastore to client with the per-item status
+ * codes for a batch of PUT messages.
+ */
+#define GNUNET_MESSAGE_TYPE_DATASTORE_STATUS_MULTIPLE 105
+
+/**
+ * Message sent by datastore client to get data for several keys.
+ */
+#define GNUNET_MESSAGE_TYPE_DATASTORE_GET_MULTIPLE 106
+
 
 /*******************************************************************************
  * FS message types
@@ -199,6 +199,134 @@ unsigned int
 GNUNET_SCHEDULER_get_load (enum GNUNET_SCHEDULER_Priority p);
 
 
+/**
+ * Obtain statistics about the pool of task structs the scheduler
+ * keeps for re-use.  Useful for services that want to export
+ * allocator behaviour via the statistics service.
+ *
+ * @param[out] allocs set to the number of tasks allocated with malloc()
+ * @param[out] hits set to the number of tasks taken from the pool
+ * @param[out] pooled set to the number of tasks currently in the pool
+ */
+void
+GNUNET_SCHEDULER_get_pool_stats (unsigned long long *allocs,
+                                 unsigned long long *hits,
+                                 unsigned int *pooled);
+
+
+/**
+ * Number of buckets in the histograms of a
+ * `struct GNUNET_SCHEDULER_TaskProfile`.  Bucket @e i counts
+ * durations of less than 2^i microseconds, the last bucket
+ * counts all longer durations.
+ */
+#define GNUNET_SCHEDULER_PROFILE_BUCKETS 24
+
+
+/**
+ * Profile of all tasks that ran a particular callback.
+ */
+struct GNUNET_SCHEDULER_TaskProfile
+{
+  /**
+   * The callback.
+   */
+  GNUNET_SCHEDULER_TaskCallback callback;
+
+  /**
+   * Human-readable name of the callback (symbol name if it
+   * can be determined, otherwise the address).
+   */
+  const char *name;
+
+  /**
+   * Number of times the callback ran.
+   */
+  unsigned long long count;
+
+  /**
+   * Total time (in microseconds) tasks spent in the ready queue.
+   */
+  unsigned long long delay_total_us;
+
+  /**
+   * Longest time (in microseconds) a task spent in the ready queue.
+   */
+  unsigned long long delay_max_us;
+
+  /**
+   * Histogram of the time tasks spent in the ready queue.
+   */
+  unsigned long long delay_hist[GNUNET_SCHEDULER_PROFILE_BUCKETS];
+
+  /**
+   * Total time (in microseconds) spent running the callback.
+   */
+  unsigned long long exec_total_us;
+
+  /**
+   * Longest time (in microseconds) a single run of the callback took.
+   */
+  unsigned long long exec_max_us;
+
+  /**
+   * Histogram of the execution time of the callback.
+   */
+  unsigned long long exec_hist[GNUNET_SCHEDULER_PROFILE_BUCKETS];
+};
+
+
+/**
+ * Function called with the profile of a callback.
+ *
+ * @param cls closure
+ * @param profile profile of the callback
+ */
+typedef void
+(*GNUNET_SCHEDULER_ProfileIterator) (void *cls,
+                                     const struct GNUNET_SCHEDULER_TaskProfile *profile);
+
+
+/**
+ * Enable or disable the scheduler profiler.  While enabled, the
+ * scheduler records for each callback how long tasks waited in the
+ * ready queue and how long they ran.  Profiling data is discarded
+ * when #GNUNET_SCHEDULER_run() returns.
+ *
+ * The profiler is also enabled if the environment variable
+ * GNUNET_SCHEDULER_PROFILE is set; in that case, the profile is
+ * written to a file named by the variable's value (with ".PID"
+ * appended) when #GNUNET_SCHEDULER_run() returns.
+ *
+ * @param enable #GNUNET_YES to enable, #GNUNET_NO to disable
+ */
+void
+GNUNET_SCHEDULER_profile_enable (int enable);
+
+
+/**
+ * Iterate over the profiles of all callbacks that ran while the
+ * profiler was enabled, i.e. to export them via statistics.
+ *
+ * @param it function to call on each profile
+ * @param it_cls closure for @a it
+ */
+void
+GNUNET_SCHEDULER_profile_iterate (GNUNET_SCHEDULER_ProfileIterator it,
+                                  void *it_cls);
+
+
+/**
+ * Write the profiles of all callbacks to a file, ordered by total
+ * execution time.
+ *
+ * @param filename name of the file to write
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+int
+GNUNET_SCHEDULER_profile_dump (const char *filename);
+
+
 /**
  * Obtain the reason code for why the current task was
  * started.  Will return the same value as
@@ -534,6 +662,9 @@ GNUNET_SCHEDULER_add_select (enum GNUNET_SCHEDULER_Priority prio,
 
 /**
  * Sets the select function to use in the scheduler (scheduler_select).
+ * By default, the scheduler uses epoll (where available) or
+ * #GNUNET_NETWORK_socket_select().  Installing a custom select
+ * function disables the use of epoll.
  *
  * @param new_select new select function to use (NULL to reset to default)
  * @param new_select_cls closure for 'new_select'
@@ -27,6 +27,9 @@
 #include "gnunet_crypto_lib.h"
 #include "gnunet_strings_lib.h"
 #include <regex.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 
 /**
@@ -146,6 +149,20 @@ static enum GNUNET_ErrorType min_level;
  */
 static struct CustomLogger *loggers;
 
+#if HAVE_PTHREAD_H
+/**
+ * Lock protecting the state of the logger, as plugins may log from
+ * threads other than the main thread.
+ */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * How often the current thread holds @e log_lock (logging while
+ * setting up the log file recurses into the logger).
+ */
+static GNUNET_THREAD_LOCAL unsigned int log_lock_depth;
+#endif
+
 /**
  * Number of log calls to ignore.
  */
@@ -885,6 +902,33 @@ GNUNET_get_log_skip ()
 }
 
 
+/**
+ * Acquire the lock of the logger (unless the current thread
+ * already holds it).
+ */
+static void
+lock_log ()
+{
+#if HAVE_PTHREAD_H
+  if (0 == log_lock_depth++)
+    GNUNET_assert (0 == pthread_mutex_lock (&log_lock));
+#endif
+}
+
+
+/**
+ * Release the lock of the logger.
+ */
+static void
+unlock_log ()
+{
+#if HAVE_PTHREAD_H
+  if (0 == --log_lock_depth)
+    GNUNET_assert (0 == pthread_mutex_unlock (&log_lock));
+#endif
+}
+
+
 /**
  * Output a log message using the default mechanism.
  *
@@ -910,6 +954,7 @@ mylog (enum GNUNET_ErrorType kind,
   GNUNET_assert (0 != size);
   va_end (vacp);
   memset (date, 0, DATE_STR_SIZE);
+  lock_log ();
   {
     char buf[size];
     long long offset;
@@ -985,6 +1030,7 @@ mylog (enum GNUNET_ErrorType kind,
 	    BULK_DELAY_THRESHOLD) ||
 	   (last_bulk_repeat > BULK_REPEAT_THRESHOLD) )
         flush_bulk (date);
+      unlock_log ();
       return;
     }
     flush_bulk (date);
@@ -995,6 +1041,7 @@ mylog (enum GNUNET_ErrorType kind,
     strncpy (last_bulk_comp, comp, COMP_TRACK_SIZE);
     output_message (kind, comp, date, buf);
   }
+  unlock_log ();
 }
 
 
@@ -1077,7 +1124,7 @@ GNUNET_error_type_to_string (enum GNUNET_ErrorType kind)
 const char *
 GNUNET_h2s (const struct GNUNET_HashCode * hc)
 {
-  static struct GNUNET_CRYPTO_HashAsciiEncoded ret;
+  static GNUNET_THREAD_LOCAL struct GNUNET_CRYPTO_HashAsciiEncoded ret;
 
   GNUNET_CRYPTO_hash_to_enc (hc, &ret);
   ret.encoding[8] = '\0';
@@ -1096,7 +1143,7 @@ GNUNET_h2s (const struct GNUNET_HashCode * hc)
 const char *
 GNUNET_h2s_full (const struct GNUNET_HashCode * hc)
 {
-  static struct GNUNET_CRYPTO_HashAsciiEncoded ret;
+  static GNUNET_THREAD_LOCAL struct GNUNET_CRYPTO_HashAsciiEncoded ret;
 
   GNUNET_CRYPTO_hash_to_enc (hc, &ret);
   ret.encoding[sizeof (ret) - 1] = '\0';
@@ -1116,7 +1163,7 @@ GNUNET_h2s_full (const struct GNUNET_HashCode * hc)
 const char *
 GNUNET_i2s (const struct GNUNET_PeerIdentity *pid)
 {
-  static char buf[256];
+  static GNUNET_THREAD_LOCAL char buf[256];
   char *ret;
 
   ret = GNUNET_CRYPTO_eddsa_public_key_to_string (&pid->public_key);
@@ -1139,7 +1186,7 @@ GNUNET_i2s (const struct GNUNET_PeerIdentity *pid)
 const char *
 GNUNET_i2s_full (const struct GNUNET_PeerIdentity *pid)
 {
-  static char buf[256];
+  static GNUNET_THREAD_LOCAL char buf[256];
   char *ret;
 
   ret = GNUNET_CRYPTO_eddsa_public_key_to_string (&pid->public_key);
@@ -1169,9 +1216,9 @@ GNUNET_a2s (const struct sockaddr *addr,
 #else
 #define LEN (INET6_ADDRSTRLEN + 8)
 #endif
-  static char buf[LEN];
+  static GNUNET_THREAD_LOCAL char buf[LEN];
 #undef LEN
-  static char b2[6];
+  static GNUNET_THREAD_LOCAL char b2[6];
   const struct sockaddr_in *v4;
   const struct sockaddr_un *un;
   const struct sockaddr_in6 *v6;
@@ -1132,7 +1132,7 @@ receive_ready (void *cls,
     signal_receive_error (connection, ECONNREFUSED);
     return;
   }
-  GNUNET_assert (GNUNET_NETWORK_fdset_isset (tc->read_ready, connection->sock));
+  GNUNET_assert (0 != (tc->reason & GNUNET_SCHEDULER_REASON_READ_READY));
 RETRY:
   ret = GNUNET_NETWORK_socket_recv (connection->sock,
                                     buffer,
@@ -1399,14 +1399,7 @@ transmit_ready (void *cls,
     return;
   }
   GNUNET_assert (NULL != connection->sock);
-  if (NULL == tc->write_ready)
-  {
-    /* special circumstances (in particular, PREREQ_DONE after
-     * connect): not yet ready to write, but no "fatal" error either.
-     * Hence retry.  */
-    goto SCHEDULE_WRITE;
-  }
-  if (!GNUNET_NETWORK_fdset_isset (tc->write_ready, connection->sock))
+  if (0 == (tc->reason & GNUNET_SCHEDULER_REASON_WRITE_READY))
   {
     GNUNET_assert (NULL == connection->write_task);
     /* special circumstances (in particular, shutdown): not yet ready
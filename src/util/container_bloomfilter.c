@@ -35,6 +35,20 @@
  * a 4 bit counter in the file on the drive (we still use only one
  * bit in memory).
  *
+ * Filters loaded with #GNUNET_CONTAINER_bloomfilter_load_mapped()
+ * keep no bit array in memory; instead, the counter file is mapped
+ * into memory and a bit is set if its counter is not zero.  Changes
+ * to the counters are only written to disk by
+ * #GNUNET_CONTAINER_bloomfilter_sync(); a marker file next to the
+ * counter file tells if there are changes that were not synced.
+ *
+ * Filters created with #GNUNET_CONTAINER_bloomfilter_init_blocked()
+ * use a different layout: all bits for an element are set within one
+ * block of #BLOCK_SIZE bytes (a cache line), so testing an element
+ * touches a single cache line and can be done with a few vector
+ * instructions.  Such filters are not compatible with the classic
+ * format used in P2P messages and cannot be kept on disk.
+ *
  * @author Igor Wronsky
  * @author Christian Grothoff
  */
@@ -42,12 +56,34 @@
 #include "platform.h"
 #include "gnunet_util_lib.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define LOG(kind,...) GNUNET_log_from (kind, "util", __VA_ARGS__)
 
 #define LOG_STRERROR(kind,syscall) GNUNET_log_from_strerror (kind, "util", syscall)
 
 #define LOG_STRERROR_FILE(kind,syscall,filename) GNUNET_log_from_strerror_file (kind, "util", syscall, filename)
 
+/**
+ * Size of a block of a blocked Bloom filter in bytes.
+ */
+#define BLOCK_SIZE GNUNET_CONTAINER_BLOOMFILTER_BLOCK_SIZE
+
+/**
+ * Number of bits in a block of a blocked Bloom filter.
+ */
+#define BLOCK_BITS (BLOCK_SIZE * 8)
+
+/**
+ * Granularity (in bytes of the counter file) at which we track
+ * which parts of a mapped filter need to be synced.
+ */
+#define DIRTY_PAGE_SIZE 4096
+
 struct GNUNET_CONTAINER_BloomFilter
 {
 
@@ -76,6 +112,41 @@ struct GNUNET_CONTAINER_BloomFilter
    */
   size_t bitArraySize;
 
+  /**
+   * #GNUNET_YES if the filter uses the blocked layout,
+   * #GNUNET_NO for the classic layout.
+   */
+  int blocked;
+
+  /**
+   * Memory-mapped counter file of a filter loaded with
+   * #GNUNET_CONTAINER_bloomfilter_load_mapped(), NULL otherwise
+   * (then @e bitArray is used).
+   */
+  uint8_t *counters;
+
+  /**
+   * Mapping of @e counters.
+   */
+  struct GNUNET_DISK_MapHandle *map;
+
+  /**
+   * Bitmap with one bit per #DIRTY_PAGE_SIZE bytes of @e counters
+   * that were changed since the last sync.
+   */
+  uint8_t *dirty;
+
+  /**
+   * Name of the marker file that exists while the counter file
+   * has changes that were not synced.
+   */
+  char *marker;
+
+  /**
+   * #GNUNET_YES if @e marker exists.
+   */
+  int marked;
+
 };
 
 
@@ -121,6 +192,23 @@ struct GNUNET_CONTAINER_BloomFilter *
 GNUNET_CONTAINER_bloomfilter_copy (const struct GNUNET_CONTAINER_BloomFilter
                                    *bf)
 {
+  struct GNUNET_CONTAINER_BloomFilter *ret;
+
+  if (GNUNET_YES == bf->blocked)
+    return GNUNET_CONTAINER_bloomfilter_init_blocked (bf->bitArray,
+                                                      bf->bitArraySize,
+                                                      bf->addressesPerElement);
+  if (NULL != bf->counters)
+  {
+    ret = GNUNET_CONTAINER_bloomfilter_init (NULL,
+                                             bf->bitArraySize,
+                                             bf->addressesPerElement);
+    if (NULL != ret)
+      GNUNET_CONTAINER_bloomfilter_get_raw_data (bf,
+                                                 ret->bitArray,
+                                                 ret->bitArraySize);
+    return ret;
+  }
   return GNUNET_CONTAINER_bloomfilter_init (bf->bitArray, bf->bitArraySize,
                                             bf->addressesPerElement);
 }
@@ -333,6 +421,132 @@ make_empty_file (const struct GNUNET_DISK_FileHandle *fh, size_t size)
   return GNUNET_OK;
 }
 
+/* ******************** mapped counters ******************** */
+
+/**
+ * Get the counter of a bit of a mapped filter.
+ *
+ * @param bf the filter
+ * @param bitIdx which bit
+ * @return the 4 bit counter
+ */
+static unsigned int
+getCounter (const struct GNUNET_CONTAINER_BloomFilter *bf,
+            unsigned int bitIdx)
+{
+  uint8_t value;
+
+  value = bf->counters[bitIdx / 2];
+  if (0 == bitIdx % 2)
+    return value & 0xF;
+  return value >> 4;
+}
+
+
+/**
+ * Create the marker file of a mapped filter, unless it exists.
+ * The marker must be on disk before the mapping is changed, as
+ * the kernel may write back the change at any time; otherwise a
+ * crash could leave a changed counter file without the marker.
+ *
+ * @param bf the filter
+ */
+static void
+createMarker (struct GNUNET_CONTAINER_BloomFilter *bf)
+{
+  struct GNUNET_DISK_FileHandle *fh;
+
+  if (GNUNET_YES == bf->marked)
+    return;
+  fh = GNUNET_DISK_file_open (bf->marker,
+                              GNUNET_DISK_OPEN_WRITE |
+                              GNUNET_DISK_OPEN_CREATE,
+                              GNUNET_DISK_PERM_USER_READ |
+                              GNUNET_DISK_PERM_USER_WRITE);
+  if (NULL == fh)
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING,
+                       "open",
+                       bf->marker);
+  }
+  else
+  {
+    if (GNUNET_OK != GNUNET_DISK_file_sync (fh))
+      LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING,
+                         "fsync",
+                         bf->marker);
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (fh));
+    (void) GNUNET_DISK_directory_sync_for_file (bf->marker);
+  }
+  bf->marked = GNUNET_YES;
+}
+
+
+/**
+ * Set the counter of a bit of a mapped filter and remember that
+ * the page with the counter must be synced.  Creates the marker
+ * file if this is the first change since the last sync.
+ *
+ * @param bf the filter
+ * @param bitIdx which bit
+ * @param counter the new 4 bit counter
+ */
+static void
+setCounter (struct GNUNET_CONTAINER_BloomFilter *bf,
+            unsigned int bitIdx,
+            unsigned int counter)
+{
+  size_t page;
+
+  createMarker (bf);
+  if (0 == bitIdx % 2)
+    bf->counters[bitIdx / 2] = (bf->counters[bitIdx / 2] & 0xF0) | counter;
+  else
+    bf->counters[bitIdx / 2] = (bf->counters[bitIdx / 2] & 0x0F) | (counter << 4);
+  page = bitIdx / 2 / DIRTY_PAGE_SIZE;
+  bf->dirty[page / 8] |= (1 << (page % 8));
+}
+
+
+/**
+ * Mark all pages of a mapped filter as dirty.
+ *
+ * @param bf the filter
+ */
+static void
+markAllDirty (struct GNUNET_CONTAINER_BloomFilter *bf)
+{
+  size_t pages;
+
+  pages = (bf->bitArraySize * 4LL + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+  memset (bf->dirty, 0xFF, (pages + 7) / 8);
+  createMarker (bf);
+}
+
+
+/**
+ * Compute the raw bits of a mapped filter.
+ *
+ * @param bf the filter
+ * @param[out] data where to write the bits, @e bitArraySize bytes
+ */
+static void
+getMappedBits (const struct GNUNET_CONTAINER_BloomFilter *bf,
+               char *data)
+{
+  size_t i;
+
+  memset (data, 0, bf->bitArraySize);
+  for (i = 0; i < bf->bitArraySize * 4LL; i++)
+  {
+    if (0 != (bf->counters[i] & 0x0F))
+      setBit (data, i * 2);
+    if (0 != (bf->counters[i] & 0xF0))
+      setBit (data, i * 2 + 1);
+  }
+}
+
+
 /* ************** GNUNET_CONTAINER_BloomFilter iterator ********* */
 
 /**
@@ -411,7 +625,15 @@ incrementBitCallback (void *cls, const struct GNUNET_CONTAINER_BloomFilter *bf,
                       unsigned int bit)
 {
   struct GNUNET_CONTAINER_BloomFilter *b = cls;
+  unsigned int counter;
 
+  if (NULL != b->counters)
+  {
+    counter = getCounter (b, bit);
+    if (counter < 0xF)
+      setCounter (b, bit, counter + 1);
+    return GNUNET_YES;
+  }
   incrementBit (b->bitArray, bit, bf->fh);
   return GNUNET_YES;
 }
@@ -430,7 +652,16 @@ decrementBitCallback (void *cls, const struct GNUNET_CONTAINER_BloomFilter *bf,
                       unsigned int bit)
 {
   struct GNUNET_CONTAINER_BloomFilter *b = cls;
+  unsigned int counter;
 
+  if (NULL != b->counters)
+  {
+    /* once we have reached the max, never go back! */
+    counter = getCounter (b, bit);
+    if ( (counter > 0) && (counter < 0xF) )
+      setCounter (b, bit, counter - 1);
+    return GNUNET_YES;
+  }
   decrementBit (b->bitArray, bit, bf->fh);
   return GNUNET_YES;
 }
@@ -450,6 +681,15 @@ testBitCallback (void *cls, const struct GNUNET_CONTAINER_BloomFilter *bf,
 {
   int *arg = cls;
 
+  if (NULL != bf->counters)
+  {
+    if (0 == getCounter (bf, bit))
+    {
+      *arg = GNUNET_NO;
+      return GNUNET_NO;
+    }
+    return GNUNET_YES;
+  }
   if (GNUNET_NO == testBit (bf->bitArray, bit))
   {
     *arg = GNUNET_NO;
@@ -458,6 +698,111 @@ testBitCallback (void *cls, const struct GNUNET_CONTAINER_BloomFilter *bf,
   return GNUNET_YES;
 }
 
+/* ******************** blocked layout ******************** */
+
+/**
+ * Compute the block and the bits within the block that a blocked
+ * filter uses for a key.  The bit positions are derived by double
+ * hashing from two words of the key; as the second word is forced to
+ * be odd, the positions are distinct for up to #BLOCK_BITS bits.
+ *
+ * @param bf the filter
+ * @param key the key
+ * @param[out] mask set to the bits to set or test within the block
+ * @return offset of the block in the bit array
+ */
+static size_t
+block_of (const struct GNUNET_CONTAINER_BloomFilter *bf,
+          const struct GNUNET_HashCode *key,
+          uint8_t mask[BLOCK_SIZE])
+{
+  uint32_t h1;
+  uint32_t h2;
+  unsigned int bit;
+  unsigned int i;
+
+  h1 = ntohl (key->bits[1]);
+  h2 = ntohl (key->bits[2]) | 1;
+  memset (mask, 0, BLOCK_SIZE);
+  for (i = 0; i < bf->addressesPerElement; i++)
+  {
+    bit = (h1 + i * h2) % BLOCK_BITS;
+    mask[bit / 8] |= (uint8_t) (1 << (bit % 8));
+  }
+  return (ntohl (key->bits[0]) % (bf->bitArraySize / BLOCK_SIZE)) * BLOCK_SIZE;
+}
+
+
+/**
+ * Check if all bits of a mask are set in a block.
+ *
+ * @param block the block
+ * @param mask the bits to test
+ * @return #GNUNET_YES if all bits are set, #GNUNET_NO if not
+ */
+static int
+block_test (const uint8_t *block,
+            const uint8_t *mask)
+{
+  unsigned int i;
+#if defined(__AVX2__)
+  __m256i b;
+  __m256i m;
+
+  for (i = 0; i < BLOCK_SIZE; i += 32)
+  {
+    b = _mm256_loadu_si256 ((const __m256i *) &block[i]);
+    m = _mm256_loadu_si256 ((const __m256i *) &mask[i]);
+    if (! _mm256_testc_si256 (b, m))
+      return GNUNET_NO;
+  }
+#elif defined(__SSE2__)
+  __m128i missing;
+
+  for (i = 0; i < BLOCK_SIZE; i += 16)
+  {
+    missing = _mm_andnot_si128 (_mm_loadu_si128 ((const __m128i *) &block[i]),
+                                _mm_loadu_si128 ((const __m128i *) &mask[i]));
+    if (0xFFFF != _mm_movemask_epi8 (_mm_cmpeq_epi8 (missing,
+                                                     _mm_setzero_si128 ())))
+      return GNUNET_NO;
+  }
+#else
+  uint64_t b;
+  uint64_t m;
+
+  for (i = 0; i < BLOCK_SIZE; i += sizeof (uint64_t))
+  {
+    memcpy (&b, &block[i], sizeof (uint64_t));
+    memcpy (&m, &mask[i], sizeof (uint64_t));
+    if (m != (b & m))
+      return GNUNET_NO;
+  }
+#endif
+  return GNUNET_YES;
+}
+
+
+/**
+ * Test if an element is in a blocked filter.
+ *
+ * @param bf the filter
+ * @param e the element
+ * @return #GNUNET_YES if the element is in the filter, #GNUNET_NO if not
+ */
+static int
+blocked_test (const struct GNUNET_CONTAINER_BloomFilter *bf,
+              const struct GNUNET_HashCode *e)
+{
+  uint8_t mask[BLOCK_SIZE];
+  size_t off;
+
+  off = block_of (bf, e, mask);
+  return block_test ((const uint8_t *) &bf->bitArray[off],
+                     mask);
+}
+
+
 /* *********************** INTERFACE **************** */
 
 /**
@@ -610,6 +955,175 @@ GNUNET_CONTAINER_bloomfilter_load (const char *filename, size_t size,
 }
 
 
+/**
+ * Load a Bloom filter from a file, mapping the counter file into
+ * memory instead of reading it.  Changes are only written to disk
+ * by #GNUNET_CONTAINER_bloomfilter_sync() and when the filter is
+ * freed.
+ *
+ * @param filename the name of the file (or the prefix)
+ * @param size the size of the bloom-filter (number of
+ *        bytes of storage space to use); will be rounded up
+ *        to next power of 2
+ * @param k the number of GNUNET_CRYPTO_hash-functions to apply per
+ *        element (number of bits set per element in the set)
+ * @param[out] clean set to #GNUNET_NO if the filter was changed
+ *        after it was last synced, so the counter file may be
+ *        inconsistent and the filter should be rebuilt
+ * @return the bloomfilter, NULL on error
+ */
+struct GNUNET_CONTAINER_BloomFilter *
+GNUNET_CONTAINER_bloomfilter_load_mapped (const char *filename,
+                                          size_t size,
+                                          unsigned int k,
+                                          int *clean)
+{
+  struct GNUNET_CONTAINER_BloomFilter *bf;
+  size_t ui;
+  size_t pages;
+  off_t fsize;
+
+  GNUNET_assert (NULL != filename);
+  if ((k == 0) || (size == 0))
+    return NULL;
+  if (size < BUFFSIZE)
+    size = BUFFSIZE;
+  ui = 1;
+  while ( (ui < size) &&
+	  (ui * 2 > ui) )
+    ui *= 2;
+  size = ui;                    /* make sure it's a power of 2 */
+
+  bf = GNUNET_new (struct GNUNET_CONTAINER_BloomFilter);
+  bf->fh =
+    GNUNET_DISK_file_open (filename,
+                           GNUNET_DISK_OPEN_CREATE |
+                           GNUNET_DISK_OPEN_READWRITE,
+                           GNUNET_DISK_PERM_USER_READ |
+                           GNUNET_DISK_PERM_USER_WRITE);
+  if (NULL == bf->fh)
+  {
+    GNUNET_free (bf);
+    return NULL;
+  }
+  if (GNUNET_OK !=
+      GNUNET_DISK_file_handle_size (bf->fh, &fsize))
+  {
+    GNUNET_DISK_file_close (bf->fh);
+    GNUNET_free (bf);
+    return NULL;
+  }
+  if (fsize == 0)
+  {
+    /* new or empty file, just overwrite */
+    if (GNUNET_OK != make_empty_file (bf->fh, size * 4LL))
+    {
+      LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING,
+                         "write",
+                         filename);
+      GNUNET_DISK_file_close (bf->fh);
+      GNUNET_free (bf);
+      return NULL;
+    }
+  }
+  else if (fsize != size * 4LL)
+  {
+    LOG (GNUNET_ERROR_TYPE_ERROR,
+         _("Size of file on disk is incorrect for this Bloom filter (want %llu, have %llu)\n"),
+         (unsigned long long) (size * 4LL),
+         (unsigned long long) fsize);
+    GNUNET_DISK_file_close (bf->fh);
+    GNUNET_free (bf);
+    return NULL;
+  }
+  bf->counters = GNUNET_DISK_file_map (bf->fh,
+                                       &bf->map,
+                                       GNUNET_DISK_MAP_TYPE_READWRITE,
+                                       size * 4LL);
+  if (NULL == bf->counters)
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING,
+                       "mmap",
+                       filename);
+    GNUNET_DISK_file_close (bf->fh);
+    GNUNET_free (bf);
+    return NULL;
+  }
+  pages = (size * 4LL + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+  bf->dirty = GNUNET_malloc ((pages + 7) / 8);
+  bf->filename = GNUNET_strdup (filename);
+  GNUNET_asprintf (&bf->marker,
+                   "%s.dirty",
+                   filename);
+  bf->marked = GNUNET_DISK_file_test (bf->marker);
+  if (NULL != clean)
+    *clean = (GNUNET_YES == bf->marked) ? GNUNET_NO : GNUNET_YES;
+  bf->bitArraySize = size;
+  bf->addressesPerElement = k;
+  return bf;
+}
+
+
+/**
+ * Write the changes to a filter loaded with
+ * #GNUNET_CONTAINER_bloomfilter_load_mapped() to disk.  Only the
+ * parts of the counter file that changed since the last sync are
+ * written.  Does nothing for other filters.
+ *
+ * @param bf the filter
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+int
+GNUNET_CONTAINER_bloomfilter_sync (struct GNUNET_CONTAINER_BloomFilter *bf)
+{
+  size_t pages;
+  size_t start;
+  size_t end;
+  int ret;
+
+  if ( (NULL == bf) ||
+       (NULL == bf->counters) ||
+       (GNUNET_NO == bf->marked) )
+    return GNUNET_OK;
+  ret = GNUNET_OK;
+  pages = (bf->bitArraySize * 4LL + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+  start = 0;
+  while (start < pages)
+  {
+    if (0 == (bf->dirty[start / 8] & (1 << (start % 8))))
+    {
+      start++;
+      continue;
+    }
+    /* sync runs of dirty pages with one call */
+    end = start;
+    while ( (end < pages) &&
+            (0 != (bf->dirty[end / 8] & (1 << (end % 8)))) )
+      end++;
+    if (GNUNET_OK !=
+        GNUNET_DISK_file_map_sync (bf->map,
+                                   start * DIRTY_PAGE_SIZE,
+                                   (end - start) * DIRTY_PAGE_SIZE))
+    {
+      LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING,
+                         "msync",
+                         bf->filename);
+      ret = GNUNET_SYSERR;
+    }
+    start = end;
+  }
+  if (GNUNET_OK != ret)
+    return ret;
+  memset (bf->dirty, 0, (pages + 7) / 8);
+  if (0 != UNLINK (bf->marker))
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING,
+                       "unlink",
+                       bf->marker);
+  bf->marked = GNUNET_NO;
+  return GNUNET_OK;
+}
+
+
 /**
  * Create a bloom filter from raw bits.
  *
@@ -648,6 +1162,46 @@ GNUNET_CONTAINER_bloomfilter_init (const char *data, size_t size,
 }
 
 
+/**
+ * Create a Bloom filter using the blocked layout from raw bits.
+ * All bits for an element are within one block of 64 bytes, which
+ * makes tests much cheaper for large filters at the expense of a
+ * slightly higher false-positive rate.  Blocked filters are not
+ * compatible with filters created by
+ * #GNUNET_CONTAINER_bloomfilter_init(), so they must not be used in
+ * P2P messages that carry filters.
+ *
+ * @param data the raw bits in memory (maybe NULL,
+ *        in which case all bits should be considered
+ *        to be zero).
+ * @param size the size of the bloom-filter (number of
+ *        bytes of storage space to use); also size of data
+ *        -- unless data is NULL.  Must be a multiple of
+ *        #BLOCK_SIZE, but need not be a power of two.
+ * @param k the number of bits to set per element (at most #BLOCK_BITS)
+ * @return the bloomfilter, NULL on error
+ */
+struct GNUNET_CONTAINER_BloomFilter *
+GNUNET_CONTAINER_bloomfilter_init_blocked (const char *data,
+                                           size_t size,
+                                           unsigned int k)
+{
+  struct GNUNET_CONTAINER_BloomFilter *bf;
+
+  if ( (0 == k) ||
+       (k > BLOCK_BITS) ||
+       (0 != size % BLOCK_SIZE) )
+    return NULL;
+  bf = GNUNET_CONTAINER_bloomfilter_init (data,
+                                          size,
+                                          k);
+  if (NULL == bf)
+    return NULL;
+  bf->blocked = GNUNET_YES;
+  return bf;
+}
+
+
 /**
  * Copy the raw data of this bloomfilter into
  * the given data array.
@@ -666,6 +1220,11 @@ GNUNET_CONTAINER_bloomfilter_get_raw_data (const struct
     return GNUNET_SYSERR;
   if (bf->bitArraySize != size)
     return GNUNET_SYSERR;
+  if (NULL != bf->counters)
+  {
+    getMappedBits (bf, data);
+    return GNUNET_OK;
+  }
   memcpy (data, bf->bitArray, size);
   return GNUNET_OK;
 }
@@ -683,10 +1242,17 @@ GNUNET_CONTAINER_bloomfilter_free (struct GNUNET_CONTAINER_BloomFilter *bf)
 {
   if (NULL == bf)
     return;
+  if (NULL != bf->counters)
+  {
+    GNUNET_CONTAINER_bloomfilter_sync (bf);
+    GNUNET_DISK_file_unmap (bf->map);
+    GNUNET_free (bf->dirty);
+    GNUNET_free (bf->marker);
+  }
   if (bf->fh != NULL)
     GNUNET_DISK_file_close (bf->fh);
   GNUNET_free_non_null (bf->filename);
-  GNUNET_free (bf->bitArray);
+  GNUNET_free_non_null (bf->bitArray);
   GNUNET_free (bf);
 }
 
@@ -701,6 +1267,13 @@ GNUNET_CONTAINER_bloomfilter_clear (struct GNUNET_CONTAINER_BloomFilter *bf)
 {
   if (NULL == bf)
     return;
+  if (NULL != bf->counters)
+  {
+    createMarker (bf);
+    memset (bf->counters, 0, bf->bitArraySize * 4LL);
+    markAllDirty (bf);
+    return;
+  }
 
   memset (bf->bitArray, 0, bf->bitArraySize);
   if (bf->filename != NULL)
@@ -723,12 +1296,52 @@ GNUNET_CONTAINER_bloomfilter_test (const struct GNUNET_CONTAINER_BloomFilter
 
   if (NULL == bf)
     return GNUNET_YES;
+  if (GNUNET_YES == bf->blocked)
+    return blocked_test (bf, e);
   res = GNUNET_YES;
   iterateBits (bf, &testBitCallback, &res, e);
   return res;
 }
 
 
+/**
+ * Test if each of several elements is in the filter.  For blocked
+ * filters, the blocks of all elements are prefetched before testing,
+ * so the cache misses overlap.
+ *
+ * @param bf the filter
+ * @param e the elements
+ * @param count number of elements in @a e
+ * @param[out] results set to #GNUNET_YES or #GNUNET_NO for each element
+ * @return number of elements that are in the filter
+ */
+unsigned int
+GNUNET_CONTAINER_bloomfilter_test_many (const struct GNUNET_CONTAINER_BloomFilter *bf,
+                                        const struct GNUNET_HashCode *e,
+                                        unsigned int count,
+                                        int *results)
+{
+  unsigned int found;
+  unsigned int i;
+
+  found = 0;
+#if defined(__GNUC__)
+  if ( (NULL != bf) &&
+       (GNUNET_YES == bf->blocked) )
+    for (i = 0; i < count; i++)
+      __builtin_prefetch (&bf->bitArray[(ntohl (e[i].bits[0]) % (bf->bitArraySize / BLOCK_SIZE)) * BLOCK_SIZE]);
+#endif
+  for (i = 0; i < count; i++)
+  {
+    results[i] = GNUNET_CONTAINER_bloomfilter_test (bf,
+                                                    &e[i]);
+    if (GNUNET_YES == results[i])
+      found++;
+  }
+  return found;
+}
+
+
 /**
  * Add an element to the filter
  *
@@ -741,6 +1354,17 @@ GNUNET_CONTAINER_bloomfilter_add (struct GNUNET_CONTAINER_BloomFilter *bf,
 {
   if (NULL == bf)
     return;
+  if (GNUNET_YES == bf->blocked)
+  {
+    uint8_t mask[BLOCK_SIZE];
+    size_t off;
+    unsigned int i;
+
+    off = block_of (bf, e, mask);
+    for (i = 0; i < BLOCK_SIZE; i++)
+      bf->bitArray[off + i] |= mask[i];
+    return;
+  }
   iterateBits (bf, &incrementBitCallback, bf, e);
 }
 
@@ -768,6 +1392,16 @@ GNUNET_CONTAINER_bloomfilter_or (struct GNUNET_CONTAINER_BloomFilter *bf,
     return GNUNET_YES;
   if (bf->bitArraySize != size)
     return GNUNET_SYSERR;
+  if (NULL != bf->counters)
+  {
+    size_t bit;
+
+    for (bit = 0; bit < size * 8LL; bit++)
+      if ( (GNUNET_YES == testBit ((char *) data, bit)) &&
+           (0 == getCounter (bf, bit)) )
+        setCounter (bf, bit, 1);
+    return GNUNET_OK;
+  }
   fc = (unsigned long long *) bf->bitArray;
   dc = (const unsigned long long *) data;
   n = size / sizeof (unsigned long long);
@@ -802,12 +1436,31 @@ GNUNET_CONTAINER_bloomfilter_or2 (struct GNUNET_CONTAINER_BloomFilter *bf,
 
   if (NULL == bf)
     return GNUNET_OK;
-  if (bf->bitArraySize != to_or->bitArraySize)
+  if ( (bf->bitArraySize != to_or->bitArraySize) ||
+       (bf->blocked != to_or->blocked) )
   {
     GNUNET_break (0);
     return GNUNET_SYSERR;
   }
   size = bf->bitArraySize;
+  if ( (NULL != bf->counters) ||
+       (NULL != to_or->counters) )
+  {
+    char *data;
+    int ret;
+
+    data = GNUNET_malloc_large (size);
+    if (NULL == data)
+      return GNUNET_SYSERR;
+    GNUNET_CONTAINER_bloomfilter_get_raw_data (to_or,
+                                               data,
+                                               size);
+    ret = GNUNET_CONTAINER_bloomfilter_or (bf,
+                                           data,
+                                           size);
+    GNUNET_free (data);
+    return ret;
+  }
   fc = (unsigned long long *) bf->bitArray;
   dc = (const unsigned long long *) to_or->bitArray;
   n = size / sizeof (unsigned long long);
@@ -857,16 +1510,35 @@ GNUNET_CONTAINER_bloomfilter_resize (struct GNUNET_CONTAINER_BloomFilter *bf,
   struct GNUNET_HashCode hc;
   unsigned int i;
 
-  GNUNET_free (bf->bitArray);
-  i = 1;
+  i = (GNUNET_YES == bf->blocked) ? BLOCK_SIZE : 1;
   while (i < size)
     i *= 2;
   size = i;                     /* make sure it's a power of 2 */
 
-  bf->bitArraySize = size;
-  bf->bitArray = GNUNET_malloc (size);
-  if (bf->filename != NULL)
-    make_empty_file (bf->fh, bf->bitArraySize * 4LL);
+  if (NULL != bf->counters)
+  {
+    createMarker (bf);
+    GNUNET_DISK_file_unmap (bf->map);
+    GNUNET_free (bf->dirty);
+    bf->bitArraySize = size;
+    GNUNET_break (GNUNET_OK ==
+                  make_empty_file (bf->fh, bf->bitArraySize * 4LL));
+    bf->counters = GNUNET_DISK_file_map (bf->fh,
+                                         &bf->map,
+                                         GNUNET_DISK_MAP_TYPE_READWRITE,
+                                         bf->bitArraySize * 4LL);
+    GNUNET_assert (NULL != bf->counters);
+    bf->dirty = GNUNET_malloc (((bf->bitArraySize * 4LL + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE + 7) / 8);
+    markAllDirty (bf);
+  }
+  else
+  {
+    GNUNET_free (bf->bitArray);
+    bf->bitArraySize = size;
+    bf->bitArray = GNUNET_malloc (size);
+    if (bf->filename != NULL)
+      make_empty_file (bf->fh, bf->bitArraySize * 4LL);
+  }
   while (GNUNET_YES == iterator (iterator_cls, &hc))
     GNUNET_CONTAINER_bloomfilter_add (bf, &hc);
 }
@@ -26,8 +26,46 @@
 #include "platform.h"
 #include "gnunet_container_lib.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define USE_SSE2 GNUNET_YES
+#else
+#define USE_SSE2 GNUNET_NO
+#endif
+
 #define LOG(kind,...) GNUNET_log_from (kind, "util", __VA_ARGS__)
 
+/**
+ * Number of slots whose control bytes are probed together in
+ * open-addressing maps.
+ */
+#define GROUP_WIDTH 16
+
+/**
+ * Control byte of an empty slot.
+ */
+#define CTRL_EMPTY 0x80
+
+/**
+ * Control byte of a slot whose entry was removed (tombstone).
+ */
+#define CTRL_DELETED 0xFE
+
+/**
+ * How often do we try to hit a full slot at random in
+ * #GNUNET_CONTAINER_multihashmap_get_random() before falling
+ * back to a linear scan?
+ */
+#define RANDOM_PROBES 32
+
+/**
+ * How many buckets do we migrate to the new table per call to
+ * #GNUNET_CONTAINER_multihashmap_put() while growing a map
+ * incrementally?  Must be at least one so that the migration is done
+ * before the map needs to grow again.
+ */
+#define MIGRATE_BUCKETS 4
+
 /**
  * An entry in the hash map with the full key.
  */
@@ -93,6 +131,44 @@ union MapEntry
 };
 
 
+/**
+ * Slot of an open-addressing map with the full key.
+ */
+struct BigSlot
+{
+
+  /**
+   * Key for the entry.
+   */
+  struct GNUNET_HashCode key;
+
+  /**
+   * Value of the entry.
+   */
+  void *value;
+
+};
+
+
+/**
+ * Slot of an open-addressing map with just a pointer to the key.
+ */
+struct SmallSlot
+{
+
+  /**
+   * Key for the entry.
+   */
+  const struct GNUNET_HashCode *key;
+
+  /**
+   * Value of the entry.
+   */
+  void *value;
+
+};
+
+
 /**
  * Internal representation of the hash map.
  */
@@ -124,6 +200,47 @@ struct GNUNET_CONTAINER_MultiHashMap
    * to the map, so that iterators can check if they are still valid.
    */
   unsigned int modification_counter;
+
+  /**
+   * Control bytes of an open-addressing map, one per slot:
+   * #CTRL_EMPTY, #CTRL_DELETED or 7 bits of the key's hash.
+   * NULL if the map uses chained buckets (@e map).
+   */
+  uint8_t *ctrl;
+
+  /**
+   * Slots of an open-addressing map (@e map_length of them), of type
+   * `struct SmallSlot` or `struct BigSlot` depending on
+   * @e use_small_entries.
+   */
+  void *slots;
+
+  /**
+   * Number of #CTRL_DELETED slots in an open-addressing map.
+   */
+  unsigned int tombstones;
+
+  /**
+   * Buckets of the table we are migrating entries away from while
+   * growing incrementally, NULL if no migration is in progress.
+   */
+  union MapEntry *old_map;
+
+  /**
+   * Length of the @e old_map array.
+   */
+  unsigned int old_map_length;
+
+  /**
+   * Buckets in @e old_map below this index have been migrated.
+   */
+  unsigned int migrate_pos;
+
+  /**
+   * #GNUNET_YES if the map grows incrementally, see
+   * #GNUNET_CONTAINER_MULTIHASHMAPFLAG_INCREMENTAL_RESIZE.
+   */
+  int incremental;
 };
 
 
@@ -186,6 +303,491 @@ GNUNET_CONTAINER_multihashmap_create (unsigned int len,
 }
 
 
+/* ******************** open addressing ********************** */
+
+/**
+ * Get the size of a slot of an open-addressing map.
+ *
+ * @param map the map
+ * @return size of one slot in bytes
+ */
+static size_t
+oa_slot_size (const struct GNUNET_CONTAINER_MultiHashMap *map)
+{
+  return map->use_small_entries
+    ? sizeof (struct SmallSlot)
+    : sizeof (struct BigSlot);
+}
+
+
+/**
+ * Get the key stored in a slot of an open-addressing map.
+ *
+ * @param map the map
+ * @param i index of the slot
+ * @return the key
+ */
+static const struct GNUNET_HashCode *
+oa_key (const struct GNUNET_CONTAINER_MultiHashMap *map,
+        unsigned int i)
+{
+  if (map->use_small_entries)
+    return ((const struct SmallSlot *) map->slots)[i].key;
+  return &((const struct BigSlot *) map->slots)[i].key;
+}
+
+
+/**
+ * Get the location of the value stored in a slot of an
+ * open-addressing map.
+ *
+ * @param map the map
+ * @param i index of the slot
+ * @return where the value is stored
+ */
+static void **
+oa_value (const struct GNUNET_CONTAINER_MultiHashMap *map,
+          unsigned int i)
+{
+  if (map->use_small_entries)
+    return &((struct SmallSlot *) map->slots)[i].value;
+  return &((struct BigSlot *) map->slots)[i].value;
+}
+
+
+/**
+ * Compute the control byte for a key.
+ *
+ * @param key the key
+ * @return 7 bits of the key (not used by the group index)
+ */
+static uint8_t
+oa_h2 (const struct GNUNET_HashCode *key)
+{
+  return (uint8_t) (key->bits[1] & 0x7F);
+}
+
+
+/**
+ * Find the slots in a group whose control byte is @a c.
+ *
+ * @param group first control byte of the group
+ * @param c control byte to look for
+ * @return bitmask with bit @e i set if slot @e i matches
+ */
+static unsigned int
+group_match (const uint8_t *group,
+             uint8_t c)
+{
+#if USE_SSE2
+  __m128i g;
+
+  g = _mm_loadu_si128 ((const __m128i *) group);
+  return (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (g,
+                                                           _mm_set1_epi8 ((char) c)));
+#else
+  unsigned int mask;
+  unsigned int i;
+
+  mask = 0;
+  for (i = 0; i < GROUP_WIDTH; i++)
+    if (c == group[i])
+      mask |= 1U << i;
+  return mask;
+#endif
+}
+
+
+/**
+ * Find the slots in a group that are empty or deleted (i.e. the
+ * control bytes with the top bit set).
+ *
+ * @param group first control byte of the group
+ * @return bitmask with bit @e i set if slot @e i is free
+ */
+static unsigned int
+group_match_free (const uint8_t *group)
+{
+#if USE_SSE2
+  return (unsigned int) _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) group));
+#else
+  unsigned int mask;
+  unsigned int i;
+
+  mask = 0;
+  for (i = 0; i < GROUP_WIDTH; i++)
+    if (0 != (group[i] & 0x80))
+      mask |= 1U << i;
+  return mask;
+#endif
+}
+
+
+/**
+ * Get the index of the lowest bit set in @a mask.
+ *
+ * @param mask non-zero bitmask
+ * @return index of the lowest set bit
+ */
+static unsigned int
+lowest_bit (unsigned int mask)
+{
+#if defined(__GNUC__)
+  return (unsigned int) __builtin_ctz (mask);
+#else
+  unsigned int i;
+
+  for (i = 0; 0 == (mask & (1U << i)); i++) ;
+  return i;
+#endif
+}
+
+
+/**
+ * State of a probe for a key in an open-addressing map.  Groups are
+ * visited in triangular order, which covers all groups as the number
+ * of groups is a power of two.
+ */
+struct Probe
+{
+  /**
+   * Key we are looking for.
+   */
+  const struct GNUNET_HashCode *key;
+
+  /**
+   * Group we are looking at.
+   */
+  unsigned int group;
+
+  /**
+   * Number of groups visited so far (minus one).
+   */
+  unsigned int step;
+
+  /**
+   * Slots in @e group with matching control bytes that
+   * we did not yet look at.
+   */
+  unsigned int mask;
+
+  /**
+   * Control byte for @e key.
+   */
+  uint8_t h2;
+
+  /**
+   * #GNUNET_YES if @e group has an empty slot, so the probe
+   * sequence ends with this group.
+   */
+  int last;
+};
+
+
+/**
+ * Load the control bytes of the current group of a probe.
+ *
+ * @param map the map
+ * @param p the probe
+ */
+static void
+probe_load (const struct GNUNET_CONTAINER_MultiHashMap *map,
+            struct Probe *p)
+{
+  const uint8_t *group = &map->ctrl[p->group * GROUP_WIDTH];
+
+  p->mask = group_match (group, p->h2);
+  p->last = (0 != group_match (group, CTRL_EMPTY)) ? GNUNET_YES : GNUNET_NO;
+}
+
+
+/**
+ * Start probing for a key.
+ *
+ * @param map the map
+ * @param key key to look for
+ * @param[out] p probe to initialize
+ */
+static void
+probe_start (const struct GNUNET_CONTAINER_MultiHashMap *map,
+             const struct GNUNET_HashCode *key,
+             struct Probe *p)
+{
+  p->key = key;
+  p->h2 = oa_h2 (key);
+  p->step = 0;
+  p->group = key->bits[0] & (map->map_length / GROUP_WIDTH - 1);
+  probe_load (map, p);
+}
+
+
+/**
+ * Find the next slot holding the key of a probe.
+ *
+ * @param map the map
+ * @param p the probe
+ * @return index of the slot, UINT_MAX if there are no more slots with the key
+ */
+static unsigned int
+probe_next (const struct GNUNET_CONTAINER_MultiHashMap *map,
+            struct Probe *p)
+{
+  unsigned int i;
+
+  while (1)
+  {
+    while (0 != p->mask)
+    {
+      i = p->group * GROUP_WIDTH + lowest_bit (p->mask);
+      p->mask &= p->mask - 1;
+      /* entry may have been removed since we loaded the group */
+      if ( (p->h2 == map->ctrl[i]) &&
+           (0 == memcmp (p->key,
+                         oa_key (map, i),
+                         sizeof (struct GNUNET_HashCode))) )
+        return i;
+    }
+    if ( (GNUNET_YES == p->last) ||
+         (++p->step == map->map_length / GROUP_WIDTH) )
+      return UINT_MAX;
+    p->group = (p->group + p->step) & (map->map_length / GROUP_WIDTH - 1);
+    probe_load (map, p);
+  }
+}
+
+
+/**
+ * Find a free slot for a key.  There must be one.
+ *
+ * @param map the map
+ * @param key the key
+ * @return index of the slot
+ */
+static unsigned int
+oa_find_free (const struct GNUNET_CONTAINER_MultiHashMap *map,
+              const struct GNUNET_HashCode *key)
+{
+  unsigned int group;
+  unsigned int step;
+  unsigned int mask;
+
+  group = key->bits[0] & (map->map_length / GROUP_WIDTH - 1);
+  for (step = 1; ; step++)
+  {
+    mask = group_match_free (&map->ctrl[group * GROUP_WIDTH]);
+    if (0 != mask)
+      return group * GROUP_WIDTH + lowest_bit (mask);
+    GNUNET_assert (step < map->map_length / GROUP_WIDTH);
+    group = (group + step) & (map->map_length / GROUP_WIDTH - 1);
+  }
+}
+
+
+/**
+ * Allocate the table of an open-addressing map.
+ *
+ * @param map the map
+ * @param len number of slots, a power of two and at least #GROUP_WIDTH
+ */
+static void
+oa_alloc (struct GNUNET_CONTAINER_MultiHashMap *map,
+          unsigned int len)
+{
+  map->map_length = len;
+  map->ctrl = GNUNET_malloc_large (len);
+  GNUNET_assert (NULL != map->ctrl);
+  memset (map->ctrl, CTRL_EMPTY, len);
+  map->slots = GNUNET_malloc_large ((size_t) len * oa_slot_size (map));
+  GNUNET_assert (NULL != map->slots);
+  map->tombstones = 0;
+}
+
+
+/**
+ * Rebuild the table of an open-addressing map, growing it if it is
+ * getting full and dropping all tombstones.
+ *
+ * @param map the map
+ */
+static void
+oa_rehash (struct GNUNET_CONTAINER_MultiHashMap *map)
+{
+  uint8_t *old_ctrl;
+  void *old_slots;
+  unsigned int old_len;
+  unsigned int new_len;
+  unsigned int i;
+  unsigned int j;
+  size_t ss;
+
+  map->modification_counter++;
+  old_ctrl = map->ctrl;
+  old_slots = map->slots;
+  old_len = map->map_length;
+  new_len = old_len;
+  if (map->size >= old_len / 16 * 7)
+    new_len = old_len * 2;
+  GNUNET_assert (new_len >= old_len);
+  ss = oa_slot_size (map);
+  oa_alloc (map, new_len);
+  for (i = 0; i < old_len; i++)
+  {
+    if (0 != (old_ctrl[i] & 0x80))
+      continue;
+    j = oa_find_free (map,
+                      (map->use_small_entries)
+                      ? ((const struct SmallSlot *) old_slots)[i].key
+                      : &((const struct BigSlot *) old_slots)[i].key);
+    map->ctrl[j] = old_ctrl[i];
+    memcpy ((char *) map->slots + j * ss,
+            (const char *) old_slots + i * ss,
+            ss);
+  }
+  GNUNET_free (old_ctrl);
+  GNUNET_free (old_slots);
+}
+
+
+/**
+ * Remove the entry in a slot of an open-addressing map.
+ *
+ * @param map the map
+ * @param i index of the slot
+ */
+static void
+oa_erase (struct GNUNET_CONTAINER_MultiHashMap *map,
+          unsigned int i)
+{
+  const uint8_t *group = &map->ctrl[i - i % GROUP_WIDTH];
+
+  /* probes stop at groups with an empty slot, so if there is one in
+     this group, nobody needs to probe past this slot */
+  if (0 != group_match (group, CTRL_EMPTY))
+  {
+    map->ctrl[i] = CTRL_EMPTY;
+  }
+  else
+  {
+    map->ctrl[i] = CTRL_DELETED;
+    map->tombstones++;
+  }
+  map->size--;
+}
+
+
+/**
+ * Create a multi hash map, selecting the implementation to use.
+ * The resulting map supports the same operations as maps created
+ * with #GNUNET_CONTAINER_multihashmap_create().
+ *
+ * @param len initial size (map will grow as needed)
+ * @param do_not_copy_keys see #GNUNET_CONTAINER_multihashmap_create()
+ * @param flags which implementation to use and how it grows
+ * @return NULL on error
+ */
+struct GNUNET_CONTAINER_MultiHashMap *
+GNUNET_CONTAINER_multihashmap_create_with_flags (unsigned int len,
+                                                 int do_not_copy_keys,
+                                                 enum GNUNET_CONTAINER_MultiHashMapFlags flags)
+{
+  struct GNUNET_CONTAINER_MultiHashMap *map;
+  unsigned int olen;
+
+  if (0 == (flags & GNUNET_CONTAINER_MULTIHASHMAPFLAG_OPEN_ADDRESSING))
+  {
+    map = GNUNET_CONTAINER_multihashmap_create (len,
+                                                do_not_copy_keys);
+    if (0 != (flags & GNUNET_CONTAINER_MULTIHASHMAPFLAG_INCREMENTAL_RESIZE))
+      map->incremental = GNUNET_YES;
+    return map;
+  }
+  GNUNET_assert (len > 0);
+  map = GNUNET_new (struct GNUNET_CONTAINER_MultiHashMap);
+  map->use_small_entries = do_not_copy_keys;
+  olen = GROUP_WIDTH;
+  while ( (olen / 8 * 7 < len) &&
+          (olen < (1U << 31)) )
+    olen *= 2;
+  oa_alloc (map, olen);
+  return map;
+}
+
+
+/**
+ * Compute the index of the bucket for the given key.
+ *
+ * @param map hash map for which to compute the index
+ * @param key what key should the index be computed for
+ * @return offset into the "map" array of "map"
+ */
+static unsigned int
+idx_of (const struct GNUNET_CONTAINER_MultiHashMap *map,
+        const struct GNUNET_HashCode *key)
+{
+  GNUNET_assert (map != NULL);
+  return (*(unsigned int *) key) % map->map_length;
+}
+
+
+/**
+ * Find the bucket for the given key.  While the map is growing
+ * incrementally, this is the bucket in the old table unless that
+ * bucket has already been migrated.
+ *
+ * @param map hash map to search
+ * @param key what key should the bucket be found for
+ * @return the bucket
+ */
+static union MapEntry *
+bucket_of (const struct GNUNET_CONTAINER_MultiHashMap *map,
+           const struct GNUNET_HashCode *key)
+{
+  unsigned int i;
+
+  if (NULL != map->old_map)
+  {
+    i = (*(unsigned int *) key) % map->old_map_length;
+    if (i >= map->migrate_pos)
+      return &map->old_map[i];
+  }
+  return &map->map[idx_of (map, key)];
+}
+
+
+/**
+ * Get the total number of buckets of a map, including those
+ * of the old table while growing incrementally.
+ *
+ * @param map the map
+ * @return number of buckets
+ */
+static unsigned int
+bucket_count (const struct GNUNET_CONTAINER_MultiHashMap *map)
+{
+  if (NULL == map->old_map)
+    return map->map_length;
+  return map->map_length + map->old_map_length;
+}
+
+
+/**
+ * Get a bucket by index; the buckets of the old table (while
+ * growing incrementally) come after those of the current one.
+ *
+ * @param map the map
+ * @param idx index of the bucket, smaller than bucket_count()
+ * @return the bucket
+ */
+static union MapEntry
+bucket_at (const struct GNUNET_CONTAINER_MultiHashMap *map,
+           unsigned int idx)
+{
+  if (idx < map->map_length)
+    return map->map[idx];
+  return map->old_map[idx - map->map_length];
+}
+
+
 /**
  * Destroy a hash map.  Will not free any values
  * stored in the hash map!
@@ -199,9 +801,16 @@ GNUNET_CONTAINER_multihashmap_destroy (struct GNUNET_CONTAINER_MultiHashMap
   unsigned int i;
   union MapEntry me;
 
-  for (i = 0; i < map->map_length; i++)
+  if (NULL != map->ctrl)
+  {
+    GNUNET_free (map->ctrl);
+    GNUNET_free (map->slots);
+    GNUNET_free (map);
+    return;
+  }
+  for (i = 0; i < bucket_count (map); i++)
   {
-    me = map->map[i];
+    me = bucket_at (map, i);
     if (map->use_small_entries)
     {
       struct SmallMapEntry *sme;
@@ -230,26 +839,11 @@ GNUNET_CONTAINER_multihashmap_destroy (struct GNUNET_CONTAINER_MultiHashMap
     }
   }
   GNUNET_free (map->map);
+  GNUNET_free_non_null (map->old_map);
   GNUNET_free (map);
 }
 
 
-/**
- * Compute the index of the bucket for the given key.
- *
- * @param map hash map for which to compute the index
- * @param key what key should the index be computed for
- * @return offset into the "map" array of "map"
- */
-static unsigned int
-idx_of (const struct GNUNET_CONTAINER_MultiHashMap *map,
-        const struct GNUNET_HashCode *key)
-{
-  GNUNET_assert (map != NULL);
-  return (*(unsigned int *) key) % map->map_length;
-}
-
-
 /**
  * Get the number of key-value pairs in the map.
  *
@@ -280,7 +874,18 @@ GNUNET_CONTAINER_multihashmap_get (const struct GNUNET_CONTAINER_MultiHashMap *m
 {
   union MapEntry me;
 
-  me = map->map[idx_of (map, key)];
+  if (NULL != map->ctrl)
+  {
+    struct Probe p;
+    unsigned int i;
+
+    probe_start (map, key, &p);
+    i = probe_next (map, &p);
+    if (UINT_MAX == i)
+      return NULL;
+    return *oa_value (map, i);
+  }
+  me = *bucket_of (map, key);
   if (map->use_small_entries)
   {
     struct SmallMapEntry *sme;
@@ -323,9 +928,25 @@ GNUNET_CONTAINER_multihashmap_iterate (const struct
 
   count = 0;
   GNUNET_assert (NULL != map);
-  for (i = 0; i < map->map_length; i++)
+  if (NULL != map->ctrl)
+  {
+    for (i = 0; i < map->map_length; i++)
+    {
+      if (0 != (map->ctrl[i] & 0x80))
+        continue;
+      if (NULL != it)
+      {
+        kc = *oa_key (map, i);
+        if (GNUNET_OK != it (it_cls, &kc, *oa_value (map, i)))
+          return GNUNET_SYSERR;
+      }
+      count++;
+    }
+    return count;
+  }
+  for (i = 0; i < bucket_count (map); i++)
   {
-    me = map->map[i];
+    me = bucket_at (map, i);
     if (map->use_small_entries)
     {
       struct SmallMapEntry *sme;
@@ -382,13 +1003,28 @@ GNUNET_CONTAINER_multihashmap_remove (struct GNUNET_CONTAINER_MultiHashMap *map,
                                       const struct GNUNET_HashCode *key,
 				      const void *value)
 {
+  union MapEntry *bucket;
   union MapEntry me;
   unsigned int i;
 
   map->modification_counter++;
 
-  i = idx_of (map, key);
-  me = map->map[i];
+  if (NULL != map->ctrl)
+  {
+    struct Probe p;
+
+    probe_start (map, key, &p);
+    while (UINT_MAX != (i = probe_next (map, &p)))
+    {
+      if (value != *oa_value (map, i))
+        continue;
+      oa_erase (map, i);
+      return GNUNET_YES;
+    }
+    return GNUNET_NO;
+  }
+  bucket = bucket_of (map, key);
+  me = *bucket;
   if (map->use_small_entries)
   {
     struct SmallMapEntry *sme;
@@ -401,7 +1037,7 @@ GNUNET_CONTAINER_multihashmap_remove (struct GNUNET_CONTAINER_MultiHashMap *map,
 	  (value == sme->value))
       {
 	if (NULL == p)
-	  map->map[i].sme = sme->next;
+	  bucket->sme = sme->next;
 	else
 	  p->next = sme->next;
 	GNUNET_free (sme);
@@ -423,7 +1059,7 @@ GNUNET_CONTAINER_multihashmap_remove (struct GNUNET_CONTAINER_MultiHashMap *map,
 	  (value == bme->value))
       {
 	if (NULL == p)
-	  map->map[i].bme = bme->next;
+	  bucket->bme = bme->next;
 	else
 	  p->next = bme->next;
 	GNUNET_free (bme);
@@ -449,6 +1085,7 @@ int
 GNUNET_CONTAINER_multihashmap_remove_all (struct GNUNET_CONTAINER_MultiHashMap *map,
                                           const struct GNUNET_HashCode *key)
 {
+  union MapEntry *bucket;
   union MapEntry me;
   unsigned int i;
   int ret;
@@ -456,8 +1093,20 @@ GNUNET_CONTAINER_multihashmap_remove_all (struct GNUNET_CONTAINER_MultiHashMap *
   map->modification_counter++;
 
   ret = 0;
-  i = idx_of (map, key);
-  me = map->map[i];
+  if (NULL != map->ctrl)
+  {
+    struct Probe p;
+
+    probe_start (map, key, &p);
+    while (UINT_MAX != (i = probe_next (map, &p)))
+    {
+      oa_erase (map, i);
+      ret++;
+    }
+    return ret;
+  }
+  bucket = bucket_of (map, key);
+  me = *bucket;
   if (map->use_small_entries)
   {
     struct SmallMapEntry *sme;
@@ -470,13 +1119,13 @@ GNUNET_CONTAINER_multihashmap_remove_all (struct GNUNET_CONTAINER_MultiHashMap *
       if (0 == memcmp (key, sme->key, sizeof (struct GNUNET_HashCode)))
       {
 	if (NULL == p)
-	  map->map[i].sme = sme->next;
+	  bucket->sme = sme->next;
 	else
 	  p->next = sme->next;
 	GNUNET_free (sme);
 	map->size--;
 	if (NULL == p)
-	  sme = map->map[i].sme;
+	  sme = bucket->sme;
 	else
 	  sme = p->next;
 	ret++;
@@ -500,13 +1149,13 @@ GNUNET_CONTAINER_multihashmap_remove_all (struct GNUNET_CONTAINER_MultiHashMap *
       if (0 == memcmp (key, &bme->key, sizeof (struct GNUNET_HashCode)))
       {
 	if (NULL == p)
-	  map->map[i].bme = bme->next;
+	  bucket->bme = bme->next;
 	else
 	  p->next = bme->next;
 	GNUNET_free (bme);
 	map->size--;
 	if (NULL == p)
-	  bme = map->map[i].bme;
+	  bme = bucket->bme;
 	else
 	  bme = p->next;
 	ret++;
@@ -558,6 +1207,14 @@ GNUNET_CONTAINER_multihashmap_clear (struct GNUNET_CONTAINER_MultiHashMap *map)
   unsigned int ret;
 
   ret = map->size;
+  if (NULL != map->ctrl)
+  {
+    map->modification_counter++;
+    memset (map->ctrl, CTRL_EMPTY, map->map_length);
+    map->size = 0;
+    map->tombstones = 0;
+    return ret;
+  }
   GNUNET_CONTAINER_multihashmap_iterate (map,
                                          &remove_all,
                                          map);
@@ -581,7 +1238,14 @@ GNUNET_CONTAINER_multihashmap_contains (const struct
 {
   union MapEntry me;
 
-  me = map->map[idx_of (map, key)];
+  if (NULL != map->ctrl)
+  {
+    struct Probe p;
+
+    probe_start (map, key, &p);
+    return (UINT_MAX == probe_next (map, &p)) ? GNUNET_NO : GNUNET_YES;
+  }
+  me = *bucket_of (map, key);
   if (map->use_small_entries)
   {
     struct SmallMapEntry *sme;
@@ -620,7 +1284,18 @@ GNUNET_CONTAINER_multihashmap_contains_value (const struct
 {
   union MapEntry me;
 
-  me = map->map[idx_of (map, key)];
+  if (NULL != map->ctrl)
+  {
+    struct Probe p;
+    unsigned int i;
+
+    probe_start (map, key, &p);
+    while (UINT_MAX != (i = probe_next (map, &p)))
+      if (value == *oa_value (map, i))
+        return GNUNET_YES;
+    return GNUNET_NO;
+  }
+  me = *bucket_of (map, key);
   if (map->use_small_entries)
   {
     struct SmallMapEntry *sme;
@@ -644,7 +1319,77 @@ GNUNET_CONTAINER_multihashmap_contains_value (const struct
 
 
 /**
- * Grow the given map to a more appropriate size.
+ * Move all entries of a bucket of an old table to their
+ * buckets in the current table of the map.
+ *
+ * @param map the hash map
+ * @param old bucket of the old table
+ */
+static void
+rehash_bucket (struct GNUNET_CONTAINER_MultiHashMap *map,
+               union MapEntry *old)
+{
+  unsigned int idx;
+
+  if (map->use_small_entries)
+  {
+    struct SmallMapEntry *sme;
+
+    while (NULL != (sme = old->sme))
+    {
+      old->sme = sme->next;
+      idx = idx_of (map, sme->key);
+      sme->next = map->map[idx].sme;
+      map->map[idx].sme = sme;
+    }
+  }
+  else
+  {
+    struct BigMapEntry *bme;
+
+    while (NULL != (bme = old->bme))
+    {
+      old->bme = bme->next;
+      idx = idx_of (map, &bme->key);
+      bme->next = map->map[idx].bme;
+      map->map[idx].bme = bme;
+    }
+  }
+}
+
+
+/**
+ * Migrate some buckets of the old table of a map that is
+ * growing incrementally, and free the old table once all
+ * of its buckets have been migrated.
+ *
+ * @param map the hash map
+ * @param max maximum number of buckets to migrate
+ */
+static void
+migrate (struct GNUNET_CONTAINER_MultiHashMap *map,
+         unsigned int max)
+{
+  map->modification_counter++;
+  while ( (max > 0) &&
+          (map->migrate_pos < map->old_map_length) )
+  {
+    rehash_bucket (map,
+                   &map->old_map[map->migrate_pos]);
+    map->migrate_pos++;
+    max--;
+  }
+  if (map->migrate_pos < map->old_map_length)
+    return;
+  GNUNET_free (map->old_map);
+  map->old_map = NULL;
+}
+
+
+/**
+ * Grow the given map to a more appropriate size.  If the map
+ * grows incrementally, the entries are only moved to the new
+ * table by later calls to migrate().
  *
  * @param map the hash map to grow
  */
@@ -652,47 +1397,28 @@ static void
 grow (struct GNUNET_CONTAINER_MultiHashMap *map)
 {
   union MapEntry *old_map;
-  union MapEntry *new_map;
   unsigned int old_len;
-  unsigned int new_len;
-  unsigned int idx;
   unsigned int i;
 
   map->modification_counter++;
 
+  if (NULL != map->old_map)
+    migrate (map,
+             UINT_MAX);
   old_map = map->map;
   old_len = map->map_length;
-  new_len = old_len * 2;
-  new_map = GNUNET_malloc (sizeof (union MapEntry) * new_len);
-  map->map_length = new_len;
-  map->map = new_map;
-  for (i = 0; i < old_len; i++)
+  map->map_length = old_len * 2;
+  map->map = GNUNET_malloc (sizeof (union MapEntry) * map->map_length);
+  if (GNUNET_YES == map->incremental)
   {
-    if (map->use_small_entries)
-    {
-      struct SmallMapEntry *sme;
-
-      while (NULL != (sme = old_map[i].sme))
-      {
-	old_map[i].sme = sme->next;
-	idx = idx_of (map, sme->key);
-	sme->next = new_map[idx].sme;
-	new_map[idx].sme = sme;
-      }
-    }
-    else
-    {
-      struct BigMapEntry *bme;
-
-      while (NULL != (bme = old_map[i].bme))
-      {
-	old_map[i].bme = bme->next;
-	idx = idx_of (map, &bme->key);
-	bme->next = new_map[idx].bme;
-	new_map[idx].bme = bme;
-      }
-    }
+    map->old_map = old_map;
+    map->old_map_length = old_len;
+    map->migrate_pos = 0;
+    return;
   }
+  for (i = 0; i < old_len; i++)
+    rehash_bucket (map,
+                   &old_map[i]);
   GNUNET_free (old_map);
 }
 
@@ -715,14 +1441,49 @@ GNUNET_CONTAINER_multihashmap_put (struct GNUNET_CONTAINER_MultiHashMap *map,
 				   void *value,
                                    enum GNUNET_CONTAINER_MultiHashMapOption opt)
 {
+  union MapEntry *bucket;
   union MapEntry me;
   unsigned int i;
 
-  i = idx_of (map, key);
+  if (NULL != map->ctrl)
+  {
+    if ((opt != GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE) &&
+        (opt != GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST))
+    {
+      struct Probe p;
+
+      probe_start (map, key, &p);
+      i = probe_next (map, &p);
+      if (UINT_MAX != i)
+      {
+        if (opt == GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY)
+          return GNUNET_SYSERR;
+        *oa_value (map, i) = value;
+        return GNUNET_NO;
+      }
+    }
+    if (map->size + map->tombstones >= map->map_length / 8 * 7)
+      oa_rehash (map);
+    i = oa_find_free (map, key);
+    if (CTRL_DELETED == map->ctrl[i])
+      map->tombstones--;
+    map->ctrl[i] = oa_h2 (key);
+    if (map->use_small_entries)
+      ((struct SmallSlot *) map->slots)[i].key = key;
+    else
+      ((struct BigSlot *) map->slots)[i].key = *key;
+    *oa_value (map, i) = value;
+    map->size++;
+    return GNUNET_OK;
+  }
+  if (NULL != map->old_map)
+    migrate (map,
+             MIGRATE_BUCKETS);
+  bucket = bucket_of (map, key);
   if ((opt != GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE) &&
       (opt != GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST))
   {
-    me = map->map[i];
+    me = *bucket;
     if (map->use_small_entries)
     {
       struct SmallMapEntry *sme;
@@ -753,7 +1514,7 @@ GNUNET_CONTAINER_multihashmap_put (struct GNUNET_CONTAINER_MultiHashMap *map,
   if (map->size / 3 >= map->map_length / 4)
   {
     grow (map);
-    i = idx_of (map, key);
+    bucket = bucket_of (map, key);
   }
   if (map->use_small_entries)
   {
@@ -762,8 +1523,8 @@ GNUNET_CONTAINER_multihashmap_put (struct GNUNET_CONTAINER_MultiHashMap *map,
     sme = GNUNET_new (struct SmallMapEntry);
     sme->key = key;
     sme->value = value;
-    sme->next = map->map[i].sme;
-    map->map[i].sme = sme;
+    sme->next = bucket->sme;
+    bucket->sme = sme;
   }
   else
   {
@@ -772,8 +1533,8 @@ GNUNET_CONTAINER_multihashmap_put (struct GNUNET_CONTAINER_MultiHashMap *map,
     bme = GNUNET_new (struct BigMapEntry);
     bme->key = *key;
     bme->value = value;
-    bme->next = map->map[i].bme;
-    map->map[i].bme = bme;
+    bme->next = bucket->bme;
+    bucket->bme = bme;
   }
   map->size++;
   return GNUNET_OK;
@@ -801,7 +1562,21 @@ GNUNET_CONTAINER_multihashmap_get_multiple (const struct
   union MapEntry me;
 
   count = 0;
-  me = map->map[idx_of (map, key)];
+  if (NULL != map->ctrl)
+  {
+    struct Probe p;
+    unsigned int i;
+
+    probe_start (map, key, &p);
+    while (UINT_MAX != (i = probe_next (map, &p)))
+    {
+      if ((it != NULL) && (GNUNET_OK != it (it_cls, key, *oa_value (map, i))))
+        return GNUNET_SYSERR;
+      count++;
+    }
+    return count;
+  }
+  me = *bucket_of (map, key);
   if (map->use_small_entries)
   {
     struct SmallMapEntry *sme;
@@ -842,7 +1617,8 @@ GNUNET_CONTAINER_multihashmap_get_multiple (const struct
  * @ingroup hashmap
  * Call @a it on a random value from the map, or not at all
  * if the map is empty. Note that this function has linear
- * complexity (in the size of the map).
+ * complexity (in the size of the map), except for maps using
+ * open addressing that are not mostly empty.
  *
  * @param map the map
  * @param it function to call on a random entry
@@ -862,11 +1638,45 @@ GNUNET_CONTAINER_multihashmap_get_random (const struct GNUNET_CONTAINER_MultiHas
     return 0;
   if (NULL == it)
     return 1;
+  if (NULL != map->ctrl)
+  {
+    struct GNUNET_HashCode kc;
+
+    /* picking random slots until we hit a full one is uniform
+       over the entries and cheap unless the map is rather empty */
+    for (off = 0; off < RANDOM_PROBES; off++)
+    {
+      idx = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_NONCE,
+                                      map->map_length);
+      if (0 == (map->ctrl[idx] & 0x80))
+        break;
+    }
+    if (RANDOM_PROBES == off)
+    {
+      off = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_NONCE,
+                                      map->size);
+      for (idx = 0; idx < map->map_length; idx++)
+      {
+        if (0 != (map->ctrl[idx] & 0x80))
+          continue;
+        if (0 == off)
+          break;
+        off--;
+      }
+    }
+    GNUNET_assert (idx < map->map_length);
+    kc = *oa_key (map, idx);
+    if (GNUNET_OK != it (it_cls,
+                         &kc,
+                         *oa_value (map, idx)))
+      return GNUNET_SYSERR;
+    return 1;
+  }
   off = GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_NONCE,
                                   map->size);
-  for (idx = 0; idx < map->map_length; idx++)
+  for (idx = 0; idx < bucket_count (map); idx++)
   {
-    me = map->map[idx];
+    me = bucket_at (map, idx);
     if (map->use_small_entries)
     {
       struct SmallMapEntry *sme;
@@ -932,7 +1742,8 @@ GNUNET_CONTAINER_multihashmap_iterator_create (const struct GNUNET_CONTAINER_Mul
   iter = GNUNET_new (struct GNUNET_CONTAINER_MultiHashMapIterator);
   iter->map = map;
   iter->modification_counter = map->modification_counter;
-  iter->me = map->map[0];
+  if (NULL == map->ctrl)
+    iter->me = bucket_at (map, 0);
   return iter;
 }
 
@@ -959,10 +1770,26 @@ GNUNET_CONTAINER_multihashmap_iterator_next (struct GNUNET_CONTAINER_MultiHashMa
   /* make sure the map has not been modified */
   GNUNET_assert (iter->modification_counter == iter->map->modification_counter);
 
+  if (NULL != iter->map->ctrl)
+  {
+    const struct GNUNET_CONTAINER_MultiHashMap *map = iter->map;
+
+    while ( (iter->idx < map->map_length) &&
+            (0 != (map->ctrl[iter->idx] & 0x80)) )
+      iter->idx++;
+    if (iter->idx >= map->map_length)
+      return GNUNET_NO;
+    if (NULL != key)
+      *key = *oa_key (map, iter->idx);
+    if (NULL != value)
+      *value = *oa_value (map, iter->idx);
+    iter->idx++;
+    return GNUNET_YES;
+  }
   /* look for the next entry, skipping empty buckets */
   while (1)
   {
-    if (iter->idx >= iter->map->map_length)
+    if (iter->idx >= bucket_count (iter->map))
       return GNUNET_NO;
     if (GNUNET_YES == iter->map->use_small_entries)
     {
@@ -989,8 +1816,8 @@ GNUNET_CONTAINER_multihashmap_iterator_next (struct GNUNET_CONTAINER_MultiHashMa
       }
     }
     iter->idx += 1;
-    if (iter->idx < iter->map->map_length)
-      iter->me = iter->map->map[iter->idx];
+    if (iter->idx < bucket_count (iter->map))
+      iter->me = bucket_at (iter->map, iter->idx);
   }
 }
 
@@ -26,9 +26,14 @@
 #include "platform.h"
 #include "gnunet_util_lib.h"
 #include <gcrypt.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #define LOG(kind,...) GNUNET_log_from (kind, "util", __VA_ARGS__)
 
+#define LOG_STRERROR(kind,syscall) GNUNET_log_from_strerror (kind, "util", syscall)
+
 #define LOG_STRERROR_FILE(kind,syscall,filename) GNUNET_log_from_strerror_file (kind, "util", syscall, filename)
 
 
@@ -93,6 +98,46 @@ struct GNUNET_CRYPTO_FileHashContext
    */
   size_t bsize;
 
+#if HAVE_PTHREAD_H
+  /**
+   * Worker thread doing the hashing, if #GNUNET_YES == @e threaded.
+   */
+  pthread_t thread;
+
+  /**
+   * Pipe the worker thread uses to tell the scheduler that
+   * it is done, NULL if we are not hashing in a thread.
+   */
+  struct GNUNET_DISK_PipeHandle *done_pipe;
+
+  /**
+   * Result computed by the worker thread.
+   */
+  struct GNUNET_HashCode result;
+
+  /**
+   * Set by the main thread to tell the worker thread to stop.
+   */
+  volatile int cancelled;
+
+  /**
+   * #GNUNET_OK if the worker thread computed @e result,
+   * #GNUNET_SYSERR if reading the file failed.
+   */
+  int status;
+
+  /**
+   * Value of errno if reading the file failed in the worker thread.
+   */
+  int read_errno;
+
+  /**
+   * Value of errno if the worker thread failed to write to the
+   * @e done_pipe, 0 if it did not fail.
+   */
+  int signal_errno;
+#endif
+
 };
 
 
@@ -109,6 +154,10 @@ file_hash_finish (struct GNUNET_CRYPTO_FileHashContext *fhc,
   if (!GNUNET_DISK_handle_invalid (fhc->fh))
     GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (fhc->fh));
   gcry_md_close (fhc->md);
+#if HAVE_PTHREAD_H
+  if (NULL != fhc->done_pipe)
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_pipe_close (fhc->done_pipe));
+#endif
   GNUNET_free (fhc);            /* also frees fhc->buffer */
 }
 
@@ -151,20 +200,18 @@ file_hash_task (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
 
 
 /**
- * Compute the hash of an entire file.
+ * Create a context for hashing a file and open the file.
  *
- * @param priority scheduling priority to use
  * @param filename name of file to hash
- * @param blocksize number of bytes to process in one task
+ * @param blocksize number of bytes to read at once
  * @param callback function to call upon completion
- * @param callback_cls closure for callback
+ * @param callback_cls closure for @a callback
  * @return NULL on (immediate) errror
  */
-struct GNUNET_CRYPTO_FileHashContext *
-GNUNET_CRYPTO_hash_file (enum GNUNET_SCHEDULER_Priority priority,
-                         const char *filename, size_t blocksize,
-                         GNUNET_CRYPTO_HashCompletedCallback callback,
-                         void *callback_cls)
+static struct GNUNET_CRYPTO_FileHashContext *
+file_hash_create (const char *filename, size_t blocksize,
+                  GNUNET_CRYPTO_HashCompletedCallback callback,
+                  void *callback_cls)
 {
   struct GNUNET_CRYPTO_FileHashContext *fhc;
 
@@ -178,12 +225,14 @@ GNUNET_CRYPTO_hash_file (enum GNUNET_SCHEDULER_Priority priority,
   if (GPG_ERR_NO_ERROR != gcry_md_open (&fhc->md, GCRY_MD_SHA512, 0))
   {
     GNUNET_break (0);
+    GNUNET_free (fhc->filename);
     GNUNET_free (fhc);
     return NULL;
   }
   fhc->bsize = blocksize;
   if (GNUNET_OK != GNUNET_DISK_file_size (filename, &fhc->fsize, GNUNET_NO, GNUNET_YES))
   {
+    gcry_md_close (fhc->md);
     GNUNET_free (fhc->filename);
     GNUNET_free (fhc);
     return NULL;
@@ -193,10 +242,36 @@ GNUNET_CRYPTO_hash_file (enum GNUNET_SCHEDULER_Priority priority,
                              GNUNET_DISK_PERM_NONE);
   if (!fhc->fh)
   {
+    gcry_md_close (fhc->md);
     GNUNET_free (fhc->filename);
     GNUNET_free (fhc);
     return NULL;
   }
+  return fhc;
+}
+
+
+/**
+ * Compute the hash of an entire file.
+ *
+ * @param priority scheduling priority to use
+ * @param filename name of file to hash
+ * @param blocksize number of bytes to process in one task
+ * @param callback function to call upon completion
+ * @param callback_cls closure for callback
+ * @return NULL on (immediate) errror
+ */
+struct GNUNET_CRYPTO_FileHashContext *
+GNUNET_CRYPTO_hash_file (enum GNUNET_SCHEDULER_Priority priority,
+                         const char *filename, size_t blocksize,
+                         GNUNET_CRYPTO_HashCompletedCallback callback,
+                         void *callback_cls)
+{
+  struct GNUNET_CRYPTO_FileHashContext *fhc;
+
+  fhc = file_hash_create (filename, blocksize, callback, callback_cls);
+  if (NULL == fhc)
+    return NULL;
   fhc->priority = priority;
   fhc->task =
       GNUNET_SCHEDULER_add_with_priority (priority, &file_hash_task, fhc);
@@ -204,6 +279,151 @@ GNUNET_CRYPTO_hash_file (enum GNUNET_SCHEDULER_Priority priority,
 }
 
 
+#if HAVE_PTHREAD_H
+/**
+ * Main function of the worker thread.  Reads and hashes the
+ * file, asking the kernel to read ahead the next block while
+ * we hash the current one, and then signals the scheduler
+ * thread via the @e done_pipe.  Must not use the scheduler
+ * or the logging functions, as those are not thread-safe.
+ *
+ * @param cls the `struct GNUNET_CRYPTO_FileHashContext`
+ * @return NULL
+ */
+static void *
+file_hash_thread (void *cls)
+{
+  struct GNUNET_CRYPTO_FileHashContext *fhc = cls;
+  size_t delta;
+
+#if HAVE_POSIX_FADVISE && !WINDOWS
+  (void) posix_fadvise (fhc->fh->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  fhc->status = GNUNET_OK;
+  while ( (fhc->offset < fhc->fsize) &&
+          (! fhc->cancelled) )
+  {
+    delta = fhc->bsize;
+    if (fhc->fsize - fhc->offset < delta)
+      delta = fhc->fsize - fhc->offset;
+#if HAVE_POSIX_FADVISE && !WINDOWS
+    if (fhc->offset + delta < fhc->fsize)
+      (void) posix_fadvise (fhc->fh->fd, fhc->offset + delta, fhc->bsize,
+                            POSIX_FADV_WILLNEED);
+#endif
+    if (delta != GNUNET_DISK_file_read (fhc->fh, fhc->buffer, delta))
+    {
+      fhc->read_errno = errno;
+      fhc->status = GNUNET_SYSERR;
+      break;
+    }
+    gcry_md_write (fhc->md, fhc->buffer, delta);
+    fhc->offset += delta;
+  }
+  if ( (GNUNET_OK == fhc->status) &&
+       (! fhc->cancelled) )
+    memcpy (&fhc->result,
+            gcry_md_read (fhc->md, GCRY_MD_SHA512),
+            sizeof (struct GNUNET_HashCode));
+  /* errors are logged by the scheduler thread */
+  if (1 !=
+      GNUNET_DISK_file_write (GNUNET_DISK_pipe_handle (fhc->done_pipe,
+                                                       GNUNET_DISK_PIPE_END_WRITE),
+                              "", 1))
+    fhc->signal_errno = (0 != errno) ? errno : EIO;
+  return NULL;
+}
+
+
+/**
+ * The worker thread is done, report the result on the
+ * scheduler thread.
+ *
+ * @param cls the `struct GNUNET_CRYPTO_FileHashContext`
+ * @param tc scheduler context
+ */
+static void
+file_hash_done (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct GNUNET_CRYPTO_FileHashContext *fhc = cls;
+
+  fhc->task = NULL;
+  GNUNET_break (0 == pthread_join (fhc->thread, NULL));
+  if (GNUNET_OK != fhc->status)
+  {
+    errno = fhc->read_errno;
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING, "read", fhc->filename);
+    file_hash_finish (fhc, NULL);
+    return;
+  }
+  file_hash_finish (fhc, &fhc->result);
+}
+#endif
+
+
+/**
+ * Compute the hash of an entire file in a worker thread.  Unlike
+ * #GNUNET_CRYPTO_hash_file(), the scheduler is not involved while the
+ * file is read and hashed, so large files are hashed at the speed of
+ * the disk or the CPU.  The @a callback is still invoked from the
+ * scheduler.  If threads are not available, this is the same as
+ * #GNUNET_CRYPTO_hash_file().
+ *
+ * @param priority scheduling priority to use for the @a callback
+ * @param filename name of file to hash
+ * @param blocksize number of bytes to read at once
+ * @param callback function to call upon completion
+ * @param callback_cls closure for @a callback
+ * @return NULL on (immediate) errror
+ */
+struct GNUNET_CRYPTO_FileHashContext *
+GNUNET_CRYPTO_hash_file_threaded (enum GNUNET_SCHEDULER_Priority priority,
+                                  const char *filename, size_t blocksize,
+                                  GNUNET_CRYPTO_HashCompletedCallback callback,
+                                  void *callback_cls)
+{
+#if HAVE_PTHREAD_H
+  struct GNUNET_CRYPTO_FileHashContext *fhc;
+  int ret;
+
+  fhc = file_hash_create (filename, blocksize, callback, callback_cls);
+  if (NULL == fhc)
+    return NULL;
+  fhc->priority = priority;
+  fhc->done_pipe = GNUNET_DISK_pipe (GNUNET_NO, GNUNET_NO, GNUNET_NO, GNUNET_NO);
+  if (NULL == fhc->done_pipe)
+  {
+    GNUNET_break (0);
+    fhc->task =
+        GNUNET_SCHEDULER_add_with_priority (priority, &file_hash_task, fhc);
+    return fhc;
+  }
+  ret = pthread_create (&fhc->thread, NULL, &file_hash_thread, fhc);
+  if (0 != ret)
+  {
+    errno = ret;
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING, "pthread_create", filename);
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_pipe_close (fhc->done_pipe));
+    fhc->done_pipe = NULL;
+    fhc->task =
+        GNUNET_SCHEDULER_add_with_priority (priority, &file_hash_task, fhc);
+    return fhc;
+  }
+  fhc->task =
+      GNUNET_SCHEDULER_add_file_with_priority (GNUNET_TIME_UNIT_FOREVER_REL,
+                                               priority,
+                                               GNUNET_DISK_pipe_handle (fhc->done_pipe,
+                                                                        GNUNET_DISK_PIPE_END_READ),
+                                               GNUNET_YES, GNUNET_NO,
+                                               &file_hash_done, fhc);
+  return fhc;
+#else
+  return GNUNET_CRYPTO_hash_file (priority, filename, blocksize,
+                                  callback, callback_cls);
+#endif
+}
+
+
 /**
  * Cancel a file hashing operation.
  *
@@ -213,8 +433,23 @@ void
 GNUNET_CRYPTO_hash_file_cancel (struct GNUNET_CRYPTO_FileHashContext *fhc)
 {
   GNUNET_SCHEDULER_cancel (fhc->task);
+#if HAVE_PTHREAD_H
+  if (NULL != fhc->done_pipe)
+  {
+    /* task is the completion task, so the thread may still be running */
+    fhc->cancelled = GNUNET_YES;
+    GNUNET_break (0 == pthread_join (fhc->thread, NULL));
+    if (0 != fhc->signal_errno)
+    {
+      errno = fhc->signal_errno;
+      LOG_STRERROR (GNUNET_ERROR_TYPE_WARNING, "write");
+    }
+    GNUNET_break (GNUNET_OK == GNUNET_DISK_pipe_close (fhc->done_pipe));
+  }
+#endif
   GNUNET_free (fhc->filename);
   GNUNET_break (GNUNET_OK == GNUNET_DISK_file_close (fhc->fh));
+  gcry_md_close (fhc->md);
   GNUNET_free (fhc);
 }
 
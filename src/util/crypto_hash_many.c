@@ -0,0 +1,408 @@
+/*
+     This file is part of GNUnet.
+     Copyright (C) 2016 GNUnet e.V.
+
+     GNUnet is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with GNUnet; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+
+*/
+/**
+ * @file util/crypto_hash_many.c
+ * @brief hash many blocks at once with a multi-buffer SHA-512
+ *
+ * The SHA-512 compression function is run on #LANES independent
+ * messages at once, with one message per 64-bit lane of an AVX2
+ * register.  This is faster than hashing short messages one after the
+ * other, where libgcrypt spends much of its time setting up and
+ * finishing the hash context, and also beats libgcrypt for long
+ * messages as long as all lanes are busy, i.e. if the messages have
+ * the same length (such as the DBLOCKs of a file).  The code uses the
+ * vector extensions of
+ * GCC (and clang) and is compiled for AVX2 regardless of the target,
+ * but only used if the CPU supports AVX2; narrower vectors are not
+ * faster than libgcrypt, so otherwise (and for other compilers and
+ * CPUs) we just hash the messages one by one.
+ */
+#include "platform.h"
+#include "gnunet_crypto_lib.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_MULTI_BUFFER 1
+#else
+#define HAVE_MULTI_BUFFER 0
+#endif
+
+#if HAVE_MULTI_BUFFER
+
+/**
+ * Number of messages we hash at the same time.
+ */
+#define LANES 4
+
+/**
+ * Size of a SHA-512 block.
+ */
+#define BLOCK_SIZE 128
+
+/**
+ * Messages longer than this are only hashed together with messages
+ * of the same number of blocks: libgcrypt is fast for long messages,
+ * so it only pays off if no lane idles while the others finish.
+ */
+#define MAX_MULTI_SIZE (8 * BLOCK_SIZE)
+
+/**
+ * One 64-bit word of each of the #LANES messages.
+ */
+typedef uint64_t lane_t __attribute__ ((vector_size (LANES * sizeof (uint64_t))));
+
+
+/**
+ * SHA-512 round constants.
+ */
+static const uint64_t K[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+  0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+  0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+  0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+  0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+  0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+  0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+  0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+  0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+  0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+  0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+  0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+  0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+  0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+  0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+  0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+  0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+  0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+  0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+  0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+  0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+
+/**
+ * SHA-512 initial hash value.
+ */
+static const uint64_t H0[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+  0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+
+/**
+ * Block we feed to lanes that have no message (left).
+ */
+static const uint8_t zero_block[BLOCK_SIZE];
+
+
+/**
+ * Messages that wait to be hashed together by hash_lanes().
+ */
+struct LaneGroup
+{
+  /**
+   * The messages.
+   */
+  const void *blocks[LANES];
+
+  /**
+   * Sizes of the messages.
+   */
+  size_t sizes[LANES];
+
+  /**
+   * Where to write the hash codes.
+   */
+  struct GNUNET_HashCode *ret[LANES];
+
+  /**
+   * Number of messages in the group.
+   */
+  unsigned int n;
+
+  /**
+   * Number of SHA-512 blocks of each message, only used for
+   * groups of long messages.
+   */
+  unsigned int nblocks;
+};
+
+
+#define ROTR(x,n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SIGMA0(x) (ROTR (x, 28) ^ ROTR (x, 34) ^ ROTR (x, 39))
+#define SIGMA1(x) (ROTR (x, 14) ^ ROTR (x, 18) ^ ROTR (x, 41))
+#define GAMMA0(x) (ROTR (x, 1) ^ ROTR (x, 8) ^ ((x) >> 7))
+#define GAMMA1(x) (ROTR (x, 19) ^ ROTR (x, 61) ^ ((x) >> 6))
+
+
+/**
+ * Get a block of a message, including the SHA-512 padding.
+ *
+ * @param msg the message
+ * @param size number of bytes in @a msg
+ * @param idx index of the block
+ * @param buf buffer to use for blocks that need padding
+ * @return the block, either in @a msg or in @a buf
+ */
+static const uint8_t *
+get_block (const char *msg,
+           size_t size,
+           unsigned int idx,
+           uint8_t buf[BLOCK_SIZE])
+{
+  size_t off;
+  size_t len;
+  uint64_t bits;
+  unsigned int i;
+
+  off = (size_t) idx * BLOCK_SIZE;
+  if (off + BLOCK_SIZE <= size)
+    return (const uint8_t *) &msg[off];
+  memset (buf, 0, BLOCK_SIZE);
+  len = 0;
+  if (off <= size)
+  {
+    len = size - off;
+    memcpy (buf, &msg[off], len);
+    buf[len] = 0x80;
+  }
+  if (idx == (size + 16) / BLOCK_SIZE)
+  {
+    /* last block: the length in bits, big endian, in the last 16 bytes
+       (we only support lengths that fit into 64 bits) */
+    bits = (uint64_t) size * 8;
+    for (i = 0; i < 8; i++)
+      buf[BLOCK_SIZE - 1 - i] = (uint8_t) (bits >> (8 * i));
+  }
+  return buf;
+}
+
+
+/**
+ * Hash up to #LANES messages of at most #MAX_MULTI_SIZE bytes
+ * with one SHA-512 computation per vector lane.
+ *
+ * @param blocks the messages
+ * @param sizes the sizes of the messages
+ * @param n number of messages, at most #LANES
+ * @param ret where to write the hash codes
+ */
+static void __attribute__ ((target ("avx2")))
+hash_lanes (const void *const *blocks,
+            const size_t *sizes,
+            unsigned int n,
+            struct GNUNET_HashCode **ret)
+{
+  uint8_t buf[LANES][BLOCK_SIZE];
+  const uint8_t *block[LANES];
+  unsigned int nblocks[LANES];
+  unsigned int max_blocks;
+  lane_t W[80];
+  lane_t H[8];
+  lane_t a, b, c, d, e, f, g, h;
+  lane_t t1, t2;
+  lane_t active;
+  unsigned int lane;
+  unsigned int idx;
+  unsigned int t;
+  unsigned int i;
+
+  max_blocks = 0;
+  for (lane = 0; lane < LANES; lane++)
+  {
+    nblocks[lane] = (lane < n) ? (sizes[lane] + 16) / BLOCK_SIZE + 1 : 0;
+    max_blocks = GNUNET_MAX (max_blocks, nblocks[lane]);
+  }
+  for (i = 0; i < 8; i++)
+    for (lane = 0; lane < LANES; lane++)
+      H[i][lane] = H0[i];
+  for (idx = 0; idx < max_blocks; idx++)
+  {
+    for (lane = 0; lane < LANES; lane++)
+    {
+      if (idx < nblocks[lane])
+      {
+        block[lane] = get_block (blocks[lane], sizes[lane], idx, buf[lane]);
+        active[lane] = UINT64_MAX;
+      }
+      else
+      {
+        /* lane is done, hash zeros and discard the result */
+        block[lane] = zero_block;
+        active[lane] = 0;
+      }
+    }
+    for (t = 0; t < 16; t++)
+      for (lane = 0; lane < LANES; lane++)
+      {
+        uint64_t w;
+
+        memcpy (&w, &block[lane][t * 8], sizeof (w));
+        W[t][lane] = __builtin_bswap64 (w); /* x86 is little endian */
+      }
+    for (t = 16; t < 80; t++)
+      W[t] = GAMMA1 (W[t - 2]) + W[t - 7] + GAMMA0 (W[t - 15]) + W[t - 16];
+    a = H[0]; b = H[1]; c = H[2]; d = H[3];
+    e = H[4]; f = H[5]; g = H[6]; h = H[7];
+    for (t = 0; t < 80; t++)
+    {
+      t1 = h + SIGMA1 (e) + CH (e, f, g) + K[t] + W[t];
+      t2 = SIGMA0 (a) + MAJ (a, b, c);
+      h = g; g = f; f = e;
+      e = d + t1;
+      d = c; c = b; b = a;
+      a = t1 + t2;
+    }
+    /* lanes that are done keep their state */
+    H[0] += a & active; H[1] += b & active;
+    H[2] += c & active; H[3] += d & active;
+    H[4] += e & active; H[5] += f & active;
+    H[6] += g & active; H[7] += h & active;
+  }
+  for (lane = 0; lane < n; lane++)
+    for (i = 0; i < 8; i++)
+    {
+      ret[lane]->bits[2 * i] = htonl ((uint32_t) (H[i][lane] >> 32));
+      ret[lane]->bits[2 * i + 1] = htonl ((uint32_t) H[i][lane]);
+    }
+}
+
+
+/**
+ * Hash the messages of a group and empty it.
+ *
+ * @param g the group
+ */
+static void
+group_flush (struct LaneGroup *g)
+{
+  if (1 == g->n)
+    GNUNET_CRYPTO_hash (g->blocks[0], g->sizes[0], g->ret[0]);
+  else if (g->n > 1)
+    hash_lanes (g->blocks, g->sizes, g->n, g->ret);
+  g->n = 0;
+}
+
+
+/**
+ * Add a message to a group, hashing the group once it is full.
+ *
+ * @param g the group
+ * @param block the message
+ * @param size size of @a block
+ * @param ret where to write the hash code
+ */
+static void
+group_add (struct LaneGroup *g,
+           const void *block,
+           size_t size,
+           struct GNUNET_HashCode *ret)
+{
+  g->blocks[g->n] = block;
+  g->sizes[g->n] = size;
+  g->ret[g->n] = ret;
+  if (LANES == ++g->n)
+    group_flush (g);
+}
+
+
+/**
+ * Hash many blocks, grouping short ones and long ones of the
+ * same length into batches of #LANES for hash_lanes().
+ *
+ * @param blocks the data to hash
+ * @param sizes sizes of the @a blocks
+ * @param count number of blocks
+ * @param ret where to write the hash codes, @a count of them
+ */
+static void
+hash_many_lanes (const void *const *blocks,
+                 const size_t *sizes,
+                 unsigned int count,
+                 struct GNUNET_HashCode *ret)
+{
+  struct LaneGroup short_group;
+  struct LaneGroup long_group;
+  unsigned int nblocks;
+  unsigned int i;
+
+  short_group.n = 0;
+  long_group.n = 0;
+  long_group.nblocks = 0;
+  for (i = 0; i < count; i++)
+  {
+    if (sizes[i] <= MAX_MULTI_SIZE)
+    {
+      group_add (&short_group, blocks[i], sizes[i], &ret[i]);
+      continue;
+    }
+    nblocks = (sizes[i] + 16) / BLOCK_SIZE + 1;
+    if (nblocks != long_group.nblocks)
+      group_flush (&long_group);
+    long_group.nblocks = nblocks;
+    group_add (&long_group, blocks[i], sizes[i], &ret[i]);
+  }
+  group_flush (&short_group);
+  group_flush (&long_group);
+}
+
+#endif
+
+
+/**
+ * Compute the hashes of many blocks.  Produces the same results as
+ * calling #GNUNET_CRYPTO_hash() on each block, but is faster for
+ * many short blocks (or many blocks of the same size) if the CPU
+ * supports AVX2, as several blocks are then hashed at the same time.
+ *
+ * @param blocks the data to hash
+ * @param sizes sizes of the @a blocks
+ * @param count number of blocks
+ * @param ret where to write the hash codes, @a count of them
+ */
+void
+GNUNET_CRYPTO_hash_many (const void *const *blocks,
+                         const size_t *sizes,
+                         unsigned int count,
+                         struct GNUNET_HashCode *ret)
+{
+  unsigned int i;
+
+#if HAVE_MULTI_BUFFER
+  if (__builtin_cpu_supports ("avx2"))
+  {
+    hash_many_lanes (blocks, sizes, count, ret);
+    return;
+  }
+#endif
+  for (i = 0; i < count; i++)
+    GNUNET_CRYPTO_hash (blocks[i], sizes[i], &ret[i]);
+}
+
+/* end of crypto_hash_many.c */
@@ -2020,6 +2020,50 @@ GNUNET_DISK_file_unmap (struct GNUNET_DISK_MapHandle *h)
 }
 
 
+/**
+ * Write changes to a range of a memory-mapped file to disk.
+ *
+ * @param h mapping handle
+ * @param off offset of the range in the mapping
+ * @param len length of the range
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR otherwise
+ */
+int
+GNUNET_DISK_file_map_sync (struct GNUNET_DISK_MapHandle *h,
+                           size_t off,
+                           size_t len)
+{
+  if (h == NULL)
+  {
+    errno = EINVAL;
+    return GNUNET_SYSERR;
+  }
+
+#ifdef MINGW
+  if (! FlushViewOfFile ((char *) h->addr + off, len))
+  {
+    SetErrnoFromWinError (GetLastError ());
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+#else
+  {
+    size_t page;
+    size_t start;
+    size_t end;
+
+    /* msync() wants a page-aligned address */
+    page = (size_t) sysconf (_SC_PAGESIZE);
+    start = off - off % page;
+    end = GNUNET_MIN (off + len, h->len);
+    return (-1 == msync ((char *) h->addr + start,
+                         end - start,
+                         MS_SYNC)) ? GNUNET_SYSERR : GNUNET_OK;
+  }
+#endif
+}
+
+
 /**
  * Write file changes to disk
  * @param h handle to an open file
@@ -2049,6 +2093,55 @@ GNUNET_DISK_file_sync (const struct GNUNET_DISK_FileHandle *h)
 }
 
 
+/**
+ * Write the directory entries of the directory that contains
+ * @a filename to disk, so that creating, renaming or removing
+ * @a filename survives a crash.
+ *
+ * @param filename name of a file in the directory
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR otherwise
+ */
+int
+GNUNET_DISK_directory_sync_for_file (const char *filename)
+{
+#ifdef MINGW
+  /* directory entries are written with the file on W32 */
+  return GNUNET_OK;
+#else
+  char *rdir;
+  size_t len;
+  int fd;
+  int ret;
+
+  rdir = GNUNET_STRINGS_filename_expand (filename);
+  if (NULL == rdir)
+    return GNUNET_SYSERR;
+  len = strlen (rdir);
+  while ((len > 0) && (rdir[len] != DIR_SEPARATOR))
+    len--;
+  rdir[len] = '\0';
+  if (0 == len)
+  {
+    GNUNET_free (rdir);
+    rdir = GNUNET_strdup ("/");
+  }
+  fd = open (rdir, O_RDONLY);
+  if (-1 == fd)
+  {
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING, "open", rdir);
+    GNUNET_free (rdir);
+    return GNUNET_SYSERR;
+  }
+  ret = (0 == fsync (fd)) ? GNUNET_OK : GNUNET_SYSERR;
+  if (GNUNET_OK != ret)
+    LOG_STRERROR_FILE (GNUNET_ERROR_TYPE_WARNING, "fsync", rdir);
+  GNUNET_break (0 == close (fd));
+  GNUNET_free (rdir);
+  return ret;
+#endif
+}
+
+
 #if WINDOWS
 #ifndef PIPE_BUF
 #define PIPE_BUF        512
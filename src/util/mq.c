@@ -63,9 +63,66 @@ struct GNUNET_MQ_Envelope
    * Closure for @e send_cb
    */
   void *sent_cls;
+
+  /**
+   * Size class of the envelope (index into #pools), or
+   * #POOL_CLASSES if the envelope is not pooled.
+   */
+  unsigned int pool_class;
+};
+
+
+/**
+ * Number of size classes for pooled envelopes.  Class @e i holds
+ * envelopes with room for messages of up to (#POOL_MIN_SIZE << i)
+ * bytes, larger messages are never pooled.
+ */
+#define POOL_CLASSES 7
+
+/**
+ * Maximum message size of the smallest size class.
+ */
+#define POOL_MIN_SIZE 64
+
+/**
+ * Maximum number of unused envelopes kept per size class.
+ */
+#define POOL_MAX 64
+
+/**
+ * Pool of unused envelopes of one size class.
+ */
+struct EnvelopePool
+{
+  /**
+   * Unused envelopes (linked via their @e next field).
+   */
+  struct GNUNET_MQ_Envelope *head;
+
+  /**
+   * Number of envelopes in the pool.
+   */
+  unsigned int size;
 };
 
 
+/**
+ * Pools of unused envelopes, by size class.  Like the rest
+ * of MQ, this is not thread-safe.
+ */
+static struct EnvelopePool pools[POOL_CLASSES];
+
+/**
+ * Number of envelopes allocated with malloc().
+ */
+static unsigned long long pool_allocs;
+
+/**
+ * Number of envelopes taken from the #pools.
+ */
+static unsigned long long pool_hits;
+
+
 /**
  * Handle to a message queue.
  */
@@ -255,11 +312,98 @@ GNUNET_MQ_inject_error (struct GNUNET_MQ_Handle *mq,
 }
 
 
+/**
+ * Allocate a (zero-initialized) envelope with room for a message of
+ * @a size bytes, re-using an envelope from the #pools if possible.
+ *
+ * @param size size of the message
+ * @return the new envelope
+ */
+static struct GNUNET_MQ_Envelope *
+envelope_create (uint16_t size)
+{
+  struct GNUNET_MQ_Envelope *ev;
+  struct EnvelopePool *pool;
+  unsigned int pc;
+
+  for (pc = 0; pc < POOL_CLASSES; pc++)
+    if (size <= (POOL_MIN_SIZE << pc))
+      break;
+  if (POOL_CLASSES == pc)
+  {
+    pool_allocs++;
+    ev = GNUNET_malloc (sizeof (struct GNUNET_MQ_Envelope) + size);
+    ev->pool_class = POOL_CLASSES;
+    return ev;
+  }
+  pool = &pools[pc];
+  if (NULL == (ev = pool->head))
+  {
+    pool_allocs++;
+    ev = GNUNET_malloc (sizeof (struct GNUNET_MQ_Envelope) + (POOL_MIN_SIZE << pc));
+    ev->pool_class = pc;
+    return ev;
+  }
+  pool->head = ev->next;
+  pool->size--;
+  pool_hits++;
+  memset (ev, 0, sizeof (struct GNUNET_MQ_Envelope) + size);
+  ev->pool_class = pc;
+  return ev;
+}
+
+
+/**
+ * Free an envelope, keeping it in the #pools if possible.
+ *
+ * @param ev envelope to free
+ */
+static void
+envelope_destroy (struct GNUNET_MQ_Envelope *ev)
+{
+  struct EnvelopePool *pool;
+
+  if ( (POOL_CLASSES == ev->pool_class) ||
+       (pools[ev->pool_class].size >= POOL_MAX) )
+  {
+    GNUNET_free (ev);
+    return;
+  }
+  pool = &pools[ev->pool_class];
+  ev->next = pool->head;
+  pool->head = ev;
+  pool->size++;
+}
+
+
+/**
+ * Obtain statistics about the pool of envelopes MQ keeps
+ * for re-use.
+ *
+ * @param[out] allocs set to the number of envelopes allocated with malloc()
+ * @param[out] hits set to the number of envelopes taken from the pool
+ * @param[out] pooled set to the number of envelopes currently in the pool
+ */
+void
+GNUNET_MQ_get_pool_stats (unsigned long long *allocs,
+                          unsigned long long *hits,
+                          unsigned int *pooled)
+{
+  unsigned int pc;
+
+  *allocs = pool_allocs;
+  *hits = pool_hits;
+  *pooled = 0;
+  for (pc = 0; pc < POOL_CLASSES; pc++)
+    *pooled += pools[pc].size;
+}
+
+
 void
 GNUNET_MQ_discard (struct GNUNET_MQ_Envelope *mqm)
 {
   GNUNET_assert (NULL == mqm->parent_queue);
-  GNUNET_free (mqm);
+  envelope_destroy (mqm);
 }
 
 
@@ -329,7 +473,7 @@ impl_send_continue (void *cls,
   }
   if (NULL != current_envelope->sent_cb)
     current_envelope->sent_cb (current_envelope->sent_cls);
-  GNUNET_free (current_envelope);
+  envelope_destroy (current_envelope);
 }
 
 
@@ -433,7 +577,7 @@ GNUNET_MQ_msg_ (struct GNUNET_MessageHeader **mhp,
 {
   struct GNUNET_MQ_Envelope *mqm;
 
-  mqm = GNUNET_malloc (sizeof *mqm + size);
+  mqm = envelope_create (size);
   mqm->mh = (struct GNUNET_MessageHeader *) &mqm[1];
   mqm->mh->size = htons (size);
   mqm->mh->type = htons (type);
@@ -875,7 +1019,7 @@ GNUNET_MQ_send_cancel (struct GNUNET_MQ_Envelope *ev)
 
   ev->parent_queue = NULL;
   ev->mh = NULL;
-  GNUNET_free (ev);
+  envelope_destroy (ev);
 }
 
 /* end of mq.c */
@@ -349,7 +349,10 @@ socket_set_nodelay (const struct GNUNET_NETWORK_Handle *h)
  * Perform proper canonical initialization for a network handle.
  * Set it to non-blocking, make it non-inheritable to child
  * processes, disable SIGPIPE, enable "nodelay" (if non-UNIX
- * stream socket) and check that it is smaller than FD_SETSIZE.
+ * stream socket) and check that it is smaller than FD_SETSIZE
+ * (unless the scheduler can use epoll, which has no such limit;
+ * sockets beyond FD_SETSIZE are then only refused by
+ * #GNUNET_NETWORK_fdset_set()).
  *
  * @param h socket to initialize
  * @param af address family of the socket
@@ -376,7 +379,7 @@ initialize_network_handle (struct GNUNET_NETWORK_Handle *h,
     errno = eno;
     return GNUNET_SYSERR;
   }
-#ifndef MINGW
+#if ! (defined(MINGW) || HAVE_SYS_EPOLL_H)
   if (h->fd >= FD_SETSIZE)
   {
     GNUNET_break (GNUNET_OK == GNUNET_NETWORK_socket_close (h));
@@ -1108,7 +1111,9 @@ GNUNET_NETWORK_fdset_zero (struct GNUNET_NETWORK_FDSet *fds)
 
 
 /**
- * Add a socket to the FD set
+ * Add a socket to the FD set.  Sockets beyond FD_SETSIZE do not fit
+ * into the set, trying to add one is reported as an error and leaves
+ * the set unchanged.
  *
  * @param fds fd set
  * @param desc socket to add
@@ -1117,6 +1122,17 @@ void
 GNUNET_NETWORK_fdset_set (struct GNUNET_NETWORK_FDSet *fds,
                           const struct GNUNET_NETWORK_Handle *desc)
 {
+#ifndef MINGW
+  if (desc->fd >= FD_SETSIZE)
+  {
+    LOG (GNUNET_ERROR_TYPE_ERROR,
+         _("Socket %d does not fit into an FD set (FD_SETSIZE is %d)\n"),
+         desc->fd,
+         FD_SETSIZE);
+    GNUNET_break (0);
+    return;
+  }
+#endif
   FD_SET (desc->fd,
           &fds->sds);
   fds->nsds = GNUNET_MAX (fds->nsds,
@@ -1135,6 +1151,10 @@ int
 GNUNET_NETWORK_fdset_isset (const struct GNUNET_NETWORK_FDSet *fds,
                             const struct GNUNET_NETWORK_Handle *desc)
 {
+#ifndef MINGW
+  if (desc->fd >= FD_SETSIZE)
+    return 0;
+#endif
   return FD_ISSET (desc->fd,
                    &fds->sds);
 }
@@ -1298,6 +1318,7 @@ GNUNET_NETWORK_fdset_test_native (const struct GNUNET_NETWORK_FDSet *to,
                                   int nfd)
 {
   if ( (-1 == nfd) ||
+       (nfd >= FD_SETSIZE) ||
        (NULL == to) )
     return GNUNET_NO;
   return FD_ISSET (nfd, &to->sds) ? GNUNET_YES : GNUNET_NO;
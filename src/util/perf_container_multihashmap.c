@@ -0,0 +1,193 @@
+/*
+     This file is part of GNUnet.
+     Copyright (C) 2016 GNUnet e.V.
+
+     GNUnet is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with GNUnet; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file util/perf_container_multihashmap.c
+ * @brief measure performance of the multihashmap implementations
+ */
+#include "platform.h"
+#include "gnunet_util_lib.h"
+#include <gauger.h>
+
+/**
+ * How many keys do we put into the map?
+ */
+#define NUM_KEYS (1024 * 1024)
+
+/**
+ * How many lookups do we do?
+ */
+#define NUM_LOOKUPS (4 * NUM_KEYS)
+
+
+static int
+count_cb (void *cls,
+          const struct GNUNET_HashCode *key,
+          void *value)
+{
+  unsigned int *cnt = cls;
+
+  (*cnt)++;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Print and report to gauger how long an operation took.
+ *
+ * @param impl name of the implementation
+ * @param op name of the operation
+ * @param ops number of operations
+ * @param start when the operations started
+ */
+static void
+report (const char *impl,
+        const char *op,
+        unsigned int ops,
+        struct GNUNET_TIME_Absolute start)
+{
+  struct GNUNET_TIME_Relative duration;
+  char *name;
+
+  duration = GNUNET_TIME_absolute_get_duration (start);
+  printf ("%s: %u %s took %s\n",
+          impl,
+          ops,
+          op,
+          GNUNET_STRINGS_relative_time_to_string (duration,
+                                                  GNUNET_YES));
+  GNUNET_asprintf (&name,
+                   "Multihashmap %s (%s)",
+                   op,
+                   impl);
+  GAUGER ("UTIL", name,
+          ops / 1024 / (1 + duration.rel_value_us / 1000LL), "kops/ms");
+  GNUNET_free (name);
+}
+
+
+/**
+ * Run the same workload as the test case (put, get, get_multiple,
+ * iterate, remove) on a large map.
+ *
+ * @param impl name of the implementation
+ * @param flags implementation to use
+ * @param keys the keys to use
+ * @param perm random permutation of the key indices, used for lookups
+ * @return 0 on success
+ */
+static int
+perfMap (const char *impl,
+         enum GNUNET_CONTAINER_MultiHashMapFlags flags,
+         const struct GNUNET_HashCode *keys,
+         const unsigned int *perm)
+{
+  struct GNUNET_CONTAINER_MultiHashMap *m;
+  const struct GNUNET_HashCode *key;
+  struct GNUNET_TIME_Absolute start;
+  unsigned int cnt;
+  unsigned int i;
+
+  m = GNUNET_CONTAINER_multihashmap_create_with_flags (16,
+                                                       GNUNET_NO,
+                                                       flags);
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < NUM_KEYS; i++)
+    GNUNET_assert (GNUNET_OK ==
+                   GNUNET_CONTAINER_multihashmap_put (m,
+                                                      &keys[i],
+                                                      (void *) &keys[i],
+                                                      GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY));
+  report (impl, "put", NUM_KEYS, start);
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < NUM_LOOKUPS; i++)
+  {
+    key = &keys[perm[i % NUM_KEYS]];
+    GNUNET_assert (key ==
+                   GNUNET_CONTAINER_multihashmap_get (m,
+                                                      key));
+  }
+  report (impl, "get", NUM_LOOKUPS, start);
+  start = GNUNET_TIME_absolute_get ();
+  cnt = 0;
+  for (i = 0; i < NUM_LOOKUPS; i++)
+    GNUNET_CONTAINER_multihashmap_get_multiple (m,
+                                                &keys[perm[i % NUM_KEYS]],
+                                                &count_cb,
+                                                &cnt);
+  GNUNET_assert (NUM_LOOKUPS == cnt);
+  report (impl, "get_multiple", NUM_LOOKUPS, start);
+  start = GNUNET_TIME_absolute_get ();
+  cnt = 0;
+  GNUNET_CONTAINER_multihashmap_iterate (m,
+                                         &count_cb,
+                                         &cnt);
+  GNUNET_assert (NUM_KEYS == cnt);
+  report (impl, "iterate", NUM_KEYS, start);
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < NUM_KEYS; i++)
+  {
+    key = &keys[perm[i]];
+    GNUNET_assert (GNUNET_YES ==
+                   GNUNET_CONTAINER_multihashmap_remove (m,
+                                                         key,
+                                                         key));
+  }
+  report (impl, "remove", NUM_KEYS, start);
+  GNUNET_CONTAINER_multihashmap_destroy (m);
+  return 0;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  struct GNUNET_HashCode *keys;
+  unsigned int *perm;
+  unsigned int i;
+  int ret;
+
+  GNUNET_log_setup ("perf-container-multihashmap",
+                    "WARNING",
+                    NULL);
+  keys = GNUNET_malloc_large (NUM_KEYS * sizeof (struct GNUNET_HashCode));
+  GNUNET_assert (NULL != keys);
+  for (i = 0; i < NUM_KEYS; i++)
+    GNUNET_CRYPTO_hash (&i, sizeof (i), &keys[i]);
+  perm = GNUNET_CRYPTO_random_permute (GNUNET_CRYPTO_QUALITY_WEAK,
+                                       NUM_KEYS);
+  ret = perfMap ("chained",
+                 GNUNET_CONTAINER_MULTIHASHMAPFLAG_NONE,
+                 keys,
+                 perm);
+  ret += perfMap ("incremental",
+                  GNUNET_CONTAINER_MULTIHASHMAPFLAG_INCREMENTAL_RESIZE,
+                  keys,
+                  perm);
+  ret += perfMap ("open addressing",
+                  GNUNET_CONTAINER_MULTIHASHMAPFLAG_OPEN_ADDRESSING,
+                  keys,
+                  perm);
+  GNUNET_free (perm);
+  GNUNET_free (keys);
+  return ret;
+}
+
+/* end of perf_container_multihashmap.c */
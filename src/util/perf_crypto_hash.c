@@ -55,6 +55,26 @@ perfHashSmall ()
 }
 
 
+static void
+perfHashMany (unsigned int batch)
+{
+  struct GNUNET_HashCode hc[256];
+  const void *blocks[256];
+  size_t sizes[256];
+  unsigned int i;
+  char buf[64];
+
+  memset (buf, 1, sizeof (buf));
+  for (i = 0; i < batch; i++)
+  {
+    blocks[i] = buf;
+    sizes[i] = sizeof (buf);
+  }
+  for (i = 0; i < 64 * 1024 / batch; i++)
+    GNUNET_CRYPTO_hash_many (blocks, sizes, batch, hc);
+}
+
+
 static void
 perfHKDF ()
 {
@@ -79,6 +99,9 @@ int
 main (int argc, char *argv[])
 {
   struct GNUNET_TIME_Absolute start;
+  struct GNUNET_TIME_Relative delta;
+  unsigned int batch;
+  char gstr[64];
 
   start = GNUNET_TIME_absolute_get ();
   perfHashSmall ();
@@ -95,6 +118,22 @@ main (int argc, char *argv[])
           64 * 1024 / (1 +
 		       GNUNET_TIME_absolute_get_duration
 		       (start).rel_value_us / 1000LL), "kb/ms");
+  for (batch = 1; batch <= 256; batch *= 4)
+  {
+    start = GNUNET_TIME_absolute_get ();
+    perfHashMany (batch);
+    delta = GNUNET_TIME_absolute_get_duration (start);
+    printf ("64k 64-byte hashes in batches of %u took %s\n",
+            batch,
+            GNUNET_STRINGS_relative_time_to_string (delta,
+                                                    GNUNET_YES));
+    GNUNET_snprintf (gstr, sizeof (gstr),
+                     "Batched hashing (%u)",
+                     batch);
+    GAUGER ("UTIL", gstr,
+            64 * 1024 / (1 + delta.rel_value_us / 1000LL),
+            "hashes/ms");
+  }
   start = GNUNET_TIME_absolute_get ();
   perfHKDF ();
   printf ("HKDF perf took %s\n",
@@ -27,6 +27,17 @@
 #include "gnunet_util_lib.h"
 #include <gauger.h>
 
+/**
+ * How many tasks / envelopes do we churn?
+ */
+#define CHURN_ROUNDS (1024 * 1024)
+
+/**
+ * How many tasks / envelopes are alive at the same time?
+ */
+#define CHURN_BATCH 64
+
+
 static uint64_t
 perfMalloc ()
 {
@@ -43,6 +54,110 @@ perfMalloc ()
 }
 
 
+static void
+dummy_task (void *cls,
+            const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  unsigned int *ran = cls;
+
+  (*ran)++;
+}
+
+
+/**
+ * Churn scheduler tasks: add a batch of tasks, let them run,
+ * repeat.  Task structs are recycled by the scheduler's pool.
+ */
+static void
+perfTasks (void *cls,
+           const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  static unsigned int ran;
+  static struct GNUNET_TIME_Absolute start;
+  unsigned long long allocs;
+  unsigned long long hits;
+  unsigned int pooled;
+  unsigned int i;
+
+  if (NULL == cls)
+    start = GNUNET_TIME_absolute_get ();
+  if (ran < CHURN_ROUNDS)
+  {
+    for (i = 0; i < CHURN_BATCH; i++)
+      GNUNET_SCHEDULER_add_now (&dummy_task, &ran);
+    GNUNET_SCHEDULER_add_now (&perfTasks, &ran);
+    return;
+  }
+  printf ("Task churn (%u tasks) took %s\n",
+          ran,
+          GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start),
+                                                  GNUNET_YES));
+  GAUGER ("UTIL", "Scheduler task churn",
+          ran / 1024 / (1 +
+                        GNUNET_TIME_absolute_get_duration
+                        (start).rel_value_us / 1000LL), "kops/ms");
+  GNUNET_SCHEDULER_get_pool_stats (&allocs, &hits, &pooled);
+  printf ("Task pool: %llu allocations, %llu re-used, %u pooled\n",
+          allocs, hits, pooled);
+}
+
+
+/**
+ * Churn MQ envelopes of various sizes, comparing the envelope
+ * pool against plain malloc() of the same sizes.
+ */
+static void
+perfEnvelopes ()
+{
+  struct GNUNET_MQ_Envelope *ev[CHURN_BATCH];
+  struct GNUNET_MessageHeader *msg;
+  struct GNUNET_TIME_Absolute start;
+  void *mem[CHURN_BATCH];
+  unsigned long long allocs;
+  unsigned long long hits;
+  unsigned int pooled;
+  unsigned int i;
+  unsigned int j;
+  uint16_t size;
+
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < CHURN_ROUNDS / CHURN_BATCH; i++)
+  {
+    for (j = 0; j < CHURN_BATCH; j++)
+    {
+      size = sizeof (struct GNUNET_MessageHeader) + ((i + j) * 37) % 2048;
+      ev[j] = GNUNET_MQ_msg_ (&msg, size, 1);
+    }
+    for (j = 0; j < CHURN_BATCH; j++)
+      GNUNET_MQ_discard (ev[j]);
+  }
+  printf ("Envelope churn (pooled) took %s\n",
+          GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start),
+                                                  GNUNET_YES));
+  GAUGER ("UTIL", "MQ envelope churn",
+          CHURN_ROUNDS / 1024 / (1 +
+                                 GNUNET_TIME_absolute_get_duration
+                                 (start).rel_value_us / 1000LL), "kops/ms");
+  GNUNET_MQ_get_pool_stats (&allocs, &hits, &pooled);
+  printf ("Envelope pool: %llu allocations, %llu re-used, %u pooled\n",
+          allocs, hits, pooled);
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < CHURN_ROUNDS / CHURN_BATCH; i++)
+  {
+    for (j = 0; j < CHURN_BATCH; j++)
+    {
+      size = sizeof (struct GNUNET_MessageHeader) + ((i + j) * 37) % 2048;
+      mem[j] = GNUNET_malloc (size + 64);
+    }
+    for (j = 0; j < CHURN_BATCH; j++)
+      GNUNET_free (mem[j]);
+  }
+  printf ("Envelope churn (malloc) took %s\n",
+          GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start),
+                                                  GNUNET_YES));
+}
+
+
 int
 main (int argc, char *argv[])
 {
@@ -58,6 +173,8 @@ main (int argc, char *argv[])
           kb / 1024 / (1 +
 		       GNUNET_TIME_absolute_get_duration
 		       (start).rel_value_us / 1000LL), "kb/ms");
+  perfEnvelopes ();
+  GNUNET_SCHEDULER_run (&perfTasks, NULL);
   return 0;
 }
 
@@ -0,0 +1,137 @@
+/*
+     This file is part of GNUnet.
+     Copyright (C) 2016 GNUnet e.V.
+
+     GNUnet is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with GNUnet; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file util/perf_scheduler.c
+ * @brief measure performance of adding, cancelling and running timers
+ */
+#include "platform.h"
+#include "gnunet_util_lib.h"
+#include <gauger.h>
+
+/**
+ * How many timers do we churn?
+ */
+#define NUM_TIMERS (1024 * 1024)
+
+/**
+ * Timers are spread over this many milliseconds.
+ */
+#define MAX_DELAY_MS 500
+
+/**
+ * All timers we added.
+ */
+static struct GNUNET_SCHEDULER_Task **tasks;
+
+/**
+ * Number of timers that ran so far.
+ */
+static unsigned int fired;
+
+/**
+ * When did we start running timers?
+ */
+static struct GNUNET_TIME_Absolute start;
+
+
+static void
+timer_cb (void *cls,
+          const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  unsigned int *off = cls;
+
+  tasks[*off] = NULL;
+  fired++;
+}
+
+
+static void
+run (void *cls,
+     const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  static unsigned int offsets[NUM_TIMERS];
+  struct GNUNET_TIME_Relative delay;
+  unsigned int i;
+
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < NUM_TIMERS; i++)
+  {
+    offsets[i] = i;
+    delay = GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MILLISECONDS,
+                                           1 + GNUNET_CRYPTO_random_u32 (GNUNET_CRYPTO_QUALITY_WEAK,
+                                                                         MAX_DELAY_MS));
+    tasks[i] = GNUNET_SCHEDULER_add_delayed (delay,
+                                             &timer_cb,
+                                             &offsets[i]);
+  }
+  printf ("Adding %u timers took %s\n",
+          NUM_TIMERS,
+          GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start),
+                                                  GNUNET_YES));
+  GAUGER ("UTIL", "Scheduler timer add",
+          NUM_TIMERS / 1024 / (1 +
+                               GNUNET_TIME_absolute_get_duration
+                               (start).rel_value_us / 1000LL), "kops/ms");
+  start = GNUNET_TIME_absolute_get ();
+  for (i = 0; i < NUM_TIMERS; i += 2)
+  {
+    GNUNET_SCHEDULER_cancel (tasks[i]);
+    tasks[i] = NULL;
+  }
+  printf ("Cancelling %u timers took %s\n",
+          NUM_TIMERS / 2,
+          GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (start),
+                                                  GNUNET_YES));
+  GAUGER ("UTIL", "Scheduler timer cancel",
+          NUM_TIMERS / 2 / 1024 / (1 +
+                                   GNUNET_TIME_absolute_get_duration
+                                   (start).rel_value_us / 1000LL), "kops/ms");
+  start = GNUNET_TIME_absolute_get ();
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  struct GNUNET_TIME_Relative duration;
+
+  GNUNET_log_setup ("perf-scheduler",
+                    "WARNING",
+                    NULL);
+  tasks = GNUNET_new_array (NUM_TIMERS,
+                            struct GNUNET_SCHEDULER_Task *);
+  GNUNET_SCHEDULER_run (&run, NULL);
+  duration = GNUNET_TIME_absolute_get_duration (start);
+  GNUNET_free (tasks);
+  if (NUM_TIMERS / 2 != fired)
+  {
+    GNUNET_break (0);
+    return 1;
+  }
+  printf ("Running %u timers took %s (timers spread over %u ms)\n",
+          fired,
+          GNUNET_STRINGS_relative_time_to_string (duration,
+                                                  GNUNET_YES),
+          MAX_DELAY_MS);
+  return 0;
+}
+
+/* end of perf_scheduler.c */
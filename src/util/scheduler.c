@@ -58,16 +58,40 @@
 #endif
 
 /**
- * Should we figure out which tasks are delayed for a while
- * before they are run? (Consider using in combination with EXECINFO).
+ * Tasks that were in the ready queue or ran for longer than this
+ * are reported if profiling is active.
  */
-#define PROFILE_DELAYS GNUNET_NO
+#define DELAY_THRESHOLD GNUNET_TIME_UNIT_SECONDS
 
 /**
- * Task that were in the queue for longer than this are reported if
- * PROFILE_DELAYS is active.
+ * Name of the environment variable that, if set, enables the
+ * profiler and names the file the profile is dumped to when
+ * #GNUNET_SCHEDULER_run() returns.
  */
-#define DELAY_THRESHOLD GNUNET_TIME_UNIT_SECONDS
+#define PROFILE_ENV "GNUNET_SCHEDULER_PROFILE"
+
+/**
+ * Use epoll() instead of select() to wait for tasks that are
+ * waiting on a single file descriptor?  Only used if no custom
+ * select function was installed via #GNUNET_SCHEDULER_set_select().
+ */
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define USE_EPOLL GNUNET_YES
+#else
+#define USE_EPOLL GNUNET_NO
+#endif
+
+/**
+ * Maximum number of events we fetch from epoll per iteration.
+ */
+#define EPOLL_MAX_EVENTS 256
+
+/**
+ * Maximum number of unused task structs we keep around
+ * for re-use instead of returning them to malloc().
+ */
+#define TASK_POOL_MAX 1024
 
 
 /**
@@ -116,12 +140,11 @@ struct GNUNET_SCHEDULER_Task
    */
   struct GNUNET_TIME_Absolute timeout;
 
-#if PROFILE_DELAYS
   /**
-   * When was the task scheduled?
+   * When was the task added to the ready queue?  Always set, as
+   * profiling may be enabled while the task is in the queue.
    */
-  struct GNUNET_TIME_Absolute start_time;
-#endif
+  struct GNUNET_TIME_Absolute ready_time;
 
   /**
    * Why is the task ready?  Set after task is added to ready queue.
@@ -156,6 +179,19 @@ struct GNUNET_SCHEDULER_Task
    */
   int in_ready_list;
 
+  /**
+   * Entry in the #timeout_heap, NULL if the task is not in the heap.
+   */
+  struct GNUNET_CONTAINER_HeapNode *timeout_node;
+
+#if USE_EPOLL
+  /**
+   * Is this task waiting in the #fd_table (instead of
+   * the #pending_head list)?
+   */
+  int in_fd_table;
+#endif
+
 #if EXECINFO
   /**
    * Array of strings which make up a backtrace from the point when this
@@ -184,28 +220,28 @@ static struct GNUNET_SCHEDULER_Task *pending_head;
 static struct GNUNET_SCHEDULER_Task *pending_tail;
 
 /**
- * List of tasks waiting ONLY for a timeout event.
- * Sorted by timeout (earliest first).  Used so that
- * we do not traverse the list of these tasks when
- * building select sets (we just look at the head
- * to determine the respective timeout ONCE).
+ * List of tasks waiting ONLY for a timeout event that is already
+ * due (they were added with a delay of zero), or that were marked
+ * for shutdown.  All of these are moved to the ready queue in the
+ * next iteration.
  */
 static struct GNUNET_SCHEDULER_Task *pending_timeout_head;
 
 /**
- * List of tasks waiting ONLY for a timeout event.
- * Sorted by timeout (earliest first).  Used so that
- * we do not traverse the list of these tasks when
- * building select sets (we just look at the head
- * to determine the respective timeout ONCE).
+ * List of tasks waiting ONLY for a timeout event that is already
+ * due (they were added with a delay of zero), or that were marked
+ * for shutdown.  All of these are moved to the ready queue in the
+ * next iteration.
  */
 static struct GNUNET_SCHEDULER_Task *pending_timeout_tail;
 
 /**
- * Last inserted task waiting ONLY for a timeout event.
- * Used to (heuristically) speed up insertion.
+ * Tasks waiting ONLY for a timeout event that is not yet due, and
+ * tasks in the #fd_table with a timeout, sorted by timeout (earliest
+ * first).  Used so that adding and cancelling timeouts is O(log n)
+ * and so that we only look at the root to determine the next timeout.
  */
-static struct GNUNET_SCHEDULER_Task *pending_timeout_last;
+static struct GNUNET_CONTAINER_Heap *timeout_heap;
 
 /**
  * ID of the task that is running right now.
@@ -251,7 +287,7 @@ static int current_lifeness;
 
 /**
  * Function to use as a select() in the scheduler.
- * If NULL, we use GNUNET_NETWORK_socket_select().
+ * If NULL, we use epoll (if available) or GNUNET_NETWORK_socket_select().
  */
 static GNUNET_SCHEDULER_select scheduler_select;
 
@@ -260,9 +296,175 @@ static GNUNET_SCHEDULER_select scheduler_select;
  */
 static void *scheduler_select_cls;
 
+/**
+ * List of unused task structs kept for re-use (linked via
+ * their @e next field).  Like the scheduler itself, this is
+ * not thread-safe.
+ */
+static struct GNUNET_SCHEDULER_Task *task_pool;
+
+/**
+ * Number of task structs in the #task_pool.
+ */
+static unsigned int task_pool_size;
+
+/**
+ * Number of task structs we allocated with malloc().
+ */
+static unsigned long long task_pool_allocs;
+
+/**
+ * Number of task structs we took from the #task_pool.
+ */
+static unsigned long long task_pool_hits;
+
+/**
+ * Profiling information for one callback.
+ */
+struct ProfileEntry
+{
+  /**
+   * Kept in a DLL.
+   */
+  struct ProfileEntry *next;
+
+  /**
+   * Kept in a DLL.
+   */
+  struct ProfileEntry *prev;
+
+  /**
+   * Public part of the profile, handed to iterators.
+   */
+  struct GNUNET_SCHEDULER_TaskProfile profile;
+};
+
+/**
+ * Is the profiler active?
+ */
+static int profiling;
+
+/**
+ * Head of DLL of all profile entries.
+ */
+static struct ProfileEntry *profile_head;
+
+/**
+ * Tail of DLL of all profile entries.
+ */
+static struct ProfileEntry *profile_tail;
+
+/**
+ * Map from (the lower 32 bits of) callback addresses to
+ * `struct ProfileEntry`s.
+ */
+static struct GNUNET_CONTAINER_MultiHashMap32 *profile_map;
+
+/**
+ * Number of tasks waiting in the #fd_table.
+ */
+static unsigned int fd_task_count;
+
+/**
+ * Number of tasks in the #timeout_heap or the #fd_table (each
+ * task counted once) that count for lifeness.
+ */
+static unsigned int lifeness_count;
+
+#if USE_EPOLL
+/**
+ * State we keep per file descriptor for the epoll backend.
+ */
+struct FdEntry
+{
+  /**
+   * Head of list of tasks waiting on this file descriptor.
+   */
+  struct GNUNET_SCHEDULER_Task *head;
+
+  /**
+   * Tail of list of tasks waiting on this file descriptor.
+   */
+  struct GNUNET_SCHEDULER_Task *tail;
+
+  /**
+   * Events currently registered with the kernel, 0 for none.
+   */
+  uint32_t events;
+
+  /**
+   * Is this entry in #fd_dirty?
+   */
+  int dirty;
+
+  /**
+   * Did the last task waiting on this file descriptor go away since
+   * the last sync?  Then the descriptor may have been closed (and its
+   * number re-used) in the meantime, so @e events cannot be trusted.
+   */
+  int idle;
+};
+
+/**
+ * epoll file descriptor, -1 if we are using select().
+ */
+static int epoll_fd = -1;
+
+/**
+ * Read end of the shutdown pipe (registered with #epoll_fd).
+ */
+static int epoll_shutdown_fd = -1;
+
+/**
+ * Tasks waiting on a single file descriptor, indexed by the
+ * file descriptor.  Registrations with the kernel are kept
+ * across iterations and only updated if the set of events
+ * we are interested in changes.
+ */
+static struct FdEntry *fd_table;
+
+/**
+ * Length of the #fd_table.
+ */
+static unsigned int fd_table_size;
+
+/**
+ * File descriptors whose #fd_table entry must be synced
+ * with the kernel before we wait again.
+ */
+static int *fd_dirty;
+
+/**
+ * Length of the #fd_dirty array.
+ */
+static unsigned int fd_dirty_size;
+
+/**
+ * Number of entries used in #fd_dirty.
+ */
+static unsigned int fd_dirty_count;
+
+/**
+ * Events returned by the last call to epoll_wait().
+ */
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+
+/**
+ * Number of valid entries in #epoll_events.
+ */
+static unsigned int epoll_event_count;
+
+/**
+ * Set by #GNUNET_SCHEDULER_shutdown() if tasks in the #fd_table
+ * were marked and #check_ready() must move them to the ready queue.
+ */
+static int fd_scan_needed;
+#endif
+
 
 /**
  * Sets the select function to use in the scheduler (scheduler_select).
+ * Installing a custom select function disables the use of epoll.
  *
  * @param new_select new select function to use
  * @param new_select_cls closure for @a new_select
@@ -293,6 +495,31 @@ check_priority (enum GNUNET_SCHEDULER_Priority p)
 }
 
 
+/**
+ * A task waits on an FD beyond FD_SETSIZE, but we have to use
+ * select() (no epoll, or a custom select function was installed).
+ * Report this as an error and mark the task as ready, so that it
+ * sees the problem when it uses the FD instead of waiting forever.
+ *
+ * @param task task waiting on @a fd
+ * @param fd file descriptor that does not fit into an FD set
+ * @param reason reason to mark the task ready with
+ */
+static void
+fd_beyond_setsize (struct GNUNET_SCHEDULER_Task *task,
+                   int fd,
+                   enum GNUNET_SCHEDULER_Reason reason)
+{
+  if (0 != (task->reason & reason))
+    return;
+  LOG (GNUNET_ERROR_TYPE_ERROR,
+       "Cannot select() on file descriptor %d (FD_SETSIZE is %d)\n",
+       fd,
+       FD_SETSIZE);
+  task->reason |= reason;
+}
+
+
 /**
  * Update all sets and timeout for select.
  *
@@ -310,15 +537,19 @@ update_sets (struct GNUNET_NETWORK_FDSet *rs,
   struct GNUNET_TIME_Relative to;
 
   now = GNUNET_TIME_absolute_get ();
-  pos = pending_timeout_head;
+  if (NULL != pending_timeout_head)
+    *timeout = GNUNET_TIME_UNIT_ZERO;
+  pos = GNUNET_CONTAINER_heap_peek (timeout_heap);
   if (NULL != pos)
   {
     to = GNUNET_TIME_absolute_get_difference (now, pos->timeout);
     if (timeout->rel_value_us > to.rel_value_us)
       *timeout = to;
-    if (0 != pos->reason)
-      *timeout = GNUNET_TIME_UNIT_ZERO;
   }
+#if USE_EPOLL
+  if (GNUNET_YES == fd_scan_needed)
+    *timeout = GNUNET_TIME_UNIT_ZERO;
+#endif
   for (pos = pending_head; NULL != pos; pos = pos->next)
   {
     if (pos->timeout.abs_value_us != GNUNET_TIME_UNIT_FOREVER_ABS.abs_value_us)
@@ -328,9 +559,23 @@ update_sets (struct GNUNET_NETWORK_FDSet *rs,
         *timeout = to;
     }
     if (-1 != pos->read_fd)
-      GNUNET_NETWORK_fdset_set_native (rs, pos->read_fd);
+    {
+      if (pos->read_fd < FD_SETSIZE)
+        GNUNET_NETWORK_fdset_set_native (rs, pos->read_fd);
+      else
+        fd_beyond_setsize (pos,
+                           pos->read_fd,
+                           GNUNET_SCHEDULER_REASON_READ_READY);
+    }
     if (-1 != pos->write_fd)
-      GNUNET_NETWORK_fdset_set_native (ws, pos->write_fd);
+    {
+      if (pos->write_fd < FD_SETSIZE)
+        GNUNET_NETWORK_fdset_set_native (ws, pos->write_fd);
+      else
+        fd_beyond_setsize (pos,
+                           pos->write_fd,
+                           GNUNET_SCHEDULER_REASON_WRITE_READY);
+    }
     if (NULL != pos->read_set)
       GNUNET_NETWORK_fdset_add (rs, pos->read_set);
     if (NULL != pos->write_set)
@@ -421,11 +666,428 @@ queue_ready_task (struct GNUNET_SCHEDULER_Task *task)
   GNUNET_CONTAINER_DLL_insert (ready_head[p],
                                ready_tail[p],
                                task);
+  task->ready_time = GNUNET_TIME_absolute_get ();
   task->in_ready_list = GNUNET_YES;
   ready_count++;
 }
 
 
+#if USE_EPOLL
+/**
+ * Get the file descriptor a task from the #fd_table is waiting on.
+ *
+ * @param task task waiting on a single file descriptor
+ * @return the file descriptor
+ */
+static int
+get_task_fd (const struct GNUNET_SCHEDULER_Task *task)
+{
+  if (-1 != task->read_fd)
+  {
+    GNUNET_assert ( (-1 == task->write_fd) ||
+                    (task->read_fd == task->write_fd) );
+    return task->read_fd;
+  }
+  return task->write_fd;
+}
+
+
+/**
+ * Get the #fd_table entry for a file descriptor, growing the
+ * table if necessary.
+ *
+ * @param fd file descriptor
+ * @return entry for @a fd
+ */
+static struct FdEntry *
+get_fd_entry (int fd)
+{
+  GNUNET_assert (fd >= 0);
+  if (fd >= fd_table_size)
+    GNUNET_array_grow (fd_table,
+                       fd_table_size,
+                       GNUNET_MAX (fd + 1, 2 * fd_table_size));
+  return &fd_table[fd];
+}
+
+
+/**
+ * Remember that the kernel registration of @a fd must be
+ * checked before we wait again.
+ *
+ * @param fd file descriptor
+ * @param e entry for @a fd
+ */
+static void
+mark_fd_dirty (int fd,
+               struct FdEntry *e)
+{
+  if (GNUNET_YES == e->dirty)
+    return;
+  e->dirty = GNUNET_YES;
+  if (fd_dirty_count == fd_dirty_size)
+    GNUNET_array_grow (fd_dirty,
+                       fd_dirty_size,
+                       2 * fd_dirty_size + 16);
+  fd_dirty[fd_dirty_count++] = fd;
+}
+
+
+/**
+ * Add a task that waits on a single file descriptor to the #fd_table.
+ *
+ * @param task task to add
+ */
+static void
+fd_table_insert (struct GNUNET_SCHEDULER_Task *task)
+{
+  struct FdEntry *e;
+  uint32_t events;
+  int fd;
+
+  fd = get_task_fd (task);
+  e = get_fd_entry (fd);
+  GNUNET_CONTAINER_DLL_insert (e->head,
+                               e->tail,
+                               task);
+  task->in_fd_table = GNUNET_YES;
+  if (task->timeout.abs_value_us != GNUNET_TIME_UNIT_FOREVER_ABS.abs_value_us)
+    task->timeout_node = GNUNET_CONTAINER_heap_insert (timeout_heap,
+                                                       task,
+                                                       task->timeout.abs_value_us);
+  fd_task_count++;
+  if (GNUNET_YES == task->lifeness)
+    lifeness_count++;
+  events = 0;
+  if (-1 != task->read_fd)
+    events |= EPOLLIN;
+  if (-1 != task->write_fd)
+    events |= EPOLLOUT;
+  if ( (0 != (events & ~e->events)) ||
+       (GNUNET_YES == e->idle) )
+    mark_fd_dirty (fd, e);
+}
+
+
+/**
+ * Remove a task from the #fd_table.
+ *
+ * @param task task to remove
+ */
+static void
+fd_table_remove (struct GNUNET_SCHEDULER_Task *task)
+{
+  struct FdEntry *e;
+  int fd;
+
+  fd = get_task_fd (task);
+  e = &fd_table[fd];
+  GNUNET_CONTAINER_DLL_remove (e->head,
+                               e->tail,
+                               task);
+  task->in_fd_table = GNUNET_NO;
+  if (NULL != task->timeout_node)
+  {
+    GNUNET_CONTAINER_heap_remove_node (task->timeout_node);
+    task->timeout_node = NULL;
+  }
+  fd_task_count--;
+  if (GNUNET_YES == task->lifeness)
+    lifeness_count--;
+  if (NULL == e->head)
+    e->idle = GNUNET_YES;
+  mark_fd_dirty (fd, e);
+}
+
+
+/**
+ * Move a task from the #fd_table to the ready queue.
+ *
+ * @param task task that is ready
+ * @param reason why it is ready
+ */
+static void
+fd_table_ready (struct GNUNET_SCHEDULER_Task *task,
+                enum GNUNET_SCHEDULER_Reason reason)
+{
+  fd_table_remove (task);
+  task->reason |= reason | GNUNET_SCHEDULER_REASON_PREREQ_DONE;
+  queue_ready_task (task);
+}
+
+
+/**
+ * Bring the kernel registration of all dirty #fd_table entries
+ * in line with the tasks waiting on them.
+ */
+static void
+sync_fd_table ()
+{
+  struct GNUNET_SCHEDULER_Task *pos;
+  struct GNUNET_SCHEDULER_Task *next;
+  struct FdEntry *e;
+  struct epoll_event ev;
+  uint32_t events;
+  unsigned int i;
+  int fd;
+  int op;
+  int ret;
+
+  for (i = 0; i < fd_dirty_count; i++)
+  {
+    fd = fd_dirty[i];
+    e = &fd_table[fd];
+    e->dirty = GNUNET_NO;
+    events = 0;
+    for (pos = e->head; NULL != pos; pos = pos->next)
+    {
+      if (-1 != pos->read_fd)
+        events |= EPOLLIN;
+      if (-1 != pos->write_fd)
+        events |= EPOLLOUT;
+    }
+    if (0 == events)
+    {
+      /* may fail if the FD was closed already, that's fine */
+      if (0 != e->events)
+        (void) epoll_ctl (epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      e->events = 0;
+      e->idle = GNUNET_NO;
+      continue;
+    }
+    if ( (events == e->events) &&
+         (GNUNET_NO == e->idle) )
+      continue;
+    memset (&ev, 0, sizeof (ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    op = (0 == e->events) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    ret = epoll_ctl (epoll_fd, op, fd, &ev);
+    if ( (0 != ret) &&
+         (EPOLL_CTL_ADD == op) &&
+         (EEXIST == errno) )
+      ret = epoll_ctl (epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    else if ( (0 != ret) &&
+              (EPOLL_CTL_MOD == op) &&
+              (ENOENT == errno) )
+      ret = epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    e->idle = GNUNET_NO;
+    if (0 == ret)
+    {
+      e->events = events;
+      continue;
+    }
+    e->events = 0;
+    if (EPERM == errno)
+    {
+      /* not pollable (i.e. a regular file), select() would
+         always report those as ready, so do we */
+      for (pos = e->head; NULL != pos; pos = next)
+      {
+        next = pos->next;
+        fd_table_ready (pos,
+                        ((-1 != pos->read_fd) ? GNUNET_SCHEDULER_REASON_READ_READY : 0) |
+                        ((-1 != pos->write_fd) ? GNUNET_SCHEDULER_REASON_WRITE_READY : 0));
+      }
+      continue;
+    }
+    LOG_STRERROR (GNUNET_ERROR_TYPE_WARNING,
+                  "epoll_ctl");
+    /* let select() deal with the tasks waiting on this FD (and
+       report errors as it always did, see #update_sets()) */
+    for (pos = e->head; NULL != pos; pos = next)
+    {
+      next = pos->next;
+      fd_table_remove (pos);
+      GNUNET_CONTAINER_DLL_insert (pending_head,
+                                   pending_tail,
+                                   pos);
+    }
+  }
+  fd_dirty_count = 0;
+}
+
+
+/**
+ * Switch to the epoll backend.  On failure, we simply
+ * keep using select().
+ *
+ * @param pr read end of the shutdown pipe
+ */
+static void
+epoll_enable (const struct GNUNET_DISK_FileHandle *pr)
+{
+  struct epoll_event ev;
+
+  GNUNET_assert (-1 == epoll_fd);
+  epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (-1 == epoll_fd)
+  {
+    LOG_STRERROR (GNUNET_ERROR_TYPE_WARNING,
+                  "epoll_create1");
+    return;
+  }
+  GNUNET_DISK_internal_file_handle_ (pr,
+                                     &epoll_shutdown_fd,
+                                     sizeof (int));
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = epoll_shutdown_fd;
+  if (0 != epoll_ctl (epoll_fd, EPOLL_CTL_ADD, epoll_shutdown_fd, &ev))
+  {
+    LOG_STRERROR (GNUNET_ERROR_TYPE_WARNING,
+                  "epoll_ctl");
+    GNUNET_break (0 == close (epoll_fd));
+    epoll_fd = -1;
+    return;
+  }
+}
+
+
+/**
+ * Stop using the epoll backend, moving all tasks from the
+ * #fd_table back to the #pending_head list.
+ */
+static void
+epoll_disable ()
+{
+  struct GNUNET_SCHEDULER_Task *pos;
+  unsigned int i;
+
+  for (i = 0; i < fd_table_size; i++)
+  {
+    while (NULL != (pos = fd_table[i].head))
+    {
+      fd_table_remove (pos);
+      GNUNET_CONTAINER_DLL_insert (pending_head,
+                                   pending_tail,
+                                   pos);
+    }
+  }
+  GNUNET_assert (0 == fd_task_count);
+  GNUNET_array_grow (fd_table,
+                     fd_table_size,
+                     0);
+  GNUNET_array_grow (fd_dirty,
+                     fd_dirty_size,
+                     0);
+  fd_dirty_count = 0;
+  epoll_event_count = 0;
+  fd_scan_needed = GNUNET_NO;
+  GNUNET_break (0 == close (epoll_fd));
+  epoll_fd = -1;
+  epoll_shutdown_fd = -1;
+}
+
+
+/**
+ * Wait for tasks to become ready using epoll.  Tasks waiting on
+ * file descriptor sets still require select(), in which case we
+ * include the #epoll_fd in the read set.
+ *
+ * @param rs set of FDs for tasks waiting on FD sets (updated)
+ * @param ws set of FDs for tasks waiting on FD sets (updated)
+ * @param timeout how long to wait at most
+ * @return number of ready FDs, #GNUNET_SYSERR on error
+ */
+static int
+epoll_select (struct GNUNET_NETWORK_FDSet *rs,
+              struct GNUNET_NETWORK_FDSet *ws,
+              struct GNUNET_TIME_Relative timeout)
+{
+  int ret;
+  int n;
+  int ms;
+
+  epoll_event_count = 0;
+  ret = 0;
+  if (NULL != pending_head)
+  {
+    GNUNET_NETWORK_fdset_set_native (rs, epoll_fd);
+    ret = GNUNET_NETWORK_socket_select (rs, ws, NULL, timeout);
+    if ( (ret <= 0) ||
+         (GNUNET_YES != GNUNET_NETWORK_fdset_test_native (rs, epoll_fd)) )
+      return ret;
+    timeout = GNUNET_TIME_UNIT_ZERO;
+  }
+  if (timeout.rel_value_us == GNUNET_TIME_UNIT_FOREVER_REL.rel_value_us)
+    ms = -1;
+  else if (timeout.rel_value_us / 1000 >= INT_MAX)
+    ms = INT_MAX;
+  else
+    ms = (int) ((timeout.rel_value_us + 999) / 1000);
+  n = epoll_wait (epoll_fd, epoll_events, EPOLL_MAX_EVENTS, ms);
+  if (-1 == n)
+    return GNUNET_SYSERR;
+  epoll_event_count = n;
+  return ret + n;
+}
+
+
+/**
+ * Move tasks from the #fd_table that are ready (because of FD
+ * events from the last #epoll_select() or because of a shutdown)
+ * to the ready queue.
+ *
+ * @param rs read set, the shutdown pipe is added if it is ready
+ * @param now the current time
+ */
+static void
+check_fd_table (struct GNUNET_NETWORK_FDSet *rs,
+                struct GNUNET_TIME_Absolute now)
+{
+  struct GNUNET_SCHEDULER_Task *pos;
+  struct GNUNET_SCHEDULER_Task *next;
+  enum GNUNET_SCHEDULER_Reason reason;
+  unsigned int i;
+  uint32_t ev;
+  int fd;
+
+  for (i = 0; i < epoll_event_count; i++)
+  {
+    fd = epoll_events[i].data.fd;
+    ev = epoll_events[i].events;
+    if (fd == epoll_shutdown_fd)
+    {
+      GNUNET_NETWORK_fdset_set_native (rs, fd);
+      continue;
+    }
+    for (pos = fd_table[fd].head; NULL != pos; pos = next)
+    {
+      next = pos->next;
+      reason = 0;
+      if ( (-1 != pos->read_fd) &&
+           (0 != (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))) )
+        reason |= GNUNET_SCHEDULER_REASON_READ_READY;
+      if ( (-1 != pos->write_fd) &&
+           (0 != (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))) )
+        reason |= GNUNET_SCHEDULER_REASON_WRITE_READY;
+      if (0 == reason)
+        continue;
+      if (now.abs_value_us >= pos->timeout.abs_value_us)
+        reason |= GNUNET_SCHEDULER_REASON_TIMEOUT;
+      fd_table_ready (pos, reason);
+    }
+    /* events nobody waits for anymore must be unregistered */
+    mark_fd_dirty (fd, &fd_table[fd]);
+  }
+  epoll_event_count = 0;
+  if (GNUNET_YES != fd_scan_needed)
+    return;
+  fd_scan_needed = GNUNET_NO;
+  for (fd = 0; fd < fd_table_size; fd++)
+  {
+    for (pos = fd_table[fd].head; NULL != pos; pos = next)
+    {
+      next = pos->next;
+      if (0 != pos->reason)
+        fd_table_ready (pos, 0);
+    }
+  }
+}
+#endif
+
+
 /**
  * Check which tasks are ready and move them
  * to the respective ready queue.
@@ -434,7 +1096,7 @@ queue_ready_task (struct GNUNET_SCHEDULER_Task *task)
  * @param ws FDs ready for writing
  */
 static void
-check_ready (const struct GNUNET_NETWORK_FDSet *rs,
+check_ready (struct GNUNET_NETWORK_FDSet *rs,
              const struct GNUNET_NETWORK_FDSet *ws)
 {
   struct GNUNET_SCHEDULER_Task *pos;
@@ -444,17 +1106,37 @@ check_ready (const struct GNUNET_NETWORK_FDSet *rs,
   now = GNUNET_TIME_absolute_get ();
   while (NULL != (pos = pending_timeout_head))
   {
-    if (now.abs_value_us >= pos->timeout.abs_value_us)
+    /* zero-delay tasks are due even if the clock went backwards */
+    if ( (now.abs_value_us >= pos->timeout.abs_value_us) ||
+         (0 == pos->reason) )
       pos->reason |= GNUNET_SCHEDULER_REASON_TIMEOUT;
-    if (0 == pos->reason)
-      break;
     GNUNET_CONTAINER_DLL_remove (pending_timeout_head,
                                  pending_timeout_tail,
                                  pos);
-    if (pending_timeout_last == pos)
-      pending_timeout_last = NULL;
     queue_ready_task (pos);
   }
+  while ( (NULL != (pos = GNUNET_CONTAINER_heap_peek (timeout_heap))) &&
+          (now.abs_value_us >= pos->timeout.abs_value_us) )
+  {
+    GNUNET_CONTAINER_heap_remove_root (timeout_heap);
+    pos->timeout_node = NULL;
+#if USE_EPOLL
+    if (GNUNET_YES == pos->in_fd_table)
+    {
+      fd_table_ready (pos,
+                      GNUNET_SCHEDULER_REASON_TIMEOUT);
+      continue;
+    }
+#endif
+    if (GNUNET_YES == pos->lifeness)
+      lifeness_count--;
+    pos->reason |= GNUNET_SCHEDULER_REASON_TIMEOUT;
+    queue_ready_task (pos);
+  }
+#if USE_EPOLL
+  if (-1 != epoll_fd)
+    check_fd_table (rs, now);
+#endif
   pos = pending_head;
   while (NULL != pos)
   {
@@ -488,16 +1170,65 @@ GNUNET_SCHEDULER_shutdown ()
   struct GNUNET_SCHEDULER_Task *pos;
   int i;
 
+  /* tasks waiting for a timeout are now due (tasks from the
+     #fd_table are taken care of below) */
+  while ( (NULL != timeout_heap) &&
+          (NULL != (pos = GNUNET_CONTAINER_heap_remove_root (timeout_heap))) )
+  {
+    pos->timeout_node = NULL;
+#if USE_EPOLL
+    if (GNUNET_YES == pos->in_fd_table)
+      continue;
+#endif
+    if (GNUNET_YES == pos->lifeness)
+      lifeness_count--;
+    GNUNET_CONTAINER_DLL_insert_tail (pending_timeout_head,
+                                      pending_timeout_tail,
+                                      pos);
+  }
   for (pos = pending_timeout_head; NULL != pos; pos = pos->next)
     pos->reason |= GNUNET_SCHEDULER_REASON_SHUTDOWN;
   for (pos = pending_head; NULL != pos; pos = pos->next)
     pos->reason |= GNUNET_SCHEDULER_REASON_SHUTDOWN;
+#if USE_EPOLL
+  if (0 != fd_task_count)
+  {
+    for (i = 0; i < fd_table_size; i++)
+      for (pos = fd_table[i].head; NULL != pos; pos = pos->next)
+        pos->reason |= GNUNET_SCHEDULER_REASON_SHUTDOWN;
+    fd_scan_needed = GNUNET_YES;
+  }
+#endif
   for (i = 0; i < GNUNET_SCHEDULER_PRIORITY_COUNT; i++)
     for (pos = ready_head[i]; NULL != pos; pos = pos->next)
       pos->reason |= GNUNET_SCHEDULER_REASON_SHUTDOWN;
 }
 
 
+/**
+ * Create a new (zero-initialized) task, re-using a
+ * task struct from the #task_pool if possible.
+ *
+ * @return the new task
+ */
+static struct GNUNET_SCHEDULER_Task *
+create_task ()
+{
+  struct GNUNET_SCHEDULER_Task *t;
+
+  if (NULL == (t = task_pool))
+  {
+    task_pool_allocs++;
+    return GNUNET_new (struct GNUNET_SCHEDULER_Task);
+  }
+  task_pool = t->next;
+  task_pool_size--;
+  task_pool_hits++;
+  memset (t, 0, sizeof (struct GNUNET_SCHEDULER_Task));
+  return t;
+}
+
+
 /**
  * Destroy a task (release associated resources)
  *
@@ -513,7 +1244,198 @@ destroy_task (struct GNUNET_SCHEDULER_Task *t)
 #if EXECINFO
   GNUNET_free (t->backtrace_strings);
 #endif
-  GNUNET_free (t);
+  if (task_pool_size >= TASK_POOL_MAX)
+  {
+    GNUNET_free (t);
+    return;
+  }
+  t->next = task_pool;
+  task_pool = t;
+  task_pool_size++;
+}
+
+
+/**
+ * Closure for #find_profile_entry().
+ */
+struct ProfileLookupContext
+{
+  /**
+   * Callback we are looking for.
+   */
+  GNUNET_SCHEDULER_TaskCallback callback;
+
+  /**
+   * Set to the matching entry, if any.
+   */
+  struct ProfileEntry *pe;
+};
+
+
+/**
+ * Check if a profile entry is for the callback we are looking for.
+ *
+ * @param cls the `struct ProfileLookupContext`
+ * @param key lower 32 bits of the callback address
+ * @param value a `struct ProfileEntry`
+ * @return #GNUNET_NO if we found the entry
+ */
+static int
+find_profile_entry (void *cls,
+                    uint32_t key,
+                    void *value)
+{
+  struct ProfileLookupContext *plc = cls;
+  struct ProfileEntry *pe = value;
+
+  if (pe->profile.callback != plc->callback)
+    return GNUNET_YES;
+  plc->pe = pe;
+  return GNUNET_NO;
+}
+
+
+/**
+ * Get (or create) the profile entry for a callback.
+ *
+ * @param callback callback to get the profile entry for
+ * @return the profile entry
+ */
+static struct ProfileEntry *
+get_profile_entry (GNUNET_SCHEDULER_TaskCallback callback)
+{
+  struct ProfileLookupContext plc;
+  struct ProfileEntry *pe;
+  uint32_t key;
+#if HAVE_EXECINFO_H
+  void *addr;
+  char **names;
+#endif
+
+  key = (uint32_t) (intptr_t) callback;
+  plc.callback = callback;
+  plc.pe = NULL;
+  GNUNET_CONTAINER_multihashmap32_get_multiple (profile_map,
+                                                key,
+                                                &find_profile_entry,
+                                                &plc);
+  if (NULL != plc.pe)
+    return plc.pe;
+  pe = GNUNET_new (struct ProfileEntry);
+  pe->profile.callback = callback;
+#if HAVE_EXECINFO_H
+  addr = (void *) (intptr_t) callback;
+  names = backtrace_symbols (&addr, 1);
+  if (NULL != names)
+  {
+    pe->profile.name = GNUNET_strdup (names[0]);
+    free (names);
+  }
+#endif
+  if (NULL == pe->profile.name)
+    GNUNET_asprintf ((char **) &pe->profile.name,
+                     "%p",
+                     callback);
+  GNUNET_CONTAINER_DLL_insert (profile_head,
+                               profile_tail,
+                               pe);
+  GNUNET_assert (GNUNET_OK ==
+                 GNUNET_CONTAINER_multihashmap32_put (profile_map,
+                                                      key,
+                                                      pe,
+                                                      GNUNET_CONTAINER_MULTIHASHMAPOPTION_MULTIPLE));
+  return pe;
+}
+
+
+/**
+ * Compute the histogram bucket for a duration.  Bucket @e i
+ * counts durations of less than 2^i microseconds, the last
+ * bucket counts everything else.
+ *
+ * @param us duration in microseconds
+ * @return bucket index
+ */
+static unsigned int
+profile_bucket (uint64_t us)
+{
+  unsigned int b;
+
+  for (b = 0; b < GNUNET_SCHEDULER_PROFILE_BUCKETS - 1; b++)
+    if (us < (1LLU << b))
+      break;
+  return b;
+}
+
+
+/**
+ * Record the queue delay and execution time of a task.
+ *
+ * @param task the task that ran
+ * @param start when the task's callback was invoked
+ * @param end when the task's callback returned
+ */
+static void
+profile_task (const struct GNUNET_SCHEDULER_Task *task,
+              struct GNUNET_TIME_Absolute start,
+              struct GNUNET_TIME_Absolute end)
+{
+  struct GNUNET_SCHEDULER_TaskProfile *tp;
+  uint64_t delay;
+  uint64_t exec;
+
+  tp = &get_profile_entry (task->callback)->profile;
+  delay = GNUNET_TIME_absolute_get_difference (task->ready_time,
+                                               start).rel_value_us;
+  exec = GNUNET_TIME_absolute_get_difference (start,
+                                              end).rel_value_us;
+  tp->count++;
+  tp->delay_total_us += delay;
+  tp->delay_max_us = GNUNET_MAX (tp->delay_max_us, delay);
+  tp->delay_hist[profile_bucket (delay)]++;
+  tp->exec_total_us += exec;
+  tp->exec_max_us = GNUNET_MAX (tp->exec_max_us, exec);
+  tp->exec_hist[profile_bucket (exec)]++;
+  if (delay > DELAY_THRESHOLD.rel_value_us)
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Task %p (%s) took %s to be scheduled\n",
+         task,
+         tp->name,
+         GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MICROSECONDS,
+                                                                                delay),
+                                                 GNUNET_YES));
+  if (exec > DELAY_THRESHOLD.rel_value_us)
+    LOG (GNUNET_ERROR_TYPE_DEBUG,
+         "Task %p (%s) blocked the scheduler for %s\n",
+         task,
+         tp->name,
+         GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MICROSECONDS,
+                                                                                exec),
+                                                 GNUNET_YES));
+}
+
+
+/**
+ * Release all profiling information.
+ */
+static void
+profile_clear ()
+{
+  struct ProfileEntry *pe;
+
+  while (NULL != (pe = profile_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (profile_head,
+                                 profile_tail,
+                                 pe);
+    GNUNET_free ((char *) pe->profile.name);
+    GNUNET_free (pe);
+  }
+  if (NULL != profile_map)
+  {
+    GNUNET_CONTAINER_multihashmap32_destroy (profile_map);
+    profile_map = NULL;
+  }
 }
 
 
@@ -557,34 +1479,41 @@ run_ready (struct GNUNET_NETWORK_FDSet *rs,
     current_priority = pos->priority;
     current_lifeness = pos->lifeness;
     active_task = pos;
-#if PROFILE_DELAYS
-    if (GNUNET_TIME_absolute_get_duration (pos->start_time).rel_value_us >
-        DELAY_THRESHOLD.rel_value_us)
-    {
-      LOG (GNUNET_ERROR_TYPE_DEBUG,
-	   "Task %p took %s to be scheduled\n",
-           pos,
-           GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_duration (pos->start_time),
-                                                   GNUNET_YES));
-    }
-#endif
     tc.reason = pos->reason;
+    /* FDs beyond FD_SETSIZE (epoll only) cannot be put into the
+       sets, tasks waiting on those must look at the reason code */
     tc.read_ready = (NULL == pos->read_set) ? rs : pos->read_set;
     if ((-1 != pos->read_fd) &&
+        (pos->read_fd < FD_SETSIZE) &&
         (0 != (pos->reason & GNUNET_SCHEDULER_REASON_READ_READY)))
       GNUNET_NETWORK_fdset_set_native (rs, pos->read_fd);
     tc.write_ready = (NULL == pos->write_set) ? ws : pos->write_set;
     if ((-1 != pos->write_fd) &&
+        (pos->write_fd < FD_SETSIZE) &&
         (0 != (pos->reason & GNUNET_SCHEDULER_REASON_WRITE_READY)))
       GNUNET_NETWORK_fdset_set_native (ws, pos->write_fd);
     if ((0 != (tc.reason & GNUNET_SCHEDULER_REASON_WRITE_READY)) &&
         (-1 != pos->write_fd) &&
+        (pos->write_fd < FD_SETSIZE) &&
         (!GNUNET_NETWORK_fdset_test_native (ws, pos->write_fd)))
       GNUNET_assert (0);          // added to ready in previous select loop!
     LOG (GNUNET_ERROR_TYPE_DEBUG,
 	 "Running task: %p\n",
          pos);
-    pos->callback (pos->callback_cls, &tc);
+    if (GNUNET_YES == profiling)
+    {
+      struct GNUNET_TIME_Absolute start;
+
+      start = GNUNET_TIME_absolute_get ();
+      pos->callback (pos->callback_cls, &tc);
+      profile_task (pos,
+                    start,
+                    GNUNET_TIME_absolute_get ());
+    }
+    else
+    {
+      pos->callback (pos->callback_cls, &tc);
+    }
 #if EXECINFO
     unsigned int i;
 
@@ -599,7 +1528,9 @@ run_ready (struct GNUNET_NETWORK_FDSet *rs,
     destroy_task (pos);
     tasks_run++;
   }
-  while ((NULL == pending_head) || (p >= max_priority_added));
+  while ( ( (NULL == pending_head) &&
+            (0 == fd_task_count) ) ||
+          (p >= max_priority_added) );
 }
 
 
@@ -677,13 +1608,18 @@ check_lifeness ()
 
   if (ready_count > 0)
     return GNUNET_OK;
+  if (lifeness_count > 0)
+    return GNUNET_OK;
   for (t = pending_head; NULL != t; t = t->next)
     if (t->lifeness == GNUNET_YES)
       return GNUNET_OK;
   for (t = pending_timeout_head; NULL != t; t = t->next)
     if (t->lifeness == GNUNET_YES)
       return GNUNET_OK;
-  if ((NULL != pending_head) || (NULL != pending_timeout_head))
+  if ((NULL != pending_head) ||
+      (NULL != pending_timeout_head) ||
+      (0 != GNUNET_CONTAINER_heap_get_size (timeout_heap)) ||
+      (0 != fd_task_count))
   {
     GNUNET_SCHEDULER_shutdown ();
     return GNUNET_OK;
@@ -725,12 +1661,23 @@ GNUNET_SCHEDULER_run (GNUNET_SCHEDULER_TaskCallback task,
   struct GNUNET_SIGNAL_Context *shc_hup;
   struct GNUNET_SIGNAL_Context *shc_pipe;
 #endif
+  struct GNUNET_SCHEDULER_Task *t;
   unsigned long long last_tr;
   unsigned int busy_wait_warning;
   const struct GNUNET_DISK_FileHandle *pr;
+  const char *profile_env;
+  char *fn;
   char c;
 
   GNUNET_assert (NULL == active_task);
+  GNUNET_assert (NULL == timeout_heap);
+  timeout_heap = GNUNET_CONTAINER_heap_create (GNUNET_CONTAINER_HEAP_ORDER_MIN);
+  profile_env = getenv (PROFILE_ENV);
+  if ( (NULL != profile_env) &&
+       (0 != strlen (profile_env)) )
+    GNUNET_SCHEDULER_profile_enable (GNUNET_YES);
+  else
+    profile_env = NULL;
   rs = GNUNET_NETWORK_fdset_create ();
   ws = GNUNET_NETWORK_fdset_create ();
   GNUNET_assert (NULL == shutdown_pipe_handle);
@@ -766,31 +1713,54 @@ GNUNET_SCHEDULER_run (GNUNET_SCHEDULER_TaskCallback task,
                                           &GNUNET_OS_install_parent_control_handler,
                                           NULL);
   active_task = NULL;
+#if USE_EPOLL
+  if (NULL == scheduler_select)
+    epoll_enable (pr);
+#endif
   last_tr = 0;
   busy_wait_warning = 0;
   while (GNUNET_OK == check_lifeness ())
   {
     GNUNET_NETWORK_fdset_zero (rs);
     GNUNET_NETWORK_fdset_zero (ws);
+#if USE_EPOLL
+    if ( (-1 != epoll_fd) &&
+         (NULL != scheduler_select) )
+      epoll_disable ();
+    if (-1 != epoll_fd)
+      sync_fd_table ();
+#endif
     timeout = GNUNET_TIME_UNIT_FOREVER_REL;
     update_sets (rs, ws, &timeout);
-    GNUNET_NETWORK_fdset_handle_set (rs, pr);
     if (ready_count > 0)
     {
       /* no blocking, more work already ready! */
       timeout = GNUNET_TIME_UNIT_ZERO;
     }
+#if USE_EPOLL
+    if (-1 != epoll_fd)
+      ret = epoll_select (rs,
+                          ws,
+                          timeout);
+    else
+#endif
     if (NULL == scheduler_select)
+    {
+      GNUNET_NETWORK_fdset_handle_set (rs, pr);
       ret = GNUNET_NETWORK_socket_select (rs,
                                           ws,
                                           NULL,
                                           timeout);
+    }
     else
+    {
+      GNUNET_NETWORK_fdset_handle_set (rs, pr);
       ret = scheduler_select (scheduler_select_cls,
                               rs,
                               ws,
                               NULL,
                               timeout);
+    }
     if (ret == GNUNET_SYSERR)
     {
       if (errno == EINTR)
@@ -893,11 +1863,37 @@ GNUNET_SCHEDULER_run (GNUNET_SCHEDULER_TaskCallback task,
   GNUNET_SIGNAL_handler_uninstall (shc_pipe);
   GNUNET_SIGNAL_handler_uninstall (shc_quit);
   GNUNET_SIGNAL_handler_uninstall (shc_hup);
+#endif
+#if USE_EPOLL
+  if (-1 != epoll_fd)
+    epoll_disable ();
 #endif
   GNUNET_DISK_pipe_close (shutdown_pipe_handle);
   shutdown_pipe_handle = NULL;
   GNUNET_NETWORK_fdset_destroy (rs);
   GNUNET_NETWORK_fdset_destroy (ws);
+  GNUNET_CONTAINER_heap_destroy (timeout_heap);
+  timeout_heap = NULL;
+  while (NULL != (t = task_pool))
+  {
+    task_pool = t->next;
+    GNUNET_free (t);
+  }
+  task_pool_size = 0;
+  if (NULL != profile_env)
+  {
+    GNUNET_asprintf (&fn,
+                     "%s.%u",
+                     profile_env,
+                     (unsigned int) my_pid);
+    if (GNUNET_OK != GNUNET_SCHEDULER_profile_dump (fn))
+      LOG (GNUNET_ERROR_TYPE_WARNING,
+           _("Failed to write scheduler profile to `%s'\n"),
+           fn);
+    GNUNET_free (fn);
+  }
+  GNUNET_SCHEDULER_profile_enable (GNUNET_NO);
+  profile_clear ();
 }
 
 
@@ -943,6 +1939,175 @@ GNUNET_SCHEDULER_get_load (enum GNUNET_SCHEDULER_Priority p)
 }
 
 
+/**
+ * Obtain statistics about the pool of task structs the scheduler
+ * keeps for re-use.
+ *
+ * @param[out] allocs set to the number of tasks allocated with malloc()
+ * @param[out] hits set to the number of tasks taken from the pool
+ * @param[out] pooled set to the number of tasks currently in the pool
+ */
+void
+GNUNET_SCHEDULER_get_pool_stats (unsigned long long *allocs,
+                                 unsigned long long *hits,
+                                 unsigned int *pooled)
+{
+  *allocs = task_pool_allocs;
+  *hits = task_pool_hits;
+  *pooled = task_pool_size;
+}
+
+
+/**
+ * Enable or disable the scheduler profiler.  While enabled, the
+ * scheduler records for each callback how long tasks waited in the
+ * ready queue and how long they ran.  Profiling data is kept when
+ * the profiler is disabled, and discarded when
+ * #GNUNET_SCHEDULER_run() returns.
+ *
+ * @param enable #GNUNET_YES to enable, #GNUNET_NO to disable
+ */
+void
+GNUNET_SCHEDULER_profile_enable (int enable)
+{
+  profiling = (GNUNET_YES == enable) ? GNUNET_YES : GNUNET_NO;
+  if ( (GNUNET_YES == profiling) &&
+       (NULL == profile_map) )
+    profile_map = GNUNET_CONTAINER_multihashmap32_create (32);
+}
+
+
+/**
+ * Iterate over the profiles of all callbacks that ran while the
+ * profiler was enabled.
+ *
+ * @param it function to call on each profile
+ * @param it_cls closure for @a it
+ */
+void
+GNUNET_SCHEDULER_profile_iterate (GNUNET_SCHEDULER_ProfileIterator it,
+                                  void *it_cls)
+{
+  struct ProfileEntry *pe;
+
+  for (pe = profile_head; NULL != pe; pe = pe->next)
+    it (it_cls,
+        &pe->profile);
+}
+
+
+/**
+ * Compare two profiles by total execution time (descending).
+ *
+ * @param a0 a `struct GNUNET_SCHEDULER_TaskProfile **`
+ * @param a1 a `struct GNUNET_SCHEDULER_TaskProfile **`
+ * @return -1, 0 or 1
+ */
+static int
+cmp_profile (const void *a0,
+             const void *a1)
+{
+  const struct GNUNET_SCHEDULER_TaskProfile *p0 =
+    *(const struct GNUNET_SCHEDULER_TaskProfile **) a0;
+  const struct GNUNET_SCHEDULER_TaskProfile *p1 =
+    *(const struct GNUNET_SCHEDULER_TaskProfile **) a1;
+
+  if (p0->exec_total_us > p1->exec_total_us)
+    return -1;
+  if (p0->exec_total_us < p1->exec_total_us)
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Write a histogram to the profile dump.
+ *
+ * @param f file to write to
+ * @param label name of the histogram
+ * @param hist the histogram
+ */
+static void
+dump_histogram (FILE *f,
+                const char *label,
+                const unsigned long long *hist)
+{
+  unsigned int b;
+
+  FPRINTF (f, "  %s:", label);
+  for (b = 0; b < GNUNET_SCHEDULER_PROFILE_BUCKETS; b++)
+    if (0 != hist[b])
+    {
+      if (b < GNUNET_SCHEDULER_PROFILE_BUCKETS - 1)
+        FPRINTF (f, " <%lluus:%llu", 1LLU << b, hist[b]);
+      else
+        FPRINTF (f, " more:%llu", hist[b]);
+    }
+  FPRINTF (f, "\n");
+}
+
+
+/**
+ * Write the profiles of all callbacks to a file, ordered by total
+ * execution time.
+ *
+ * @param filename name of the file to write
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR on error
+ */
+int
+GNUNET_SCHEDULER_profile_dump (const char *filename)
+{
+  const struct GNUNET_SCHEDULER_TaskProfile **sorted;
+  const struct GNUNET_SCHEDULER_TaskProfile *tp;
+  struct ProfileEntry *pe;
+  unsigned int cnt;
+  unsigned int i;
+  FILE *f;
+
+  f = FOPEN (filename, "w");
+  if (NULL == f)
+  {
+    LOG_STRERROR (GNUNET_ERROR_TYPE_WARNING,
+                  "fopen");
+    return GNUNET_SYSERR;
+  }
+  cnt = 0;
+  for (pe = profile_head; NULL != pe; pe = pe->next)
+    cnt++;
+  sorted = GNUNET_new_array (cnt + 1,
+                             const struct GNUNET_SCHEDULER_TaskProfile *);
+  i = 0;
+  for (pe = profile_head; NULL != pe; pe = pe->next)
+    sorted[i++] = &pe->profile;
+  qsort (sorted,
+         cnt,
+         sizeof (const struct GNUNET_SCHEDULER_TaskProfile *),
+         &cmp_profile);
+  for (i = 0; i < cnt; i++)
+  {
+    tp = sorted[i];
+    FPRINTF (f,
+             "%s: runs %llu exec total %llu us max %llu us delay total %llu us max %llu us\n",
+             tp->name,
+             tp->count,
+             tp->exec_total_us,
+             tp->exec_max_us,
+             tp->delay_total_us,
+             tp->delay_max_us);
+    dump_histogram (f, "exec", tp->exec_hist);
+    dump_histogram (f, "delay", tp->delay_hist);
+  }
+  GNUNET_free (sorted);
+  if (0 != FCLOSE (f))
+  {
+    LOG_STRERROR (GNUNET_ERROR_TYPE_WARNING,
+                  "fclose");
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
 /**
  * Cancel the task with the specified identifier.
  * The task must not yet have run.
@@ -959,16 +2124,29 @@ GNUNET_SCHEDULER_cancel (struct GNUNET_SCHEDULER_Task *task)
   GNUNET_assert (NULL != active_task);
   if (! task->in_ready_list)
   {
+#if USE_EPOLL
+    if (GNUNET_YES == task->in_fd_table)
+      fd_table_remove (task);
+    else
+#endif
     if ( (-1 == task->read_fd) &&
          (-1 == task->write_fd) &&
          (NULL == task->read_set) &&
          (NULL == task->write_set) )
     {
-      GNUNET_CONTAINER_DLL_remove (pending_timeout_head,
-                                   pending_timeout_tail,
-                                   task);
-      if (task == pending_timeout_last)
-        pending_timeout_last = NULL;
+      if (NULL != task->timeout_node)
+      {
+        GNUNET_CONTAINER_heap_remove_node (task->timeout_node);
+        task->timeout_node = NULL;
+        if (GNUNET_YES == task->lifeness)
+          lifeness_count--;
+      }
+      else
+      {
+        GNUNET_CONTAINER_DLL_remove (pending_timeout_head,
+                                     pending_timeout_tail,
+                                     task);
+      }
     }
     else
     {
@@ -1019,7 +2197,7 @@ GNUNET_SCHEDULER_add_with_reason_and_priority (GNUNET_SCHEDULER_TaskCallback tas
   GNUNET_assert (NULL != task);
   GNUNET_assert ((NULL != active_task) ||
                  (GNUNET_SCHEDULER_REASON_STARTUP == reason));
-  t = GNUNET_new (struct GNUNET_SCHEDULER_Task);
+  t = create_task ();
 #if EXECINFO
   t->num_backtrace_strings = backtrace (backtrace_array, 50);
   t->backtrace_strings =
@@ -1029,9 +2207,6 @@ GNUNET_SCHEDULER_add_with_reason_and_priority (GNUNET_SCHEDULER_TaskCallback tas
   t->write_fd = -1;
   t->callback = task;
   t->callback_cls = task_cls;
-#if PROFILE_DELAYS
-  t->start_time = GNUNET_TIME_absolute_get ();
-#endif
   t->reason = reason;
   t->priority = priority;
   t->lifeness = current_lifeness;
@@ -1061,8 +2236,6 @@ GNUNET_SCHEDULER_add_delayed_with_priority (struct GNUNET_TIME_Relative delay,
                                             void *task_cls)
 {
   struct GNUNET_SCHEDULER_Task *t;
-  struct GNUNET_SCHEDULER_Task *pos;
-  struct GNUNET_SCHEDULER_Task *prev;
 
 #if EXECINFO
   void *backtrace_array[MAX_TRACE_DEPTH];
@@ -1070,7 +2243,7 @@ GNUNET_SCHEDULER_add_delayed_with_priority (struct GNUNET_TIME_Relative delay,
 
   GNUNET_assert (NULL != active_task);
   GNUNET_assert (NULL != task);
-  t = GNUNET_new (struct GNUNET_SCHEDULER_Task);
+  t = create_task ();
   t->callback = task;
   t->callback_cls = task_cls;
 #if EXECINFO
@@ -1080,14 +2253,9 @@ GNUNET_SCHEDULER_add_delayed_with_priority (struct GNUNET_TIME_Relative delay,
 #endif
   t->read_fd = -1;
   t->write_fd = -1;
-#if PROFILE_DELAYS
-  t->start_time = GNUNET_TIME_absolute_get ();
-#endif
   t->timeout = GNUNET_TIME_relative_to_absolute (delay);
   t->priority = priority;
   t->lifeness = current_lifeness;
-  /* try tail first (optimization in case we are
-   * appending to a long list of tasks with timeouts) */
   if (0 == delay.rel_value_us)
   {
     GNUNET_CONTAINER_DLL_insert (pending_timeout_head,
@@ -1096,29 +2264,11 @@ GNUNET_SCHEDULER_add_delayed_with_priority (struct GNUNET_TIME_Relative delay,
   }
   else
   {
-    /* first move from heuristic start backwards to before start time */
-    prev = pending_timeout_last;
-    while ( (NULL != prev) &&
-            (prev->timeout.abs_value_us > t->timeout.abs_value_us) )
-      prev = prev->prev;
-    /* now, move from heuristic start (or head of list) forward to insertion point */
-    if (NULL == prev)
-      pos = pending_timeout_head;
-    else
-      pos = prev->next;
-    while ( (NULL != pos) &&
-            ( (pos->timeout.abs_value_us <= t->timeout.abs_value_us) ||
-              (0 != pos->reason) ) )
-    {
-      prev = pos;
-      pos = pos->next;
-    }
-    GNUNET_CONTAINER_DLL_insert_after (pending_timeout_head,
-                                       pending_timeout_tail,
-                                       prev,
-                                       t);
-    /* finally, update heuristic insertion point to last insertion... */
-    pending_timeout_last = t;
+    t->timeout_node = GNUNET_CONTAINER_heap_insert (timeout_heap,
+                                                    t,
+                                                    t->timeout.abs_value_us);
+    if (GNUNET_YES == t->lifeness)
+      lifeness_count++;
   }
 
   LOG (GNUNET_ERROR_TYPE_DEBUG,
@@ -1274,7 +2424,7 @@ add_without_sets (struct GNUNET_TIME_Relative delay,
 
   GNUNET_assert (NULL != active_task);
   GNUNET_assert (NULL != task);
-  t = GNUNET_new (struct GNUNET_SCHEDULER_Task);
+  t = create_task ();
   t->callback = task;
   t->callback_cls = task_cls;
 #if EXECINFO
@@ -1327,12 +2477,14 @@ add_without_sets (struct GNUNET_TIME_Relative delay,
   t->read_fd = rfd;
   GNUNET_assert (wfd >= -1);
   t->write_fd = wfd;
-#if PROFILE_DELAYS
-  t->start_time = GNUNET_TIME_absolute_get ();
-#endif
   t->timeout = GNUNET_TIME_relative_to_absolute (delay);
   t->priority = check_priority ((priority == GNUNET_SCHEDULER_PRIORITY_KEEP) ? current_priority : priority);
   t->lifeness = current_lifeness;
+#if USE_EPOLL
+  if (-1 != epoll_fd)
+    fd_table_insert (t);
+  else
+#endif
   GNUNET_CONTAINER_DLL_insert (pending_head,
                                pending_tail,
                                t);
@@ -1650,7 +2802,7 @@ GNUNET_SCHEDULER_add_select (enum GNUNET_SCHEDULER_Priority prio,
                                                        task_cls);
   GNUNET_assert (NULL != active_task);
   GNUNET_assert (NULL != task);
-  t = GNUNET_new (struct GNUNET_SCHEDULER_Task);
+  t = create_task ();
   t->callback = task;
   t->callback_cls = task_cls;
 #if EXECINFO
@@ -1670,9 +2822,6 @@ GNUNET_SCHEDULER_add_select (enum GNUNET_SCHEDULER_Priority prio,
     t->write_set = GNUNET_NETWORK_fdset_create ();
     GNUNET_NETWORK_fdset_copy (t->write_set, ws);
   }
-#if PROFILE_DELAYS
-  t->start_time = GNUNET_TIME_absolute_get ();
-#endif
   t->timeout = GNUNET_TIME_relative_to_absolute (delay);
   t->priority =
       check_priority ((prio ==
@@ -658,7 +658,7 @@ const char *
 GNUNET_STRINGS_relative_time_to_string (struct GNUNET_TIME_Relative delta,
 					int do_round)
 {
-  static char buf[128];
+  static GNUNET_THREAD_LOCAL char buf[128];
   const char *unit = _( /* time unit */ "µs");
   uint64_t dval = delta.rel_value_us;
 
@@ -722,14 +722,21 @@ GNUNET_STRINGS_relative_time_to_string (struct GNUNET_TIME_Relative delta,
 const char *
 GNUNET_STRINGS_absolute_time_to_string (struct GNUNET_TIME_Absolute t)
 {
-  static char buf[255];
+  static GNUNET_THREAD_LOCAL char buf[255];
   time_t tt;
   struct tm *tp;
+#ifndef WINDOWS
+  struct tm tm;
+#endif
 
   if (t.abs_value_us == GNUNET_TIME_UNIT_FOREVER_ABS.abs_value_us)
     return _("end of time");
   tt = t.abs_value_us / 1000LL / 1000LL;
+#ifndef WINDOWS
+  tp = localtime_r (&tt, &tm);
+#else
   tp = localtime (&tt);
+#endif
   /* This is hacky, but i don't know a way to detect libc character encoding.
    * Just expect utf8 from glibc these days.
    * As for msvcrt, use the wide variant, which always returns utf16
@@ -740,7 +747,7 @@ GNUNET_STRINGS_absolute_time_to_string (struct GNUNET_TIME_Absolute t)
   strftime (buf, sizeof (buf), "%a %b %d %H:%M:%S %Y", tp);
 #else
   {
-    static wchar_t wbuf[255];
+    static GNUNET_THREAD_LOCAL wchar_t wbuf[255];
     uint8_t *conved;
     size_t ssize;
 
@@ -59,6 +59,9 @@ main (int argc, char *argv[])
   struct GNUNET_CONTAINER_BloomFilter *bf;
   struct GNUNET_CONTAINER_BloomFilter *bfi;
   struct GNUNET_HashCode tmp;
+  struct GNUNET_HashCode hcs[200];
+  int results[200];
+  int clean;
   int i;
   int ok1;
   int ok2;
@@ -238,6 +241,75 @@ main (int argc, char *argv[])
   GNUNET_CONTAINER_bloomfilter_free (bf);
   GNUNET_CONTAINER_bloomfilter_free (bfi);
 
+  bf = GNUNET_CONTAINER_bloomfilter_init_blocked (NULL, SIZE, K);
+  GNUNET_assert (bf != NULL);
+  GNUNET_CRYPTO_seed_weak_random (4);
+  for (i = 0; i < 200; i++)
+  {
+    nextHC (&hcs[i]);
+    GNUNET_CONTAINER_bloomfilter_add (bf, &hcs[i]);
+  }
+  bfi = GNUNET_CONTAINER_bloomfilter_copy (bf);
+  GNUNET_assert (bfi != NULL);
+  ok1 = GNUNET_CONTAINER_bloomfilter_test_many (bf, hcs, 200, results);
+  ok2 = 0;
+  for (i = 0; i < 200; i++)
+    if ( (GNUNET_YES == results[i]) &&
+         (GNUNET_YES == GNUNET_CONTAINER_bloomfilter_test (bfi, &hcs[i])) )
+      ok2++;
+  if ( (ok1 != 200) ||
+       (ok2 != 200) )
+  {
+    printf ("Got %d/%d elements out of 200 expected in blocked filter.\n",
+            ok1, ok2);
+    GNUNET_CONTAINER_bloomfilter_free (bf);
+    GNUNET_CONTAINER_bloomfilter_free (bfi);
+    return -1;
+  }
+  falseok = 0;
+  for (i = 0; i < 1000; i++)
+  {
+    nextHC (&tmp);
+    if (GNUNET_CONTAINER_bloomfilter_test (bf, &tmp) == GNUNET_YES)
+      falseok++;
+  }
+  if (falseok > 10)
+  {
+    printf ("Got %d false positives out of 1000 in blocked filter.\n",
+            falseok);
+    GNUNET_CONTAINER_bloomfilter_free (bf);
+    GNUNET_CONTAINER_bloomfilter_free (bfi);
+    return -1;
+  }
+  GNUNET_CONTAINER_bloomfilter_free (bf);
+  GNUNET_CONTAINER_bloomfilter_free (bfi);
+
+  GNUNET_break (0 == UNLINK (TESTFILE));
+  bf = GNUNET_CONTAINER_bloomfilter_load_mapped (TESTFILE, SIZE, K, &clean);
+  GNUNET_assert (bf != NULL);
+  GNUNET_assert (GNUNET_YES == clean);
+  for (i = 0; i < 200; i++)
+    GNUNET_CONTAINER_bloomfilter_add (bf, &hcs[i]);
+  /* not synced yet, so a crash now would leave the file dirty */
+  GNUNET_assert (GNUNET_YES == GNUNET_DISK_file_test (TESTFILE ".dirty"));
+  GNUNET_assert (GNUNET_OK == GNUNET_CONTAINER_bloomfilter_sync (bf));
+  GNUNET_assert (GNUNET_NO == GNUNET_DISK_file_test (TESTFILE ".dirty"));
+  for (i = 0; i < 100; i++)
+    GNUNET_CONTAINER_bloomfilter_remove (bf, &hcs[i]);
+  GNUNET_CONTAINER_bloomfilter_free (bf);
+  bf = GNUNET_CONTAINER_bloomfilter_load_mapped (TESTFILE, SIZE, K, &clean);
+  GNUNET_assert (bf != NULL);
+  ok1 = GNUNET_CONTAINER_bloomfilter_test_many (bf, &hcs[100], 100, results);
+  if ( (GNUNET_YES != clean) ||
+       (ok1 != 100) )
+  {
+    printf ("Got %d elements out of 100 expected in mapped filter.\n",
+            ok1);
+    GNUNET_CONTAINER_bloomfilter_free (bf);
+    return -1;
+  }
+  GNUNET_CONTAINER_bloomfilter_free (bf);
+
   GNUNET_break (0 == UNLINK (TESTFILE));
   return 0;
 }
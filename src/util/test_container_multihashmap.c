@@ -31,7 +31,8 @@
 #define CHECK(c) { if (! (c)) ABORT(); }
 
 static int
-testMap (int i)
+testMap (int i,
+         enum GNUNET_CONTAINER_MultiHashMapFlags flags)
 {
   struct GNUNET_CONTAINER_MultiHashMap *m;
   struct GNUNET_HashCode k1;
@@ -41,7 +42,7 @@ testMap (int i)
   const char *ret;
   int j;
 
-  CHECK (NULL != (m = GNUNET_CONTAINER_multihashmap_create (i, GNUNET_NO)));
+  CHECK (NULL != (m = GNUNET_CONTAINER_multihashmap_create_with_flags (i, GNUNET_NO, flags)));
   memset (&k1, 0, sizeof (k1));
   memset (&k2, 1, sizeof (k2));
   CHECK (GNUNET_NO == GNUNET_CONTAINER_multihashmap_contains (m, &k1));
@@ -98,6 +99,37 @@ testMap (int i)
     CHECK (GNUNET_YES == GNUNET_CONTAINER_multihashmap_iterator_next (iter, NULL, NULL));
   CHECK (GNUNET_NO == GNUNET_CONTAINER_multihashmap_iterator_next (iter, NULL, NULL));
   GNUNET_free (iter);
+  CHECK (1 == GNUNET_CONTAINER_multihashmap_get_random (m, NULL, NULL));
+  CHECK (1024 == GNUNET_CONTAINER_multihashmap_remove_all (m, &k1));
+  CHECK (0 == GNUNET_CONTAINER_multihashmap_get_random (m, NULL, NULL));
+
+  for (j = 0; j < 1024; j++)
+  {
+    memset (&k2, 0, sizeof (k2));
+    k2.bits[0] = j;
+    k2.bits[1] = j * 7;
+    CHECK (GNUNET_OK ==
+           GNUNET_CONTAINER_multihashmap_put (m, &k2, "v3",
+                                              GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY));
+  }
+  for (j = 0; j < 1024; j += 2)
+  {
+    memset (&k2, 0, sizeof (k2));
+    k2.bits[0] = j;
+    k2.bits[1] = j * 7;
+    CHECK (GNUNET_YES == GNUNET_CONTAINER_multihashmap_remove (m, &k2, "v3"));
+  }
+  CHECK (512 == GNUNET_CONTAINER_multihashmap_size (m));
+  for (j = 0; j < 1024; j++)
+  {
+    memset (&k2, 0, sizeof (k2));
+    k2.bits[0] = j;
+    k2.bits[1] = j * 7;
+    CHECK ((j % 2) == GNUNET_CONTAINER_multihashmap_contains (m, &k2));
+  }
+  CHECK (512 == GNUNET_CONTAINER_multihashmap_iterate (m, NULL, NULL));
+  CHECK (512 == GNUNET_CONTAINER_multihashmap_clear (m));
+  CHECK (0 == GNUNET_CONTAINER_multihashmap_size (m));
 
   GNUNET_CONTAINER_multihashmap_destroy (m);
   return 0;
@@ -111,7 +143,11 @@ main (int argc, char *argv[])
 
   GNUNET_log_setup ("test-container-multihashmap", "WARNING", NULL);
   for (i = 1; i < 255; i++)
-    failureCount += testMap (i);
+  {
+    failureCount += testMap (i, GNUNET_CONTAINER_MULTIHASHMAPFLAG_NONE);
+    failureCount += testMap (i, GNUNET_CONTAINER_MULTIHASHMAPFLAG_OPEN_ADDRESSING);
+    failureCount += testMap (i, GNUNET_CONTAINER_MULTIHASHMAPFLAG_INCREMENTAL_RESIZE);
+  }
   if (failureCount != 0)
     return 1;
   return 0;
@@ -99,6 +99,61 @@ testArithmetic ()
   return 0;
 }
 
+static int
+testHashMany ()
+{
+  const void *blocks[100];
+  size_t sizes[100];
+  struct GNUNET_HashCode hc[100];
+  struct GNUNET_HashCode want;
+  unsigned int i;
+
+  for (i = 0; i < sizeof (block); i++)
+    block[i] = (char) i;
+  for (i = 0; i < 100; i++)
+  {
+    blocks[i] = &block[i];
+    sizes[i] = (i * 37) % 1200;
+  }
+  /* make sure large blocks are handled, too */
+  sizes[42] = sizeof (block) - 42;
+  GNUNET_CRYPTO_hash_many (blocks, sizes, 100, hc);
+  for (i = 0; i < 100; i++)
+  {
+    GNUNET_CRYPTO_hash (blocks[i], sizes[i], &want);
+    if (0 != memcmp (&hc[i], &want, sizeof (want)))
+    {
+      printf ("hash_many failed for block %u\n", i);
+      return 1;
+    }
+  }
+  /* odd batch sizes */
+  for (i = 1; i < 7; i++)
+  {
+    GNUNET_CRYPTO_hash_many (blocks, sizes, i, hc);
+    GNUNET_CRYPTO_hash (blocks[i - 1], sizes[i - 1], &want);
+    if (0 != memcmp (&hc[i - 1], &want, sizeof (want)))
+      return 1;
+  }
+  /* long blocks of equal and of different lengths */
+  for (i = 0; i < 7; i++)
+  {
+    blocks[i] = &block[i * 4096];
+    sizes[i] = (i < 5) ? 32768 : 20000 + i;
+  }
+  GNUNET_CRYPTO_hash_many (blocks, sizes, 7, hc);
+  for (i = 0; i < 7; i++)
+  {
+    GNUNET_CRYPTO_hash (blocks[i], sizes[i], &want);
+    if (0 != memcmp (&hc[i], &want, sizeof (want)))
+    {
+      printf ("hash_many failed for long block %u\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 static void
 finished_task (void *cls, const struct GNUNET_HashCode * res)
 {
@@ -122,6 +177,16 @@ file_hasher (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
 }
 
 
+static void
+file_hasher_threaded (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  GNUNET_assert (NULL !=
+                 GNUNET_CRYPTO_hash_file_threaded (GNUNET_SCHEDULER_PRIORITY_DEFAULT,
+                                                   FILENAME, 1000,
+                                                   &finished_task, cls));
+}
+
+
 static int
 testFileHash ()
 {
@@ -135,6 +200,11 @@ testFileHash ()
   GNUNET_break (0 == FCLOSE (f));
   ret = 1;
   GNUNET_SCHEDULER_run (&file_hasher, &ret);
+  if (0 == ret)
+  {
+    ret = 1;
+    GNUNET_SCHEDULER_run (&file_hasher_threaded, &ret);
+  }
   GNUNET_break (0 == UNLINK (FILENAME));
   return ret;
 }
@@ -150,6 +220,7 @@ main (int argc, char *argv[])
   for (i = 0; i < 10; i++)
     failureCount += testEncoding ();
   failureCount += testArithmetic ();
+  failureCount += testHashMany ();
   failureCount += testFileHash ();
   if (failureCount != 0)
     return 1;
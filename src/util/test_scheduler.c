@@ -230,6 +230,70 @@ checkCancel ()
 }
 
 
+static void
+taskProfiled (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  int *ok = cls;
+
+  (*ok)++;
+}
+
+
+static void
+checkProfileEntry (void *cls,
+                   const struct GNUNET_SCHEDULER_TaskProfile *profile)
+{
+  int *ok = cls;
+
+  if ( (&taskProfiled == profile->callback) &&
+       (3 == profile->count) &&
+       (NULL != profile->name) )
+    *ok = 0;
+}
+
+
+static void
+taskCheckProfile (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  int *ok = cls;
+
+  GNUNET_assert (3 == *ok);
+  *ok = 1;
+  GNUNET_SCHEDULER_profile_iterate (&checkProfileEntry, ok);
+}
+
+
+static void
+taskProfile (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  int *ok = cls;
+
+  *ok = 0;
+  GNUNET_SCHEDULER_profile_enable (GNUNET_YES);
+  GNUNET_SCHEDULER_add_now (&taskProfiled, ok);
+  GNUNET_SCHEDULER_add_now (&taskProfiled, ok);
+  GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_UNIT_MILLISECONDS,
+                                &taskProfiled, ok);
+  GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MILLISECONDS, 50),
+                                &taskCheckProfile, ok);
+}
+
+
+/**
+ * Main method, starts scheduler with the profiler enabled,
+ * checks that the profile was recorded.
+ */
+static int
+checkProfile ()
+{
+  int ok;
+
+  ok = 1;
+  GNUNET_SCHEDULER_run (&taskProfile, &ok);
+  return ok;
+}
+
+
 int
 main (int argc, char *argv[])
 {
@@ -242,6 +306,7 @@ main (int argc, char *argv[])
 #endif
   ret += checkShutdown ();
   ret += checkCancel ();
+  ret += checkProfile ();
   GNUNET_DISK_pipe_close (p);
 
   return ret;